@@ -35,10 +35,14 @@ void init_ai_objLong(ai_obj *a, ulong l);
 
 void init_ai_objU160(ai_obj *a, uint160 y);
 
+void init_ai_objString(ai_obj *a, char *s, uint32 len);
+
 void cloneIC(icol_t *dic, icol_t *sic);
 
 void ai_objClone(ai_obj *dest, ai_obj *src);
 
+void ai_objFree(ai_obj *a);
+
 bool ai_objEQ(ai_obj *a, ai_obj *b);
 
 void dump_ai_obj(FILE *fp, ai_obj *a);
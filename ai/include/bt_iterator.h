@@ -64,6 +64,7 @@ typedef struct btIterator { // 60B + 16*bt_ll_n(512) -> dont malloc
 	uint160      highy;     // HIGH for U160
 	float        highf;     // HIGH for FLOAT
 	char        *highs;     // HIGH for TEXT
+	uint32       highslen;  // HIGH length for TEXT (binary safe)
 	uchar        num_nodes; // \/-slot in nodes[]
 	bt_ll_n      nodes[MAX_BTREE_DEPTH];
 } btIterator;
@@ -100,6 +100,8 @@ int btU160Cmp (void *a, void *b);
 int btFloatCmp(void *a, void *b);
 int btTextCmp (void *a, void *b);
 
+int strLenCmp(char *s1, uint32 slen1, char *s2, uint32 slen2);
+
 char *createBTKey(ai_obj *key, bool *med, uint32 *ksize, bt *btr, btk_t *btk);
 void  destroyBTKey(char *btkey, bool  med);
 
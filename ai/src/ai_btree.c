@@ -97,6 +97,17 @@ init_ai_objFromDigest(ai_obj *akey, cf_digest *d)
 	init_ai_objU160(akey, *(uint160 *)d);
 }
 
+// NB: string keys reference the sbin's value, which must outlive akey.
+static void
+init_ai_objFromSbin(as_sindex_metadata *imd, ai_obj *akey, as_sindex_bin *b)
+{
+	if (C_IS_S(imd->dtype)) {
+		init_ai_objString(akey, b->u.str.val, b->u.str.len);
+	} else {
+		init_ai_objLong(akey, b->u.i64);
+	}
+}
+
 
 void
 ai_btree_init(void) {
@@ -593,9 +604,8 @@ ai_btree_key_hash(as_sindex_metadata *imd, as_sindex_bin *b)
 {
 	uint64_t u;
 
-	if (C_IS_Y(imd->dtype)) {
-		char *x = (char *) &b->digest; // x += 4;
-		u = ((* (uint128 *) x) % imd->nprts);
+	if (C_IS_S(imd->dtype)) {
+		u = cf_hash_fnv(b->u.str.val, b->u.str.len) % imd->nprts;
 	} else {
 		u = (((uint64_t) b->u.i64) % imd->nprts);
 	}
@@ -734,6 +744,7 @@ add_recs_from_nbtr(as_sindex_metadata *imd, ai_obj *ikey, bt *nbtr, as_sindex_qc
 			}
 			if (qctx->n_bdigs == qctx->bsize) {
 				if (ikey) {
+					ai_objFree(qctx->bkey);
 					ai_objClone(qctx->bkey, ikey);
 				}
 				cloneDigestFromai_obj(&qctx->bdig, akey);
@@ -765,6 +776,7 @@ add_recs_from_arr(as_sindex_metadata *imd, ai_obj *ikey, ai_arr *arr, as_sindex_
 	// mark nbtr as finished and copy the offset
 	qctx->nbtr_done = true;
 	if (ikey) {
+		ai_objFree(qctx->bkey);
 		ai_objClone(qctx->bkey, ikey);
 	}
 
@@ -806,16 +818,16 @@ get_recl(as_sindex_metadata *imd, ai_obj *afk, as_sindex_qctx *qctx)
  *        -1 in case of failure
  */
 static int
-get_numeric_range_recl(as_sindex_metadata *imd, uint64_t begk, uint64_t endk, as_sindex_qctx *qctx)
+get_range_recl(as_sindex_metadata *imd, ai_obj *begk, ai_obj *efk, as_sindex_qctx *qctx)
 {
+	// Own a copy of the start key - the batch offset in qctx->bkey is
+	// overwritten while iterating.
 	ai_obj sfk;
-	init_ai_objLong(&sfk, qctx->new_ibtr ? begk : qctx->bkey->l);
-	ai_obj efk;
-	init_ai_objLong(&efk, endk);
+	ai_objClone(&sfk, qctx->new_ibtr ? begk : qctx->bkey);
 	as_sindex_pmetadata *pimd = &imd->pimd[qctx->pimd_idx];
 	bool fullrng              = qctx->new_ibtr;
 	int ret                   = 0;
-	btSIter *bi               = btGetRangeIter(pimd->ibtr, &sfk, &efk, 1);
+	btSIter *bi               = btGetRangeIter(pimd->ibtr, &sfk, efk, 1);
 	btEntry *be;
 
 	if (bi) {
@@ -870,6 +882,7 @@ get_numeric_range_recl(as_sindex_metadata *imd, uint64_t begk, uint64_t endk, as
 		}
 		btReleaseRangeIterator(bi);
 	}
+	ai_objFree(&sfk);
 	return ret;
 }
 
@@ -879,15 +892,14 @@ ai_btree_query(as_sindex_metadata *imd, as_sindex_range *srange, as_sindex_qctx
 	bool err = 1;
 	if (!srange->isrange) { // EQUALITY LOOKUP
 		ai_obj afk;
-		if (C_IS_Y(imd->dtype)) {
-			init_ai_objFromDigest(&afk, &srange->start.digest);
-		}
-		else {
-			init_ai_objLong(&afk, srange->start.u.i64);
-		}
+		init_ai_objFromSbin(imd, &afk, &srange->start);
 		err = get_recl(imd, &afk, qctx);
-	} else {                // RANGE LOOKUP
-		err = get_numeric_range_recl(imd, srange->start.u.i64, srange->end.u.i64, qctx);
+	} else {                // RANGE LOOKUP - strings in byte order, so a
+		                    // prefix p is the range [p, p + 0xff]
+		ai_obj sfk, efk;
+		init_ai_objFromSbin(imd, &sfk, &srange->start);
+		init_ai_objFromSbin(imd, &efk, &srange->end);
+		err = get_range_recl(imd, &sfk, &efk, qctx);
 	}
 	return (err ? AS_SINDEX_ERR_NO_MEMORY :
 			(qctx->n_bdigs >= qctx->bsize) ? AS_SINDEX_CONTINUE : AS_SINDEX_OK);
@@ -901,16 +913,11 @@ ai_btree_put(as_sindex_metadata *imd, as_sindex_pmetadata *pimd, as_sindex_key *
 	cf_digest *keyd = (cf_digest *)value;
 
 	ai_obj ncol;
-	if (C_IS_Y(imd->dtype)) {
-		init_ai_objFromDigest(&ncol, &skey->b[0].digest);
-	}
-	else {
-		init_ai_objLong(&ncol, skey->b[0].u.i64);
-	}
+	init_ai_objFromSbin(imd, &ncol, &skey->b[0]);
 	ai_obj apk;
 	init_ai_objFromDigest(&apk, keyd);
 
-	cf_detail(AS_SINDEX, "Insert: %ld %ld %ld", *(uint64_t *) &ncol.y, *(uint64_t *) &skey->b[0].digest, *((uint64_t *) &apk.y));
+	cf_detail(AS_SINDEX, "Insert: %ld %ld", ncol.l, *((uint64_t *) &apk.y));
 
 	ulong bb = pimd->ibtr->msize + pimd->ibtr->nsize;
 	ret = reduced_iAdd(pimd->ibtr, &ncol, &apk, COL_TYPE_U160);
@@ -946,12 +953,7 @@ ai_btree_delete(as_sindex_metadata *imd, as_sindex_pmetadata *pimd, as_sindex_ke
 		return AS_SINDEX_KEY_NOTFOUND;
 	}
 	ai_obj ncol;
-	if (C_IS_Y(imd->dtype)) {
-		init_ai_objFromDigest(&ncol, &skey->b[0].digest);
-	}
-	else {
-		init_ai_objLong(&ncol, skey->b[0].u.i64);
-	}
+	init_ai_objFromSbin(imd, &ncol, &skey->b[0]);
 
 	ai_obj apk;
 	init_ai_objFromDigest(&apk, (cf_digest *)val);
@@ -1122,8 +1124,10 @@ ai_btree_build_defrag_list(as_sindex_metadata *imd, as_sindex_pmetadata *pimd, a
 		goto END;
 	}
 	//Entry is range query, FROM previous icol TO maxKey(ibtr)
-	if (icol->empty) {
-		assignMinKey(pimd->ibtr, icol); // init first call
+	if (icol->empty) { // init first call
+		ai_obj iL;
+		assignMinKey(pimd->ibtr, &iL);
+		ai_objClone(icol, &iL);
 	}
 	ai_obj iH;
 	assignMaxKey(pimd->ibtr, &iH);
@@ -1160,6 +1164,7 @@ ai_btree_build_defrag_list(as_sindex_metadata *imd, as_sindex_pmetadata *pimd, a
 		// This tree may have some more digest to defrag
 		if (limit == 0) {
 			*nofst = *nofst + processed;
+			ai_objFree(icol);
 			ai_objClone(icol, acol);
 			cf_detail(AS_SINDEX, "Current pimd may need more iteration of defragging.");
 			ret = AS_SINDEX_CONTINUE;
@@ -1169,6 +1174,7 @@ ai_btree_build_defrag_list(as_sindex_metadata *imd, as_sindex_pmetadata *pimd, a
 		// We have finished this tree. Yet we have not reached our limit to defrag.
 		// Goes to next iteration
 		*nofst = 0;
+		ai_objFree(icol);
 		ai_objClone(icol, acol);
 	};
 	btReleaseRangeIterator(bi);
@@ -1225,6 +1231,7 @@ ai_btree_defrag_list(as_sindex_metadata *imd, as_sindex_pmetadata *pimd, cf_ll *
 				}
 				deletion_time_ns = 0;
 			}
+			ai_objFree(&(dt->acol_digs[i].acol));
 			dt->num -= 1;
 			n2del--;
 			if (n2del == 0) {
@@ -58,6 +58,16 @@ void init_ai_objU160(ai_obj *a, uint160 y) {
 	a->empty = 0;
 }
 
+// NB: does not copy the string, the caller keeps 's' alive while 'a' is used.
+void init_ai_objString(ai_obj *a, char *s, uint32 len)
+{
+	init_ai_obj(a);
+	a->s = s;
+	a->len = len;
+	a->type = a->enc = COL_TYPE_STRING;
+	a->empty = 0;
+}
+
 void cloneIC(icol_t *dic, icol_t *sic)
 {
 	bzero(dic, sizeof(icol_t));
@@ -72,11 +82,13 @@ void cloneIC(icol_t *dic, icol_t *sic)
 	}
 }
 
+// String keys are always deep copied - a clone may outlive the B-tree stream
+// it was taken from. Release with ai_objFree().
 void ai_objClone(ai_obj *dest, ai_obj *src)
 {
 	memcpy(dest, src, sizeof(ai_obj));
-	if (src->freeme) {
-		dest->s = cf_malloc(src->len);
+	if (src->freeme || (C_IS_S(src->type) && src->s)) {
+		dest->s = cf_malloc(src->len ? src->len : 1);
 		memcpy(dest->s, src->s, src->len);
 		dest->freeme = 1;
 	}
@@ -86,10 +98,19 @@ void ai_objClone(ai_obj *dest, ai_obj *src)
 	}
 }
 
+void ai_objFree(ai_obj *a)
+{
+	if (a->freeme) {
+		cf_free(a->s);
+		a->s = NULL;
+		a->freeme = 0;
+	}
+}
+
 static int ai_objCmp(ai_obj *a, ai_obj *b)
 {
 	if (C_IS_S(a->type)) {
-		return strncmp(a->s, b->s, a->len);
+		return strLenCmp(a->s, a->len, b->s, b->len);
 	} else if (C_IS_F(a->type)) {
 		float f = a->f - b->f;
 		return (f == 0.0)     ? 0 : ((f > 0.0)     ? 1 : -1);
@@ -222,6 +222,7 @@ static void init_iter(btIterator  *iter, bt          *btr,
 					  iter_single *itl, iter_single *itn) {
 	iter->btr         = btr;
 	iter->highs       = NULL;
+	iter->highslen    = 0;
 	iter->high      = LONG_MIN;
 	iter->highx = 0;
 	iter->highf       = FLT_MIN;
@@ -320,6 +321,7 @@ static void setHigh(btSIter *siter, ai_obj *high, uchar ktype) {
 		siter->x.highs            = cf_malloc(high->len + 1);    /* FREE ME 058 */
 		memcpy(siter->x.highs, high->s, high->len);
 		siter->x.highs[high->len] = '\0';
+		siter->x.highslen         = high->len;
 	} else if (C_IS_I(ktype)) {
 		siter->x.high  = high->i;
 	}
@@ -452,7 +454,8 @@ btEntry *btRangeNext(btSIter *siter, bool asc) { //printf("btRangeNext\n");
 		return asc ? ((f <= siter->x.highf) ? & (siter->be) : NULL) :
 			   ((f >= siter->x.highf) ? & (siter->be) : NULL);
 	} else { // C_IS_S()
-		int r = strncmp(siter->key.s, siter->x.highs, siter->key.len);
+		int r = strLenCmp(siter->key.s, siter->key.len,
+						  siter->x.highs, siter->x.highslen);
 		if (r == 0)              siter->x.finished = 1;       /* exact match */
 		return asc ? ((r <= 0) ?              & (siter->be) : NULL) :
 			   ((r >= 0) ?              & (siter->be) : NULL);
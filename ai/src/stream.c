@@ -464,18 +464,20 @@ int btFloatCmp(void *a, void *b) {                    //printf("btFloatCmp\n");
 	float f    = key1 - key2;
 	return (f == 0.0) ? 0 : ((f > 0.0) ? 1 : -1);
 }
+// Binary safe, bytes compared unsigned, shorter string sorts first on a tie.
+int strLenCmp(char *s1, uint32 slen1, char *s2, uint32 slen2) {
+	uint32 i   = (slen1 < slen2) ? slen1 : slen2;
+	int    ret = i ? memcmp(s1, s2, i) : 0;
+	if (ret != 0) return ret;
+	return (slen1 == slen2) ? 0 : ((slen1 < slen2) ? -1 : 1);
+}
 int btTextCmp(void *a, void *b) {                      //printf("btTextCmp\n");
 	uint32 slen1, slen2;
 	uchar  *s1     = (uchar *)a;
 	uchar  *s2     = (uchar *)b;
 	s1 = (getSflag(*s1)) ? getTString(s1, &slen1) : getString( s1, &slen1);
 	s2 = (getSflag(*s2)) ? getTString(s2, &slen2) : getString( s2, &slen2);
-	if (slen1 == slen2) return strncmp((char *)s1, (char *)s2, slen1);
-	else {
-		int i   = (slen1 < slen2) ? slen1 : slen2;
-		int ret = strncmp((char *)s1, (char *)s2, i);
-		return (ret == 0) ? ((slen1 < slen2) ? -1 : 1) : ret;
-	}
+	return strLenCmp((char *)s1, slen1, (char *)s2, slen2);
 }
 
 void destroyBTKey(char *btkey, bool med) {
@@ -41,6 +41,7 @@
 #include "hist_track.h"
 #include "olock.h"
 #include "queue.h"
+#include "shard_counter.h"
 #include "socket.h"
 #include "util.h"
 
@@ -55,6 +56,7 @@
 #define MAX_DEMARSHAL_THREADS  48	// maximum number of demarshal worker threads
 #define MAX_FABRIC_WORKERS 64		// maximum fabric worker threads
 #define MAX_BATCH_THREADS 16		// maximum batch worker threads
+#define MAX_BATCH_HELPER_THREADS 64	// maximum threads helping batch workers read from device
 
 struct as_namespace_s;
 
@@ -97,6 +99,7 @@ typedef struct as_config_s {
 	int					n_migrate_threads;
 	int					n_info_threads;
 	int					n_batch_threads;
+	int					n_batch_helper_threads;
 
 	/* Query tunables */
 	uint32_t			query_threads;
@@ -149,6 +152,9 @@ typedef struct as_config_s {
 	/* Whether or not a socket can be reused (SO_REUSEADDR) */
 	bool				socket_reuse_addr;
 
+	/* Whether or not each demarshal thread listens on its own socket (SO_REUSEPORT) */
+	bool				socket_reuse_port;
+
 	/* Consensus algorithm runtime data */
 	as_paxos			*paxos;
 
@@ -168,8 +174,6 @@ typedef struct as_config_s {
 
 	/* The transaction queues */
 	uint32_t			transactionq_current;
-	cf_queue			*transactionq_a[MAX_TRANSACTION_QUEUES];
-	cf_queue			*transaction_slow_q; // One slow queue to hold sleepy trans
 
 	/* object lock structure */
 	olock				*record_locks;
@@ -213,6 +217,8 @@ typedef struct as_config_s {
 	uint32_t			transaction_pending_limit;
 	/* transaction_repeatable_read flag defines whether a read should attempt to get all duplicate values before returning */
 	bool				transaction_repeatable_read;
+	// trace the stages of 1 in this many transactions (0 means no tracing)
+	uint32_t			transaction_trace_sample_rate;
 	/* disable generation checking */
 	bool				generation_disable;
 	bool				write_duplicate_resolution_disable;
@@ -220,22 +226,26 @@ typedef struct as_config_s {
 	bool				respond_client_on_master_completion;
 	// replication is queued and sent
 	bool				replication_fire_and_forget;
+	// group concurrent replica writes to the same node into one fabric msg
+	bool				replication_batch;
 	/* enables node snubbing - this code caused a Paxos issue in the past */
 	bool				snub_nodes;
 
-	// number of records between an enforced context switch - thus 1 is very low priority, 1000000 would be very high
+	// no longer used - was the number of records between an enforced context switch
 	uint32_t			scan_priority;
 	// amount of time a thread will sleep after yielding scan_priority amount of data. (in microseconds)
 	uint32_t			scan_sleep;
 	// maximum count of database requests in a single batch
 	uint32_t			batch_max_requests;
-	// number of records between an enforced context switch - thus 1 is very low priority, 1000000 would be very high
+	// no longer used - was the number of records between an enforced context switch
 	uint32_t			batch_priority;
 
 	// nsup (expiration and eviction) tuning parameters
 	uint32_t			nsup_delete_sleep; // sleep this many microseconds between generating delete transactions, default 0
 	uint32_t			nsup_period;
+	uint32_t			nsup_reduce_rate; // max records per second reduced by all nsup workers, 0 means no limit
 	bool				nsup_startup_evict;
+	uint32_t			nsup_threads; // workers reducing each namespace's partitions concurrently
 
 	/* tuning parameter for how often to run retransmit checks for paxos */
 	uint32_t			paxos_retransmit_period;
@@ -248,13 +258,12 @@ typedef struct as_config_s {
 	/* Currently-active Paxos recovery policy. */
 	paxos_recovery_policy_enum	paxos_recovery_policy;
 
-	/* number of records between an enforced context switch --- 1 is lowest possible priority, 10000 would be full-speed */
-	uint32_t			migrate_xmit_priority;
-	uint32_t			migrate_xmit_sleep;
-	uint32_t			migrate_read_priority;
-	uint32_t			migrate_read_sleep;
-	uint32_t			migrate_xmit_hwm;
-	uint32_t			migrate_xmit_lwm;
+	/* max bytes of unacknowledged migrate inserts per outgoing migration */
+	uint32_t			migrate_window_size;
+	/* cap on total outgoing migrate insert bandwidth, 0 is unlimited */
+	uint32_t			migrate_max_mb_per_sec;
+	/* compare digest summaries first and only migrate ranges that differ */
+	bool				migrate_delta;
 	// For receiver-side migration flow control:
 	int					migrate_max_num_incoming;
 	cf_atomic_int		migrate_num_incoming;
@@ -330,8 +339,8 @@ typedef struct as_config_s {
 	/*
 	** STATISTICS
 	*/
-	cf_atomic_int		fabric_msgs_sent;
-	cf_atomic_int		fabric_msgs_rcvd;
+	cf_shard_counter	fabric_msgs_sent;
+	cf_shard_counter	fabric_msgs_rcvd;
 	cf_atomic_int		fabric_msgs_selfsend;  // not included in prev send + receive
 	cf_atomic_int		fabric_write_short;
 	cf_atomic_int		fabric_write_medium;
@@ -348,12 +357,13 @@ typedef struct as_config_s {
 	cf_atomic_int		migrate_progress_send;
 	cf_atomic_int		migrate_progress_recv;
 	cf_atomic_int		migrate_reads;
+	cf_atomic_int		migrate_delta_skipped; // records not sent - range matched at destination
 	cf_atomic_int		migrate_num_incoming_accepted;
 	cf_atomic_int		migrate_num_incoming_refused; // For receiver-side migration flow control.
-	cf_atomic_int		proto_transactions;
-	cf_atomic_int		proxy_initiate; // initiated
-	cf_atomic_int		proxy_action;   // did it
-	cf_atomic_int		proxy_retry;    // retried it
+	cf_shard_counter	proto_transactions;
+	cf_shard_counter	proxy_initiate; // initiated
+	cf_shard_counter	proxy_action;   // did it
+	cf_shard_counter	proxy_retry;    // retried it
 	cf_atomic_int		proxy_retry_q_full;
 	cf_atomic_int		proxy_unproxy;
 	cf_atomic_int		proxy_retry_same_dest;
@@ -361,9 +371,9 @@ typedef struct as_config_s {
 	cf_atomic_int		tscan_initiate;
 	cf_atomic_int		tscan_succeeded;
 	cf_atomic_int		tscan_aborted;
-	cf_atomic_int		write_master;
-	cf_atomic_int		write_prole;
-	cf_atomic_int		read_dup_prole;
+	cf_shard_counter	write_master;
+	cf_shard_counter	write_prole;
+	cf_shard_counter	read_dup_prole;
 	cf_atomic_int		rw_err_dup_internal;
 	// When rw_dup_prole() sees a cluster key mismatch, we increment this counter.
 	cf_atomic_int		rw_err_dup_cluster_key;
@@ -371,6 +381,8 @@ typedef struct as_config_s {
 	cf_atomic_int		rw_err_write_internal;
 	cf_atomic_int		rw_err_write_cluster_key;
 	cf_atomic_int		rw_err_write_send;
+	cf_shard_counter	write_batch_sent;
+	cf_shard_counter	write_batch_writes;
 	cf_atomic_int		rw_err_ack_internal;
 	cf_atomic_int		rw_err_ack_nomatch;
 	cf_atomic_int		rw_err_ack_badnode;
@@ -403,10 +415,10 @@ typedef struct as_config_s {
 	cf_atomic_int		rw_tree_count;
 	cf_atomic_int		reaper_count;
 
-	cf_atomic_int		batch_initiate;
+	cf_shard_counter	batch_initiate;
 	cf_atomic_int		batch_tree_count;
-	cf_atomic_int		batch_timeout;
-	cf_atomic_int		batch_errors;
+	cf_shard_counter	batch_timeout;
+	cf_shard_counter	batch_errors;
 
 	cf_hist_track *		rt_hist; // histogram that tracks read performance
 	cf_hist_track *		ut_hist; // histogram that tracks udf performance
@@ -466,33 +478,33 @@ typedef struct as_config_s {
 	histogram *			read9_hist;
 #endif
 
-	cf_atomic_int		stat_read_reqs;
-	cf_atomic_int		stat_read_reqs_xdr;
-	cf_atomic_int		stat_read_success;
-	cf_atomic_int		stat_read_errs_notfound;
-	cf_atomic_int		stat_read_errs_other;
-
-	cf_atomic_int		stat_write_reqs;
-	cf_atomic_int		stat_write_reqs_xdr;
-	cf_atomic_int		stat_write_success;
-	cf_atomic_int		stat_write_errs; // deprecated
-	cf_atomic_int		stat_write_errs_notfound;
-	cf_atomic_int		stat_write_errs_other;
+	cf_shard_counter	stat_read_reqs;
+	cf_shard_counter	stat_read_reqs_xdr;
+	cf_shard_counter	stat_read_success;
+	cf_shard_counter	stat_read_errs_notfound;
+	cf_shard_counter	stat_read_errs_other;
+
+	cf_shard_counter	stat_write_reqs;
+	cf_shard_counter	stat_write_reqs_xdr;
+	cf_shard_counter	stat_write_success;
+	cf_shard_counter	stat_write_errs; // deprecated
+	cf_shard_counter	stat_write_errs_notfound;
+	cf_shard_counter	stat_write_errs_other;
 	cf_atomic_int		stat_write_latency_gt50;
 	cf_atomic_int		stat_write_latency_gt100;
 	cf_atomic_int		stat_write_latency_gt250;
 	cf_atomic_int		stat_xdr_pipe_writes;
 	cf_atomic_int		stat_xdr_pipe_miss;
 
-	cf_atomic_int		stat_delete_success;
-	cf_atomic_int		stat_rw_timeout;
+	cf_shard_counter	stat_delete_success;
+	cf_shard_counter	stat_rw_timeout;
 
-	cf_atomic_int		stat_compressed_pkts_received;
+	cf_shard_counter	stat_compressed_pkts_received;
 
-	cf_atomic_int		stat_proxy_reqs;
-	cf_atomic_int		stat_proxy_reqs_xdr;
-	cf_atomic_int		stat_proxy_success;
-	cf_atomic_int		stat_proxy_errs;
+	cf_shard_counter	stat_proxy_reqs;
+	cf_shard_counter	stat_proxy_reqs_xdr;
+	cf_shard_counter	stat_proxy_success;
+	cf_shard_counter	stat_proxy_errs;
 	cf_atomic_int		stat_proxy_retransmits;
 	cf_atomic_int		stat_proxy_redirect;
 
@@ -552,7 +564,7 @@ typedef struct as_config_s {
 	cf_atomic_int		stat_zero_bin_records;
 	cf_atomic_int		stat_nsup_deletes_not_shipped;
 
-	cf_atomic_int		err_tsvc_requests;
+	cf_shard_counter	err_tsvc_requests;
 	cf_atomic_int		err_out_of_space;
 	cf_atomic_int		err_duplicate_proxy_request;
 	cf_atomic_int		err_rw_request_not_found;
@@ -584,23 +596,23 @@ typedef struct as_config_s {
 	cf_atomic_int		stat_duplicate_operation;
 
 	//stats for UDF read - write operation.
-	cf_atomic_int		udf_read_reqs;
-	cf_atomic_int		udf_read_success;
-	cf_atomic_int		udf_read_errs_other;
+	cf_shard_counter	udf_read_reqs;
+	cf_shard_counter	udf_read_success;
+	cf_shard_counter	udf_read_errs_other;
 
-	cf_atomic_int		udf_write_reqs;
-	cf_atomic_int		udf_write_success;
-	cf_atomic_int		udf_write_errs_other;
+	cf_shard_counter	udf_write_reqs;
+	cf_shard_counter	udf_write_success;
+	cf_shard_counter	udf_write_errs_other;
 
-	cf_atomic_int		udf_delete_reqs;
-	cf_atomic_int		udf_delete_success;
-	cf_atomic_int		udf_delete_errs_other;
+	cf_shard_counter	udf_delete_reqs;
+	cf_shard_counter	udf_delete_success;
+	cf_shard_counter	udf_delete_errs_other;
 
 	cf_atomic_int		udf_lua_errs;
 
-	cf_atomic_int		udf_scan_rec_reqs;
-	cf_atomic_int		udf_query_rec_reqs;
-	cf_atomic_int		udf_replica_writes;
+	cf_shard_counter	udf_scan_rec_reqs;
+	cf_shard_counter	udf_query_rec_reqs;
+	cf_shard_counter	udf_replica_writes;
 
 	// For Lua Garbage Collection, we want to track three things:
 	// (1) The number of times we were below the GC threshold
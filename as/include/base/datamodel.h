@@ -664,6 +664,7 @@ struct as_partition_s {
 	as_partition_vinfo  dupl_pvinfo[AS_CLUSTER_SZ];
 	bool reject_writes;
 	bool waiting_for_master;
+	bool delta_retained;	// DESYNC but kept its tree for a delta migration
 	cf_node  qnode; 	// point to the node which serves the query at the moment
 	as_partition_vinfo primary_version_info; // the version of the primary partition in the cluster
 	as_partition_vinfo version_info;         // the version of my partition here and now
@@ -679,6 +680,10 @@ struct as_partition_s {
 	// the maximum void time of all records in the tree below
 	cf_atomic_int max_void_time;
 
+	// optional void-time index of the tree below - digests keyed by void-time
+	pthread_mutex_t expire_lock;
+	struct cf_timer_wheel_s *expire_wheel;
+
 	// the actual data
 	struct as_index_tree_s *vp;
 	struct as_index_tree_s *sub_vp;
@@ -745,6 +750,7 @@ typedef struct as_partition_states_s {
 /* Partition function declarations */
 extern void as_partition_init(as_partition *p, as_namespace *ns, int pid);
 extern void as_partition_reinit(as_partition *p, as_namespace *ns, int pid);
+extern void as_partition_expire_index_update(as_partition *p, cf_digest *keyd, uint32_t old_void_time, uint32_t void_time);
 extern void as_partition_bless(as_partition *p);
 extern bool is_partition_null(as_partition_vinfo *vinfo);
 extern cf_node as_partition_getreplica_read(as_namespace *ns, as_partition_id p);
@@ -829,6 +835,11 @@ typedef enum {
 	AS_NAMESPACE_CONFLICT_RESOLUTION_POLICY_TTL = 2
 } conflict_resolution_policy;
 
+typedef enum {
+	AS_STORAGE_IO_ENGINE_SYNC = 0,
+	AS_STORAGE_IO_ENGINE_URING = 1
+} as_storage_io_engine;
+
 #define AS_SET_MAX_COUNT 0x3FF	// ID's 10 bits worth minus 1 (ID 0 means no set)
 #define AS_BINID_HAS_SINDEX_SIZE  MAX_BIN_NAMES / ( sizeof(uint32_t) * CHAR_BIT )
 
@@ -880,6 +891,7 @@ struct as_namespace_s {
 	bool						data_in_index;	// with single-bin, allows warm restart for data-in-memory (with storage-engine device)
 	bool 						disallow_null_setname;
 	bool                        ldt_enabled;
+	bool						nsup_expire_index; // index digests by void-time so nsup expires without reducing
 
 	/* XDR */
 	bool						enable_xdr;
@@ -926,6 +938,12 @@ struct as_namespace_s {
 	uint64_t	storage_fsync_max_us;
 	uint32_t	storage_min_avail_pct;
 	uint32_t	storage_write_smoothing_period;
+	as_storage_io_engine storage_io_engine;
+	uint32_t	storage_io_depth;
+	bool		storage_scan_device_order; // full scans read devices sequentially
+	uint32_t	storage_cold_start_threads; // index load workers, 0 means one per CPU
+	char*		storage_index_snapshot_file; // periodic index snapshot for fast restart, NULL if none
+	uint32_t	storage_index_snapshot_period; // seconds between index snapshots
 
 	// For data-not-in-memory, optionally cache swbs after writing to device.
 	cf_atomic32 storage_post_write_queue; // number of swbs/device held after writing to device
@@ -934,6 +952,13 @@ struct as_namespace_s {
 	cf_atomic32 n_reads_from_device;
 	float cache_read_pct;
 
+	// For data-not-in-memory, optionally cache records read from device.
+	uint64_t	storage_record_cache_size; // 0 means no record cache
+	cf_atomic64	record_cache_hits;
+	cf_atomic64	record_cache_misses;
+	cf_atomic64	record_cache_evictions;
+	cf_atomic64	record_cache_bytes;
+
 	int demo_read_multiplier;
 	int demo_write_multiplier;
 
@@ -956,6 +981,10 @@ struct as_namespace_s {
 	uint32_t	saved_defrag_sleep; // restore after defrag at startup is done
 	uint32_t	saved_write_smoothing_period; // restore after defrag at startup is done
 	uint32_t	defrag_lwm_size; // storage_defrag_lwm_pct % of storage_write_block_size
+	cf_atomic64	defrag_read_bytes; // wblock bytes read by defrag
+	cf_atomic64	defrag_write_bytes; // record bytes moved by defrag
+	uint32_t	defrag_backlog; // wblocks waiting for defrag, as of last storage stats
+	uint32_t	defrag_backlog_age; // seconds oldest waiting wblock has waited, as of last storage stats
 
 	/* very interesting counters */
 	cf_atomic_int	n_objects;
@@ -966,6 +995,7 @@ struct as_namespace_s {
 	cf_atomic_int	n_evicted_objects;
 	cf_atomic_int	n_deleted_set_objects;
 	cf_atomic_int	n_evicted_set_objects;
+	cf_atomic_int	n_index_expired_objects; // by the void-time index, not yet in an nsup lap's stats
 
 	// the maximum void time of all records in the namespace
 	cf_atomic_int max_void_time;
@@ -0,0 +1,98 @@
+/*
+ * hot_keys.h
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+/*
+ * Hot-key detection. A space-saving top-K sketch, keyed by digest, of record
+ * lock acquisitions, along with the time each key's acquisitions waited on
+ * the record lock and how deep each key's write request wait queue got.
+ *
+ * Plain accesses are sampled per thread. Contended lock acquisitions and
+ * wait queue additions are rare and always counted. Samples taken under a
+ * record lock are held per thread and recorded once the lock is released.
+ * Sketches are per CPU and a sample is dropped rather than wait for its
+ * sketch. The sketch is kept over fixed windows, and the info command merges
+ * the CPUs' sketches for the last complete window.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "citrusleaf/cf_digest.h"
+
+#include "dynbuf.h"
+
+
+#define AS_HOT_KEYS_SAMPLE_MASK 31 // sample 1 in 32 uncontended accesses
+
+typedef struct as_hot_keys_pending_s {
+	bool		pending;
+	uint32_t	weight;
+	uint64_t	lock_wait_ns;
+	cf_digest	keyd;
+} as_hot_keys_pending;
+
+extern __thread uint32_t g_hot_keys_n_accesses;
+extern __thread as_hot_keys_pending g_hot_keys_pending;
+
+void as_hot_keys_record(const cf_digest *keyd, uint32_t weight,
+		uint64_t lock_wait_ns, uint32_t queue_depth);
+void as_hot_keys_get_info(uint32_t max_keys, cf_dyn_buf *db);
+
+// Call on every record lock acquisition, with the time spent waiting. Only
+// notes the sample - as_hot_keys_flush() records it. If a sample is already
+// pending, e.g. with nested record locks, the new one is dropped.
+static inline void
+as_hot_keys_access(const cf_digest *keyd, uint64_t lock_wait_ns)
+{
+	uint32_t weight = (++g_hot_keys_n_accesses & AS_HOT_KEYS_SAMPLE_MASK) == 0 ?
+			AS_HOT_KEYS_SAMPLE_MASK + 1 : 0;
+
+	if ((weight == 0 && lock_wait_ns == 0) || g_hot_keys_pending.pending) {
+		return;
+	}
+
+	g_hot_keys_pending.pending = true;
+	g_hot_keys_pending.weight = weight;
+	g_hot_keys_pending.lock_wait_ns = lock_wait_ns;
+	g_hot_keys_pending.keyd = *keyd;
+}
+
+// Call after releasing a record lock.
+static inline void
+as_hot_keys_flush()
+{
+	if (g_hot_keys_pending.pending) {
+		g_hot_keys_pending.pending = false;
+		as_hot_keys_record(&g_hot_keys_pending.keyd, g_hot_keys_pending.weight,
+				g_hot_keys_pending.lock_wait_ns, 0);
+	}
+}
+
+// Call when a transaction is parked behind a write request on the same key,
+// after dropping the write request's lock.
+static inline void
+as_hot_keys_queued(const cf_digest *keyd, uint32_t queue_depth)
+{
+	as_hot_keys_record(keyd, 0, 0, queue_depth);
+}
@@ -306,6 +306,11 @@ typedef void (*as_index_value_destructor) (as_index *v, void *udata);
 typedef struct as_index_tree_s {
 	pthread_mutex_t		lock;
 
+	// For lookups without the tree lock - see index.c.
+	cf_atomic32			seq; // odd while a writer is changing tree shape
+	cf_atomic32			reader_epoch;
+	cf_atomic32			n_readers[2];
+
 	as_index			*root;
 	cf_arenax_handle	root_h;
 
@@ -340,6 +345,9 @@ extern int as_index_get_insert_vlock(as_index_tree *tree, cf_digest *key, as_ind
 
 // This call is more unusual. It does not take the object lock but does take the
 // ref-count. Thus, the caller (as_record_get) must take the o_lock.
+//
+// Lookups in get, get-insert and exists don't take the tree lock unless a
+// lockless search is inconclusive due to concurrent inserts or deletes.
 extern int as_index_get_vlock(as_index_tree *tree, cf_digest *key, as_index_ref *index_ref);
 
 extern int as_index_exists(as_index_tree *tree, cf_digest *key);
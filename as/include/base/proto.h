@@ -31,6 +31,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <netinet/in.h>
+#include <sys/uio.h>
 
 #include <aerospike/as_val.h>
 #include <citrusleaf/cf_digest.h>
@@ -495,8 +496,21 @@ extern size_t as_msg_response_msgsize(struct as_index_s *r, struct as_storage_rd
 		bool nobindata, char *nsname, bool use_sets, cf_vector *binlist);
 extern int as_msg_make_val_response_bufbuilder(const as_val *val, cf_buf_builder **bb_r, int val_sz, bool);
 
-extern int as_msg_send_response(int fd, uint8_t* buf, size_t len, int flags);
-extern int as_msg_send_fin(int fd, uint32_t result_code);
+extern int as_msg_send_fin(struct as_file_handle_s *fd_h, uint32_t result_code);
+
+// Non-blocking client response path. What the socket won't take is queued on
+// the file handle and written out by its demarshal thread on EPOLLOUT. With
+// throttle set, the caller waits (without spinning) while the backlog is over
+// the high-water mark - for streaming producers like scan, query and batch.
+// Never throttle on a demarshal thread, it's the one that drains the backlog -
+// it instead stops reading requests while as_msg_send_fh_recv_paused().
+extern int as_msg_send_fh(struct as_file_handle_s *fd_h, const uint8_t *buf, size_t len, bool throttle);
+extern int as_msg_send_fh_iov(struct as_file_handle_s *fd_h, struct iovec *iov, int iovcnt, bool throttle);
+extern int as_msg_send_fh_flush(struct as_file_handle_s *fd_h);
+extern bool as_msg_send_fh_recv_paused(struct as_file_handle_s *fd_h);
+extern void as_msg_send_fh_init(struct as_file_handle_s *fd_h);
+extern void as_msg_send_fh_close(struct as_file_handle_s *fd_h);
+extern void as_msg_send_fh_destroy(struct as_file_handle_s *fd_h);
 
 extern bool as_msg_peek_data_in_memory(cl_msg *msgp);
 
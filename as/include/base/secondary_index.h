@@ -108,8 +108,8 @@ typedef enum {
 typedef enum {
 	AS_SINDEX_KTYPE_NONE   = 0,
 	AS_SINDEX_KTYPE_LONG   = 2, //Particle type INT
-	AS_SINDEX_KTYPE_FLOAT  = 4, //Particle type INT
-	AS_SINDEX_KTYPE_DIGEST = 10
+	AS_SINDEX_KTYPE_STRING = 3, //Particle type STRING
+	AS_SINDEX_KTYPE_FLOAT  = 4  //Particle type INT
 } as_sindex_ktype;
 
 as_particle_type as_sindex_pktype_from_sktype(as_sindex_ktype t);
@@ -133,7 +133,7 @@ typedef enum {
  * bin_id lists the bin id being touched. 
  */
 #define SINDEX_FLAG_BIN_ISVALID    0x01
-#define SINDEX_STRONSTACK_VALSZ    256
+#define SINDEX_FLAG_BIN_DOFREE     0x02 // u.str.val is owned by this sbin
 typedef struct as_sindex_bin_s {
 	uint32_t          id;
 	as_particle_type  type; // this type is citrusleaf type
@@ -141,8 +141,11 @@ typedef struct as_sindex_bin_s {
 	// Currently sindex is supported for only int64 and string.
 	union {
 		int64_t  i64;
+		struct {
+			char     *val;
+			uint32_t  len;
+		} str;
 	} u;
-	cf_digest         digest;
 	byte              flag;
 } as_sindex_bin;
 
@@ -65,6 +65,9 @@
 // 2. Secondary index, to send record operation and secondary index operation in
 //    single message.
 #define RW_FIELD_MULTIOP        14
+// Several RW msgs for one node, serialized back to back - writes going out in
+// an RW_OP_WRITE_BATCH, or their acks coming back in an RW_OP_WRITE_BATCH_ACK.
+#define RW_FIELD_BATCH          15
 
 #define RW_OP_WRITE 1
 #define RW_OP_WRITE_ACK 2
@@ -72,6 +75,8 @@
 #define RW_OP_DUP_ACK 4
 #define RW_OP_MULTI 5
 #define RW_OP_MULTI_ACK 6
+#define RW_OP_WRITE_BATCH 7
+#define RW_OP_WRITE_BATCH_ACK 8
 
 #define OP_IS_MODIFY(op) ((op) == AS_MSG_OP_APPEND_SEGMENT || (op) == AS_MSG_OP_APPEND_SEGMENT_EXT \
     || (op) == AS_MSG_OP_APPEND_SEGMENT_QUERY || (op) == AS_MSG_OP_INCR || (op) == AS_MSG_OP_MC_INCR \
@@ -67,6 +67,7 @@ typedef struct {
 	bool                fail_on_cluster_change;     // require a stable (non-moving) cluster
 	int                 job_type;                   // JOB_TYPE_PARTITION or JOB_TYPE_STORAGE
 	int                 n_threads;                  // how many threads to dispatch work to in case of JOB_TYPE_PARTITION
+	uint32_t            n_devices;                  // how many device workitems in case of JOB_TYPE_STORAGE
 	int                 scan_pct;
 	uint64_t            window;                     // max bytes to get/send_back to client each time
 	uint64_t            cluster_key;                // the cluster key under which the job was started under
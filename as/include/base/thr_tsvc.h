@@ -29,6 +29,8 @@
 
 #include <stdint.h>
 
+#include "dynbuf.h"
+
 #include "base/transaction.h"
 
 
@@ -54,6 +56,9 @@ int thr_tsvc_enqueue(as_transaction *tr);
 // Statistics function for monitoring server load.
 extern int thr_tsvc_queue_get_size();
 
+// Info function - per-queue depth, steals and wait times.
+extern int thr_tsvc_queue_info(char *name, cf_dyn_buf *db);
+
 // Initialize the queues and start the handler threads.
 extern void as_tsvc_init();
 
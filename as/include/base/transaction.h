@@ -32,6 +32,7 @@
 #include "citrusleaf/cf_clock.h"
 #include "citrusleaf/cf_digest.h"
 
+#include "dynbuf.h"
 #include "msg.h"
 #include "util.h"
 
@@ -95,6 +96,47 @@
 }
 
 
+//==========================================================
+// Transaction trace sampling.
+//
+
+typedef enum {
+	AS_TR_STAGE_DEMARSHAL,		// demarshaled, about to be queued
+	AS_TR_STAGE_DEQUEUE,		// picked up by a transaction thread
+	AS_TR_STAGE_RESERVE,		// partition reserved
+	AS_TR_STAGE_RECORD_LOCK,	// record found (or created) and locked
+	AS_TR_STAGE_STORAGE_READ,	// bins read from storage
+	AS_TR_STAGE_REPLICATE,		// all replica acks received
+	AS_TR_STAGE_REPLY,			// response sent
+
+	AS_TR_N_STAGES
+} as_tr_stage;
+
+// Carried by value with the transaction (and its write request) - unsampled
+// transactions just skip the stage macros.
+typedef struct as_tr_trace_s {
+	bool		sampled;
+	uint16_t	stages;						// bitmap of stages reached
+	uint32_t	stage_us[AS_TR_N_STAGES];	// microseconds after start_time
+} as_tr_trace;
+
+#define AS_TR_TRACE_STAGE(__tr, __stage) \
+{ \
+	if ((__tr)->trace.sampled) { \
+		(__tr)->trace.stages |= (uint16_t)(1 << (__stage)); \
+		(__tr)->trace.stage_us[__stage] = \
+				(uint32_t)((cf_getns() - (__tr)->start_time) / 1000); \
+	} \
+}
+
+#define AS_TR_TRACE_FINISH(__tr, __is_read) \
+{ \
+	if ((__tr)->trace.sampled) { \
+		as_tr_trace_finish(__tr, __is_read); \
+	} \
+}
+
+
 //==========================================================
 // Transaction.
 //
@@ -105,9 +147,19 @@ typedef struct as_file_handle_s {
 	bool		inuse;			// in use by the epoll routine
 	bool		t_inprogress;	// transaction is in progress
 	uint32_t	fh_info;		// bitmap containing status info of this file handle
-	as_proto	*proto;
+	as_proto	*proto;			// message too big for recv_buf, being read
 	uint64_t	proto_unread;
+	uint8_t		*recv_buf;		// receive buffer, demarshaled in place
+	uint32_t	recv_start;		// offset of first unconsumed byte
+	uint32_t	recv_end;		// offset past last received byte
 	void		*security_filter;
+	pthread_mutex_t	send_lock;	// protects the output queue below
+	pthread_cond_t	send_cond;	// signaled as the output queue drains
+	struct as_send_chunk_s *send_q_head; // response bytes the socket didn't take yet
+	struct as_send_chunk_s *send_q_tail;
+	uint64_t	send_q_sz;
+	bool		send_failed;	// connection is broken - drop further responses
+	bool		recv_paused;	// demarshal thread not reading - backlog too big
 } as_file_handle;
 
 #define FH_INFO_DONOT_REAP	0x00000001	// this bit indicates that this file handle should not be reaped
@@ -166,6 +218,8 @@ typedef struct udf_request_data {
 #define AS_TRANSACTION_FLAG_LDT_SUB         0x0008
 // Set if this transaction has touched secondary index
 #define AS_TRANSACTION_FLAG_SINDEX_TOUCHED  0x0010
+// Set if the prefetch field holds this read's record data
+#define AS_TRANSACTION_FLAG_PREFETCH        0x0020
 
 /* as_transaction
  * The basic unit of work
@@ -224,9 +278,16 @@ typedef struct as_transaction_s {
 	// to collect microbenchmarks
 	uint64_t          microbenchmark_time;
 
+	// sampled transactions record when they pass each stage
+	as_tr_trace       trace;
+
 	/* incoming cluster key passed in a proxy request */
 	uint64_t          incoming_cluster_key;
 
+	// record data read ahead (io-engine uring) - valid only with
+	// AS_TRANSACTION_FLAG_PREFETCH set
+	as_storage_prefetch *prefetch;
+
 	// RESPONSE RESPONSE RESPONSE
 
 } as_transaction;
@@ -238,6 +299,10 @@ extern int as_transaction_prepare(as_transaction *tr);
 extern void as_transaction_init(as_transaction *tr, cf_digest *, cl_msg *);
 extern int as_transaction_digest_validate(as_transaction *tr);
 
+extern void as_tr_trace_sample(as_transaction *tr);
+extern void as_tr_trace_finish(as_transaction *tr, bool is_read);
+extern void as_tr_trace_get_info(uint32_t max_traces, cf_dyn_buf *db);
+
 // When you hold an as_record, you should also hold its vlock. So keep them all
 // in one bundle.
 typedef struct as_record_lock_s {
@@ -60,6 +60,7 @@ typedef struct wreq_tr_element_s {
 typedef struct write_request_s {
 	pthread_mutex_t      lock;
 	wreq_tr_element    * wait_queue_head;
+	uint32_t             wait_queue_depth; // elements on wait_queue_head
 	bool                 ready; // set to true when fully initialized
 	uint32_t             tid;
 
@@ -73,6 +74,7 @@ typedef struct write_request_s {
 
 	cf_clock             xmit_ms; // time of next retransmit
 	uint32_t             retry_interval_ms; // interval to add for next retransmit
+	cf_clock             timer_ms; // deadline of live retransmit timer entry
 	cf_clock             start_time;
 
 	// Be carefully atomic, since this is written in 2 places (constructor and
@@ -82,6 +84,9 @@ typedef struct write_request_s {
 
 	cf_clock             microbenchmark_time;
 
+	// Sampled transaction's trace, carried across to the reply.
+	as_tr_trace          trace;
+
 	// The request we're making, so we can retransmit if necessary. Will be the
 	// duplicate request if we're in dup phase, or the op (write) if we're in
 	// the second phase but it's always the message we're sending out to the
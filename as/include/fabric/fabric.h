@@ -32,6 +32,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "dynbuf.h"
 #include "msg.h"
 #include "queue.h"
 #include "rchash.h"
@@ -205,6 +206,9 @@ extern void as_fabric_send_reliable(cf_node node, msg *m, int timeout_ms, as_fab
 // Print useful status information about all fabric resources to the log file.
 extern void as_fabric_dump(bool verbose);
 
+// Per-node transmit statistics, for the "fabric-stats" info command.
+extern int as_fabric_stats_info(char *name, cf_dyn_buf *db);
+
 //
 // Get a list of all the nodes - use a dynamic array, which requires inline
 //
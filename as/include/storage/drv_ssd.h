@@ -36,6 +36,10 @@
 #include "hist.h"
 #include "queue.h"
 
+#ifdef USE_URING
+#include "uring.h"
+#endif
+
 #include "base/datamodel.h"
 
 
@@ -58,8 +62,10 @@
 
 #define MAX_SSD_THREADS 20
 
-// Forward declaration.
+// Forward declarations.
 struct drv_ssd_s;
+typedef struct ssd_cache_s ssd_cache;
+typedef struct ssd_snapshot_s ssd_snapshot;
 
 
 //------------------------------------------------
@@ -88,10 +94,44 @@ typedef struct {
 	cf_atomic32			rc;
 	struct drv_ssd_s	*ssd;
 	uint32_t			wblock_id;
-	uint32_t			pos;
+	uint64_t			state;			// open flag, writer count and fill position
 	uint8_t				*buf;
+	uint64_t			journal_seq;	// index snapshot journal entry for wblock_id
+#ifdef USE_URING
+	cf_uring_op			flush_op;	// for io-engine uring, flush in flight
+#endif
 } ssd_write_buf;
 
+// An swb's state word lets writers reserve space with a single compare-and-swap.
+// Space can only be reserved while the swb is open. A write lane counts as a
+// writer while the swb is in the lane, so the swb is only handed off to be
+// flushed once it has left its lane and the last writer has finished.
+#define SWB_POS_MASK		0x00000000FFFFffffUL	// bytes reserved so far
+#define SWB_WRITER			0x0000000100000000UL	// one writer in progress
+#define SWB_WRITERS_MASK	0x0000FFFF00000000UL
+#define SWB_OPEN			0x8000000000000000UL
+
+static inline uint32_t
+swb_pos(ssd_write_buf *swb)
+{
+	return (uint32_t)(__atomic_load_n(&swb->state, __ATOMIC_ACQUIRE) &
+			SWB_POS_MASK);
+}
+
+
+//------------------------------------------------
+// Write lane - writers on the same CPU share a
+// lane's swb, so writers on different CPUs don't
+// contend for buffer space.
+//
+#define MAX_SSD_WRITE_LANES 8
+
+typedef struct ssd_write_lane_s {
+	pthread_mutex_t		lock;		// serializes swb replacement and timed flushes
+	ssd_write_buf		*swb;		// swb being filled, may be NULL
+	uint32_t			flush_pos;	// swb position at last timed flush
+} ssd_write_lane;
+
 
 //------------------------------------------------
 // Per-wblock information.
@@ -111,6 +151,15 @@ typedef struct ssd_wblock_state_s {
 #define WBLOCK_STATE_DEFRAG		1
 
 
+//------------------------------------------------
+// Element of defrag_wblock_q.
+//
+typedef struct ssd_defrag_entry_s {
+	uint32_t			wblock_id;
+	uint32_t			enq_sec;	// when queued, for backlog age
+} ssd_defrag_entry;
+
+
 //------------------------------------------------
 // Per-device information about its wblocks.
 //
@@ -136,22 +185,36 @@ typedef struct drv_ssd_s
 {
 	as_namespace	*ns;
 
-	pthread_mutex_t	LOCK;
-
 	uint32_t		running;
-	ssd_write_buf	*current_swb;		// swb currently being filled by writes
-	cf_atomic32		n_writers;			// number of concurrent writers to current swb
+
+	ssd_write_lane	lanes[MAX_SSD_WRITE_LANES]; // swbs currently being filled by writes
+	uint32_t		n_lanes;
 
 	cf_queue		*fd_q;				// queue of open fds
 
+#ifdef USE_URING
+	cf_uring		*uring;				// if io-engine uring, record prefetches, defrag reads and flushes go here
+	int				uring_fd;			// fd used for all operations on the ring
+	pthread_t		uring_thread;		// reaps ring completions
+#endif
+
 	cf_queue		*free_wblock_q;		// IDs of free wblocks
-	cf_queue		*defrag_wblock_q;	// IDs of wblocks to defrag
+	cf_queue		*defrag_wblock_q;	// wblocks to defrag, as ssd_defrag_entry
+	cf_queue		*defrag_read_q;		// defrag reads done, in order of priority
+	cf_queue		*defrag_slot_q;		// defrag read slots free for reading
+
+	pthread_mutex_t	defrag_lock;		// held by defrag while moving records
+	ssd_write_buf	*defrag_swb;		// swb being filled by defrag
+	uint32_t		defrag_flush_pos;	// defrag_swb position at last idle flush
+	cf_atomic32		defrag_backlog_age;	// seconds oldest waiting wblock has waited
 
 	cf_queue		*swb_write_q;		// pointers to swbs ready to write
 	cf_queue		*swb_free_q;		// pointers to swbs free and waiting
+	cf_queue		*swb_husk_q;		// pointers to swbs whose bufs were freed
 	cf_queue		*post_write_q;		// pointers to swbs that have been written but are cached
 
 	cf_atomic_int	defrag_wblock_counter; // total number of wblocks added to the defrag_wblock_q
+	cf_atomic_int	defrag_done_counter; // total number of wblocks defragged
 	cf_atomic_int	ssd_write_buf_counter; // total number of swbs added to the swb_write_q
 
 	off_t			file_size;
@@ -172,19 +235,23 @@ typedef struct drv_ssd_s
 	bool			sub_sweep;
 
 	uint32_t		cold_start_block_counter;		// large blocks read
-	uint64_t		record_add_generation_counter;	// records not inserted due to generation
-	uint64_t		record_add_expired_counter;		// records not inserted due to expiration
-	uint64_t		record_add_max_ttl_counter;		// records not inserted due to max-ttl
-	uint64_t		record_add_replace_counter;		// records reinserted
-	uint64_t		record_add_unique_counter;		// records inserted
+	cf_atomic64		record_add_generation_counter;	// records not inserted due to generation
+	cf_atomic64		record_add_expired_counter;		// records not inserted due to expiration
+	cf_atomic64		record_add_max_ttl_counter;		// records not inserted due to max-ttl
+	cf_atomic64		record_add_replace_counter;		// records reinserted
+	cf_atomic64		record_add_unique_counter;		// records inserted
 	uint64_t		record_add_sigfail_counter;
 
 	ssd_alloc_table	*alloc_table;
 
+	uint32_t		*replay_wblock_ids;	// if index was loaded from snapshot, wblocks to read
+	uint32_t		n_replay_wblocks;
+
 	pthread_t		maintenance_thread;
 	pthread_t		write_worker_thread[MAX_SSD_THREADS];
 	pthread_t		load_device_thread;
 	pthread_t		defrag_thread;
+	pthread_t		defrag_read_thread;
 
 	histogram		*hist_read;
 	histogram		*hist_large_block_read;
@@ -207,6 +274,9 @@ typedef struct drv_ssds_s
 	// load a record.
 	bool get_state_from_storage[AS_PARTITIONS];
 
+	ssd_cache			*cache;		// record cache, NULL if not configured
+	ssd_snapshot		*snapshot;	// index snapshot, NULL if not configured
+
 	int					n_ssds;
 	drv_ssd				ssds[];
 } drv_ssds;
@@ -218,6 +288,25 @@ typedef struct drv_ssds_s
 
 void ssd_resume_devices(drv_ssds *ssds);
 
+//
+// Record cache - drv_ssd_cache.c.
+//
+
+ssd_cache *ssd_cache_create(as_namespace *ns, uint64_t size);
+uint8_t *ssd_cache_get(ssd_cache *cache, const cf_digest *keyd, uint32_t generation, uint32_t file_id, uint64_t rblock_id, uint32_t size);
+void ssd_cache_put(ssd_cache *cache, const cf_digest *keyd, uint32_t generation, uint32_t file_id, uint64_t rblock_id, const uint8_t *block, uint32_t size);
+void ssd_cache_remove(ssd_cache *cache, const cf_digest *keyd);
+
+//
+// Index snapshot - drv_ssd_snapshot.c.
+//
+
+ssd_snapshot *ssd_snapshot_create(drv_ssds *ssds);
+bool ssd_snapshot_load(drv_ssds *ssds, uint64_t prev_random);
+void ssd_snapshot_start(drv_ssds *ssds);
+uint64_t ssd_snapshot_journal_add(drv_ssd *ssd, uint32_t wblock_id);
+void ssd_snapshot_journal_sync(drv_ssd *ssd, uint64_t journal_seq);
+
 //
 // Conversions between bytes and rblocks.
 //
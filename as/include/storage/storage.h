@@ -134,6 +134,22 @@ typedef struct {
     int		n_devices;
 } as_storage_attributes;
 
+// Device-order scan callback - record is locked and rd is open, with the device
+// block attached. Return false to stop the scan.
+typedef bool (*as_storage_scan_fn)(as_index_ref *r_ref, as_storage_rd *rd, void *udata);
+
+// Device-order scan callback between wblocks - no record or partition is held,
+// so this is where to do anything slow. Return false to stop the scan.
+typedef bool (*as_storage_scan_flush_fn)(void *udata);
+
+// A record's device data, read asynchronously ahead of a transaction.
+typedef struct as_storage_prefetch_s as_storage_prefetch;
+
+// Prefetch completion callback - made on the storage engine's completion
+// thread, so it should only hand the prefetch off, e.g. re-queue the
+// transaction that will read the record.
+typedef void (*as_storage_prefetch_fn)(as_storage_prefetch *pf, void *udata);
+
 
 //------------------------------------------------
 // Generic "base class" functions that call
@@ -165,6 +181,14 @@ extern void as_storage_wait_for_defrag();
 extern bool as_storage_overloaded(as_namespace *ns); // returns true if write queue is too backed up
 extern bool as_storage_has_space(as_namespace *ns);
 
+// Asynchronous read of a record's device data (io-engine uring) - returns false
+// if the engine won't do it, in which case the callback isn't made. Record need
+// not be locked.
+extern bool as_storage_record_prefetch(as_namespace *ns, as_record *r, as_storage_prefetch_fn cb, void *udata);
+
+// Sequential scan of a device, for large scans.
+extern int as_storage_scan_device(as_namespace *ns, uint32_t device_ix, as_storage_scan_fn cb, as_storage_scan_flush_fn flush_cb, void *udata);
+
 // Storage of generic data into device headers.
 extern int as_storage_info_set(as_namespace *ns, uint idx, uint8_t *buf, size_t len);
 extern int as_storage_info_get(as_namespace *ns, uint idx, uint8_t *buf, size_t *len);
@@ -191,6 +215,12 @@ extern uint32_t as_storage_record_copy_rec_props(as_storage_rd *rd, as_rec_props
 // Called only at shutdown to flush all device write-queues.
 extern void as_storage_shutdown();
 
+// A prefetch attached to the current thread is claimed by the thread's next
+// read of that record, instead of reading the device. Attach NULL to detach.
+// Destroy the prefetch whether or not it was claimed.
+extern void as_storage_prefetch_attach(as_storage_prefetch *pf);
+extern void as_storage_prefetch_destroy(as_storage_prefetch *pf);
+
 
 //------------------------------------------------
 // AS_STORAGE_ENGINE_MEMORY functions.
@@ -229,6 +259,10 @@ extern void as_storage_wait_for_defrag_ssd(as_namespace *ns);
 extern bool as_storage_overloaded_ssd(as_namespace *ns);
 extern bool as_storage_has_space_ssd(as_namespace *ns);
 
+extern bool as_storage_record_prefetch_ssd(as_namespace *ns, as_record *r, as_storage_prefetch_fn cb, void *udata);
+
+extern int as_storage_scan_device_ssd(as_namespace *ns, uint32_t device_ix, as_storage_scan_fn cb, as_storage_scan_flush_fn flush_cb, void *udata);
+
 extern int as_storage_info_set_ssd(as_namespace *ns, uint idx, uint8_t *buf, size_t len);
 extern int as_storage_info_get_ssd(as_namespace *ns, uint idx, uint8_t *buf, size_t *len);
 extern int as_storage_info_flush_ssd(as_namespace *ns);
@@ -241,6 +275,8 @@ extern int as_storage_histogram_clear_ssd(as_namespace *ns);
 // Called by "base class" functions but not via table.
 extern bool as_storage_record_get_key_ssd(as_storage_rd *rd);
 extern void as_storage_shutdown_ssd(as_namespace *ns);
+extern void as_storage_prefetch_attach_ssd(as_storage_prefetch *pf);
+extern void as_storage_prefetch_destroy_ssd(as_storage_prefetch *pf);
 
 
 //------------------------------------------------
@@ -101,8 +101,9 @@ cfg_set_defaults()
 	c->n_proto_fd_max = 15000;
 	c->allow_inline_transactions = true; // allow data-in-memory namespaces to process transactions in service threads
 	c->batch_max_requests = 5000; // maximum requests/digests in a single batch
-	c->batch_priority = 200; // # of rows between a quick context switch?
+	c->batch_priority = 200; // no longer used - batch threads don't yield
 	c->n_batch_threads = 4;
+	c->n_batch_helper_threads = 8; // threads sharing device reads of large batches (0 = batch thread reads all)
 	c->n_fabric_workers = 16;
 	c->fb_health_bad_pct = 0; // percent of successful messages in a burst at/below which node is deemed bad
 	c->fb_health_good_pct = 50; // percent of successful messages in a burst at/above which node is deemed ok
@@ -113,16 +114,14 @@ cfg_set_defaults()
 	c->n_info_threads = 16;
 	c->microbenchmarks = false;
 	c->migrate_max_num_incoming = AS_MIGRATE_DEFAULT_MAX_NUM_INCOMING; // for receiver-side migration flow-control
-	c->migrate_read_priority = 10; // # of rows between a quick context switch? not a great way to tune
-	c->migrate_read_sleep = 500; // # of rows between a quick context switch? not a great way to tune
+	c->migrate_delta = false; // compare digest-range summaries and skip matching ranges
+	c->migrate_max_mb_per_sec = 0; // no cap - the per-migration window alone paces migration
 	c->migrate_rx_lifetime_ms = AS_MIGRATE_DEFAULT_RX_LIFETIME_MS; // for debouncing re-transmitted migrate start messages
 	c->n_migrate_threads = 1;
-	c->migrate_xmit_hwm = 10; // these are actually far more interesting for tuning parameters
-	c->migrate_xmit_lwm = 5; // because the monitor the queue depth
-	c->migrate_xmit_priority = 40; // # of rows between a quick context switch? not a great way to tune
-	c->migrate_xmit_sleep = 500; // # of rows between a quick context switch? not a great way to tune
+	c->migrate_window_size = 4 * 1024 * 1024; // unacked bytes in flight per migration
 	c->nsup_period = 120; // run nsup once every 2 minutes
 	c->nsup_startup_evict = true;
+	c->nsup_threads = 1;
 	c->paxos_max_cluster_size = AS_CLUSTER_DEFAULT_SZ; // default the maximum cluster size to a "reasonable" value
 	c->paxos_protocol = AS_PAXOS_PROTOCOL_V3; // default to 3.0 "sindex" paxos protocol version
 	c->paxos_recovery_policy = AS_PAXOS_RECOVERY_POLICY_MANUAL; // default to the manual paxos recovery policy
@@ -149,6 +148,7 @@ cfg_set_defaults()
 	// Network service defaults.
 	c->socket.proto = SOCK_STREAM; // not configurable, but addr and port are
 	c->socket_reuse_addr = true;
+	c->socket_reuse_port = true; // every demarshal thread accepts on its own socket
 
 	// Network heartbeat defaults.
 	c->hb_mode = AS_HB_MODE_UNDEF; // must supply heartbeat mode in the configuration file
@@ -247,6 +247,7 @@ typedef enum {
 	CASE_SERVICE_ALLOW_INLINE_TRANSACTIONS,
 	CASE_SERVICE_AUTO_DUN,
 	CASE_SERVICE_AUTO_UNDUN,
+	CASE_SERVICE_BATCH_HELPER_THREADS,
 	CASE_SERVICE_BATCH_MAX_REQUESTS,
 	CASE_SERVICE_BATCH_PRIORITY,
 	CASE_SERVICE_BATCH_THREADS,
@@ -261,25 +262,24 @@ typedef enum {
 	CASE_SERVICE_HIST_TRACK_THRESHOLDS,
 	CASE_SERVICE_INFO_THREADS,
 	CASE_SERVICE_MICROBENCHMARKS,
+	CASE_SERVICE_MIGRATE_DELTA,
+	CASE_SERVICE_MIGRATE_MAX_MB_PER_SEC,
 	CASE_SERVICE_MIGRATE_MAX_NUM_INCOMING,
-	CASE_SERVICE_MIGRATE_READ_PRIORITY,
-	CASE_SERVICE_MIGRATE_READ_SLEEP,
 	CASE_SERVICE_MIGRATE_RX_LIFETIME_MS,
 	CASE_SERVICE_MIGRATE_THREADS,
-	CASE_SERVICE_MIGRATE_XMIT_HWM,
-	CASE_SERVICE_MIGRATE_XMIT_LWM,
-	CASE_SERVICE_MIGRATE_PRIORITY, // renamed
-	CASE_SERVICE_MIGRATE_XMIT_PRIORITY,
-	CASE_SERVICE_MIGRATE_XMIT_SLEEP,
+	CASE_SERVICE_MIGRATE_WINDOW_SIZE,
 	CASE_SERVICE_NSUP_DELETE_SLEEP,
 	CASE_SERVICE_NSUP_PERIOD,
+	CASE_SERVICE_NSUP_REDUCE_RATE,
 	CASE_SERVICE_NSUP_STARTUP_EVICT,
+	CASE_SERVICE_NSUP_THREADS,
 	CASE_SERVICE_PAXOS_MAX_CLUSTER_SIZE,
 	CASE_SERVICE_PAXOS_PROTOCOL,
 	CASE_SERVICE_PAXOS_RECOVERY_POLICY,
 	CASE_SERVICE_PAXOS_RETRANSMIT_PERIOD,
 	CASE_SERVICE_PROTO_FD_IDLE_MS,
 	CASE_SERVICE_QUERY_IN_TRANSACTION_THREAD,
+	CASE_SERVICE_REPLICATION_BATCH,
 	CASE_SERVICE_REPLICATION_FIRE_AND_FORGET,
 	CASE_SERVICE_RESPOND_CLIENT_ON_MASTER_COMPLETION,
 	CASE_SERVICE_RUN_AS_DAEMON,
@@ -293,6 +293,7 @@ typedef enum {
 	CASE_SERVICE_TRANSACTION_PENDING_LIMIT,
 	CASE_SERVICE_TRANSACTION_REPEATABLE_READ,
 	CASE_SERVICE_TRANSACTION_RETRY_MS,
+	CASE_SERVICE_TRANSACTION_TRACE_SAMPLE_RATE,
 	CASE_SERVICE_UDF_RUNTIME_MAX_GMEMORY,
 	CASE_SERVICE_UDF_RUNTIME_MAX_MEMORY,
 	CASE_SERVICE_USE_QUEUE_PER_DEVICE,
@@ -312,6 +313,13 @@ typedef enum {
 	CASE_SERVICE_DEFRAG_QUEUE_HWM,
 	CASE_SERVICE_DEFRAG_QUEUE_LWM,
 	CASE_SERVICE_DEFRAG_QUEUE_PRIORITY,
+	CASE_SERVICE_MIGRATE_PRIORITY,
+	CASE_SERVICE_MIGRATE_READ_PRIORITY,
+	CASE_SERVICE_MIGRATE_READ_SLEEP,
+	CASE_SERVICE_MIGRATE_XMIT_HWM,
+	CASE_SERVICE_MIGRATE_XMIT_LWM,
+	CASE_SERVICE_MIGRATE_XMIT_PRIORITY,
+	CASE_SERVICE_MIGRATE_XMIT_SLEEP,
 	CASE_SERVICE_NSUP_AUTO_HWM,
 	CASE_SERVICE_NSUP_AUTO_HWM_PCT,
 	CASE_SERVICE_NSUP_MAX_DELETES,
@@ -320,7 +328,6 @@ typedef enum {
 	CASE_SERVICE_NSUP_QUEUE_ESCAPE,
 	CASE_SERVICE_NSUP_REDUCE_PRIORITY,
 	CASE_SERVICE_NSUP_REDUCE_SLEEP,
-	CASE_SERVICE_NSUP_THREADS,
 	CASE_SERVICE_SCAN_MEMORY,
 	CASE_SERVICE_SCAN_RETRANSMIT,
 	CASE_SERVICE_SCHEDULER_PRIORITY,
@@ -372,6 +379,7 @@ typedef enum {
 	CASE_NETWORK_SERVICE_ACCESS_ADDRESS,
 	CASE_NETWORK_SERVICE_NETWORK_INTERFACE_NAME,
 	CASE_NETWORK_SERVICE_REUSE_ADDRESS,
+	CASE_NETWORK_SERVICE_REUSE_PORT,
 
 	// Network heartbeat options:
 	// Normally visible, in canonical configuration file order:
@@ -433,6 +441,7 @@ typedef enum {
 	CASE_NAMESPACE_HIGH_WATER_MEMORY_PCT,
 	CASE_NAMESPACE_LDT_ENABLED,
 	CASE_NAMESPACE_MAX_TTL,
+	CASE_NAMESPACE_NSUP_EXPIRE_INDEX,
 	CASE_NAMESPACE_OBJ_SIZE_HIST_MAX,
 	CASE_NAMESPACE_READ_CONSISTENCY_LEVEL_OVERRIDE,
 	CASE_NAMESPACE_SET_BEGIN,
@@ -485,9 +494,16 @@ typedef enum {
 	CASE_NAMESPACE_STORAGE_DEVICE_ENABLE_OSYNC,
 	CASE_NAMESPACE_STORAGE_DEVICE_FLUSH_MAX_MS,
 	CASE_NAMESPACE_STORAGE_DEVICE_FSYNC_MAX_SEC,
+	CASE_NAMESPACE_STORAGE_DEVICE_IO_DEPTH,
+	CASE_NAMESPACE_STORAGE_DEVICE_IO_ENGINE,
 	CASE_NAMESPACE_STORAGE_DEVICE_MAX_WRITE_CACHE,
 	CASE_NAMESPACE_STORAGE_DEVICE_MIN_AVAIL_PCT,
 	CASE_NAMESPACE_STORAGE_DEVICE_POST_WRITE_QUEUE,
+	CASE_NAMESPACE_STORAGE_DEVICE_SCAN_DEVICE_ORDER,
+	CASE_NAMESPACE_STORAGE_DEVICE_RECORD_CACHE_SIZE,
+	CASE_NAMESPACE_STORAGE_DEVICE_COLD_START_THREADS,
+	CASE_NAMESPACE_STORAGE_DEVICE_INDEX_SNAPSHOT_FILE,
+	CASE_NAMESPACE_STORAGE_DEVICE_INDEX_SNAPSHOT_PERIOD,
 	CASE_NAMESPACE_STORAGE_DEVICE_SIGNATURE,
 	CASE_NAMESPACE_STORAGE_DEVICE_WRITE_SMOOTHING_PERIOD,
 	CASE_NAMESPACE_STORAGE_DEVICE_WRITE_THREADS,
@@ -498,6 +514,10 @@ typedef enum {
 	CASE_NAMESPACE_STORAGE_DEVICE_PERSIST,
 	CASE_NAMESPACE_STORAGE_DEVICE_READONLY,
 
+	// Namespace storage-engine device io-engine options (value tokens):
+	CASE_NAMESPACE_STORAGE_DEVICE_IO_ENGINE_SYNC,
+	CASE_NAMESPACE_STORAGE_DEVICE_IO_ENGINE_URING,
+
 	// Namespace storage-engine kv options:
 	CASE_NAMESPACE_STORAGE_KV_DEVICE,
 	CASE_NAMESPACE_STORAGE_KV_FILESIZE,
@@ -603,6 +623,7 @@ const cfg_opt SERVICE_OPTS[] = {
 		{ "auto-dun",						CASE_SERVICE_AUTO_DUN },
 		{ "auto-undun",						CASE_SERVICE_AUTO_UNDUN },
 		{ "batch-threads",					CASE_SERVICE_BATCH_THREADS },
+		{ "batch-helper-threads",			CASE_SERVICE_BATCH_HELPER_THREADS },
 		{ "batch-max-requests",				CASE_SERVICE_BATCH_MAX_REQUESTS },
 		{ "batch-priority",					CASE_SERVICE_BATCH_PRIORITY },
 		{ "fabric-workers",					CASE_SERVICE_FABRIC_WORKERS },
@@ -616,25 +637,24 @@ const cfg_opt SERVICE_OPTS[] = {
 		{ "hist-track-thresholds",			CASE_SERVICE_HIST_TRACK_THRESHOLDS },
 		{ "info-threads",					CASE_SERVICE_INFO_THREADS },
 		{ "microbenchmarks",				CASE_SERVICE_MICROBENCHMARKS },
+		{ "migrate-delta",					CASE_SERVICE_MIGRATE_DELTA },
+		{ "migrate-max-mb-per-sec",			CASE_SERVICE_MIGRATE_MAX_MB_PER_SEC },
 		{ "migrate-max-num-incoming",		CASE_SERVICE_MIGRATE_MAX_NUM_INCOMING },
-		{ "migrate-read-priority",			CASE_SERVICE_MIGRATE_READ_PRIORITY },
-		{ "migrate-read-sleep",				CASE_SERVICE_MIGRATE_READ_SLEEP },
 		{ "migrate-rx-lifetime-ms",			CASE_SERVICE_MIGRATE_RX_LIFETIME_MS },
 		{ "migrate-threads",				CASE_SERVICE_MIGRATE_THREADS },
-		{ "migrate-xmit-hwm",				CASE_SERVICE_MIGRATE_XMIT_HWM },
-		{ "migrate-xmit-lwm",				CASE_SERVICE_MIGRATE_XMIT_LWM },
-		{ "migrate-priority",				CASE_SERVICE_MIGRATE_PRIORITY },
-		{ "migrate-xmit-priority",			CASE_SERVICE_MIGRATE_XMIT_PRIORITY },
-		{ "migrate-xmit-sleep",				CASE_SERVICE_MIGRATE_XMIT_SLEEP },
+		{ "migrate-window-size",			CASE_SERVICE_MIGRATE_WINDOW_SIZE },
 		{ "nsup-delete-sleep",				CASE_SERVICE_NSUP_DELETE_SLEEP },
 		{ "nsup-period",					CASE_SERVICE_NSUP_PERIOD },
+		{ "nsup-reduce-rate",				CASE_SERVICE_NSUP_REDUCE_RATE },
 		{ "nsup-startup-evict",				CASE_SERVICE_NSUP_STARTUP_EVICT },
+		{ "nsup-threads",					CASE_SERVICE_NSUP_THREADS },
 		{ "paxos-max-cluster-size",			CASE_SERVICE_PAXOS_MAX_CLUSTER_SIZE },
 		{ "paxos-protocol",					CASE_SERVICE_PAXOS_PROTOCOL },
 		{ "paxos-recovery-policy",			CASE_SERVICE_PAXOS_RECOVERY_POLICY },
 		{ "paxos-retransmit-period",		CASE_SERVICE_PAXOS_RETRANSMIT_PERIOD },
 		{ "proto-fd-idle-ms",				CASE_SERVICE_PROTO_FD_IDLE_MS },
 		{ "query-in-transaction-thread",	CASE_SERVICE_QUERY_IN_TRANSACTION_THREAD },
+		{ "replication-batch",				CASE_SERVICE_REPLICATION_BATCH },
 		{ "replication-fire-and-forget",	CASE_SERVICE_REPLICATION_FIRE_AND_FORGET },
 		{ "respond-client-on-master-completion", CASE_SERVICE_RESPOND_CLIENT_ON_MASTER_COMPLETION },
 		{ "run-as-daemon",					CASE_SERVICE_RUN_AS_DAEMON },
@@ -648,6 +668,7 @@ const cfg_opt SERVICE_OPTS[] = {
 		{ "transaction-pending-limit",		CASE_SERVICE_TRANSACTION_PENDING_LIMIT },
 		{ "transaction-repeatable-read",	CASE_SERVICE_TRANSACTION_REPEATABLE_READ },
 		{ "transaction-retry-ms",			CASE_SERVICE_TRANSACTION_RETRY_MS },
+		{ "transaction-trace-sample-rate",	CASE_SERVICE_TRANSACTION_TRACE_SAMPLE_RATE },
 		{ "udf-runtime-max-gmemory",		CASE_SERVICE_UDF_RUNTIME_MAX_GMEMORY },
 		{ "udf-runtime-max-memory",			CASE_SERVICE_UDF_RUNTIME_MAX_MEMORY },
 		{ "use-queue-per-device",			CASE_SERVICE_USE_QUEUE_PER_DEVICE },
@@ -665,6 +686,13 @@ const cfg_opt SERVICE_OPTS[] = {
 		{ "defrag-queue-hwm",				CASE_SERVICE_DEFRAG_QUEUE_HWM },
 		{ "defrag-queue-lwm",				CASE_SERVICE_DEFRAG_QUEUE_LWM },
 		{ "defrag-queue-priority",			CASE_SERVICE_DEFRAG_QUEUE_PRIORITY },
+		{ "migrate-priority",				CASE_SERVICE_MIGRATE_PRIORITY },
+		{ "migrate-read-priority",			CASE_SERVICE_MIGRATE_READ_PRIORITY },
+		{ "migrate-read-sleep",				CASE_SERVICE_MIGRATE_READ_SLEEP },
+		{ "migrate-xmit-hwm",				CASE_SERVICE_MIGRATE_XMIT_HWM },
+		{ "migrate-xmit-lwm",				CASE_SERVICE_MIGRATE_XMIT_LWM },
+		{ "migrate-xmit-priority",			CASE_SERVICE_MIGRATE_XMIT_PRIORITY },
+		{ "migrate-xmit-sleep",				CASE_SERVICE_MIGRATE_XMIT_SLEEP },
 		{ "nsup-auto-hwm",					CASE_SERVICE_NSUP_AUTO_HWM },
 		{ "nsup-auto-hwm-pct",				CASE_SERVICE_NSUP_AUTO_HWM_PCT },
 		{ "nsup-max-deletes",				CASE_SERVICE_NSUP_MAX_DELETES },
@@ -673,7 +701,6 @@ const cfg_opt SERVICE_OPTS[] = {
 		{ "nsup-queue-lwm",					CASE_SERVICE_NSUP_QUEUE_LWM },
 		{ "nsup-reduce-priority",			CASE_SERVICE_NSUP_REDUCE_PRIORITY },
 		{ "nsup-reduce-sleep",				CASE_SERVICE_NSUP_REDUCE_SLEEP },
-		{ "nsup-threads",					CASE_SERVICE_NSUP_THREADS },
 		{ "scan-memory",					CASE_SERVICE_SCAN_MEMORY },
 		{ "scan-retransmit",				CASE_SERVICE_SCAN_RETRANSMIT },
 		{ "scheduler-priority",				CASE_SERVICE_SCHEDULER_PRIORITY },
@@ -728,6 +755,7 @@ const cfg_opt NETWORK_SERVICE_OPTS[] = {
 		{ "access-address",					CASE_NETWORK_SERVICE_ACCESS_ADDRESS },
 		{ "network-interface-name",			CASE_NETWORK_SERVICE_NETWORK_INTERFACE_NAME },
 		{ "reuse-address",					CASE_NETWORK_SERVICE_REUSE_ADDRESS },
+		{ "reuse-port",						CASE_NETWORK_SERVICE_REUSE_PORT },
 		{ "}",								CASE_CONTEXT_END }
 };
 
@@ -791,6 +819,7 @@ const cfg_opt NAMESPACE_OPTS[] = {
 		{ "high-water-memory-pct",			CASE_NAMESPACE_HIGH_WATER_MEMORY_PCT },
 		{ "ldt-enabled",					CASE_NAMESPACE_LDT_ENABLED },
 		{ "max-ttl",						CASE_NAMESPACE_MAX_TTL },
+		{ "nsup-expire-index",				CASE_NAMESPACE_NSUP_EXPIRE_INDEX },
 		{ "obj-size-hist-max",				CASE_NAMESPACE_OBJ_SIZE_HIST_MAX },
 		{ "read-consistency-level-override", CASE_NAMESPACE_READ_CONSISTENCY_LEVEL_OVERRIDE },
 		{ "set",							CASE_NAMESPACE_SET_BEGIN },
@@ -846,9 +875,16 @@ const cfg_opt NAMESPACE_STORAGE_DEVICE_OPTS[] = {
 		{ "enable-osync",					CASE_NAMESPACE_STORAGE_DEVICE_ENABLE_OSYNC },
 		{ "flush-max-ms",					CASE_NAMESPACE_STORAGE_DEVICE_FLUSH_MAX_MS },
 		{ "fsync-max-sec",					CASE_NAMESPACE_STORAGE_DEVICE_FSYNC_MAX_SEC },
+		{ "io-depth",						CASE_NAMESPACE_STORAGE_DEVICE_IO_DEPTH },
+		{ "io-engine",						CASE_NAMESPACE_STORAGE_DEVICE_IO_ENGINE },
 		{ "max-write-cache",				CASE_NAMESPACE_STORAGE_DEVICE_MAX_WRITE_CACHE },
 		{ "min-avail-pct",					CASE_NAMESPACE_STORAGE_DEVICE_MIN_AVAIL_PCT },
 		{ "post-write-queue",				CASE_NAMESPACE_STORAGE_DEVICE_POST_WRITE_QUEUE },
+		{ "scan-device-order",				CASE_NAMESPACE_STORAGE_DEVICE_SCAN_DEVICE_ORDER },
+		{ "record-cache-size",				CASE_NAMESPACE_STORAGE_DEVICE_RECORD_CACHE_SIZE },
+		{ "cold-start-threads",				CASE_NAMESPACE_STORAGE_DEVICE_COLD_START_THREADS },
+		{ "index-snapshot-file",		CASE_NAMESPACE_STORAGE_DEVICE_INDEX_SNAPSHOT_FILE },
+		{ "index-snapshot-period",		CASE_NAMESPACE_STORAGE_DEVICE_INDEX_SNAPSHOT_PERIOD },
 		{ "signature",						CASE_NAMESPACE_STORAGE_DEVICE_SIGNATURE },
 		{ "write-smoothing-period",			CASE_NAMESPACE_STORAGE_DEVICE_WRITE_SMOOTHING_PERIOD },
 		{ "write-threads",					CASE_NAMESPACE_STORAGE_DEVICE_WRITE_THREADS },
@@ -860,6 +896,11 @@ const cfg_opt NAMESPACE_STORAGE_DEVICE_OPTS[] = {
 		{ "}",								CASE_CONTEXT_END }
 };
 
+const cfg_opt NAMESPACE_STORAGE_DEVICE_IO_ENGINE_OPTS[] = {
+		{ "sync",							CASE_NAMESPACE_STORAGE_DEVICE_IO_ENGINE_SYNC },
+		{ "uring",							CASE_NAMESPACE_STORAGE_DEVICE_IO_ENGINE_URING }
+};
+
 const cfg_opt NAMESPACE_STORAGE_KV_OPTS[] = {
 		{ "device",							CASE_NAMESPACE_STORAGE_KV_DEVICE },
 		{ "filesize",						CASE_NAMESPACE_STORAGE_KV_FILESIZE },
@@ -966,6 +1007,7 @@ const int NUM_NAMESPACE_READ_CONSISTENCY_OPTS		= sizeof(NAMESPACE_READ_CONSISTEN
 const int NUM_NAMESPACE_WRITE_COMMIT_OPTS			= sizeof(NAMESPACE_WRITE_COMMIT_OPTS) / sizeof(cfg_opt);
 const int NUM_NAMESPACE_STORAGE_OPTS				= sizeof(NAMESPACE_STORAGE_OPTS) / sizeof(cfg_opt);
 const int NUM_NAMESPACE_STORAGE_DEVICE_OPTS			= sizeof(NAMESPACE_STORAGE_DEVICE_OPTS) / sizeof(cfg_opt);
+const int NUM_NAMESPACE_STORAGE_DEVICE_IO_ENGINE_OPTS	= sizeof(NAMESPACE_STORAGE_DEVICE_IO_ENGINE_OPTS) / sizeof(cfg_opt);
 const int NUM_NAMESPACE_STORAGE_KV_OPTS				= sizeof(NAMESPACE_STORAGE_KV_OPTS) / sizeof(cfg_opt);
 const int NUM_NAMESPACE_SET_OPTS					= sizeof(NAMESPACE_SET_OPTS) / sizeof(cfg_opt);
 const int NUM_NAMESPACE_SET_ENABLE_XDR_OPTS			= sizeof(NAMESPACE_SET_ENABLE_XDR_OPTS) / sizeof(cfg_opt);
@@ -1749,6 +1791,9 @@ as_config_init(const char *config_file)
 			case CASE_SERVICE_AUTO_UNDUN:
 				c->auto_undun = cfg_bool(&line);
 				break;
+			case CASE_SERVICE_BATCH_HELPER_THREADS:
+				c->n_batch_helper_threads = cfg_int(&line, 0, MAX_BATCH_HELPER_THREADS);
+				break;
 			case CASE_SERVICE_BATCH_MAX_REQUESTS:
 				c->batch_max_requests = cfg_u32_no_checks(&line);
 				break;
@@ -1792,14 +1837,14 @@ as_config_init(const char *config_file)
 			case CASE_SERVICE_MICROBENCHMARKS:
 				c->microbenchmarks = cfg_bool(&line);
 				break;
-			case CASE_SERVICE_MIGRATE_MAX_NUM_INCOMING:
-				c->migrate_max_num_incoming = cfg_int(&line, 0, INT_MAX);
+			case CASE_SERVICE_MIGRATE_DELTA:
+				c->migrate_delta = cfg_bool(&line);
 				break;
-			case CASE_SERVICE_MIGRATE_READ_PRIORITY:
-				c->migrate_read_priority = cfg_u32_no_checks(&line);
+			case CASE_SERVICE_MIGRATE_MAX_MB_PER_SEC:
+				c->migrate_max_mb_per_sec = cfg_u32_no_checks(&line);
 				break;
-			case CASE_SERVICE_MIGRATE_READ_SLEEP:
-				c->migrate_read_sleep = cfg_u32_no_checks(&line);
+			case CASE_SERVICE_MIGRATE_MAX_NUM_INCOMING:
+				c->migrate_max_num_incoming = cfg_int(&line, 0, INT_MAX);
 				break;
 			case CASE_SERVICE_MIGRATE_RX_LIFETIME_MS:
 				c->migrate_rx_lifetime_ms = cfg_int_no_checks(&line);
@@ -1807,20 +1852,8 @@ as_config_init(const char *config_file)
 			case CASE_SERVICE_MIGRATE_THREADS:
 				c->n_migrate_threads = cfg_int(&line, 0, MAX_NUM_MIGRATE_XMIT_THREADS);
 				break;
-			case CASE_SERVICE_MIGRATE_XMIT_HWM:
-				c->migrate_xmit_hwm = cfg_u32_no_checks(&line);
-				break;
-			case CASE_SERVICE_MIGRATE_XMIT_LWM:
-				c->migrate_xmit_lwm = cfg_u32_no_checks(&line);
-				break;
-			case CASE_SERVICE_MIGRATE_PRIORITY:
-				cfg_renamed_name_tok(&line, "migrate-xmit-priority");
-				// Intentional fall-through.
-			case CASE_SERVICE_MIGRATE_XMIT_PRIORITY:
-				c->migrate_xmit_priority = cfg_u32_no_checks(&line);
-				break;
-			case CASE_SERVICE_MIGRATE_XMIT_SLEEP:
-				c->migrate_xmit_sleep = cfg_u32_no_checks(&line);
+			case CASE_SERVICE_MIGRATE_WINDOW_SIZE:
+				c->migrate_window_size = cfg_u32(&line, 64 * 1024, 1024 * 1024 * 1024);
 				break;
 			case CASE_SERVICE_NSUP_DELETE_SLEEP:
 				c->nsup_delete_sleep = cfg_u32_no_checks(&line);
@@ -1828,9 +1861,15 @@ as_config_init(const char *config_file)
 			case CASE_SERVICE_NSUP_PERIOD:
 				c->nsup_period = cfg_u32_no_checks(&line);
 				break;
+			case CASE_SERVICE_NSUP_REDUCE_RATE:
+				c->nsup_reduce_rate = cfg_u32_no_checks(&line);
+				break;
 			case CASE_SERVICE_NSUP_STARTUP_EVICT:
 				c->nsup_startup_evict = cfg_bool(&line);
 				break;
+			case CASE_SERVICE_NSUP_THREADS:
+				c->nsup_threads = cfg_u32(&line, 1, 128);
+				break;
 			case CASE_SERVICE_PAXOS_MAX_CLUSTER_SIZE:
 				c->paxos_max_cluster_size = cfg_u64(&line, 2, AS_CLUSTER_SZ);
 				break;
@@ -1880,6 +1919,9 @@ as_config_init(const char *config_file)
 			case CASE_SERVICE_QUERY_IN_TRANSACTION_THREAD:
 				c->query_in_transaction_thr = cfg_bool(&line);
 				break;
+			case CASE_SERVICE_REPLICATION_BATCH:
+				c->replication_batch = cfg_bool(&line);
+				break;
 			case CASE_SERVICE_REPLICATION_FIRE_AND_FORGET:
 				c->replication_fire_and_forget = cfg_bool(&line);
 				break;
@@ -1927,6 +1969,9 @@ as_config_init(const char *config_file)
 			case CASE_SERVICE_TRANSACTION_RETRY_MS:
 				c->transaction_retry_ms = cfg_u32_no_checks(&line);
 				break;
+			case CASE_SERVICE_TRANSACTION_TRACE_SAMPLE_RATE:
+				c->transaction_trace_sample_rate = cfg_u32_no_checks(&line);
+				break;
 			case CASE_SERVICE_UDF_RUNTIME_MAX_GMEMORY:
 				config_val = cfg_u64_no_checks(&line);
 				if (config_val < c->udf_runtime_gmemory_used) {
@@ -1973,6 +2018,13 @@ as_config_init(const char *config_file)
 			case CASE_SERVICE_DEFRAG_QUEUE_HWM:
 			case CASE_SERVICE_DEFRAG_QUEUE_LWM:
 			case CASE_SERVICE_DEFRAG_QUEUE_PRIORITY:
+			case CASE_SERVICE_MIGRATE_PRIORITY:
+			case CASE_SERVICE_MIGRATE_READ_PRIORITY:
+			case CASE_SERVICE_MIGRATE_READ_SLEEP:
+			case CASE_SERVICE_MIGRATE_XMIT_HWM:
+			case CASE_SERVICE_MIGRATE_XMIT_LWM:
+			case CASE_SERVICE_MIGRATE_XMIT_PRIORITY:
+			case CASE_SERVICE_MIGRATE_XMIT_SLEEP:
 			case CASE_SERVICE_NSUP_AUTO_HWM:
 			case CASE_SERVICE_NSUP_AUTO_HWM_PCT:
 			case CASE_SERVICE_NSUP_MAX_DELETES:
@@ -1981,7 +2033,6 @@ as_config_init(const char *config_file)
 			case CASE_SERVICE_NSUP_QUEUE_LWM:
 			case CASE_SERVICE_NSUP_REDUCE_PRIORITY:
 			case CASE_SERVICE_NSUP_REDUCE_SLEEP:
-			case CASE_SERVICE_NSUP_THREADS:
 			case CASE_SERVICE_SCAN_MEMORY:
 			case CASE_SERVICE_SCAN_RETRANSMIT:
 			case CASE_SERVICE_SCHEDULER_PRIORITY:
@@ -2129,6 +2180,9 @@ as_config_init(const char *config_file)
 			case CASE_NETWORK_SERVICE_REUSE_ADDRESS:
 				c->socket_reuse_addr = cfg_bool_no_value_is_true(&line);
 				break;
+			case CASE_NETWORK_SERVICE_REUSE_PORT:
+				c->socket_reuse_port = cfg_bool_no_value_is_true(&line);
+				break;
 			case CASE_CONTEXT_END:
 				cfg_end_context(&state);
 				break;
@@ -2367,6 +2421,9 @@ as_config_init(const char *config_file)
 			case CASE_NAMESPACE_MAX_TTL:
 				ns->max_ttl = cfg_seconds(&line);
 				break;
+			case CASE_NAMESPACE_NSUP_EXPIRE_INDEX:
+				ns->nsup_expire_index = cfg_bool(&line);
+				break;
 			case CASE_NAMESPACE_OBJ_SIZE_HIST_MAX:
 				ns->obj_size_hist_max = cfg_obj_size_hist_max(cfg_u32_no_checks(&line));
 				break;
@@ -2526,6 +2583,27 @@ as_config_init(const char *config_file)
 			case CASE_NAMESPACE_STORAGE_DEVICE_FSYNC_MAX_SEC:
 				ns->storage_fsync_max_us = cfg_u64_no_checks(&line) * 1000000;
 				break;
+			case CASE_NAMESPACE_STORAGE_DEVICE_IO_DEPTH:
+				ns->storage_io_depth = cfg_u32(&line, 1, 4096);
+				break;
+			case CASE_NAMESPACE_STORAGE_DEVICE_IO_ENGINE:
+				switch(cfg_find_tok(line.val_tok_1, NAMESPACE_STORAGE_DEVICE_IO_ENGINE_OPTS, NUM_NAMESPACE_STORAGE_DEVICE_IO_ENGINE_OPTS)) {
+				case CASE_NAMESPACE_STORAGE_DEVICE_IO_ENGINE_SYNC:
+					ns->storage_io_engine = AS_STORAGE_IO_ENGINE_SYNC;
+					break;
+				case CASE_NAMESPACE_STORAGE_DEVICE_IO_ENGINE_URING:
+#ifdef USE_URING
+					ns->storage_io_engine = AS_STORAGE_IO_ENGINE_URING;
+#else
+					cfg_not_supported(&line, "io_uring");
+#endif
+					break;
+				case CASE_NOT_FOUND:
+				default:
+					cfg_unknown_val_tok_1(&line);
+					break;
+				}
+				break;
 			case CASE_NAMESPACE_STORAGE_DEVICE_MAX_WRITE_CACHE:
 				ns->storage_max_write_cache = cfg_u64_no_checks(&line);
 				break;
@@ -2535,6 +2613,21 @@ as_config_init(const char *config_file)
 			case CASE_NAMESPACE_STORAGE_DEVICE_POST_WRITE_QUEUE:
 				ns->storage_post_write_queue = cfg_u32(&line, 0, 2 * 1024);
 				break;
+			case CASE_NAMESPACE_STORAGE_DEVICE_SCAN_DEVICE_ORDER:
+				ns->storage_scan_device_order = cfg_bool(&line);
+				break;
+			case CASE_NAMESPACE_STORAGE_DEVICE_RECORD_CACHE_SIZE:
+				ns->storage_record_cache_size = cfg_u64_no_checks(&line);
+				break;
+			case CASE_NAMESPACE_STORAGE_DEVICE_COLD_START_THREADS:
+				ns->storage_cold_start_threads = cfg_u32(&line, 0, 256);
+				break;
+			case CASE_NAMESPACE_STORAGE_DEVICE_INDEX_SNAPSHOT_FILE:
+				ns->storage_index_snapshot_file = cfg_strdup(&line);
+				break;
+			case CASE_NAMESPACE_STORAGE_DEVICE_INDEX_SNAPSHOT_PERIOD:
+				ns->storage_index_snapshot_period = cfg_u32(&line, 60, 7 * 24 * 60 * 60);
+				break;
 			case CASE_NAMESPACE_STORAGE_DEVICE_SIGNATURE:
 				ns->storage_signature = cfg_bool(&line);
 				break;
@@ -0,0 +1,284 @@
+/*
+ * hot_keys.c
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "base/hot_keys.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "citrusleaf/alloc.h"
+#include "citrusleaf/cf_clock.h"
+#include "citrusleaf/cf_digest.h"
+
+#include "dynbuf.h"
+
+
+#define HOT_KEYS_SIZE 64
+#define HOT_KEYS_WINDOW_MS (10 * 1000)
+#define HOT_KEYS_N_SHARDS 16 // CPUs beyond this share shards
+
+typedef struct hot_key_s {
+	cf_digest	keyd;
+	uint64_t	count;			// estimated accesses - over-counts by up to err
+	uint64_t	err;
+	uint64_t	n_lock_waits;
+	uint64_t	lock_wait_ns;
+	uint32_t	n_queued;
+	uint32_t	max_queue_depth;
+} hot_key;
+
+typedef struct hot_keys_window_s {
+	uint32_t	n_keys;
+	hot_key		keys[HOT_KEYS_SIZE];
+} hot_keys_window;
+
+// Windows are numbered by start time / HOT_KEYS_WINDOW_MS, so every shard
+// agrees on where they begin and end.
+typedef struct hot_keys_shard_s {
+	pthread_mutex_t	lock;
+	uint64_t		cur_window;
+	hot_keys_window	cur;
+	uint64_t		last_window;
+	hot_keys_window	last;
+} __attribute__ ((aligned(64))) hot_keys_shard;
+
+__thread uint32_t g_hot_keys_n_accesses = 0;
+__thread as_hot_keys_pending g_hot_keys_pending = { false };
+
+static hot_keys_shard g_shards[HOT_KEYS_N_SHARDS] = {
+	[0 ... HOT_KEYS_N_SHARDS - 1] = { .lock = PTHREAD_MUTEX_INITIALIZER }
+};
+
+
+//------------------------------------------------
+// Start a new window if the current one is over.
+// Call under the shard's lock.
+//
+static void
+rotate_if_due(hot_keys_shard *shard, uint64_t window)
+{
+	if (shard->cur_window == window) {
+		return;
+	}
+
+	if (shard->cur_window + 1 == window) {
+		shard->last = shard->cur;
+	}
+	else {
+		// Nothing was recorded for a whole window - the last one is empty.
+		shard->last.n_keys = 0;
+	}
+
+	shard->last_window = window - 1;
+	shard->cur.n_keys = 0;
+	shard->cur_window = window;
+}
+
+//------------------------------------------------
+// Add an event to this CPU's current window.
+// Space-saving - a key not in a full table replaces
+// the one with the lowest count, inheriting that
+// count as its error.
+//
+void
+as_hot_keys_record(const cf_digest *keyd, uint32_t weight,
+		uint64_t lock_wait_ns, uint32_t queue_depth)
+{
+	int cpu = sched_getcpu();
+	hot_keys_shard *shard = &g_shards[cpu < 0 ? 0 : cpu % HOT_KEYS_N_SHARDS];
+
+	// Better to lose a sample than to wait for one.
+	if (pthread_mutex_trylock(&shard->lock) != 0) {
+		return;
+	}
+
+	rotate_if_due(shard, cf_getms() / HOT_KEYS_WINDOW_MS);
+
+	hot_keys_window *w = &shard->cur;
+	hot_key *k = NULL;
+	hot_key *min_k = NULL;
+
+	for (uint32_t i = 0; i < w->n_keys; i++) {
+		hot_key *ik = &w->keys[i];
+
+		if (memcmp(&ik->keyd, keyd, sizeof(cf_digest)) == 0) {
+			k = ik;
+			break;
+		}
+
+		if (! min_k || ik->count < min_k->count) {
+			min_k = ik;
+		}
+	}
+
+	if (! k) {
+		uint64_t err = 0;
+
+		if (w->n_keys < HOT_KEYS_SIZE) {
+			k = &w->keys[w->n_keys++];
+		}
+		else {
+			k = min_k;
+			err = min_k->count;
+		}
+
+		memset(k, 0, sizeof(hot_key));
+		k->keyd = *keyd;
+		k->count = err;
+		k->err = err;
+	}
+
+	k->count += weight;
+
+	if (lock_wait_ns != 0) {
+		k->n_lock_waits++;
+		k->lock_wait_ns += lock_wait_ns;
+	}
+
+	if (queue_depth != 0) {
+		k->n_queued++;
+
+		if (queue_depth > k->max_queue_depth) {
+			k->max_queue_depth = queue_depth;
+		}
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+static int
+hot_key_digest_cmp(const void *pa, const void *pb)
+{
+	return memcmp(&((const hot_key*)pa)->keyd, &((const hot_key*)pb)->keyd,
+			sizeof(cf_digest));
+}
+
+static int
+hot_key_count_cmp(const void *pa, const void *pb)
+{
+	uint64_t a = ((const hot_key*)pa)->count;
+	uint64_t b = ((const hot_key*)pb)->count;
+
+	return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+//------------------------------------------------
+// Get the hottest keys from the last complete
+// window, merged over all shards, hottest first,
+// e.g.:
+// digest=...,accesses-per-sec=8200,accesses-per-sec-error=32,
+// lock-waits=1240,lock-wait-avg-us=85,queued=310,max-queue-depth=6;
+//
+// A key may have been evicted from some shards, so
+// merged errors are approximate.
+//
+void
+as_hot_keys_get_info(uint32_t max_keys, cf_dyn_buf *db)
+{
+	hot_key *keys = cf_malloc(sizeof(hot_key) * HOT_KEYS_SIZE * HOT_KEYS_N_SHARDS);
+
+	if (! keys) {
+		return;
+	}
+
+	uint64_t window = cf_getms() / HOT_KEYS_WINDOW_MS;
+	uint32_t n_keys = 0;
+
+	for (uint32_t i = 0; i < HOT_KEYS_N_SHARDS; i++) {
+		hot_keys_shard *shard = &g_shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+
+		rotate_if_due(shard, window);
+
+		if (shard->last_window + 1 == window) {
+			memcpy(&keys[n_keys], shard->last.keys,
+					sizeof(hot_key) * shard->last.n_keys);
+			n_keys += shard->last.n_keys;
+		}
+
+		pthread_mutex_unlock(&shard->lock);
+	}
+
+	// Merge each key's entries from different shards.
+	qsort(keys, n_keys, sizeof(hot_key), hot_key_digest_cmp);
+
+	uint32_t n_merged = 0;
+
+	for (uint32_t i = 0; i < n_keys; i++) {
+		hot_key *m = n_merged == 0 ? NULL : &keys[n_merged - 1];
+
+		if (! m || memcmp(&m->keyd, &keys[i].keyd, sizeof(cf_digest)) != 0) {
+			keys[n_merged++] = keys[i];
+			continue;
+		}
+
+		m->count += keys[i].count;
+		m->err += keys[i].err;
+		m->n_lock_waits += keys[i].n_lock_waits;
+		m->lock_wait_ns += keys[i].lock_wait_ns;
+		m->n_queued += keys[i].n_queued;
+
+		if (keys[i].max_queue_depth > m->max_queue_depth) {
+			m->max_queue_depth = keys[i].max_queue_depth;
+		}
+	}
+
+	qsort(keys, n_merged, sizeof(hot_key), hot_key_count_cmp);
+
+	if (max_keys > n_merged) {
+		max_keys = n_merged;
+	}
+
+	for (uint32_t i = 0; i < max_keys; i++) {
+		hot_key *k = &keys[i];
+		char digest_str[(sizeof(cf_digest) * 2) + 1];
+
+		for (uint32_t b = 0; b < sizeof(cf_digest); b++) {
+			sprintf(&digest_str[b * 2], "%02x", k->keyd.digest[b]);
+		}
+
+		cf_dyn_buf_append_string(db, "digest=");
+		cf_dyn_buf_append_string(db, digest_str);
+		cf_dyn_buf_append_string(db, ",accesses-per-sec=");
+		cf_dyn_buf_append_uint64(db, (k->count * 1000) / HOT_KEYS_WINDOW_MS);
+		cf_dyn_buf_append_string(db, ",accesses-per-sec-error=");
+		cf_dyn_buf_append_uint64(db, (k->err * 1000) / HOT_KEYS_WINDOW_MS);
+		cf_dyn_buf_append_string(db, ",lock-waits=");
+		cf_dyn_buf_append_uint64(db, k->n_lock_waits);
+		cf_dyn_buf_append_string(db, ",lock-wait-avg-us=");
+		cf_dyn_buf_append_uint64(db, k->n_lock_waits == 0 ?
+				0 : k->lock_wait_ns / k->n_lock_waits / 1000);
+		cf_dyn_buf_append_string(db, ",queued=");
+		cf_dyn_buf_append_uint32(db, k->n_queued);
+		cf_dyn_buf_append_string(db, ",max-queue-depth=");
+		cf_dyn_buf_append_uint32(db, k->max_queue_depth);
+		cf_dyn_buf_append_char(db, ';');
+	}
+
+	cf_free(keys);
+}
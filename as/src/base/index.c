@@ -26,12 +26,14 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
 #include <unistd.h>
+#include <xmmintrin.h>
 
 #include "citrusleaf/alloc.h"
 #include "citrusleaf/cf_clock.h"
@@ -40,6 +42,7 @@
 
 #include "base/index.h"
 #include "base/cfg.h"
+#include "base/hot_keys.h"
 
 
 #define RESOLVE_H( __h ) ((as_index *) cf_arenax_resolve(tree->arena, __h))
@@ -49,6 +52,169 @@ enum {
 	CF_RCRB_RED
 };
 
+/*
+ * Lockless lookups.
+ *
+ * Readers search the tree without the tree lock. Writers hold the tree lock,
+ * and bump tree->seq before and after changing the tree's shape, so a reader
+ * can tell whether a miss is genuine or an artifact of a concurrent rotation.
+ *
+ * A node found by a lockless search is always safe to reserve - after
+ * unlinking a node, delete waits for all readers that might have reached it
+ * (a "grace period") before dropping the tree's reference. Readers register in
+ * one of two per-tree counters, and a writer flips the epoch and waits for the
+ * old counter to drain.
+ */
+
+// RB tree height is at most 2 * log2(n + 1) - more steps means the search ran
+// into a transient cycle mid-rotation.
+#define MAX_LOCKLESS_STEPS	128
+#define MAX_LOCKLESS_TRIES	3
+
+// Waiting for readers - pause-spin, doubling up to this many pauses per poll,
+// then yield the CPU (e.g. to a descheduled reader) between polls.
+#define MAX_READER_WAIT_PAUSES	64
+
+static inline uint32_t
+as_index_read_begin(as_index_tree *tree)
+{
+	while (true) {
+		uint32_t epoch = cf_atomic32_get(tree->reader_epoch) & 1;
+
+		cf_atomic32_incr(&tree->n_readers[epoch]);
+
+		if ((cf_atomic32_get(tree->reader_epoch) & 1) == epoch) {
+			return epoch;
+		}
+
+		// Raced with a writer flipping the epoch - register again.
+		cf_atomic32_decr(&tree->n_readers[epoch]);
+	}
+}
+
+static inline void
+as_index_read_end(as_index_tree *tree, uint32_t epoch)
+{
+	cf_atomic32_decr(&tree->n_readers[epoch]);
+}
+
+// Call with the tree lock held.
+static inline void
+as_index_write_begin(as_index_tree *tree)
+{
+	cf_atomic32_incr(&tree->seq);
+}
+
+// Call with the tree lock held.
+static inline void
+as_index_write_end(as_index_tree *tree)
+{
+	cf_atomic32_incr(&tree->seq);
+}
+
+// Call with the tree lock held, after unlinking a node and before releasing
+// the tree's reference to it.
+static void
+as_index_wait_for_readers(as_index_tree *tree)
+{
+	uint32_t epoch = cf_atomic32_get(tree->reader_epoch) & 1;
+
+	cf_atomic32_incr(&tree->reader_epoch);
+
+	uint32_t n_pauses = 1;
+
+	while (cf_atomic32_get(tree->n_readers[epoch]) != 0) {
+		if (n_pauses > MAX_READER_WAIT_PAUSES) {
+			sched_yield();
+			continue;
+		}
+
+		for (uint32_t i = 0; i < n_pauses; i++) {
+			_mm_pause();
+		}
+
+		n_pauses <<= 1;
+	}
+}
+
+/* as_index_search_bounded
+ * Search without the tree lock, from within a reader section. Gives up if the
+ * search runs too long, which may happen during a concurrent rotation.
+ *
+ * 0 success (found)
+ * -1 fail (not found)
+ * -2 inconclusive
+ */
+static int
+as_index_search_bounded(as_index_tree *tree, cf_digest *key, as_index **ret, cf_arenax_handle *ret_h)
+{
+	cf_arenax_handle r_h = tree->root->left_h;
+
+	for (int i = 0; i < MAX_LOCKLESS_STEPS; i++) {
+		if (r_h == tree->sentinel_h) {
+			return(-1);
+		}
+
+		as_index *r = RESOLVE_H(r_h);
+		int c = cf_digest_compare(key, &r->key);
+
+		if (c == 0) {
+			*ret_h = r_h;
+			*ret = r;
+			return(0);
+		}
+
+		r_h = (c > 0) ? r->left_h : r->right_h;
+	}
+
+	return(-2);
+}
+
+/* as_index_get_lockless
+ * Search without the tree lock, optionally reserving the node if found. Misses
+ * are only trusted if no writer changed the tree's shape during the search.
+ *
+ * 0 success (found)
+ * -1 fail (not found)
+ * -2 inconclusive - caller must search under the tree lock
+ */
+static int
+as_index_get_lockless(as_index_tree *tree, cf_digest *key, bool reserve, as_index **ret, cf_arenax_handle *ret_h)
+{
+	for (int i = 0; i < MAX_LOCKLESS_TRIES; i++) {
+		uint32_t seq = cf_atomic32_get(tree->seq);
+
+		if ((seq & 1) != 0) {
+			continue;
+		}
+
+		uint32_t epoch = as_index_read_begin(tree);
+
+		int rv = as_index_search_bounded(tree, key, ret, ret_h);
+
+		if (rv == 0 && reserve) {
+			as_index *r = *ret;
+
+			as_index_reserve(r);
+			cf_atomic_int_incr(&g_config.global_record_ref_count);
+		}
+
+		as_index_read_end(tree, epoch);
+
+		if (rv == 0) {
+			return(0);
+		}
+
+		smb_mb();
+
+		if (rv == -1 && cf_atomic32_get(tree->seq) == seq) {
+			return(-1);
+		}
+	}
+
+	return(-2);
+}
+
 /* as_indexrotate_left
  * Rotate a tree left - r's parent might change */
 void
@@ -132,7 +298,7 @@ as_index_ref_initialize(as_index_tree *tree, cf_digest *key, as_index_ref *index
 	index_ref->r = n;
 	index_ref->r_h = n_h;
 	if (!index_ref->skip_lock) {
-		olock_vlock(g_config.record_locks, key, &(index_ref->olock));
+		as_hot_keys_access(key, olock_vlock(g_config.record_locks, key, &(index_ref->olock)));
 		cf_atomic_int_incr(&g_config.global_record_lock_count);
 	}
 	as_index_reserve(n);
@@ -145,6 +311,7 @@ as_index_ref_initialize(as_index_tree *tree, cf_digest *key, as_index_ref *index
 		if (!index_ref->skip_lock) {
 			pthread_mutex_unlock(index_ref->olock);
 			cf_atomic_int_decr(&g_config.global_record_lock_count);
+			as_hot_keys_flush();
 		}
 		as_index_release(n);
 		cf_arenax_free(tree->arena, n_h);
@@ -171,6 +338,15 @@ as_index_get_insert_vlock(as_index_tree *tree, cf_digest *key, as_index_ref *ind
 	as_index 		*n, *s, *t;
 	cf_arenax_handle n_h, s_h, t_h;
 
+	/* Most calls find an existing node - try that without the tree lock */
+	if (0 == as_index_get_lockless(tree, key, true, &(index_ref->r), &(index_ref->r_h))) {
+		if (!index_ref->skip_lock) {
+			as_hot_keys_access(key, olock_vlock(g_config.record_locks, key, &(index_ref->olock)));
+			cf_atomic_int_incr(&g_config.global_record_lock_count);
+		}
+		return(0);
+	}
+
 	/* Lock the tree */
 	pthread_mutex_lock(&tree->lock);
 
@@ -205,7 +381,7 @@ as_index_get_insert_vlock(as_index_tree *tree, cf_digest *key, as_index_ref *ind
 		cf_atomic_int_incr(&g_config.global_record_ref_count);
 		pthread_mutex_unlock(&tree->lock);
 		if (!index_ref->skip_lock) {
-			olock_vlock(g_config.record_locks, key, &(index_ref->olock) );
+			as_hot_keys_access(key, olock_vlock(g_config.record_locks, key, &(index_ref->olock)));
 			cf_atomic_int_incr(&g_config.global_record_lock_count);
 		}
 		index_ref->r = s;
@@ -238,6 +414,8 @@ as_index_get_insert_vlock(as_index_tree *tree, cf_digest *key, as_index_ref *ind
 	as_index_reserve(n);
 	cf_atomic_int_add(&g_config.global_record_ref_count, 2);
 
+	as_index_write_begin(tree);
+
 	/* Insert the node */
 	if ((s == tree->root) || (0 < cf_digest_compare(&n->key, &s->key)))
 		s->left_h = n_h;
@@ -296,12 +474,13 @@ as_index_get_insert_vlock(as_index_tree *tree, cf_digest *key, as_index_ref *ind
 		}
 	}
 	RESOLVE_H(tree->root->left_h)->color = CF_RCRB_BLACK;
+	as_index_write_end(tree);
 	tree->elements++;
 
 	// done with tree now, and pick up the olock
 	pthread_mutex_unlock(&tree->lock);
 	if (!index_ref->skip_lock) {
-		olock_vlock(g_config.record_locks, key, &(index_ref->olock) );
+		as_hot_keys_access(key, olock_vlock(g_config.record_locks, key, &(index_ref->olock)));
 		cf_atomic_int_incr(&g_config.global_record_lock_count);
 	}
 
@@ -522,6 +701,14 @@ miss:
 int
 as_index_exists(as_index_tree *tree, cf_digest *key)
 {
+	as_index *r;
+	cf_arenax_handle r_h;
+	int lockless_rv = as_index_get_lockless(tree, key, false, &r, &r_h);
+
+	if (lockless_rv != -2) {
+		return lockless_rv;
+	}
+
 	/* Lock the tree */
 	pthread_mutex_lock(&tree->lock);
 
@@ -549,6 +736,20 @@ as_index_exists(as_index_tree *tree, cf_digest *key)
 int
 as_index_get_vlock(as_index_tree *tree, cf_digest *key, as_index_ref *index_ref)
 {
+	int lockless_rv = as_index_get_lockless(tree, key, true, &(index_ref->r), &(index_ref->r_h));
+
+	if (lockless_rv == 0) {
+		if (!index_ref->skip_lock) {
+			as_hot_keys_access(key, olock_vlock(g_config.record_locks, key, &(index_ref->olock)));
+			cf_atomic_int_incr(&g_config.global_record_lock_count);
+		}
+		return(0);
+	}
+
+	if (lockless_rv == -1) {
+		return(-1);
+	}
+
 	/* Lock the tree */
 	pthread_mutex_lock(&tree->lock);
 
@@ -558,7 +759,7 @@ as_index_get_vlock(as_index_tree *tree, cf_digest *key, as_index_ref *index_ref)
 		cf_atomic_int_incr(&g_config.global_record_ref_count);
 		pthread_mutex_unlock(&tree->lock);
 		if (!index_ref->skip_lock) {
-			olock_vlock(g_config.record_locks, key, &(index_ref->olock) );
+			as_hot_keys_access(key, olock_vlock(g_config.record_locks, key, &(index_ref->olock)));
 			cf_atomic_int_incr(&g_config.global_record_lock_count);
 		}
 	}
@@ -599,6 +800,8 @@ as_index_delete(as_index_tree *tree, cf_digest *key)
 		goto release;
 	}
 
+	as_index_write_begin(tree);
+
 	if ((tree->sentinel_h == r->left_h) || (tree->sentinel_h == r->right_h)) {
 		s = r;
 		s_h = r_h;
@@ -648,6 +851,11 @@ as_index_delete(as_index_tree *tree, cf_digest *key)
 		else
 			r_parent->right_h = s_h;
 
+		as_index_write_end(tree);
+
+		/* Lockless readers may still be looking at r */
+		as_index_wait_for_readers(tree);
+
 		/* Consume the node - R IS DEAD AFTER HERE */
 		// cf_detail(AS_RECORD, "as_index_delete REFERENCE RELEASED:  %p", r);
 		if (0 == as_index_release(r)) {
@@ -664,6 +872,11 @@ as_index_delete(as_index_tree *tree, cf_digest *key)
 		if (CF_RCRB_BLACK == s->color)
 			as_index_deleterebalance(tree, t, t_h);
 
+		as_index_write_end(tree);
+
+		/* Lockless readers may still be looking at s */
+		as_index_wait_for_readers(tree);
+
 		// cf_detail(AS_RECORD, "as_index_delete REFERENCE RELEASED:  %p", s);
 		/* Destroy the node contents - S IS DEAD AFTER HERE */
 		if (0 == as_index_release(s)) {
@@ -697,6 +910,11 @@ as_index_tree_create(cf_arenax *arena, as_index_value_destructor destructor, voi
 
 	pthread_mutex_init(&tree->lock, NULL);
 
+	tree->seq = 0;
+	tree->reader_epoch = 0;
+	tree->n_readers[0] = 0;
+	tree->n_readers[1] = 0;
+
 	tree->arena = arena;
 
 	/* Allocate memory for the sentinel; note that it's pointers are all set
@@ -757,6 +975,11 @@ as_index_tree_resume(cf_arenax *arena, as_index_value_destructor destructor, voi
 
 	pthread_mutex_init(&tree->lock, NULL);
 
+	tree->seq = 0;
+	tree->reader_epoch = 0;
+	tree->n_readers[0] = 0;
+	tree->n_readers[1] = 0;
+
 	tree->arena = arena;
 
 	/* Resume the sentinel */
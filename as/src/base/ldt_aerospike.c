@@ -427,6 +427,7 @@ ldt_chunk_setup(ldt_chunk *lchunk, as_rec *h_urec, cf_digest *keyd)
 	// We do not track microbenchmark or time for chunk today
 	c_tr->microbenchmark_time  = 0;
 	c_tr->microbenchmark_is_resolve = false;
+	c_tr->trace.sampled        = false;
 	c_tr->start_time           = h_tr->start_time;
 	c_tr->end_time             = h_tr->end_time;
 	c_tr->trid                 = h_tr->trid;
@@ -144,10 +144,17 @@ as_namespace_create(char *name, uint16_t replication_factor)
 	ns->storage_defrag_startup_minimum = 10; // defrag until >= 10% disk is writable before joining cluster
 	ns->storage_flush_max_us = 1000 * 1000; // wait this many microseconds before flushing inactive current write buffer (0 = never)
 	ns->storage_fsync_max_us = 0; // fsync interval in microseconds (0 = never)
+	ns->storage_io_engine = AS_STORAGE_IO_ENGINE_SYNC; // blocking reads and writes on pooled fds
+	ns->storage_io_depth = 128; // maximum async I/O operations in flight per device (io-engine uring only)
 	ns->storage_max_write_cache = 1024 * 1024 * 64;
 	ns->storage_min_avail_pct = 5; // stop writes when < 5% disk is writable
 	ns->storage_num_write_blocks = 64; // number of write blocks to use with KV store devices
 	ns->storage_post_write_queue = 256; // number of wblocks per device used as post-write cache
+	ns->storage_scan_device_order = false; // full scans walk the index and read each record
+	ns->storage_record_cache_size = 0; // no record cache
+	ns->storage_cold_start_threads = 0; // one cold start worker per CPU
+	ns->storage_index_snapshot_file = NULL; // no index snapshot - restart after reboot is a full cold start
+	ns->storage_index_snapshot_period = 60 * 60; // seconds between index snapshots
 	ns->storage_read_block_size = 64 * 1024; // size in bytes of read buffers to use with KV store devices
 	// [Note - current FusionIO maximum read buffer size is 1MB - 512B.]
 	ns->storage_write_smoothing_period = 0; // seconds of write data to use for smoothing (default 0 = off)
@@ -27,14 +27,18 @@
 #include "base/proto.h"
 
 #include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <asm/byteorder.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "aerospike/as_val.h"
 #include "citrusleaf/alloc.h"
@@ -782,33 +786,14 @@ as_msg_send_reply(as_file_handle *fd_h, uint32_t result_code, uint32_t generatio
 
 //	cf_detail(AS_PROTO, "write fd %d",fd);
 
-	size_t pos = 0;
-	while (pos < msg_sz) {
-		int rv = send(fd_h->fd, msgp + pos, msg_sz - pos, MSG_NOSIGNAL);
-		if (rv > 0) {
-			pos += rv;
-		}
-		else if (rv < 0) {
-			if (errno != EWOULDBLOCK) {
-				// common message when a client aborts
-				cf_debug(AS_PROTO, "protocol write fail: fd %d sz %zd pos %zd rv %d errno %d", fd_h->fd, msg_sz, pos, rv, errno);
-				shutdown(fd_h->fd, SHUT_RDWR);
-				rv = -1;
-				goto Exit;
-			}
-			usleep(1); // Yield
-		} else {
-			cf_info(AS_PROTO, "protocol write fail zero return: fd %d sz %d pos %d ", fd_h->fd, msg_sz, pos);
-			shutdown(fd_h->fd, SHUT_RDWR);
-			rv = -1;
-			goto Exit;
-		}
+	// Never blocks - a failed write (common when a client aborts) is logged and
+	// the connection shut down there. The handle is released below either way,
+	// so callers must not look at it.
+	if (0 == as_msg_send_fh(fd_h, msgp, msg_sz, false)) {
+		// good for stats as a higher layer
+		if (written_sz) *written_sz = msg_sz;
 	}
 
-	// good for stats as a higher layer
-	if (written_sz) *written_sz = msg_sz;
-
-Exit:
 	if ((uint8_t *)msgp != fb)
 		cf_free(msgp);
 
@@ -1127,29 +1112,7 @@ as_msg_make_val_response_bufbuilder(const as_val *val, cf_buf_builder **bb_r, in
 }
 
 int
-as_msg_send_response(int fd, uint8_t* buf, size_t len, int flags)
-{
-	int rv;
-	int pos = 0;
-
-	while (pos < len) {
-		rv = send(fd, buf + pos, len - pos, flags);
-
-		if (rv <= 0) {
-			if (errno != EAGAIN) {
-				cf_info(AS_PROTO, "send response error returned %d errno %d fd %d", rv, errno, fd);
-				return -1;
-			}
-		}
-		else {
-			pos += rv;
-		}
-	}
-	return 0;
-}
-
-int
-as_msg_send_fin(int fd, uint32_t result_code)
+as_msg_send_fin(as_file_handle *fd_h, uint32_t result_code)
 {
 	cl_msg m;
 	m.proto.version = PROTO_VERSION;
@@ -1169,5 +1132,349 @@ as_msg_send_fin(int fd, uint32_t result_code)
 	m.msg.n_ops = 0;
 	as_msg_swap_header(&m.msg);
 
-	return as_msg_send_response(fd, (uint8_t*) &m, sizeof(m), MSG_NOSIGNAL);
+	return as_msg_send_fh(fd_h, (uint8_t*) &m, sizeof(m), false);
+}
+
+
+//==========================================================
+// Client response output queue.
+//
+// A response is written straight to the (non-blocking) client socket if
+// nothing is queued ahead of it. Whatever the socket won't take is copied to
+// the file handle's output queue, which the demarshal thread owning the
+// connection flushes when epoll reports EPOLLOUT. So transaction, scan and
+// query threads never spin on a slow client. Streaming producers pass
+// throttle, and wait on send_cond while the backlog is over PROTO_SEND_Q_HWM.
+// Everything else (replies, proxy responses, fin) is bounded by the demarshal
+// thread, which stops reading requests from a client whose backlog is over
+// PROTO_SEND_Q_HWM, until it drains below PROTO_SEND_Q_LWM.
+//
+
+#define PROTO_SEND_CHUNK_SZ	(16 * 1024)
+#define PROTO_SEND_Q_HWM	(4 * 1024 * 1024)
+#define PROTO_SEND_Q_LWM	(PROTO_SEND_Q_HWM / 2)
+#define PROTO_SEND_MAX_IOV	64
+
+typedef struct as_send_chunk_s {
+	struct as_send_chunk_s *next;
+	uint32_t	cap;
+	uint32_t	sz;
+	uint32_t	pos;	// offset of first unsent byte
+	uint8_t		data[];
+} as_send_chunk;
+
+void
+as_msg_send_fh_init(as_file_handle *fd_h)
+{
+	pthread_mutex_init(&fd_h->send_lock, NULL);
+	pthread_cond_init(&fd_h->send_cond, NULL);
+	fd_h->send_q_head = NULL;
+	fd_h->send_q_tail = NULL;
+	fd_h->send_q_sz = 0;
+	fd_h->send_failed = false;
+	fd_h->recv_paused = false;
+}
+
+// All the send_q_* helpers are called with send_lock held.
+static void
+send_q_drop(as_file_handle *fd_h)
+{
+	as_send_chunk *c = fd_h->send_q_head;
+
+	while (c) {
+		as_send_chunk *next = c->next;
+
+		cf_free(c);
+		c = next;
+	}
+
+	fd_h->send_q_head = NULL;
+	fd_h->send_q_tail = NULL;
+	fd_h->send_q_sz = 0;
+}
+
+static void
+send_q_fail(as_file_handle *fd_h)
+{
+	// common when a client aborts
+	cf_debug(AS_PROTO, "protocol write fail: fd %d queued %"PRIu64" errno %d", fd_h->fd, fd_h->send_q_sz, errno);
+
+	fd_h->send_failed = true;
+	send_q_drop(fd_h);
+	shutdown(fd_h->fd, SHUT_RDWR); // demarshal thread sees the error, cleans up
+	pthread_cond_broadcast(&fd_h->send_cond);
+}
+
+// Queue the iovecs' bytes from offset skip on, coalescing small responses.
+static void
+send_q_append(as_file_handle *fd_h, const struct iovec *iov, int iovcnt, size_t skip)
+{
+	for (int i = 0; i < iovcnt; i++) {
+		const uint8_t *p = (const uint8_t *)iov[i].iov_base;
+		size_t len = iov[i].iov_len;
+
+		if (skip >= len) {
+			skip -= len;
+			continue;
+		}
+
+		p += skip;
+		len -= skip;
+		skip = 0;
+
+		as_send_chunk *tail = fd_h->send_q_tail;
+
+		if (! tail || tail->cap - tail->sz < len) {
+			size_t cap = len < PROTO_SEND_CHUNK_SZ ? PROTO_SEND_CHUNK_SZ : len;
+
+			tail = cf_malloc(sizeof(as_send_chunk) + cap);
+			cf_assert(tail, AS_PROTO, CF_CRITICAL, "allocation: %zu %s", cap, cf_strerror(errno));
+			tail->next = NULL;
+			tail->cap = (uint32_t)cap;
+			tail->sz = 0;
+			tail->pos = 0;
+
+			if (fd_h->send_q_tail) {
+				fd_h->send_q_tail->next = tail;
+			}
+			else {
+				fd_h->send_q_head = tail;
+			}
+
+			fd_h->send_q_tail = tail;
+		}
+
+		memcpy(tail->data + tail->sz, p, len);
+		tail->sz += (uint32_t)len;
+		fd_h->send_q_sz += len;
+	}
+}
+
+// Write as much of the queue as the socket takes. Stopping on EAGAIN is what
+// guarantees another EPOLLOUT edge once the client makes room.
+static int
+send_q_flush(as_file_handle *fd_h)
+{
+	bool progress = false;
+
+	while (fd_h->send_q_head) {
+		struct iovec iov[PROTO_SEND_MAX_IOV];
+		int n_iov = 0;
+
+		for (as_send_chunk *c = fd_h->send_q_head; c && n_iov < PROTO_SEND_MAX_IOV; c = c->next) {
+			iov[n_iov].iov_base = c->data + c->pos;
+			iov[n_iov].iov_len = c->sz - c->pos;
+			n_iov++;
+		}
+
+		struct msghdr mh;
+
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = iov;
+		mh.msg_iovlen = n_iov;
+
+		ssize_t rv = sendmsg(fd_h->fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (rv < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			break;
+		}
+
+		if (rv <= 0) {
+			send_q_fail(fd_h);
+			return -1;
+		}
+
+		progress = true;
+		fd_h->send_q_sz -= rv;
+
+		while (rv > 0) {
+			as_send_chunk *c = fd_h->send_q_head;
+			size_t left = c->sz - c->pos;
+
+			if ((size_t)rv < left) {
+				c->pos += (uint32_t)rv;
+				break;
+			}
+
+			rv -= left;
+			fd_h->send_q_head = c->next;
+			cf_free(c);
+		}
+
+		if (! fd_h->send_q_head) {
+			fd_h->send_q_tail = NULL;
+		}
+	}
+
+	if (progress) {
+		// Keep the reaper at bay while the client is reading.
+		fd_h->last_used = cf_getms();
+		pthread_cond_broadcast(&fd_h->send_cond);
+	}
+
+	return 0;
+}
+
+// Wait for the backlog to drain below the high-water mark. Give up if the
+// client stops reading for the configured idle time - the reaper won't do it
+// for scan and query connections.
+static int
+send_q_throttle(as_file_handle *fd_h)
+{
+	uint64_t progress_ms = cf_getms();
+	uint64_t prev_sz = fd_h->send_q_sz;
+
+	while (! fd_h->send_failed && fd_h->send_q_sz > PROTO_SEND_Q_HWM) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+		pthread_cond_timedwait(&fd_h->send_cond, &fd_h->send_lock, &ts);
+
+		uint64_t now_ms = cf_getms();
+
+		if (fd_h->send_q_sz < prev_sz) {
+			prev_sz = fd_h->send_q_sz;
+			progress_ms = now_ms;
+		}
+		else if (g_config.proto_fd_idle_ms != 0 &&
+				progress_ms + g_config.proto_fd_idle_ms < now_ms) {
+			cf_info(AS_PROTO, "client fd %d not reading responses for %d ms, dropping connection",
+					fd_h->fd, g_config.proto_fd_idle_ms);
+			send_q_fail(fd_h);
+		}
+	}
+
+	return fd_h->send_failed ? -1 : 0;
+}
+
+int
+as_msg_send_fh_iov(as_file_handle *fd_h, struct iovec *iov, int iovcnt, bool throttle)
+{
+	if (fd_h->fd == 0) {
+		cf_crash(AS_PROTO, "send reply: can't write to fd 0");
+	}
+
+	size_t len = 0;
+
+	for (int i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+	}
+
+	int rv = 0;
+
+	pthread_mutex_lock(&fd_h->send_lock);
+
+	if (fd_h->send_failed) {
+		rv = -1;
+		goto Exit;
+	}
+
+	size_t sent = 0;
+
+	// Only write directly if nothing is queued - responses must stay in order.
+	if (! fd_h->send_q_head) {
+		struct msghdr mh;
+
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = iov;
+		mh.msg_iovlen = iovcnt;
+
+		ssize_t n = sendmsg(fd_h->fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (n > 0) {
+			sent = (size_t)n;
+		}
+		else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+			send_q_fail(fd_h);
+			rv = -1;
+			goto Exit;
+		}
+	}
+
+	if (sent < len) {
+		send_q_append(fd_h, iov, iovcnt, sent);
+
+		// After a short write, make sure the socket has reported EAGAIN so
+		// the demarshal thread gets an EPOLLOUT edge.
+		if (sent != 0 && 0 != send_q_flush(fd_h)) {
+			rv = -1;
+			goto Exit;
+		}
+	}
+
+	if (throttle) {
+		rv = send_q_throttle(fd_h);
+	}
+
+Exit:
+	pthread_mutex_unlock(&fd_h->send_lock);
+
+	return rv;
+}
+
+int
+as_msg_send_fh(as_file_handle *fd_h, const uint8_t *buf, size_t len, bool throttle)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+
+	return as_msg_send_fh_iov(fd_h, &iov, 1, throttle);
+}
+
+// Called by the demarshal thread when epoll reports the socket writable.
+int
+as_msg_send_fh_flush(as_file_handle *fd_h)
+{
+	pthread_mutex_lock(&fd_h->send_lock);
+
+	int rv = fd_h->send_failed ? -1 : send_q_flush(fd_h);
+
+	pthread_mutex_unlock(&fd_h->send_lock);
+
+	return rv;
+}
+
+// Called by the demarshal thread before it reads the next request. Stop reading
+// while the client isn't taking its responses - the EPOLLOUT edge for the
+// backlog brings us back here. No lock, a stale size is just a hint.
+bool
+as_msg_send_fh_recv_paused(as_file_handle *fd_h)
+{
+	uint64_t sz = fd_h->send_q_sz;
+
+	if (! fd_h->recv_paused && sz > PROTO_SEND_Q_HWM) {
+		cf_detail(AS_PROTO, "client fd %d backlog %"PRIu64" - pausing reads", fd_h->fd, sz);
+		fd_h->recv_paused = true;
+	}
+	else if (fd_h->recv_paused && sz <= PROTO_SEND_Q_LWM) {
+		cf_detail(AS_PROTO, "client fd %d backlog %"PRIu64" - resuming reads", fd_h->fd, sz);
+		fd_h->recv_paused = false;
+	}
+
+	return fd_h->recv_paused;
+}
+
+// Connection is going away - drop the backlog and fail current and future
+// senders, including any waiting in send_q_throttle().
+void
+as_msg_send_fh_close(as_file_handle *fd_h)
+{
+	pthread_mutex_lock(&fd_h->send_lock);
+
+	fd_h->send_failed = true;
+	send_q_drop(fd_h);
+	pthread_cond_broadcast(&fd_h->send_cond);
+
+	pthread_mutex_unlock(&fd_h->send_lock);
+}
+
+void
+as_msg_send_fh_destroy(as_file_handle *fd_h)
+{
+	send_q_drop(fd_h);
+	pthread_cond_destroy(&fd_h->send_cond);
+	pthread_mutex_destroy(&fd_h->send_lock);
 }
@@ -44,6 +44,7 @@
 
 #include "base/cfg.h"
 #include "base/datamodel.h"
+#include "base/hot_keys.h"
 #include "base/index.h"
 #include "base/ldt.h"
 #include "base/rec_props.h"
@@ -293,6 +294,8 @@ as_record_done(as_index_ref *r_ref, as_namespace *ns)
 	if (0 != rv)
 		cf_crash(AS_RECORD, "couldn't release lock: %s", cf_strerror(rv));
 
+	as_hot_keys_flush();
+
 	if (0 == as_index_release(r_ref->r)) {
 		// cf_info(AS_RECORD, "index destroy 4 %p %x",r_ref->r,r_ref->r_h);
 		as_record_destroy(r_ref->r, ns);
@@ -1224,6 +1227,8 @@ as_record_merge(as_partition_reservation *rsv, cf_digest *keyd, uint16_t n_compo
 		r->generation = 1;
 	}
 
+	as_partition_expire_index_update(rsv->p, keyd, r->void_time, void_time);
+
 	r->void_time = void_time;
 	r->migrate_mark = 0;
 
@@ -1328,6 +1333,8 @@ as_record_flatten_component(as_partition_reservation *rsv, as_storage_rd *rd,
 		}
 	}
 
+	as_partition_expire_index_update(rsv->p, &rd->keyd, r->void_time, c->void_time);
+
 	r->void_time  = c->void_time;
 	r->generation = c->generation;
 
@@ -44,6 +44,7 @@
 
 #include "ai_globals.h"
 #include "bt_iterator.h"
+#include "stream.h"
 
 #include "base/thr_scan.h"
 #include "base/secondary_index.h"
@@ -318,7 +319,7 @@ as_sindex_pktype_from_sktype(as_sindex_ktype t)
 	switch(t) {
 		case AS_SINDEX_KTYPE_LONG:    return AS_PARTICLE_TYPE_INTEGER;
 		case AS_SINDEX_KTYPE_FLOAT:   return AS_PARTICLE_TYPE_FLOAT;
-		case AS_SINDEX_KTYPE_DIGEST:  return AS_PARTICLE_TYPE_STRING;
+		case AS_SINDEX_KTYPE_STRING:  return AS_PARTICLE_TYPE_STRING;
 		default: cf_crash(AS_SINDEX, "Key type not known");
 	}
 	return AS_SINDEX_ERR_UNKNOWN_KEYTYPE;
@@ -330,7 +331,7 @@ as_sindex_sktype_from_pktype(as_particle_type t)
 	switch(t) {
 		case AS_PARTICLE_TYPE_INTEGER :     return AS_SINDEX_KTYPE_LONG;
 		case AS_PARTICLE_TYPE_FLOAT   :     return AS_SINDEX_KTYPE_FLOAT;
-		case AS_PARTICLE_TYPE_STRING  :     return AS_SINDEX_KTYPE_DIGEST;
+		case AS_PARTICLE_TYPE_STRING  :     return AS_SINDEX_KTYPE_STRING;
 		default                       :     return AS_SINDEX_KTYPE_NONE;
 	}
 	return AS_SINDEX_KTYPE_NONE;
@@ -538,6 +539,7 @@ as_sindex__skey_from_rd(as_sindex_metadata *imd, as_sindex_key *skey,
 
 Cleanup:
 	SINDEX_GUNLOCK();
+	as_sindex_sbin_freeall(skey->b, imd->num_bins);
 	as_sindex__skey_release(skey);
 	return ret;
 }
@@ -548,10 +550,8 @@ as_sindex__skey_from_sbin(as_sindex_key *skey, int idx, as_sindex_bin *sbin)
 	GTRACE(CALLSTACK, debug, "as_sindex__skey_from_sbin");
 	skey->b[idx].id     = sbin->id;
 	skey->b[idx].type   = sbin->type;
-	skey->b[idx].u.i64  = sbin->u.i64;
-	if (sbin->type == AS_PARTICLE_TYPE_STRING) {
-		memcpy(&skey->b[idx].digest, &sbin->digest, AS_DIGEST_KEY_SZ);
-	}
+	// string value stays owned by the sbin, skey only references it
+	skey->b[idx].u      = sbin->u;
 	skey->b[idx].flag   = 0;
 	return AS_SINDEX_OK;
 }
@@ -892,13 +892,13 @@ as_sindex__setup_histogram(as_sindex *si)
 int
 as_sindex__destroy_histogram(as_sindex *si)
 {
-	if (si->stats._write_hist)            cf_free(si->stats._write_hist);
-	if (si->stats._delete_hist)           cf_free(si->stats._delete_hist);
-	if (si->stats._query_hist)            cf_free(si->stats._query_hist);
-	if (si->stats._query_batch_lookup)    cf_free(si->stats._query_batch_lookup);
-	if (si->stats._query_batch_io)        cf_free(si->stats._query_batch_io);
-	if (si->stats._query_rcnt_hist)       cf_free(si->stats._query_rcnt_hist);
-	if (si->stats._query_diff_hist)       cf_free(si->stats._query_diff_hist);
+	if (si->stats._write_hist)            histogram_destroy(si->stats._write_hist);
+	if (si->stats._delete_hist)           histogram_destroy(si->stats._delete_hist);
+	if (si->stats._query_hist)            histogram_destroy(si->stats._query_hist);
+	if (si->stats._query_batch_lookup)    histogram_destroy(si->stats._query_batch_lookup);
+	if (si->stats._query_batch_io)        histogram_destroy(si->stats._query_batch_io);
+	if (si->stats._query_rcnt_hist)       histogram_destroy(si->stats._query_rcnt_hist);
+	if (si->stats._query_diff_hist)       histogram_destroy(si->stats._query_diff_hist);
 	return 0;
 }
 
@@ -1404,6 +1404,7 @@ as_sindex_put_rd(as_sindex *si, as_storage_rd *rd)
 		SINDEX_UNLOCK(&pimd->slock);
 		as_sindex__process_ret(si, ret, AS_SINDEX_OP_INSERT, starttime,
 							    __LINE__);
+		as_sindex_sbin_freeall(skey.b, skey.num_binval);
 		as_sindex__skey_release(&skey);
 	}
 	SINDEX_UNLOCK(&imd->slock);
@@ -1976,6 +1977,21 @@ as_sindex_range_free(as_sindex_range **range)
 	return AS_SINDEX_OK;
 }
 
+/*
+ * Copies a string value into the sbin. The copy is released by
+ * as_sindex_sbin_free(). Null terminated only to ease logging, the value is
+ * binary and compared using its length.
+ */
+static void
+as_sindex__sbin_str_copy(as_sindex_bin *sbin, const void *val, uint32_t len)
+{
+	sbin->u.str.val = cf_malloc(len + 1);
+	memcpy(sbin->u.str.val, val, len);
+	sbin->u.str.val[len] = '\0';
+	sbin->u.str.len = len;
+	sbin->flag |= SINDEX_FLAG_BIN_DOFREE;
+}
+
 /*
  * Extract out range information from the as_msg and create the irange structure
  * if required allocates the memory.
@@ -2154,7 +2170,6 @@ as_sindex_range_from_msg(as_namespace *ns, as_msg *msgp, as_sindex_range *srange
 			data              += sizeof(uint32_t);
 			char* start_binval       = (char *)data;
 			data              += startl;
-			srange->isrange    = FALSE;
 
 			if ((startl <= 0) || (startl >= AS_SINDEX_MAX_STRING_KSIZE)) {
 				cf_warning(AS_SINDEX, "Out of bound query key size %ld", startl);
@@ -2163,15 +2178,26 @@ as_sindex_range_from_msg(as_namespace *ns, as_msg *msgp, as_sindex_range *srange
 			uint32_t endl	   = ntohl(*((uint32_t *)data));
 			data              += sizeof(uint32_t);
 			char * end_binval        = (char *)data;
-			if (startl != endl && strncmp(start_binval, end_binval, startl)) {
+			data              += endl;
+
+			if ((endl <= 0) || (endl >= AS_SINDEX_MAX_STRING_KSIZE)) {
+				cf_warning(AS_SINDEX, "Out of bound query key size %ld", endl);
+				goto Cleanup;
+			}
+			// Strings are ordered bytewise, a prefix query for p is sent
+			// as the range [p, p + 0xff].
+			int cmp = strLenCmp(start_binval, startl, end_binval, endl);
+			if (cmp > 0) {
 				cf_warning(AS_SINDEX,
-                           "Only Equality Query Supported in Strings %s-%s",
-                           start_binval, end_binval);
+                           "Invalid string range %.*s-%.*s",
+                           startl, start_binval, endl, end_binval);
 				goto Cleanup;
 			}
-			cf_digest_compute(start_binval, startl, &(start->digest));
-			GTRACE(QUERY, debug, "Range is equal %s ,%s",
-                               start_binval, end_binval);
+			srange->isrange    = (cmp != 0);
+			as_sindex__sbin_str_copy(start, start_binval, startl);
+			as_sindex__sbin_str_copy(end, end_binval, endl);
+			GTRACE(QUERY, debug, "Range is %.*s - %.*s",
+                               startl, start_binval, endl, end_binval);
 		} else {
 			cf_warning(AS_SINDEX, "Only handle String and Numeric type");
 			goto Cleanup;
@@ -2234,7 +2260,7 @@ as_sindex_sbin_from_op(as_msg_op *op, as_sindex_bin *sbin, int binid)
 			return AS_SINDEX_ERR_PARAM;
 		}
 		sbin->flag |= SINDEX_FLAG_BIN_ISVALID;
-		cf_digest_compute(binval, valsz, &sbin->digest);
+		as_sindex__sbin_str_copy(sbin, binval, valsz);
 	} else if (op->particle_type == AS_PARTICLE_TYPE_INTEGER) {
 		sbin->u.i64 = __cpu_to_be64(
 						*(uint64_t *)as_msg_op_get_value_p(op));
@@ -2306,10 +2332,10 @@ as_sindex_sbin_from_bin(as_namespace *ns, const char *set, as_bin *b, as_sindex_
 				sbin->flag |= SINDEX_FLAG_BIN_ISVALID;
 				byte* bin_val;
 				as_particle_p_get( b, &bin_val, &valsz);
-				// compute the digest for string type index and store 
-				// it in sbin, this digest is store into the sindex tree 
-				// which is a B-Tree.
-				cf_digest_compute(bin_val, valsz, &sbin->digest);
+				// copy the string out of the particle, the sbin is used
+				// after the bin may have been overwritten or freed. The
+				// string itself is the key in the sindex B-Tree.
+				as_sindex__sbin_str_copy(sbin, bin_val, valsz);
 				return AS_SINDEX_OK;
 			}
 			// No index stuff for the non integer non string bins
@@ -2349,6 +2375,11 @@ as_sindex_sbin_from_rd(as_storage_rd *rd, uint16_t from_bin, uint16_t to_bin, as
 int
 as_sindex_sbin_free(as_sindex_bin *sbin)
 {
+	if (sbin->flag & SINDEX_FLAG_BIN_DOFREE) {
+		cf_free(sbin->u.str.val);
+		sbin->u.str.val = NULL;
+		sbin->flag &= ~SINDEX_FLAG_BIN_DOFREE;
+	}
 	if (sbin->flag & SINDEX_FLAG_BIN_ISVALID) {
 		sbin->flag &= ~SINDEX_FLAG_BIN_ISVALID;
 	}
@@ -2489,7 +2520,8 @@ as_sindex_sbin_match(as_sindex_bin *b1, as_sindex_bin *b2)
 	if ((b1->type == AS_PARTICLE_TYPE_INTEGER)
 			&& (b1->u.i64 != b2->u.i64))                    return false;
 	if ((b1->type == AS_PARTICLE_TYPE_STRING)
-			&& (memcmp(&b1->digest, &b2->digest, AS_DIGEST_KEY_SZ)))  return false;
+			&& ((b1->u.str.len != b2->u.str.len)
+				|| memcmp(b1->u.str.val, b2->u.str.val, b1->u.str.len)))  return false;
 
 	return true;
 }
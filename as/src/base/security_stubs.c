@@ -116,31 +116,7 @@ as_security_transact(as_transaction *tr)
 	p_sec_msg->result = AS_SEC_ERR_NOT_SUPPORTED;
 
 	// Send the complete response.
-	uint8_t* p_write = resp;
-	uint8_t* p_end = resp + resp_size;
-	int fd = tr->proto_fd_h->fd;
-
-	while (p_write < p_end) {
-		int rv = send(fd, (void*)p_write, p_end - p_write, MSG_NOSIGNAL);
-
-		if (rv > 0) {
-			p_write += rv;
-		}
-		else if (rv == 0) {
-			cf_warning(AS_SECURITY, "fd %d send returned 0", fd);
-			shutdown(fd, SHUT_RDWR);
-			break;
-		}
-		// rv < 0
-		else if (errno == EAGAIN || errno == EWOULDBLOCK) {
-			usleep(1);
-		}
-		else {
-			cf_warning(AS_SECURITY, "fd %d send failed, errno %d", fd, errno);
-			shutdown(fd, SHUT_RDWR);
-			break;
-		}
-	}
+	as_msg_send_fh(tr->proto_fd_h, resp, resp_size, false);
 
 	tr->proto_fd_h->t_inprogress = false;
 	AS_RELEASE_FILE_HANDLE(tr->proto_fd_h);
@@ -70,21 +70,42 @@ typedef struct {
 	bool get_data;
 } batch_transaction;
 
+// A batch request being processed. The digests are divided into slices, which
+// the owning batch thread and any helper threads claim in turn. Each slice's
+// results are sent to the client as soon as the slice is done.
+typedef struct {
+	batch_transaction btr;
+	uint32_t slice_size;
+	uint32_t n_slices;
+	cf_atomic32 next_slice;		// next slice to be claimed
+	pthread_mutex_t send_lock;	// serializes response chunks on the socket
+	bool send_failed;			// set under send_lock
+	pthread_mutex_t done_lock;
+	pthread_cond_t done_cond;
+	uint32_t n_slices_done;		// protected by done_lock
+} batch_job;
+
+// Slices smaller than this aren't worth handing to a helper thread.
+#define BATCH_MIN_SLICE_SIZE 16
+// Results are sent to the client at least every this many digests.
+#define BATCH_MAX_SLICE_SIZE 128
+
 static pthread_t g_batch_threads[MAX_BATCH_THREADS];
 static cf_queue* g_batch_queue = 0;
+static pthread_t g_batch_helper_threads[MAX_BATCH_HELPER_THREADS];
+static cf_queue* g_batch_helper_queue = 0;
 static cf_atomic32 g_batch_init = 0;
 
 
-// Build response to batch request.
+// Build response for digests [start, end) of batch request.
 static void
-batch_build_response(batch_transaction* btr, cf_buf_builder** bb_r)
+batch_build_response(batch_transaction* btr, int start, int end, cf_buf_builder** bb_r)
 {
 	as_namespace* ns = btr->ns;
 	batch_digests *bmds = btr->digests;
 	bool get_data = btr->get_data;
-	uint32_t yield_count = 0;
 
-	for (int i = 0; i < bmds->n_digests; i++)
+	for (int i = start; i < end; i++)
 	{
 		batch_digest *bmd = &bmds->digest[i];
 
@@ -166,44 +187,14 @@ batch_build_response(batch_transaction* btr, cf_buf_builder** bb_r)
 					cf_debug(AS_BATCH, "other_node is NULL.");
 				}
 			}
-
-			yield_count++;
-			if (yield_count % g_config.batch_priority == 0) {
-				usleep(1);
-			}
-		}
-	}
-}
-
-
-// Send response to client socket.
-static int
-batch_send(int fd, uint8_t* buf, size_t len, int flags)
-{
-	int rv;
-	int pos = 0;
-
-	while (pos < len) {
-		rv = send(fd, buf + pos, len - pos, flags);
-
-		if (rv <= 0) {
-			if (errno != EAGAIN) {
-				cf_info(AS_BATCH, "batch send response error returned %d errno %d fd %d", rv, errno, fd);
-				return -1;
-			}
-		}
-		else {
-			pos += rv;
 		}
 	}
-
-	return 0;
 }
 
 
-// Send protocol header to the requesting client.
+// Send a proto message to the requesting client - header, then body.
 static int
-batch_send_header(int fd, size_t len)
+batch_send(as_file_handle* fd_h, uint8_t* buf, size_t len)
 {
 	as_proto proto;
 	proto.version = PROTO_VERSION;
@@ -211,13 +202,26 @@ batch_send_header(int fd, size_t len)
 	proto.sz = len;
 	as_proto_swap(&proto);
 
-	return batch_send(fd, (uint8_t*) &proto, 8, MSG_NOSIGNAL | MSG_MORE);
+	struct iovec iov[2];
+	iov[0].iov_base = &proto;
+	iov[0].iov_len = sizeof(as_proto);
+	iov[1].iov_base = buf;
+	iov[1].iov_len = len;
+
+	// Throttle - a slow client holds back the batch rather than have its
+	// whole response queued in memory.
+	if (as_msg_send_fh_iov(fd_h, iov, 2, true) != 0) {
+		cf_info(AS_BATCH, "batch send response error fd %d", fd_h->fd);
+		return -1;
+	}
+
+	return 0;
 }
 
 
 // Send protocol trailer to the requesting client.
 static int
-batch_send_final(int fd, uint32_t result_code)
+batch_send_final(as_file_handle* fd_h, uint32_t result_code)
 {
 	cl_msg m;
 	m.proto.version = PROTO_VERSION;
@@ -237,7 +241,7 @@ batch_send_final(int fd, uint32_t result_code)
 	m.msg.n_ops = 0;
 	as_msg_swap_header(&m.msg);
 
-	return batch_send(fd, (uint8_t*) &m, sizeof(m), MSG_NOSIGNAL);
+	return as_msg_send_fh(fd_h, (uint8_t*) &m, sizeof(m), false);
 }
 
 
@@ -262,6 +266,76 @@ batch_transaction_done(batch_transaction* btr)
 }
 
 
+// Release reference to batch job, destroying it if it's the last.
+static void
+batch_job_release(batch_job* job)
+{
+	if (cf_rc_release(job) == 0) {
+		batch_transaction_done(&job->btr);
+		pthread_mutex_destroy(&job->send_lock);
+		pthread_mutex_destroy(&job->done_lock);
+		pthread_cond_destroy(&job->done_cond);
+		cf_rc_free(job);
+	}
+}
+
+
+// Send a slice's results to the client as one proto message.
+static void
+batch_job_send_chunk(batch_job* job, cf_buf_builder* bb)
+{
+	pthread_mutex_lock(&job->send_lock);
+
+	if (! job->send_failed) {
+		// Keep the reaper at bay.
+		job->btr.fd_h->last_used = cf_getms();
+
+		if (batch_send(job->btr.fd_h, bb->buf, bb->used_sz) != 0) {
+			job->send_failed = true;
+		}
+	}
+
+	pthread_mutex_unlock(&job->send_lock);
+}
+
+
+// Claim and process slices until there are none left. Called by the owning
+// batch thread and by helper threads.
+static void
+batch_job_run_slices(batch_job* job)
+{
+	uint32_t slice;
+
+	while ((slice = cf_atomic32_incr(&job->next_slice) - 1) < job->n_slices) {
+		// No point doing the work if the client is gone.
+		if (! job->send_failed) {
+			int start = (int)(slice * job->slice_size);
+			int end = start + (int)job->slice_size;
+
+			if (end > job->btr.digests->n_digests) {
+				end = job->btr.digests->n_digests;
+			}
+
+			cf_buf_builder* bb = 0;
+			batch_build_response(&job->btr, start, end, &bb);
+
+			if (bb) {
+				batch_job_send_chunk(job, bb);
+				cf_buf_builder_free(bb);
+			}
+		}
+
+		pthread_mutex_lock(&job->done_lock);
+
+		if (++job->n_slices_done == job->n_slices) {
+			pthread_cond_signal(&job->done_cond);
+		}
+
+		pthread_mutex_unlock(&job->done_lock);
+	}
+}
+
+
 // Process a batch request.
 static void
 batch_process_request(batch_transaction* btr)
@@ -269,29 +343,97 @@ batch_process_request(batch_transaction* btr)
 	// Keep the reaper at bay.
 	btr->fd_h->last_used = cf_getms();
 
-	cf_buf_builder* bb = 0;
-	batch_build_response(btr, &bb);
+	if (btr->digests->n_digests == 0) {
+		cf_info(AS_BATCH, " batch request: returned no local responses");
+		batch_send_final(btr->fd_h, 0);
+		batch_transaction_done(btr);
+		return;
+	}
+
+	batch_job* job = cf_rc_alloc(sizeof(batch_job));
 
-	int fd = btr->fd_h->fd;
+	if (! job) {
+		cf_warning(AS_BATCH, "Failed to allocate batch job.");
+		batch_transaction_done(btr);
+		return;
+	}
 
-	if (bb) {
-		int brv = batch_send_header(fd, bb->used_sz);
+	job->btr = *btr;
+	cf_atomic32_set(&job->next_slice, 0);
+	pthread_mutex_init(&job->send_lock, NULL);
+	job->send_failed = false;
+	pthread_mutex_init(&job->done_lock, NULL);
+	pthread_cond_init(&job->done_cond, NULL);
+	job->n_slices_done = 0;
 
-		if (brv == 0) {
-			brv = batch_send(fd, bb->buf, bb->used_sz, MSG_NOSIGNAL | MSG_MORE);
+	uint32_t n_digests = (uint32_t)btr->digests->n_digests;
+	uint32_t n_helpers = 0;
 
-			if (brv == 0) {
-				brv = batch_send_final(fd, 0);
-			}
-		}
-		cf_buf_builder_free(bb);
+	// Only reads that go to device benefit from being spread across threads.
+	if (btr->get_data && ! btr->ns->storage_data_in_memory) {
+		n_helpers = (uint32_t)g_config.n_batch_helper_threads;
 	}
-	else {
-		cf_info(AS_BATCH, " batch request: returned no local responses");
-		batch_send_final(fd, 0);
+
+	// Aim for a couple of slices per thread so threads finish together.
+	uint32_t n_threads = n_helpers + 1;
+	uint32_t slice_size = (n_digests + (2 * n_threads) - 1) / (2 * n_threads);
+
+	if (slice_size < BATCH_MIN_SLICE_SIZE) {
+		slice_size = BATCH_MIN_SLICE_SIZE;
+	}
+	else if (slice_size > BATCH_MAX_SLICE_SIZE) {
+		slice_size = BATCH_MAX_SLICE_SIZE;
+	}
+
+	job->slice_size = slice_size;
+	job->n_slices = (n_digests + slice_size - 1) / slice_size;
+
+	if (n_helpers > job->n_slices - 1) {
+		n_helpers = job->n_slices - 1;
 	}
 
-	batch_transaction_done(btr);
+	// Helpers that start after all slices are claimed just drop the job.
+	for (uint32_t i = 0; i < n_helpers; i++) {
+		cf_rc_reserve(job);
+		cf_queue_push(g_batch_helper_queue, &job);
+	}
+
+	batch_job_run_slices(job);
+
+	// Only slices being processed by helpers can still be outstanding.
+	pthread_mutex_lock(&job->done_lock);
+
+	while (job->n_slices_done < job->n_slices) {
+		pthread_cond_wait(&job->done_cond, &job->done_lock);
+	}
+
+	pthread_mutex_unlock(&job->done_lock);
+
+	if (! job->send_failed) {
+		batch_send_final(job->btr.fd_h, 0);
+	}
+
+	batch_job_release(job);
+}
+
+
+// Help batch threads process slices of large requests.
+void*
+batch_help_queue(void* q_to_wait_on)
+{
+	cf_queue* helper_queue = (cf_queue*)q_to_wait_on;
+	batch_job* job;
+
+	while (1) {
+		if (cf_queue_pop(helper_queue, &job, CF_QUEUE_FOREVER) != 0) {
+			cf_crash(AS_BATCH, "Failed to pop from batch helper queue.");
+		}
+
+		batch_job_run_slices(job);
+		batch_job_release(job);
+	}
+
+	return 0;
 }
 
 
@@ -310,7 +452,7 @@ batch_process_queue(void* q_to_wait_on)
 
 		// Check for timeouts.
 		if (btr.end_time != 0 && cf_getns() > btr.end_time) {
-			cf_atomic_int_incr(&g_config.batch_timeout);
+			cf_shard_counter_incr(&g_config.batch_timeout);
 
 			if (btr.fd_h) {
 				as_msg_send_reply(btr.fd_h, AS_PROTO_RESULT_FAIL_TIMEOUT,
@@ -346,6 +488,13 @@ as_batch_init()
 	for (int i = 0; i < max; i++) {
 		pthread_create(&g_batch_threads[i], 0, batch_process_queue, (void*)g_batch_queue);
 	}
+
+	cf_info(AS_BATCH, "Initialize %d batch helper threads.", g_config.n_batch_helper_threads);
+	g_batch_helper_queue = cf_queue_create(sizeof(batch_job*), true);
+
+	for (int i = 0; i < g_config.n_batch_helper_threads; i++) {
+		pthread_create(&g_batch_helper_threads[i], 0, batch_help_queue, (void*)g_batch_helper_queue);
+	}
 }
 
 // Create bin name list from message.
@@ -430,7 +579,7 @@ as_batch(as_transaction* tr)
 	tr->proto_fd_h = 0;
 	btr.fd_h->last_used = cf_getms();
 
-	cf_atomic_int_incr(&g_config.batch_initiate);
+	cf_shard_counter_incr(&g_config.batch_initiate);
 	cf_queue_push(g_batch_queue, &btr);
 	return 0;
 }
@@ -27,7 +27,6 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <sys/epoll.h>
-#include <sys/ioctl.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
 
@@ -55,6 +54,10 @@
 
 
 #define EPOLL_SZ	1024
+
+// Per-connection receive buffer - big enough for typical requests, which are
+// then demarshaled without any further reads or copies.
+#define DEMARSHAL_RECV_BUF_SZ	(4 * 1024)
 // Workaround for platforms that don't have EPOLLRDHUP yet.
 #ifndef EPOLLRDHUP
 #define EPOLLRDHUP EPOLLHUP
@@ -65,7 +68,9 @@ extern void *thr_demarshal(void *arg);
 
 typedef struct {
 	unsigned int	epoll_fd[MAX_DEMARSHAL_THREADS];
+	int				listen_fd[MAX_DEMARSHAL_THREADS]; // -1 if thread doesn't accept
 	unsigned int	num_threads;
+	unsigned int	num_acceptors;
 	pthread_t	dm_th[MAX_DEMARSHAL_THREADS];
 } demarshal_args;
 
@@ -82,7 +87,33 @@ uint			g_file_handle_a_sz;
 pthread_t		g_demarshal_reaper_th;
 
 void *thr_demarshal_reaper_fn(void *arg);
-static cf_queue *g_freeslot = 0;
+
+// Free slots in the file handle table, one queue per accepting thread. Slot i
+// belongs to queue i % g_num_freeslot_q, so an accepting thread can claim a
+// slot and fill it in without taking g_file_handle_a_LOCK.
+static cf_queue *g_freeslot[MAX_DEMARSHAL_THREADS];
+static uint g_num_freeslot_q = 0;
+
+static inline void
+demarshal_free_slot(int i)
+{
+	cf_queue_push(g_freeslot[i % g_num_freeslot_q], &i);
+}
+
+// Claim a free slot, preferring the accepting thread's own queue.
+static bool
+demarshal_claim_slot(int thr_id, int *p_slot)
+{
+	for (uint n = 0; n < g_num_freeslot_q; n++) {
+		uint q = (thr_id + n) % g_num_freeslot_q;
+
+		if (0 == cf_queue_pop(g_freeslot[q], p_slot, CF_QUEUE_NOWAIT)) {
+			return true;
+		}
+	}
+
+	return false;
+}
 
 void
 demarshal_file_handle_init()
@@ -102,7 +133,7 @@ demarshal_file_handle_init()
 		g_file_handle_a_sz = rl.rlim_cur;
 
 		for (int i = 0; i < g_file_handle_a_sz; i++) {
-			cf_queue_push(g_freeslot, &i);
+			demarshal_free_slot(i);
 		}
 
 		pthread_create(&g_demarshal_reaper_th, 0, thr_demarshal_reaper_fn, 0);
@@ -150,7 +181,7 @@ thr_demarshal_reaper_fn(void *arg)
 				// Reap if not obviously in use.
 				if (fd_h->inuse == false) {
 					g_file_handle_a[i] = 0;
-					cf_queue_push(g_freeslot, &i);
+					demarshal_free_slot(i);
 					AS_RELEASE_FILE_HANDLE(fd_h);
 				}
 				// Reap if past kill time.
@@ -164,7 +195,7 @@ thr_demarshal_reaper_fn(void *arg)
 					shutdown(fd_h->fd, SHUT_RDWR); // will trigger epoll errors
 					cf_debug(AS_DEMARSHAL, "remove unused connection, fd %d", fd_h->fd);
 					g_file_handle_a[i] = 0;
-					cf_queue_push(g_freeslot, &i);
+					demarshal_free_slot(i);
 					AS_RELEASE_FILE_HANDLE(fd_h);
 					cf_atomic_int_incr(&g_config.reaper_count);
 				}
@@ -195,17 +226,63 @@ thr_demarshal_reaper_fn(void *arg)
 }
 
 
+#ifdef USE_JEM
+// Find the namespace field of an AS_MSG and return its JEMalloc arena, or -1 if
+// the namespace isn't in the bytes we have.
+static int
+demarshal_get_arena(const uint8_t *buf, size_t buf_sz)
+{
+	if (buf_sz < sizeof(as_msg)) {
+		return -1;
+	}
+
+	uint16_t n_fields = ntohs(((as_msg *)buf)->n_fields);
+	size_t offset = sizeof(as_msg);
+
+	for (uint16_t field_num = 0; field_num < n_fields; field_num++) {
+		if (offset + sizeof(as_msg_field) > buf_sz) {
+			break;
+		}
+
+		as_msg_field *field = (as_msg_field *)(buf + offset);
+		uint32_t field_sz = ntohl(field->field_sz);
+
+		if (AS_MSG_FIELD_TYPE_NAMESPACE == field->type) {
+			if (field_sz == 0 || field_sz >= AS_ID_NAMESPACE_SZ ||
+					offset + sizeof(as_msg_field) - 1 + field_sz > buf_sz) {
+				cf_warning(AS_DEMARSHAL, "bad namespace field (%u) in as_msg", field_sz);
+				break;
+			}
+
+			char ns[AS_ID_NAMESPACE_SZ];
+			size_t field_sz_minus_1 = field_sz - 1;
+
+			memcpy(ns, field->data, field_sz_minus_1);
+			ns[field_sz_minus_1] = '\0';
+
+			return as_namespace_get_jem_arena(ns);
+		}
+
+		offset += field_sz + sizeof(as_msg_field) - 1;
+	}
+
+	cf_warning(AS_DEMARSHAL, "Can't get namespace from AS_MSG ~~ Using default thr_demarshal arena.");
+	return -1;
+}
+#endif
+
 // Set of threads which talk to client over the connection for doing the needful
 // processing. Note that once fd is assigned to a thread all the work on that fd
-// is done by that thread. Fair fd usage is expected of the client. First thread
-// is special - also does accept [listens for new connections]. It is the only
-// thread which does it.
+// is done by that thread. Fair fd usage is expected of the client. Threads that
+// have a listening socket also accept new connections - with SO_REUSEPORT every
+// thread has its own socket and keeps the connections it accepts, otherwise the
+// first thread is the only acceptor and deals connections out round-robin.
 void *
 thr_demarshal(void *arg)
 {
 	cf_socket_cfg *s;
 	// Create my epoll fd, register in the global list.
-	static struct epoll_event ev;
+	struct epoll_event ev;
 	int nevents, i, n, epoll_fd;
 	cf_clock last_fd_print = 0;
 
@@ -235,23 +312,28 @@ thr_demarshal(void *arg)
 		return(0);
 	}
 
-	// First thread accepts new connection at interface socket.
-	if (thr_id == 0) {
+	// Accepting threads listen for new connections at interface socket.
+	int listen_fd = g_demarshal_args->listen_fd[thr_id];
+
+	// Every acceptor needs the file handle table - first one in creates it.
+	if (listen_fd != -1) {
 		demarshal_file_handle_init();
-		epoll_fd = epoll_create(EPOLL_SZ);
-		if (epoll_fd == -1)
-			cf_crash(AS_DEMARSHAL, "epoll_create(): %s", cf_strerror(errno));
+	}
+
+	epoll_fd = epoll_create(EPOLL_SZ);
+	if (epoll_fd == -1)
+		cf_crash(AS_DEMARSHAL, "epoll_create(): %s", cf_strerror(errno));
 
+	if (listen_fd != -1) {
+		memset(&ev, 0, sizeof(ev));
 		ev.events = EPOLLIN | EPOLLERR | EPOLLHUP;
-		ev.data.fd = s->sock;
-		if (0 > epoll_ctl(epoll_fd, EPOLL_CTL_ADD, s->sock, &ev))
+		ev.data.fd = listen_fd;
+		if (0 > epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev))
 			cf_crash(AS_DEMARSHAL, "epoll_ctl(): %s", cf_strerror(errno));
-		cf_info(AS_DEMARSHAL, "Service started: socket %d", s->port);
-	}
-	else {
-		epoll_fd = epoll_create(EPOLL_SZ);
-		if (epoll_fd == -1)
-			cf_crash(AS_DEMARSHAL, "epoll_create(): %s", cf_strerror(errno));
+
+		if (thr_id == 0) {
+			cf_info(AS_DEMARSHAL, "Service started: socket %d", s->port);
+		}
 	}
 
 	g_demarshal_args->epoll_fd[thr_id] = epoll_fd;
@@ -279,7 +361,7 @@ thr_demarshal(void *arg)
 		// Iterate over all events.
 		for (i = 0; i < nevents; i++) {
 
-			if (s->sock == events[i].data.fd) {
+			if (listen_fd != -1 && listen_fd == events[i].data.fd) {
 
 				// Accept new connections on the service socket.
 				int csocket = -1;
@@ -287,7 +369,11 @@ thr_demarshal(void *arg)
 				socklen_t clen = sizeof(caddr);
 				char cpaddr[24];
 
-				if (-1 == (csocket = accept(s->sock, (struct sockaddr *)&caddr, &clen))) {
+				if (-1 == (csocket = accept(listen_fd, (struct sockaddr *)&caddr, &clen))) {
+					// Another thread sharing the port may have taken it.
+					if (errno == EAGAIN || errno == EWOULDBLOCK) {
+						continue;
+					}
 					// This means we're out of file descriptors - could be a SYN
 					// flood attack or misbehaving client. Eventually we'd like
 					// to make the reaper fairer, but for now we'll just have to
@@ -344,8 +430,12 @@ thr_demarshal(void *arg)
 				fd_h->t_inprogress = false;
 				fd_h->proto = 0;
 				fd_h->proto_unread = 0;
+				fd_h->recv_buf = 0;
+				fd_h->recv_start = 0;
+				fd_h->recv_end = 0;
 				fd_h->fh_info = 0;
 				fd_h->security_filter = as_security_filter_create();
+				as_msg_send_fh_init(fd_h);
 
 				// Insert into the global table so the reaper can manage it. Do
 				// this before queueing it up for demarshal threads - once
@@ -353,20 +443,17 @@ thr_demarshal(void *arg)
 				// into global table fails) because fd state could be anything.
 				cf_rc_reserve(fd_h);
 
-				pthread_mutex_lock(&g_file_handle_a_LOCK);
-
+				// A claimed slot is ours alone until the reaper empties it, so
+				// no lock is needed - just make sure the reaper can't see the
+				// handle before it's initialized.
 				int j;
-				bool inserted = true;
+				bool inserted = demarshal_claim_slot(thr_id, &j);
 
-				if (0 != cf_queue_pop(g_freeslot, &j, CF_QUEUE_NOWAIT)) {
-					inserted = false;
-				}
-				else {
+				if (inserted) {
+					smb_mb();
 					g_file_handle_a[j] = fd_h;
 				}
 
-				pthread_mutex_unlock(&g_file_handle_a_LOCK);
-
 				if (!inserted) {
 					cf_info(AS_DEMARSHAL, "unable to add socket to file handle table");
 					shutdown(csocket, SHUT_RDWR);
@@ -377,13 +464,17 @@ thr_demarshal(void *arg)
 				else {
 					// Place the client socket in the event queue.
 					memset(&ev, 0, sizeof(ev));
-					ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP ;
+					// EPOLLOUT is edge-triggered too - it only fires once a
+					// socket that filled up has room again, to flush queued
+					// responses.
+					ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP ;
 					ev.data.ptr = fd_h;
 
-					// Round-robin pick up demarshal thread epoll_fd and add
+					// If every thread accepts, keep the connection. Otherwise
+					// round-robin pick up demarshal thread epoll_fd and add
 					// this new connection to epoll.
-					int id;
-					while (true) {
+					int id = thr_id;
+					while (g_demarshal_args->num_acceptors == 1) {
 						id = (id_cntr++) % g_demarshal_args->num_threads;
 						if (g_demarshal_args->epoll_fd[id] != 0) {
 							break;
@@ -411,11 +502,13 @@ thr_demarshal(void *arg)
 					goto NextEvent;
 				}
 
-				// Process data on an existing connection: this might be more
-				// activity on an already existing transaction, so we have some
-				// state to manage.
+				// Process data on an existing connection. Read as much as the
+				// socket has into the connection's receive buffer, and
+				// demarshal every complete message in it - the connection is
+				// edge-triggered, so we must leave the socket drained.
 				as_proto *proto_p = 0;
 				int fd = fd_h->fd;
+				bool drained = false;
 
 				if (events[i].events & (EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
 					cf_detail(AS_DEMARSHAL, "proto socket: remote close: fd %d event %x", fd, events[i].events);
@@ -423,161 +516,199 @@ thr_demarshal(void *arg)
 					goto NextEvent_FD_Cleanup;
 				}
 
-				// If pointer is NULL, then we need to create a transaction and
-				// store it in the buffer.
-				if (fd_h->proto == NULL) {
-					as_proto proto;
-					int sz;
+				// Write out responses the client wasn't ready for. Every
+				// event on a writable socket carries EPOLLOUT, but with
+				// nothing queued this is just an uncontended lock.
+				if (events[i].events & EPOLLOUT) {
+					bool was_paused = fd_h->recv_paused;
 
-					if (fd_h->t_inprogress) {
-						cf_debug(AS_DEMARSHAL, "receiving pipelined request");
-					}
-
-					/* Get the number of available bytes */
-					if (-1 == ioctl(fd, FIONREAD, &sz)) {
-						cf_info(AS_DEMARSHAL, "unable to get number of available bytes");
+					if (0 != as_msg_send_fh_flush(fd_h)) {
 						goto NextEvent_FD_Cleanup;
 					}
 
-					// If we don't have enough data to fill the message buffer,
-					// just wait and we'll come back to this one. However, we'll
-					// let messages with zero size through, since they are
-					// likely errors. We don't cleanup the FD in this case since
-					// we'll get more data on it.
-					if (sz < sizeof(as_proto) && sz != 0) {
+					// If reads were paused, requests may be waiting in the
+					// socket or receive buffer with no EPOLLIN edge to come.
+					if (! (events[i].events & EPOLLIN) && ! was_paused) {
 						goto NextEvent;
 					}
+				}
 
-					// Do a preliminary read of the header into a stack-
-					// allocated structure, so that later on we can allocate the
-					// entire message buffer.
-					if (0 >= (n = cf_socket_recv(fd, &proto, sizeof(as_proto), MSG_WAITALL))) {
-						cf_detail(AS_DEMARSHAL, "proto socket: read header fail: error: rv %d sz was %d errno %d", n, sz, errno);
-						goto NextEvent_FD_Cleanup;
+				while (true) {
+					// The client isn't reading its responses - don't take on
+					// more work for it. Leaving the socket undrained is fine,
+					// the EPOLLOUT edge for the backlog resumes reading.
+					if (as_msg_send_fh_recv_paused(fd_h)) {
+						goto NextEvent;
 					}
 
-					// Swap the necessary elements of the as_proto.
-					as_proto_swap(&proto);
-
-					if (proto.sz > PROTO_SIZE_MAX) {
-						struct sockaddr_in addr_in;
-						socklen_t addr_len = sizeof(addr_in);
-
-						char some_addr[24];
-						some_addr[0] = 0;
-
-						// Try to get the client details for better logging.
-						// Otherwise, fall back to generic log message.
-						if (getpeername(fd, (struct sockaddr*)&addr_in, &addr_len) == 0
-								&& inet_ntop(AF_INET, &addr_in.sin_addr.s_addr, (char *)some_addr, sizeof(some_addr)) != NULL) {
-							cf_warning(AS_DEMARSHAL, "proto input from %s:%d: msg greater than %d, likely request from non-Aerospike client, rejecting: sz %"PRIu64,
-									some_addr, ntohs(addr_in.sin_port), PROTO_SIZE_MAX, proto.sz);
-						} else {
-							cf_warning(AS_DEMARSHAL, "proto input: msg greater than %d, likely request from non-Aerospike client, rejecting: sz %"PRIu64,
-									PROTO_SIZE_MAX, proto.sz);
+					if (fd_h->proto) {
+						// A message too big for the receive buffer is read
+						// straight into its own buffer.
+						proto_p = fd_h->proto;
+						fd_h->proto = 0;
+
+						errno = 0;
+						n = cf_socket_recv(fd, proto_p->data + (proto_p->sz - fd_h->proto_unread), fd_h->proto_unread, 0);
+						if (0 >= n) {
+							if (errno == EAGAIN) {
+								fd_h->proto = proto_p;
+								proto_p = 0;
+								goto NextEvent;
+							}
+							cf_info(AS_DEMARSHAL, "receive socket: fail? n %d errno %d %s closing connection.", n, errno, cf_strerror(errno));
+							goto NextEvent_FD_Cleanup;
 						}
-						goto NextEvent_FD_Cleanup;
-					}
 
-#ifdef USE_JEM
-					// Attempt to peek the namespace and set the JEMalloc arena accordingly.
-					size_t peeked_data_sz = 0;
-					size_t min_field_sz = sizeof(uint32_t) + sizeof(char);
-					size_t min_as_msg_sz = sizeof(as_msg) + min_field_sz;
-					size_t peekbuf_sz = 2048; // (Arbitrary "large enough" size for peeking the fields of "most" AS_MSGs.)
-					uint8_t peekbuf[peekbuf_sz];
-					if (PROTO_TYPE_AS_MSG == proto.type) {
-						bool found = false;
-						size_t offset = sizeof(as_msg);
-						if (!(peeked_data_sz = cf_socket_recv(fd, peekbuf, peekbuf_sz, 0))) {
-							cf_warning(AS_DEMARSHAL, "could not peek the as_msg header");
-						} else if (peeked_data_sz > min_as_msg_sz) {
-//							cf_debug(AS_DEMARSHAL, "(Peeked %zu bytes.)", peeked_data_sz);
-							uint16_t n_fields = ntohs(((as_msg *) peekbuf)->n_fields), field_num = 0;
-//							cf_debug(AS_DEMARSHAL, "Found %d AS_MSG fields", n_fields);
-							while (!found && (field_num < n_fields)) {
-								as_msg_field *field = (as_msg_field *) (&peekbuf[offset]);
-								uint32_t field_sz = ntohl(field->field_sz);
-//								cf_debug(AS_DEMARSHAL, "Field #%d offset: %lu", field_num, offset);
-//								cf_debug(AS_DEMARSHAL, "\tfield_sz %u", field_sz);
-//								cf_debug(AS_DEMARSHAL, "\ttype %d", field->type);
-								if (AS_MSG_FIELD_TYPE_NAMESPACE == field->type) {
-									if (field_sz >= AS_ID_NAMESPACE_SZ) {
-										cf_warning(AS_DEMARSHAL, "namespace too long (%u) in as_msg", field_sz);
-										break;
-									}
-									char ns[AS_ID_NAMESPACE_SZ];
-									found = true;
-									size_t field_sz_minus_1 = field_sz - 1;
-									memcpy(ns, field->data, field_sz_minus_1);
-									ns[field_sz_minus_1] = '\0';
-//									cf_debug(AS_DEMARSHAL, "Found ns \"%s\" in field #%d.", ns, field_num);
-									jem_set_arena(as_namespace_get_jem_arena(ns));
+						// Decrement bytes-unread counter.
+						cf_detail(AS_DEMARSHAL, "read fd %d (%d %"PRIu64")", fd, n, fd_h->proto_unread);
+						fd_h->proto_unread -= n;
+
+						// A short read means the socket is drained.
+						if (fd_h->proto_unread != 0) {
+							fd_h->proto = proto_p;
+							proto_p = 0;
+							goto NextEvent;
+						}
+					}
+					else {
+						uint32_t avail = fd_h->recv_end - fd_h->recv_start;
+						uint8_t *msg = fd_h->recv_buf + fd_h->recv_start;
+						as_proto proto;
+						size_t total_sz = 0;
+
+						if (avail >= sizeof(as_proto)) {
+							// Swap a copy - the header in the buffer may not be
+							// aligned.
+							memcpy(&proto, msg, sizeof(as_proto));
+							as_proto_swap(&proto);
+
+							if (proto.sz > PROTO_SIZE_MAX) {
+								struct sockaddr_in addr_in;
+								socklen_t addr_len = sizeof(addr_in);
+
+								char some_addr[24];
+								some_addr[0] = 0;
+
+								// Try to get the client details for better
+								// logging. Otherwise, fall back to generic log
+								// message.
+								if (getpeername(fd, (struct sockaddr*)&addr_in, &addr_len) == 0
+										&& inet_ntop(AF_INET, &addr_in.sin_addr.s_addr, (char *)some_addr, sizeof(some_addr)) != NULL) {
+									cf_warning(AS_DEMARSHAL, "proto input from %s:%d: msg greater than %d, likely request from non-Aerospike client, rejecting: sz %"PRIu64,
+											some_addr, ntohs(addr_in.sin_port), PROTO_SIZE_MAX, proto.sz);
 								} else {
-//									cf_debug(AS_DEMARSHAL, "Message field %d is not namespace (type %d) ~~ Reading next field", field_num, field->type);
-									field_num++;
-									offset += field_sz + sizeof(as_msg_field) - 1;
-									if (offset >= peekbuf_sz) {
-										break;
-									}
+									cf_warning(AS_DEMARSHAL, "proto input: msg greater than %d, likely request from non-Aerospike client, rejecting: sz %"PRIu64,
+											PROTO_SIZE_MAX, proto.sz);
 								}
+								goto NextEvent_FD_Cleanup;
 							}
+
+							total_sz = sizeof(as_proto) + proto.sz;
 						}
-						if (!found) {
-							cf_warning(AS_DEMARSHAL, "Can't get namespace from AS_MSG (peeked %zu bytes) ~~ Using default thr_demarshal arena.", peeked_data_sz);
-							jem_set_arena(orig_arena);
+
+						// Read more if we don't have a whole message, and it
+						// would fit in the receive buffer.
+						if (total_sz == 0 || (avail < total_sz && total_sz <= DEMARSHAL_RECV_BUF_SZ)) {
+							if (drained) {
+								goto NextEvent;
+							}
+
+							if (! fd_h->recv_buf) {
+								fd_h->recv_buf = cf_malloc(DEMARSHAL_RECV_BUF_SZ);
+								cf_assert(fd_h->recv_buf, AS_DEMARSHAL, CF_CRITICAL, "allocation: %d %s", DEMARSHAL_RECV_BUF_SZ, cf_strerror(errno));
+							}
+							else if (fd_h->recv_start != 0) {
+								// Move the partial message to the front.
+								memmove(fd_h->recv_buf, msg, avail);
+							}
+
+							fd_h->recv_start = 0;
+							fd_h->recv_end = avail;
+
+							uint32_t space = DEMARSHAL_RECV_BUF_SZ - avail;
+
+							errno = 0;
+							n = cf_socket_recv(fd, fd_h->recv_buf + avail, space, 0);
+							if (0 >= n) {
+								if (errno == EAGAIN) {
+									goto NextEvent;
+								}
+								cf_detail(AS_DEMARSHAL, "proto socket: read fail: rv %d errno %d", n, errno);
+								goto NextEvent_FD_Cleanup;
+							}
+
+							fd_h->recv_end += n;
+
+							// A short read means the socket is drained.
+							drained = (uint32_t)n < space;
+							continue;
 						}
-					} else {
-//						cf_debug(AS_DEMARSHAL, "Non-AS_MSG ~~ Using default thr_demarshal arena.");
-						jem_set_arena(orig_arena);
-					}
-#endif
 
-					// Allocate the complete message buffer.
-					proto_p = cf_malloc(sizeof(as_proto) + proto.sz);
-					cf_assert(proto_p, AS_DEMARSHAL, CF_CRITICAL, "allocation: %zu %s", (sizeof(as_proto) + proto.sz), cf_strerror(errno));
-					memcpy(proto_p, &proto, sizeof(as_proto));
+						if (fd_h->t_inprogress) {
+							cf_debug(AS_DEMARSHAL, "receiving pipelined request");
+						}
 
 #ifdef USE_JEM
-					// Jam in the peeked data.
-					if (peeked_data_sz) {
-						memcpy(proto_p->data, &peekbuf, peeked_data_sz);
-					}
-					fd_h->proto_unread = proto_p->sz - peeked_data_sz;
-#else
-					fd_h->proto_unread = proto_p->sz;
-#endif
-					fd_h->proto = (void *) proto_p;
-				}
-				else {
-					proto_p = fd_h->proto;
-				}
+						// Set the JEMalloc arena according to the namespace.
+						if (PROTO_TYPE_AS_MSG == proto.type) {
+							int arena = demarshal_get_arena(msg + sizeof(as_proto), avail - sizeof(as_proto));
 
-				if (fd_h->proto_unread > 0) {
+							jem_set_arena(arena >= 0 ? arena : orig_arena);
+						}
+						else {
+							jem_set_arena(orig_arena);
+						}
+#endif
 
-					// Read the data.
-					n = cf_socket_recv(fd, proto_p->data + (proto_p->sz - fd_h->proto_unread), fd_h->proto_unread, 0);
-					if (0 >= n) {
-						if (errno == EAGAIN) {
+						if (avail < total_sz) {
+							// Too big for the receive buffer - allocate the
+							// complete message buffer, and read the rest of
+							// the message straight into it.
+							proto_p = cf_malloc(total_sz);
+							cf_assert(proto_p, AS_DEMARSHAL, CF_CRITICAL, "allocation: %zu %s", total_sz, cf_strerror(errno));
+							memcpy(proto_p->data, msg + sizeof(as_proto), avail - sizeof(as_proto));
+							memcpy(proto_p, &proto, sizeof(as_proto));
+
+							fd_h->proto_unread = total_sz - avail;
+							fd_h->proto = proto_p;
+							proto_p = 0;
+
+							fd_h->recv_start = 0;
+							fd_h->recv_end = 0;
 							continue;
 						}
-						cf_info(AS_DEMARSHAL, "receive socket: fail? n %d errno %d %s closing connection.", n, errno, cf_strerror(errno));
-						goto NextEvent_FD_Cleanup;
-					}
 
-					// Decrement bytes-unread counter.
-					cf_detail(AS_DEMARSHAL, "read fd %d (%d %d)", fd, n, fd_h->proto_unread);
-					fd_h->proto_unread -= n;
-				}
+#ifndef USE_JEM
+						if (fd_h->recv_start == 0 && avail == total_sz) {
+							// The receive buffer holds exactly this message -
+							// hand the buffer itself to the transaction.
+							proto_p = (as_proto *)fd_h->recv_buf;
+							fd_h->recv_buf = 0;
+						}
+						else
+#endif
+						{
+							// Copy out the message - with JEMalloc, this also
+							// places it in the namespace's arena.
+							proto_p = cf_malloc(total_sz);
+							cf_assert(proto_p, AS_DEMARSHAL, CF_CRITICAL, "allocation: %zu %s", total_sz, cf_strerror(errno));
+							memcpy(proto_p->data, msg + sizeof(as_proto), proto.sz);
+						}
 
-				// Check for a finished read.
-				if (0 == fd_h->proto_unread) {
+						memcpy(proto_p, &proto, sizeof(as_proto));
+
+						fd_h->recv_start += total_sz;
+
+						if (fd_h->recv_start == fd_h->recv_end) {
+							fd_h->recv_start = 0;
+							fd_h->recv_end = 0;
+						}
+					}
 
 					// It's only really live if it's injecting a transaction.
 					fd_h->last_used = now_ms;
 
 					fd_h->t_inprogress = true; // disallow and/or detect pipelining
-					fd_h->proto = 0;
 					fd_h->proto_unread = 0;
 
 					// INIT_TR
@@ -595,6 +726,10 @@ thr_demarshal(void *arg)
 						tr.microbenchmark_time = cf_getns();
 					}
 
+					if (g_config.transaction_trace_sample_rate != 0) {
+						as_tr_trace_sample(&tr);
+					}
+
 					// Check if it's compressed.
 					if (tr.msgp->proto.type == PROTO_TYPE_AS_MSG_COMPRESSED)
 					{
@@ -606,49 +741,47 @@ thr_demarshal(void *arg)
 							goto NextEvent_FD_Cleanup;
 						}
 						// Count the packets.
-						cf_atomic_int_add(&g_config.stat_compressed_pkts_received, 1);
+						cf_shard_counter_add(&g_config.stat_compressed_pkts_received, 1);
 						// Free the compressed packet since we'll be using the
 						// decompressed packet from now on.
 						cf_free(proto_p);
+						proto_p = (as_proto *)decompressed_buf;
 						// Get original packet.
 						tr.msgp = (cl_msg *)decompressed_buf;
 						as_proto_swap(&(tr.msgp->proto));
 					}
 
+					AS_TR_TRACE_STAGE(&tr, AS_TR_STAGE_DEMARSHAL);
+
 					// Security protocol transactions.
 					if (tr.msgp->proto.type == PROTO_TYPE_SECURITY) {
 						as_security_transact(&tr);
-						cf_atomic_int_incr(&g_config.proto_transactions);
-						goto NextEvent;
+						cf_shard_counter_incr(&g_config.proto_transactions);
 					}
-
 					// Fast path for info protocol requests.
-					if ((tr.msgp->proto.type == PROTO_TYPE_INFO) && g_config.info_fastpath_enabled) {
+					else if ((tr.msgp->proto.type == PROTO_TYPE_INFO) && g_config.info_fastpath_enabled) {
 						cf_debug(AS_DEMARSHAL, "[Sending Info request via fast path.]");
 						if (as_info(&tr)) {
 							cf_warning(AS_DEMARSHAL, "Info request failed to be enqueued ~~ Freeing protocol buffer");
 							goto NextEvent_FD_Cleanup;
 						}
-						cf_atomic_int_incr(&g_config.proto_transactions);
-						goto NextEvent;
+						cf_shard_counter_incr(&g_config.proto_transactions);
 					}
-
 					// Either process the transaction directly in this thread,
 					// or queue it for processing by another thread (tsvc/info).
-					if (0 != thr_tsvc_process_or_enqueue(&tr)) {
+					else if (0 != thr_tsvc_process_or_enqueue(&tr)) {
 						cf_warning(AS_DEMARSHAL, "Failed to queue transaction to the service thread");
 						goto NextEvent_FD_Cleanup;
 					}
 					else {
-						cf_atomic_int_incr(&g_config.proto_transactions);
+						cf_shard_counter_incr(&g_config.proto_transactions);
 					}
-				}
 
-				// Jump the proto message free & FD cleanup. If we get here, the
-				// above operations went smoothly. The message free & FD cleanup
-				// job is handled elsewhere as directed by
-				// thr_tsvc_process_or_enqueue().
-				goto NextEvent;
+					// The message and the extra reference now belong to the
+					// transaction - go on to the next message.
+					proto_p = 0;
+					has_extra_ref = false;
+				}
 
 NextEvent_FD_Cleanup:
 				// If we allocated memory for the incoming message, free it.
@@ -659,6 +792,8 @@ NextEvent_FD_Cleanup:
 				if (has_extra_ref) {
 					cf_rc_release(fd_h);
 				}
+				// Fail transactions still sending on this connection.
+				as_msg_send_fh_close(fd_h);
 				// Remove the fd from the events list.
 				epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, 0);
 				pthread_mutex_lock(&g_file_handle_a_LOCK);
@@ -688,21 +823,61 @@ as_demarshal_start()
 
 	dm->num_threads = g_config.n_service_threads;
 
-	g_freeslot = cf_queue_create(sizeof(int), true);
-	if (!g_freeslot) {
-		cf_crash(AS_DEMARSHAL, " Couldn't create reaper free list ");
+	for (int i = 0; i < MAX_DEMARSHAL_THREADS; i++) {
+		dm->listen_fd[i] = -1;
 	}
 
 	// Start the listener socket: note that because this is done after privilege
 	// de-escalation, we can't use privileged ports.
 	g_config.socket.reuse_addr = g_config.socket_reuse_addr;
+	g_config.socket.reuse_port = g_config.socket_reuse_port && dm->num_threads > 1;
 	if (0 != cf_socket_init_svc(&g_config.socket)) {
-		cf_crash(AS_DEMARSHAL, "couldn't initialize service socket: %s", cf_strerror(errno));
+		if (! g_config.socket.reuse_port) {
+			cf_crash(AS_DEMARSHAL, "couldn't initialize service socket: %s", cf_strerror(errno));
+		}
+
+		cf_warning(AS_DEMARSHAL, "SO_REUSEPORT not available - only one demarshal thread will accept connections");
+		g_config.socket.reuse_port = false;
+
+		if (0 != cf_socket_init_svc(&g_config.socket)) {
+			cf_crash(AS_DEMARSHAL, "couldn't initialize service socket: %s", cf_strerror(errno));
+		}
 	}
 	if (-1 == cf_socket_set_nonblocking(g_config.socket.sock)) {
 		cf_crash(AS_DEMARSHAL, "couldn't set socket nonblocking: %s", cf_strerror(errno));
 	}
 
+	dm->listen_fd[0] = g_config.socket.sock;
+	dm->num_acceptors = 1;
+
+	// With SO_REUSEPORT, every thread gets its own socket on the same port.
+	if (g_config.socket.reuse_port) {
+		for (int i = 1; i < dm->num_threads; i++) {
+			cf_socket_cfg thr_socket = g_config.socket;
+
+			if (0 != cf_socket_init_svc(&thr_socket)) {
+				cf_crash(AS_DEMARSHAL, "couldn't initialize service socket %d: %s", i, cf_strerror(errno));
+			}
+			if (-1 == cf_socket_set_nonblocking(thr_socket.sock)) {
+				cf_crash(AS_DEMARSHAL, "couldn't set socket nonblocking: %s", cf_strerror(errno));
+			}
+
+			dm->listen_fd[i] = thr_socket.sock;
+		}
+
+		dm->num_acceptors = dm->num_threads;
+	}
+
+	cf_info(AS_DEMARSHAL, "%u demarshal threads accepting connections", dm->num_acceptors);
+
+	g_num_freeslot_q = dm->num_acceptors;
+
+	for (int i = 0; i < g_num_freeslot_q; i++) {
+		if (! (g_freeslot[i] = cf_queue_create(sizeof(int), true))) {
+			cf_crash(AS_DEMARSHAL, " Couldn't create reaper free list ");
+		}
+	}
+
 	// Create first thread which is the listener, and wait for it to come up
 	// before others are spawned.
 	if (0 != pthread_create(&(dm->dm_th[0]), 0, thr_demarshal, &g_config.socket)) {
@@ -57,6 +57,7 @@
 
 #include "base/asm.h"
 #include "base/datamodel.h"
+#include "base/hot_keys.h"
 #include "base/thr_batch.h"
 #include "base/thr_proxy.h"
 #include "base/thr_tsvc.h"
@@ -342,76 +343,76 @@ info_get_stats(char *name, cf_dyn_buf *db)
 	info_get_utilization(db);
 
 	cf_dyn_buf_append_string(db, ";stat_read_reqs=");
-	APPEND_STAT_COUNTER(db, g_config.stat_read_reqs);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_read_reqs));
 	cf_dyn_buf_append_string(db, ";stat_read_reqs_xdr=");
-	APPEND_STAT_COUNTER(db, g_config.stat_read_reqs_xdr);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_read_reqs_xdr));
 	cf_dyn_buf_append_string(db, ";stat_read_success=");
-	APPEND_STAT_COUNTER(db, g_config.stat_read_success);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_read_success));
 	cf_dyn_buf_append_string(db, ";stat_read_errs_notfound=");
-	APPEND_STAT_COUNTER(db, g_config.stat_read_errs_notfound);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_read_errs_notfound));
 	cf_dyn_buf_append_string(db, ";stat_read_errs_other=");
-	APPEND_STAT_COUNTER(db, g_config.stat_read_errs_other);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_read_errs_other));
 
 
 	cf_dyn_buf_append_string(db, ";stat_write_reqs=");
-	APPEND_STAT_COUNTER(db, g_config.stat_write_reqs);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_write_reqs));
 	cf_dyn_buf_append_string(db, ";stat_write_reqs_xdr=");
-	APPEND_STAT_COUNTER(db, g_config.stat_write_reqs_xdr);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_write_reqs_xdr));
 	cf_dyn_buf_append_string(db, ";stat_write_success=");
-	APPEND_STAT_COUNTER(db, g_config.stat_write_success);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_write_success));
 	cf_dyn_buf_append_string(db, ";stat_write_errs=");
-	APPEND_STAT_COUNTER(db, g_config.stat_write_errs);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_write_errs));
 	cf_dyn_buf_append_string(db, ";stat_xdr_pipe_writes=");
 	APPEND_STAT_COUNTER(db, g_config.stat_xdr_pipe_writes);
 	cf_dyn_buf_append_string(db, ";stat_xdr_pipe_miss=");
 	APPEND_STAT_COUNTER(db, g_config.stat_xdr_pipe_miss);
 
 	cf_dyn_buf_append_string(db, ";stat_delete_success=");
-	APPEND_STAT_COUNTER(db, g_config.stat_delete_success);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_delete_success));
 	cf_dyn_buf_append_string(db, ";stat_rw_timeout=");
-	APPEND_STAT_COUNTER(db, g_config.stat_rw_timeout);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_rw_timeout));
 
 	cf_dyn_buf_append_string(db, ";udf_read_reqs=");
-	APPEND_STAT_COUNTER(db, g_config.udf_read_reqs);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_read_reqs));
 	cf_dyn_buf_append_string(db, ";udf_read_success=");
-	APPEND_STAT_COUNTER(db, g_config.udf_read_success);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_read_success));
 	cf_dyn_buf_append_string(db, ";udf_read_errs_other=");
-	APPEND_STAT_COUNTER(db, g_config.udf_read_errs_other);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_read_errs_other));
 
 	cf_dyn_buf_append_string(db, ";udf_write_reqs=");
-	APPEND_STAT_COUNTER(db, g_config.udf_write_reqs);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_write_reqs));
 	cf_dyn_buf_append_string(db, ";udf_write_success=");
-	APPEND_STAT_COUNTER(db, g_config.udf_write_success);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_write_success));
 	cf_dyn_buf_append_string(db, ";udf_write_err_others=");
-	APPEND_STAT_COUNTER(db, g_config.udf_write_errs_other);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_write_errs_other));
 
 	cf_dyn_buf_append_string(db, ";udf_delete_reqs=");
-	APPEND_STAT_COUNTER(db, g_config.udf_delete_reqs);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_delete_reqs));
 	cf_dyn_buf_append_string(db, ";udf_delete_success=");
-	APPEND_STAT_COUNTER(db, g_config.udf_delete_success);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_delete_success));
 	cf_dyn_buf_append_string(db, ";udf_delete_err_others=");
-	APPEND_STAT_COUNTER(db, g_config.udf_delete_errs_other);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_delete_errs_other));
 
 	cf_dyn_buf_append_string(db, ";udf_lua_errs=");
 	APPEND_STAT_COUNTER(db, g_config.udf_lua_errs);
 
 	cf_dyn_buf_append_string(db, ";udf_scan_rec_reqs=");
-	APPEND_STAT_COUNTER(db, g_config.udf_scan_rec_reqs);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_scan_rec_reqs));
 
 	cf_dyn_buf_append_string(db, ";udf_query_rec_reqs=");
-	APPEND_STAT_COUNTER(db, g_config.udf_scan_rec_reqs);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_scan_rec_reqs));
 
 	cf_dyn_buf_append_string(db, ";udf_replica_writes=");
-	APPEND_STAT_COUNTER(db, g_config.udf_replica_writes);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.udf_replica_writes));
 
 	cf_dyn_buf_append_string(db, ";stat_proxy_reqs=");
-	APPEND_STAT_COUNTER(db, g_config.stat_proxy_reqs);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_proxy_reqs));
 	cf_dyn_buf_append_string(db, ";stat_proxy_reqs_xdr=");
-	APPEND_STAT_COUNTER(db, g_config.stat_proxy_reqs_xdr);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_proxy_reqs_xdr));
 	cf_dyn_buf_append_string(db, ";stat_proxy_success=");
-	APPEND_STAT_COUNTER(db, g_config.stat_proxy_success);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_proxy_success));
 	cf_dyn_buf_append_string(db, ";stat_proxy_errs=");
-	APPEND_STAT_COUNTER(db, g_config.stat_proxy_errs);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_proxy_errs));
 
 	cf_dyn_buf_append_string(db,   ";stat_cluster_key_trans_to_proxy_retry=");
 	APPEND_STAT_COUNTER(db, g_config.stat_cluster_key_trans_to_proxy_retry);
@@ -459,7 +460,7 @@ info_get_stats(char *name, cf_dyn_buf *db)
 	APPEND_STAT_COUNTER(db, g_config.stat_nsup_deletes_not_shipped);
 
 	cf_dyn_buf_append_string(db, ";err_tsvc_requests=");
-	APPEND_STAT_COUNTER(db, g_config.err_tsvc_requests);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.err_tsvc_requests));
 	cf_dyn_buf_append_string(db, ";err_out_of_space=");
 	APPEND_STAT_COUNTER(db, g_config.err_out_of_space);
 	cf_dyn_buf_append_string(db, ";err_duplicate_proxy_request=");
@@ -472,10 +473,10 @@ info_get_stats(char *name, cf_dyn_buf *db)
 	APPEND_STAT_COUNTER(db, g_config.err_rw_cant_put_unique);
 
 	cf_dyn_buf_append_string(db, ";fabric_msgs_sent=");
-	APPEND_STAT_COUNTER(db, g_config.fabric_msgs_sent);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.fabric_msgs_sent));
 
 	cf_dyn_buf_append_string(db, ";fabric_msgs_rcvd=");
-	APPEND_STAT_COUNTER(db, g_config.fabric_msgs_rcvd);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.fabric_msgs_rcvd));
 
 	cf_dyn_buf_append_string(db, ";paxos_principal=");
 	char paxos_principal[19];
@@ -500,11 +501,14 @@ info_get_stats(char *name, cf_dyn_buf *db)
 	cf_dyn_buf_append_string(db, ";migrate_num_incoming_refused=");
 	APPEND_STAT_COUNTER(db, g_config.migrate_num_incoming_refused);
 
+	cf_dyn_buf_append_string(db, ";migrate_delta_skipped=");
+	APPEND_STAT_COUNTER(db, g_config.migrate_delta_skipped);
+
 	cf_dyn_buf_append_string(db, ";queue=");
 	cf_dyn_buf_append_int(db, thr_tsvc_queue_get_size() );
 
 	cf_dyn_buf_append_string(db, ";transactions=");
-	APPEND_STAT_COUNTER(db, g_config.proto_transactions);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.proto_transactions));
 
 	cf_dyn_buf_append_string(db, ";reaped_fds=");
 	APPEND_STAT_COUNTER(db, g_config.reaper_count);
@@ -519,15 +523,15 @@ info_get_stats(char *name, cf_dyn_buf *db)
 	APPEND_STAT_COUNTER(db, g_config.tscan_aborted);
 
 	cf_dyn_buf_append_string(db, ";batch_initiate=");
-	APPEND_STAT_COUNTER(db, g_config.batch_initiate);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.batch_initiate));
 	cf_dyn_buf_append_string(db, ";batch_queue=");
 	cf_dyn_buf_append_int(db, as_batch_queue_size());
 	cf_dyn_buf_append_string(db, ";batch_tree_count=");
 	APPEND_STAT_COUNTER(db, g_config.batch_tree_count);
 	cf_dyn_buf_append_string(db, ";batch_timeout=");
-	APPEND_STAT_COUNTER(db, g_config.batch_timeout);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.batch_timeout));
 	cf_dyn_buf_append_string(db, ";batch_errors=");
-	APPEND_STAT_COUNTER(db, g_config.batch_errors);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.batch_errors));
 
 	cf_dyn_buf_append_string(db, ";info_queue=");
 	cf_dyn_buf_append_int(db, as_info_queue_get_size());
@@ -538,11 +542,11 @@ info_get_stats(char *name, cf_dyn_buf *db)
 	cf_dyn_buf_append_string(db, ";proxy_in_progress=");
 	APPEND_STAT_COUNTER(db, as_proxy_inprogress());
 	cf_dyn_buf_append_string(db, ";proxy_initiate=");
-	APPEND_STAT_COUNTER(db, g_config.proxy_initiate);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.proxy_initiate));
 	cf_dyn_buf_append_string(db, ";proxy_action=");
-	APPEND_STAT_COUNTER(db, g_config.proxy_action);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.proxy_action));
 	cf_dyn_buf_append_string(db, ";proxy_retry=");
-	APPEND_STAT_COUNTER(db, g_config.proxy_retry);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.proxy_retry));
 	cf_dyn_buf_append_string(db, ";proxy_retry_q_full=");
 	APPEND_STAT_COUNTER(db, g_config.proxy_retry_q_full);
 	cf_dyn_buf_append_string(db, ";proxy_unproxy=");
@@ -553,12 +557,12 @@ info_get_stats(char *name, cf_dyn_buf *db)
 	APPEND_STAT_COUNTER(db, g_config.proxy_retry_new_dest);
 
 	cf_dyn_buf_append_string(db, ";write_master=");
-	APPEND_STAT_COUNTER(db, g_config.write_master);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.write_master));
 	cf_dyn_buf_append_string(db, ";write_prole=");
-	APPEND_STAT_COUNTER(db, g_config.write_prole);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.write_prole));
 
 	cf_dyn_buf_append_string(db, ";read_dup_prole=");
-	APPEND_STAT_COUNTER(db, g_config.read_dup_prole);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.read_dup_prole));
 	cf_dyn_buf_append_string(db, ";rw_err_dup_internal=");
 	APPEND_STAT_COUNTER(db, g_config.rw_err_dup_internal);
 	cf_dyn_buf_append_string(db, ";rw_err_dup_cluster_key=");
@@ -572,6 +576,10 @@ info_get_stats(char *name, cf_dyn_buf *db)
 	APPEND_STAT_COUNTER(db, g_config.rw_err_write_cluster_key);
 	cf_dyn_buf_append_string(db, ";rw_err_write_send=");
 	APPEND_STAT_COUNTER(db, g_config.rw_err_write_send);
+	cf_dyn_buf_append_string(db, ";write_batch_sent=");
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.write_batch_sent));
+	cf_dyn_buf_append_string(db, ";write_batch_writes=");
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.write_batch_writes));
 
 	cf_dyn_buf_append_string(db, ";rw_err_ack_internal=");
 	APPEND_STAT_COUNTER(db, g_config.rw_err_ack_internal);
@@ -595,6 +603,12 @@ info_get_stats(char *name, cf_dyn_buf *db)
 	cf_dyn_buf_append_string(db, ";record_locks=");
 	APPEND_STAT_COUNTER(db, g_config.global_record_lock_count);
 
+	cf_dyn_buf_append_string(db, ";record_lock_waits=");
+	cf_dyn_buf_append_uint64(db, cf_atomic64_get(g_config.record_locks->n_contended));
+
+	cf_dyn_buf_append_string(db, ";record_lock_wait_us=");
+	cf_dyn_buf_append_uint64(db, cf_atomic64_get(g_config.record_locks->wait_ns) / 1000);
+
 	cf_dyn_buf_append_string(db, ";migrate_tx_objs=");
 	APPEND_STAT_COUNTER(db, g_config.migrate_tx_object_count);
 
@@ -703,9 +717,9 @@ info_get_stats(char *name, cf_dyn_buf *db)
 
 	// Write errors are now split into write_errs_notfound and write_errs_other
 	cf_dyn_buf_append_string(db, ";stat_write_errs_notfound=");
-	APPEND_STAT_COUNTER(db, g_config.stat_write_errs_notfound);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_write_errs_notfound));
 	cf_dyn_buf_append_string(db, ";stat_write_errs_other=");
-	APPEND_STAT_COUNTER(db, g_config.stat_write_errs_other);
+	APPEND_STAT_COUNTER(db, cf_shard_counter_get(&g_config.stat_write_errs_other));
 
 	cf_dyn_buf_append_string(db, ";heartbeat_received_self=");
 	cf_dyn_buf_append_uint64(db, g_config.heartbeat_received_self);
@@ -1908,18 +1922,12 @@ info_service_config_get(cf_dyn_buf *db)
 	cf_dyn_buf_append_int(db, g_config.transaction_pending_limit);
 	cf_dyn_buf_append_string(db, ";migrate-threads=");
 	cf_dyn_buf_append_int(db, g_config.n_migrate_threads);
-	cf_dyn_buf_append_string(db, ";migrate-xmit-priority=");
-	cf_dyn_buf_append_int(db, g_config.migrate_xmit_priority);
-	cf_dyn_buf_append_string(db, ";migrate-xmit-sleep=");
-	cf_dyn_buf_append_int(db, g_config.migrate_xmit_sleep);
-	cf_dyn_buf_append_string(db, ";migrate-read-priority=");
-	cf_dyn_buf_append_int(db, g_config.migrate_read_priority);
-	cf_dyn_buf_append_string(db, ";migrate-read-sleep=");
-	cf_dyn_buf_append_int(db, g_config.migrate_read_sleep);
-	cf_dyn_buf_append_string(db, ";migrate-xmit-hwm=");
-	cf_dyn_buf_append_int(db, g_config.migrate_xmit_hwm);
-	cf_dyn_buf_append_string(db, ";migrate-xmit-lwm=");
-	cf_dyn_buf_append_int(db, g_config.migrate_xmit_lwm);
+	cf_dyn_buf_append_string(db, ";migrate-window-size=");
+	cf_dyn_buf_append_uint32(db, g_config.migrate_window_size);
+	cf_dyn_buf_append_string(db, ";migrate-max-mb-per-sec=");
+	cf_dyn_buf_append_uint32(db, g_config.migrate_max_mb_per_sec);
+	cf_dyn_buf_append_string(db, ";migrate-delta=");
+	cf_dyn_buf_append_string(db, g_config.migrate_delta ? "true" : "false");
 	cf_dyn_buf_append_string(db, ";migrate-max-num-incoming=");
 	cf_dyn_buf_append_int(db, g_config.migrate_max_num_incoming);
 	cf_dyn_buf_append_string(db, ";migrate-rx-lifetime-ms=");
@@ -1934,6 +1942,8 @@ info_service_config_get(cf_dyn_buf *db)
 	cf_dyn_buf_append_int(db, (int)(g_config.transaction_max_ns / 1000000));
 	cf_dyn_buf_append_string(db, ";transaction-repeatable-read=");
 	cf_dyn_buf_append_string(db, g_config.transaction_repeatable_read ? "true" : "false");
+	cf_dyn_buf_append_string(db, ";transaction-trace-sample-rate=");
+	cf_dyn_buf_append_uint32(db, g_config.transaction_trace_sample_rate);
 	cf_dyn_buf_append_string(db, ";dump-message-above-size=");
 	cf_dyn_buf_append_int(db, g_config.dump_message_above_size);
 	cf_dyn_buf_append_string(db, ";ticker-interval=");
@@ -1949,6 +1959,8 @@ info_service_config_get(cf_dyn_buf *db)
 
 	cf_dyn_buf_append_string(db, ";batch-threads=");
 	cf_dyn_buf_append_int(db, g_config.n_batch_threads);
+	cf_dyn_buf_append_string(db, ";batch-helper-threads=");
+	cf_dyn_buf_append_int(db, g_config.n_batch_helper_threads);
 	cf_dyn_buf_append_string(db, ";batch-max-requests=");
 	cf_dyn_buf_append_int(db, g_config.batch_max_requests);
 	cf_dyn_buf_append_string(db, ";batch-priority=");
@@ -1958,6 +1970,10 @@ info_service_config_get(cf_dyn_buf *db)
 	cf_dyn_buf_append_int(db, g_config.nsup_delete_sleep);
 	cf_dyn_buf_append_string(db, ";nsup-period=");
 	cf_dyn_buf_append_int(db, g_config.nsup_period);
+	cf_dyn_buf_append_string(db, ";nsup-reduce-rate=");
+	cf_dyn_buf_append_uint32(db, g_config.nsup_reduce_rate);
+	cf_dyn_buf_append_string(db, ";nsup-threads=");
+	cf_dyn_buf_append_uint32(db, g_config.nsup_threads);
 	cf_dyn_buf_append_string(db, ";nsup-startup-evict=");
 	cf_dyn_buf_append_string(db, g_config.nsup_startup_evict ? "true" : "false");
 	cf_dyn_buf_append_string(db, ";paxos-retransmit-period=");
@@ -1982,6 +1998,8 @@ info_service_config_get(cf_dyn_buf *db)
 	cf_dyn_buf_append_string(db, g_config.respond_client_on_master_completion ? "true" : "false");
 	cf_dyn_buf_append_string(db, ";replication-fire-and-forget=");
 	cf_dyn_buf_append_string(db, g_config.replication_fire_and_forget ? "true" : "false");
+	cf_dyn_buf_append_string(db, ";replication-batch=");
+	cf_dyn_buf_append_string(db, g_config.replication_batch ? "true" : "false");
 	cf_dyn_buf_append_string(db, ";info-threads=");
 	cf_dyn_buf_append_int(db, g_config.n_info_threads);
 	cf_dyn_buf_append_string(db, ";allow-inline-transactions=");
@@ -2109,6 +2127,9 @@ info_namespace_config_get(char* context, cf_dyn_buf *db)
 	cf_dyn_buf_append_string(db, ";max-ttl=");
 	cf_dyn_buf_append_uint64(db, ns->max_ttl);
 
+	cf_dyn_buf_append_string(db, ";nsup-expire-index=");
+	cf_dyn_buf_append_string(db, ns->nsup_expire_index ? "true" : "false");
+
 	cf_dyn_buf_append_string(db, ";conflict-resolution-policy=");
 	if(ns->conflict_resolution_policy == AS_NAMESPACE_CONFLICT_RESOLUTION_POLICY_GENERATION) {
 		cf_dyn_buf_append_string(db, "generation");
@@ -2161,6 +2182,25 @@ info_namespace_config_get(char* context, cf_dyn_buf *db)
 		info_append_uint64("", "min-avail-pct", ns->storage_min_avail_pct, db);
 		info_append_uint64("", "post-write-queue", (uint64_t)ns->storage_post_write_queue, db);
 
+		cf_dyn_buf_append_string(db, ";io-engine=");
+		cf_dyn_buf_append_string(db, ns->storage_io_engine == AS_STORAGE_IO_ENGINE_URING ? "uring" : "sync");
+		info_append_uint64("", "io-depth", ns->storage_io_depth, db);
+
+		if (ns->storage_scan_device_order)
+			cf_dyn_buf_append_string(db, ";scan-device-order=true");
+		else
+			cf_dyn_buf_append_string(db, ";scan-device-order=false");
+
+		info_append_uint64("", "record-cache-size", ns->storage_record_cache_size, db);
+		info_append_uint64("", "cold-start-threads", ns->storage_cold_start_threads, db);
+
+		if (ns->storage_index_snapshot_file) {
+			cf_dyn_buf_append_string(db, ";index-snapshot-file=");
+			cf_dyn_buf_append_string(db, ns->storage_index_snapshot_file);
+		}
+
+		info_append_uint64("", "index-snapshot-period", ns->storage_index_snapshot_period, db);
+
 		if (ns->storage_data_in_memory)
 			cf_dyn_buf_append_string(db, ";data-in-memory=true");
 		else
@@ -2257,6 +2297,8 @@ info_network_info_config_get(cf_dyn_buf *db)
 	}
 	cf_dyn_buf_append_string(db, ";reuse-address=");
 	cf_dyn_buf_append_string(db, g_config.socket_reuse_addr ? "true" : "false");
+	cf_dyn_buf_append_string(db, ";reuse-port=");
+	cf_dyn_buf_append_string(db, g_config.socket_reuse_port ? "true" : "false");
 	cf_dyn_buf_append_string(db, ";fabric-port=");
 	cf_dyn_buf_append_int(db, g_config.fabric_port);
 // network-info-port is the asd info port variable/output, This was chosen because info-port conflicts with XDR config parameter.
@@ -2427,29 +2469,29 @@ info_command_config_set(char *name, char *params, cf_dyn_buf *db)
 		goto Error;
 	if (strcmp(context, "service") == 0) {
 		context_len = sizeof(context);
-		if (0 == as_info_parameter_get(params, "migrate-xmit-priority", context, &context_len)) {
-			if (0 != cf_str_atoi(context, &val))
+		if (0 == as_info_parameter_get(params, "migrate-window-size", context, &context_len)) {
+			if (0 != cf_str_atoi(context, &val) || val < 64 * 1024 || val > 1024 * 1024 * 1024)
 				goto Error;
-			cf_info(AS_INFO, "Changing value of migrate-xmit-priority from %d to %d ", g_config.migrate_xmit_priority, val);
-			g_config.migrate_xmit_priority = val;
+			cf_info(AS_INFO, "Changing value of migrate-window-size from %u to %d ", g_config.migrate_window_size, val);
+			g_config.migrate_window_size = (uint32_t)val;
 		}
-		else if (0 == as_info_parameter_get(params, "migrate-xmit-sleep", context, &context_len)) {
-			if (0 != cf_str_atoi(context, &val))
-				goto Error;
-			cf_info(AS_INFO, "Changing value of migrate-xmit-sleep from %d to %d ", g_config.migrate_xmit_sleep, val);
-			g_config.migrate_xmit_sleep = val;
-		}
-		else if (0 == as_info_parameter_get(params, "migrate-read-priority", context, &context_len)) {
-			if (0 != cf_str_atoi(context, &val))
+		else if (0 == as_info_parameter_get(params, "migrate-delta", context, &context_len)) {
+			if (strncmp(context, "true", 4) == 0 || strncmp(context, "yes", 3) == 0) {
+				cf_info(AS_INFO, "Changing value of migrate-delta from %s to %s", bool_val[g_config.migrate_delta], context);
+				g_config.migrate_delta = true;
+			}
+			else if (strncmp(context, "false", 5) == 0 || strncmp(context, "no", 2) == 0) {
+				cf_info(AS_INFO, "Changing value of migrate-delta from %s to %s", bool_val[g_config.migrate_delta], context);
+				g_config.migrate_delta = false;
+			}
+			else
 				goto Error;
-			cf_info(AS_INFO, "Changing value of migrate-read-priority from %d to %d ", g_config.migrate_read_priority, val);
-			g_config.migrate_read_priority = val;
 		}
-		else if (0 == as_info_parameter_get(params, "migrate-read-sleep", context, &context_len)) {
-			if (0 != cf_str_atoi(context, &val))
+		else if (0 == as_info_parameter_get(params, "migrate-max-mb-per-sec", context, &context_len)) {
+			if (0 != cf_str_atoi(context, &val) || val < 0)
 				goto Error;
-			cf_info(AS_INFO, "Changing value of migrate-read-sleep from %d to %d ", g_config.migrate_read_sleep, val);
-			g_config.migrate_read_sleep = val;
+			cf_info(AS_INFO, "Changing value of migrate-max-mb-per-sec from %u to %d ", g_config.migrate_max_mb_per_sec, val);
+			g_config.migrate_max_mb_per_sec = (uint32_t)val;
 		}
 		else if (0 == as_info_parameter_get(params, "transaction-retry-ms", context, &context_len)) {
 			if (0 != cf_str_atoi(context, &val))
@@ -2471,6 +2513,12 @@ info_command_config_set(char *name, char *params, cf_dyn_buf *db)
 			cf_info(AS_INFO, "Changing value of transaction-pending-limit from %d to %d ", g_config.transaction_pending_limit, val);
 			g_config.transaction_pending_limit = val;
 		}
+		else if (0 == as_info_parameter_get(params, "transaction-trace-sample-rate", context, &context_len)) {
+			if (0 != cf_str_atoi(context, &val) || val < 0)
+				goto Error;
+			cf_info(AS_INFO, "Changing value of transaction-trace-sample-rate from %u to %d ", g_config.transaction_trace_sample_rate, val);
+			g_config.transaction_trace_sample_rate = (uint32_t)val;
+		}
 		else if (0 == as_info_parameter_get(params, "transaction-repeatable-read", context, &context_len)) {
 			if (strncmp(context, "true", 4) == 0 || strncmp(context, "yes", 3) == 0) {
 				cf_info(AS_INFO, "Changing value of transaction-repeatable-read from %s to %s", bool_val[g_config.transaction_repeatable_read], context);
@@ -2569,6 +2617,18 @@ info_command_config_set(char *name, char *params, cf_dyn_buf *db)
 			cf_info(AS_INFO, "Changing value of nsup-period from %d to %d ", g_config.nsup_period, val);
 			g_config.nsup_period = val;
 		}
+		else if (0 == as_info_parameter_get(params, "nsup-reduce-rate", context, &context_len)) {
+			if (0 != cf_str_atoi(context, &val) || val < 0)
+				goto Error;
+			cf_info(AS_INFO, "Changing value of nsup-reduce-rate from %u to %d ", g_config.nsup_reduce_rate, val);
+			g_config.nsup_reduce_rate = val;
+		}
+		else if (0 == as_info_parameter_get(params, "nsup-threads", context, &context_len)) {
+			if (0 != cf_str_atoi(context, &val) || val < 1 || val > 128)
+				goto Error;
+			cf_info(AS_INFO, "Changing value of nsup-threads from %u to %d ", g_config.nsup_threads, val);
+			g_config.nsup_threads = val;
+		}
 		else if (0 == as_info_parameter_get(params, "paxos-retransmit-period", context, &context_len)) {
 			if (0 != cf_str_atoi(context, &val))
 				goto Error;
@@ -2605,18 +2665,6 @@ info_command_config_set(char *name, char *params, cf_dyn_buf *db)
 				goto Error;
 			cf_info(AS_INFO, "Changing value of paxos-recovery-policy to %s", context);
 		}
-		else if (0 == as_info_parameter_get(params, "migrate-xmit-hwm", context, &context_len)) {
-			if (0 != cf_str_atoi(context, &val))
-				goto Error;
-			cf_info(AS_INFO, "Changing value of migrate-xmit-hwm from %d to %d ", g_config.migrate_xmit_hwm, val);
-			g_config.migrate_xmit_hwm = val;
-		}
-		else if (0 == as_info_parameter_get(params, "migrate-xmit-lwm", context, &context_len)) {
-			if (0 != cf_str_atoi(context, &val))
-				goto Error;
-			cf_info(AS_INFO, "Changing value of migrate-xmit-lwm from %d to %d ", g_config.migrate_xmit_lwm, val);
-			g_config.migrate_xmit_lwm = val;
-		}
 		else if (0 == as_info_parameter_get(params, "migrate-max-num-incoming", context, &context_len)) {
 			if (0 != cf_str_atoi(context, &val) || (0 >= val))
 				goto Error;
@@ -2683,6 +2731,18 @@ info_command_config_set(char *name, char *params, cf_dyn_buf *db)
 			else
 				goto Error;
 		}
+		else if (0 == as_info_parameter_get(params, "replication-batch", context, &context_len)) {
+			if (strncmp(context, "true", 4) == 0 || strncmp(context, "yes", 3) == 0) {
+				cf_info(AS_INFO, "Changing value of replication-batch from %s to %s", bool_val[g_config.replication_batch], context);
+				g_config.replication_batch = true;
+			}
+			else if (strncmp(context, "false", 5) == 0 || strncmp(context, "no", 2) == 0) {
+				cf_info(AS_INFO, "Changing value of replication-batch from %s to %s", bool_val[g_config.replication_batch], context);
+				g_config.replication_batch = false;
+			}
+			else
+				goto Error;
+		}
 		else if (0 == as_info_parameter_get(params, "use-queue-per-device", context, &context_len)) {
 			if (strncmp(context, "true", 4) == 0 || strncmp(context, "yes", 3) == 0) {
 				cf_info(AS_INFO, "Changing value of use-queue-per-device from %s to %s", bool_val[g_config.use_queue_per_device], context);
@@ -3669,9 +3729,14 @@ info_command_log_set(char *name, char *params, cf_dyn_buf *db)
 // throughput:hist=reads;back=180;duration=60;slice=10;
 // hist-track-start:hist=reads;back=43200;slice=30;thresholds=1,4,16,64;
 // hist-track-stop:hist=reads;
+// percentiles:hist=reads;
 //
 // hist     - optional histogram name - if none, command applies to all cf_hist_track objects
 //
+// for percentiles command - current count, p50, p99, p999 and max since the
+// histogram was last cleared, e.g:
+// reads:unit=usec,count=1000,p50=120,p99=860,p999=2900,max=15344;
+//
 // for start command:
 // back     - total time span in seconds over which to cache data
 // slice    - period in seconds at which to cache histogram data
@@ -3758,6 +3823,23 @@ info_command_hist_track(char *name, char *params, cf_dyn_buf *db)
 		return 0;
 	}
 
+	if (0 == strcmp(name, "percentiles")) {
+		if (hist_p) {
+			cf_hist_track_get_percentiles_info(hist_p, db);
+		}
+		else {
+			cf_hist_track_get_percentiles_info(g_config.rt_hist, db);
+			cf_hist_track_get_percentiles_info(g_config.wt_hist, db);
+			cf_hist_track_get_percentiles_info(g_config.px_hist, db);
+			cf_hist_track_get_percentiles_info(g_config.wt_reply_hist, db);
+			cf_hist_track_get_percentiles_info(g_config.ut_hist, db);
+			cf_hist_track_get_percentiles_info(g_config.q_hist, db);
+			cf_hist_track_get_percentiles_info(g_config.q_rcnt_hist, db);
+		}
+
+		return 0;
+	}
+
 	bool start_cmd = 0 == strcmp(name, "hist-track-start");
 
 	// Note - default query params will get the most recent saved slice.
@@ -4169,25 +4251,12 @@ thr_info_fn(void *gcc_is_ass)
 		db.buf[6] = (sz >> 8) & 0xff;
 		db.buf[7] = sz & 0xff;
 
-		// write the data buffer
-		uint8_t	*b = db.buf;
-		uint8_t	*lim = db.buf + db.used_sz;
-		while (b < lim) {
-			int rv = send(tr->proto_fd_h->fd, b, lim - b, MSG_NOSIGNAL);
-			if ((rv < 0) && (errno != EAGAIN) ) {
-				if (errno == EPIPE) {
-					cf_debug(AS_INFO, "thr_info: client request gave up while I was processing: fd %d", tr->proto_fd_h->fd);
-				} else {
-					cf_info(AS_INFO, "thr_info: can't write all bytes, fd %d error %d", tr->proto_fd_h->fd, errno);
-				}
-				AS_RELEASE_FILE_HANDLE(tr->proto_fd_h);
-				tr->proto_fd_h = 0;
-				break;
-			}
-			else if (rv > 0)
-				b += rv;
-			else
-				usleep(1);
+		// write the data buffer - never blocks, what the socket won't take
+		// is flushed by the demarshal thread
+		if (0 != as_msg_send_fh(tr->proto_fd_h, db.buf, db.used_sz, false)) {
+			cf_debug(AS_INFO, "thr_info: client request gave up while I was processing: fd %d", tr->proto_fd_h->fd);
+			AS_RELEASE_FILE_HANDLE(tr->proto_fd_h);
+			tr->proto_fd_h = 0;
 		}
 
 		cf_dyn_buf_free(&db);
@@ -5512,9 +5581,19 @@ info_get_namespace_info(as_namespace *ns, cf_dyn_buf *db)
 		info_append_uint64("", "free-pct-disk",  free_pct, db);
 		info_append_uint64("", "available_pct",  available_pct, db); // the underscore is an unfortunate legacy
 
+		info_append_uint64("", "defrag-read-bytes", cf_atomic64_get(ns->defrag_read_bytes), db);
+		info_append_uint64("", "defrag-write-bytes", cf_atomic64_get(ns->defrag_write_bytes), db);
+		info_append_uint64("", "defrag-backlog", ns->defrag_backlog, db);
+		info_append_uint64("", "defrag-backlog-age", ns->defrag_backlog_age, db);
+
 		if (! ns->storage_data_in_memory) {
 			cf_dyn_buf_append_string(db, ";cache-read-pct=");
 			cf_dyn_buf_append_int(db, (int)(ns->cache_read_pct + 0.5));
+
+			info_append_uint64("", "record-cache-hits", cf_atomic64_get(ns->record_cache_hits), db);
+			info_append_uint64("", "record-cache-misses", cf_atomic64_get(ns->record_cache_misses), db);
+			info_append_uint64("", "record-cache-evictions", cf_atomic64_get(ns->record_cache_evictions), db);
+			info_append_uint64("", "record-cache-used-bytes", cf_atomic64_get(ns->record_cache_bytes), db);
 		}
 	} // SSD
 }
@@ -5677,6 +5756,79 @@ info_command_hist_dump(char *name, char *params, cf_dyn_buf *db)
 	return 0;
 }
 
+//
+// hot-keys:max=10;
+//
+// max      - optional number of keys to return, default 10
+//
+// Returns the most accessed keys over the last complete window (10 seconds),
+// hottest first, with how often and how long their record lock acquisitions
+// waited, and how many transactions queued behind their write requests, e.g:
+// digest=...,accesses-per-sec=8200,accesses-per-sec-error=32,lock-waits=1240,
+// lock-wait-avg-us=85,queued=310,max-queue-depth=6;
+//
+// A key with many lock waits but few accesses is likely sharing a record lock
+// with a hot key.
+//
+int
+info_command_hot_keys(char *name, char *params, cf_dyn_buf *db)
+{
+	char value_str[50];
+	int  value_str_len = sizeof(value_str);
+	uint32_t max_keys = 10;
+
+	if (0 == as_info_parameter_get(params, "max", value_str, &value_str_len)) {
+		int i;
+
+		if (0 != cf_str_atoi(value_str, &i) || i < 0) {
+			cf_info(AS_INFO, "%s command: max is not a valid number", name);
+			cf_dyn_buf_append_string(db, "error-bad-max");
+			return 0;
+		}
+
+		max_keys = (uint32_t)i;
+	}
+
+	as_hot_keys_get_info(max_keys, db);
+
+	return 0;
+}
+
+//
+// traces:max=10;
+//
+// max      - optional number of traces to return, default 10
+//
+// Returns the slowest of the recently sampled transactions (see service config
+// transaction-trace-sample-rate), slowest first, with microseconds spent
+// reaching each stage, e.g:
+// ns=test,digest=7e3b41c6a2f0d812,op=read,result=0,total=5238,demarshal=4,
+// dequeue=4870,reserve=2,record-lock=3,storage-read=342,reply=17;
+//
+int
+info_command_traces(char *name, char *params, cf_dyn_buf *db)
+{
+	char value_str[50];
+	int  value_str_len = sizeof(value_str);
+	uint32_t max_traces = 10;
+
+	if (0 == as_info_parameter_get(params, "max", value_str, &value_str_len)) {
+		int i;
+
+		if (0 != cf_str_atoi(value_str, &i) || i < 0) {
+			cf_info(AS_INFO, "%s command: max is not a valid number", name);
+			cf_dyn_buf_append_string(db, "error-bad-max");
+			return 0;
+		}
+
+		max_traces = (uint32_t)i;
+	}
+
+	as_tr_trace_get_info(max_traces, db);
+
+	return 0;
+}
+
 
 int
 info_get_tree_log(char *name, char *subtree, cf_dyn_buf *db)
@@ -5977,7 +6129,7 @@ as_info_parse_params_to_sindex_imd(char* params, as_sindex_metadata *imd, cf_dyn
 			return AS_SINDEX_ERR_PARAM;
 		}
 		if        (strncasecmp(btype_str, "string", 6) == 0) {
-			imd->btype[0] = AS_SINDEX_KTYPE_DIGEST;
+			imd->btype[0] = AS_SINDEX_KTYPE_STRING;
 		} else if (strncasecmp(btype_str, "numeric", 7) == 0) {
 			imd->btype[0] = AS_SINDEX_KTYPE_LONG;
 		} else {
@@ -6044,7 +6196,7 @@ as_info_parse_params_to_sindex_imd(char* params, as_sindex_metadata *imd, cf_dyn
 				return AS_SINDEX_ERR_PARAM;
 			}
 			else if        (strncasecmp(type_str, "string", 6) == 0) {
-				imd->btype[i] = AS_SINDEX_KTYPE_DIGEST;
+				imd->btype[i] = AS_SINDEX_KTYPE_STRING;
 			} else if (strncasecmp(type_str, "numeric", 7) == 0) {
 				imd->btype[i] = AS_SINDEX_KTYPE_LONG;
 			} else {
@@ -6747,12 +6899,13 @@ as_info_init()
 	as_info_set("help", "alloc-info;asm;build;bins;config-get;config-set;digests;"
 				"dump-fabric;dump-hb;dump-migrates;dump-msgs;dump-paxos;dump-smd;"
 				"dump-wb;dump-wb-summary;dump-wr;dun;get-config;get-sl;hist-dump;"
+				"hot-keys;"
 				"hist-track-start;hist-track-stop;jem-stats;jobs;latency;log;log-set;"
 				"logs;mcast;mem;mesh;mstats;mtrace;name;namespace;namespaces;"
-				"node;service;services;services-alumni;set-config;set-log;sets;set-sl;"
+				"node;percentiles;service;services;services-alumni;set-config;set-log;sets;set-sl;"
 				"show-devices;sindex;sindex-create;sindex-delete;sindex-dump;"
 				"sindex-histogram;sindex-qnodemap;sindex-repair;"
-				"smd;snub;statistics;status;tip;tip-clear;undun;version;"
+				"smd;snub;statistics;status;tip;tip-clear;traces;tsvc-queues;undun;version;"
 				"xdr-min-lastshipinfo",
 				false);
 	/*
@@ -6765,6 +6918,7 @@ as_info_init()
 	// Set up some dynamic functions
 	as_info_set_dynamic("bins", info_get_bins, false);                // Returns bin usage information and used bin names.
 	as_info_set_dynamic("cluster-generation", info_get_cluster_generation, true); // Returns cluster generation.
+	as_info_set_dynamic("fabric-stats", as_fabric_stats_info, false); // Returns per-node fabric transmit statistics.
 	as_info_set_dynamic("get-config", info_get_config, false);        // Returns running config for specified context.
 	as_info_set_dynamic("logs", info_get_logs, false);                // Returns a list of log file locations in use by this server.
 	as_info_set_dynamic("namespaces", info_get_namespaces, false);    // Returns a list of namespace defined on this server.
@@ -6782,6 +6936,7 @@ as_info_init()
 	as_info_set_dynamic("services-alumni",info_get_services_alumni, true); // All neighbor addresses (services) this server has ever know about.
 	as_info_set_dynamic("sets", info_get_sets, false);                // Returns set statistics for all or a particular set.
 	as_info_set_dynamic("statistics", info_get_stats, true);          // Returns system health and usage stats for this server.
+	as_info_set_dynamic("tsvc-queues", thr_tsvc_queue_info, false);   // Returns depth, steals and wait time of each transaction queue.
 
 #ifdef INFO_SEGV_TEST
 	as_info_set_dynamic("segvtest", info_segv_test, true);
@@ -6814,12 +6969,14 @@ as_info_init()
 	as_info_set_command("hist-dump", info_command_hist_dump, PRIV_NONE);                      // Returns a histogram snapshot for a particular histogram.
 	as_info_set_command("hist-track-start", info_command_hist_track, PRIV_SERVICE_CTRL);      // Start or Restart histogram tracking.
 	as_info_set_command("hist-track-stop", info_command_hist_track, PRIV_SERVICE_CTRL);       // Stop histogram tracking.
+	as_info_set_command("hot-keys", info_command_hot_keys, PRIV_NONE);                        // Returns the hottest keys and their contention.
 	as_info_set_command("jem-stats", info_command_jem_stats, PRIV_LOGGING_CTRL);              // Print JEMalloc statistics to the log file.
 	as_info_set_command("latency", info_command_hist_track, PRIV_NONE);                       // Returns latency and throughput information.
 	as_info_set_command("log-set", info_command_log_set, PRIV_LOGGING_CTRL);                  // Set values in the log system.
 	as_info_set_command("mem", info_command_mem, PRIV_NONE);                                  // Report on memory usage.
 	as_info_set_command("mstats", info_command_mstats, PRIV_LOGGING_CTRL);                    // Dump GLibC-level memory stats.
 	as_info_set_command("mtrace", info_command_mtrace, PRIV_SERVICE_CTRL);                    // Control GLibC-level memory tracing.
+	as_info_set_command("percentiles", info_command_hist_track, PRIV_NONE);                   // Returns latency percentiles.
 	as_info_set_command("set-config", info_command_config_set, PRIV_SET_CONFIG);              // Set config values.
 	as_info_set_command("set-log", info_command_log_set, PRIV_LOGGING_CTRL);                  // Set values in the log system.
 	as_info_set_command("set-sl", info_command_set_sl, PRIV_SERVICE_CTRL);                    // Set the Paxos succession list.
@@ -6829,6 +6986,7 @@ as_info_init()
 	as_info_set_command("throughput", info_command_hist_track, PRIV_NONE);                    // Returns throughput info.
 	as_info_set_command("tip", info_command_tip, PRIV_SERVICE_CTRL);                          // Add external IP to mesh-mode heartbeats.
 	as_info_set_command("tip-clear", info_command_tip_clear, PRIV_SERVICE_CTRL);              // Clear tip list from mesh-mode heartbeats.
+	as_info_set_command("traces", info_command_traces, PRIV_NONE);                            // Returns the slowest sampled transaction traces.
 	as_info_set_command("undun", info_command_undun, PRIV_SERVICE_CTRL);                      // Instruct this server to not ignore another node.
 	as_info_set_command("xdr-min-lastshipinfo", info_command_get_min_config, PRIV_NONE);      // Get the min XDR lastshipinfo.
 
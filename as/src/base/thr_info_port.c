@@ -230,6 +230,7 @@ thr_info_port_fn(void *arg)
 	info_socket.proto = SOCK_STREAM;
 	info_socket.port = g_config.info_port;
 	info_socket.reuse_addr = g_config.socket_reuse_addr ? true : false;
+	info_socket.reuse_port = false;
 	// Listen happens here.
 	if (0 != cf_socket_init_svc(&info_socket)) {
 		cf_crash(AS_AS, "couldn't initialize service socket: %s", cf_strerror(errno));
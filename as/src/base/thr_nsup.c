@@ -44,6 +44,7 @@
 #include "fault.h"
 #include "hist.h"
 #include "queue.h"
+#include "timer_wheel.h"
 #include "vmapx.h"
 
 #include "base/cfg.h"
@@ -62,6 +63,7 @@
 //
 
 pthread_t g_nsup_thread;
+static pthread_t g_nsup_expire_index_thread;
 
 
 //==========================================================
@@ -672,6 +674,16 @@ sets_evict_prep_reduce_cb(as_index_ref* r_ref, void* udata)
 	as_record_done(r_ref, ns);
 }
 
+static void
+sets_evict_prep_merge(void* pv_dst, const void* pv_src)
+{
+	sets_evict_prep_info* dst = (sets_evict_prep_info*)pv_dst;
+	const sets_evict_prep_info* src = (const sets_evict_prep_info*)pv_src;
+
+	dst->num_deleted += src->num_deleted;
+	dst->num_expired += src->num_expired;
+}
+
 //------------------------------------------------
 // Reduce callback evicts sets.
 // - evicts based on sets' thresholds
@@ -717,6 +729,16 @@ sets_evict_reduce_cb(as_index_ref* r_ref, void* udata)
 	as_record_done(r_ref, ns);
 }
 
+static void
+sets_evict_merge(void* pv_dst, const void* pv_src)
+{
+	sets_evict_info* dst = (sets_evict_info*)pv_dst;
+	const sets_evict_info* src = (const sets_evict_info*)pv_src;
+
+	dst->num_evicted += src->num_evicted;
+	dst->num_0_void_time += src->num_0_void_time;
+}
+
 //------------------------------------------------
 // Reduce callback deletes sets.
 // - does set deletion
@@ -768,6 +790,17 @@ sets_delete_reduce_cb(as_index_ref* r_ref, void* udata)
 	as_record_done(r_ref, ns);
 }
 
+static void
+sets_delete_merge(void* pv_dst, const void* pv_src)
+{
+	sets_delete_info* dst = (sets_delete_info*)pv_dst;
+	const sets_delete_info* src = (const sets_delete_info*)pv_src;
+
+	dst->num_deleted += src->num_deleted;
+	dst->num_expired += src->num_expired;
+	dst->num_0_void_time += src->num_0_void_time;
+}
+
 //------------------------------------------------
 // Reduce callback prepares for general eviction.
 // - builds object size, general eviction & TTL histograms
@@ -798,6 +831,15 @@ evict_prep_reduce_cb(as_index_ref* r_ref, void* udata)
 	as_record_done(r_ref, ns);
 }
 
+static void
+evict_prep_merge(void* pv_dst, const void* pv_src)
+{
+	evict_prep_info* dst = (evict_prep_info*)pv_dst;
+	const evict_prep_info* src = (const evict_prep_info*)pv_src;
+
+	dst->num_0_void_time += src->num_0_void_time;
+}
+
 //------------------------------------------------
 // Reduce callback evicts records.
 // - evicts based on general threshold
@@ -828,6 +870,15 @@ evict_reduce_cb(as_index_ref* r_ref, void* udata)
 	as_record_done(r_ref, ns);
 }
 
+static void
+evict_merge(void* pv_dst, const void* pv_src)
+{
+	evict_info* dst = (evict_info*)pv_dst;
+	const evict_info* src = (const evict_info*)pv_src;
+
+	dst->num_evicted += src->num_evicted;
+}
+
 //------------------------------------------------
 // Reduce callback expires records.
 // - does general expiration
@@ -866,35 +917,299 @@ expire_reduce_cb(as_index_ref* r_ref, void* udata)
 	as_record_done(r_ref, ns);
 }
 
+static void
+expire_merge(void* pv_dst, const void* pv_src)
+{
+	expire_info* dst = (expire_info*)pv_dst;
+	const expire_info* src = (const expire_info*)pv_src;
+
+	dst->num_expired += src->num_expired;
+	dst->num_0_void_time += src->num_0_void_time;
+}
+
+//------------------------------------------------
+// Reduce callback rebuilds histograms, for laps that
+// leave expiration to the void-time index.
+// - builds object size & general TTL histograms
+// - counts 0-void-time records
+//
+typedef struct hist_info_s {
+	as_namespace*	ns;
+	uint32_t		now;
+	uint32_t		num_0_void_time;
+} hist_info;
+
+static void
+hist_reduce_cb(as_index_ref* r_ref, void* udata)
+{
+	hist_info* p_info = (hist_info*)udata;
+	as_namespace* ns = p_info->ns;
+	uint32_t void_time = r_ref->r->void_time;
+
+	if (void_time != 0) {
+		// Expired but not yet drained from the index - leave it out, as
+		// expire_reduce_cb() would.
+		if (p_info->now <= void_time) {
+			linear_histogram_insert_data_point(ns->obj_size_hist, r_ref->r->storage_key.ssd.n_rblocks);
+			linear_histogram_insert_data_point(ns->ttl_hist, void_time);
+		}
+	}
+	else {
+		linear_histogram_insert_data_point(ns->obj_size_hist, r_ref->r->storage_key.ssd.n_rblocks);
+		p_info->num_0_void_time++;
+	}
+
+	as_record_done(r_ref, ns);
+}
+
+static void
+hist_merge(void* pv_dst, const void* pv_src)
+{
+	hist_info* dst = (hist_info*)pv_dst;
+	const hist_info* src = (const hist_info*)pv_src;
+
+	dst->num_0_void_time += src->num_0_void_time;
+}
+
+//------------------------------------------------
+// Hold the records reduced by all nsup workers, in
+// all namespaces, to nsup-reduce-rate per second
+// since the start of the nsup lap.
+//
+static cf_atomic64 g_nsup_reduce_count = 0;
+static uint64_t g_nsup_reduce_start_ms = 0;
+
+static void
+throttle_reduce(uint64_t n_reduced)
+{
+	uint32_t rate = g_config.nsup_reduce_rate;
+
+	if (rate == 0) {
+		return;
+	}
+
+	uint64_t total = cf_atomic64_add(&g_nsup_reduce_count, n_reduced);
+	uint64_t due_ms = g_nsup_reduce_start_ms + ((total * 1000) / rate);
+	uint64_t now_ms = cf_getms();
+
+	if (due_ms > now_ms) {
+		usleep((due_ms - now_ms) * 1000);
+	}
+}
+
 //------------------------------------------------
 // Reduce all master partitions, using specified
-// functionality. Throttle to make sure deletions
+// functionality, on nsup-threads workers taking
+// partitions in turn. Each worker reduces with its
+// own copy of the callback info, whose counters
+// the merge callback adds back into the caller's
+// info at the end. Throttle to make sure deletions
 // generated by reducing each partition don't blow
 // up the delete queue.
 //
-static void
-reduce_master_partitions(as_namespace* ns, as_index_reduce_fn cb, void* udata, uint32_t* p_n_waits, const char* tag)
+typedef void (*reduce_merge_fn)(void* pv_dst, const void* pv_src);
+
+typedef struct reduce_job_s {
+	as_namespace*		ns;
+	as_index_reduce_fn	cb;
+	const char*			tag;
+	cf_atomic32			next_pid;
+	cf_atomic32			n_waits;
+} reduce_job;
+
+typedef struct reduce_worker_s {
+	pthread_t		thread;
+	reduce_job*		job;
+	void*			udata;
+} reduce_worker;
+
+static void*
+run_reduce_master_partitions(void* pv_data)
 {
+	reduce_worker* p_worker = (reduce_worker*)pv_data;
+	reduce_job* job = p_worker->job;
+	as_namespace* ns = job->ns;
 	as_partition_reservation rsv;
+	int n;
 
-	for (int n = 0; n < AS_PARTITIONS; n++) {
+	while ((n = (int)cf_atomic32_incr(&job->next_pid) - 1) < AS_PARTITIONS) {
 		if (0 != as_partition_reserve_write(ns, n, &rsv, 0, 0)) {
 			continue;
 		}
 
 		cf_atomic_int_incr(&g_config.nsup_tree_count);
 
-		as_index_reduce(rsv.p->vp, cb, udata);
+		uint64_t n_reduced = rsv.tree->elements;
+
+		as_index_reduce(rsv.p->vp, job->cb, p_worker->udata);
 
 		as_partition_release(&rsv);
 		cf_atomic_int_decr(&g_config.nsup_tree_count);
 
+		throttle_reduce(n_reduced);
+
 		while (cf_queue_sz(g_p_nsup_delete_q) > DELETE_Q_SAFETY_THRESHOLD) {
 			usleep(DELETE_Q_SAFETY_SLEEP_us);
-			(*p_n_waits)++;
+			cf_atomic32_incr(&job->n_waits);
 		}
 
-		cf_debug(AS_NSUP, "{%s} %s done partition index %d, waits %u", ns->name, tag, n, *p_n_waits);
+		cf_debug(AS_NSUP, "{%s} %s done partition index %d, waits %u", ns->name, job->tag, n, cf_atomic32_get(job->n_waits));
+	}
+
+	return NULL;
+}
+
+static void
+reduce_master_partitions(as_namespace* ns, as_index_reduce_fn cb, reduce_merge_fn merge_cb, void* udata, size_t udata_sz, uint32_t* p_n_waits, const char* tag)
+{
+	uint32_t n_workers = g_config.nsup_threads;
+	reduce_job job;
+	reduce_worker workers[n_workers];
+	uint64_t udatas[n_workers][(udata_sz + 7) / 8]; // aligned copies
+
+	job.ns = ns;
+	job.cb = cb;
+	job.tag = tag;
+	job.next_pid = 0;
+	job.n_waits = 0;
+
+	// Copy before any worker starts, so no copy picks up another's counts.
+	for (uint32_t i = 0; i < n_workers; i++) {
+		memcpy(udatas[i], udata, udata_sz);
+		workers[i].job = &job;
+		workers[i].udata = udatas[i];
+	}
+
+	// This thread is the first worker.
+	for (uint32_t i = 1; i < n_workers; i++) {
+		if (0 != pthread_create(&workers[i].thread, NULL, run_reduce_master_partitions, &workers[i])) {
+			cf_crash(AS_NSUP, "nsup reduce thread create failed");
+		}
+	}
+
+	run_reduce_master_partitions(&workers[0]);
+
+	for (uint32_t i = 1; i < n_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+
+	// Merge the workers' counters - the caller's started at 0.
+	for (uint32_t i = 0; i < n_workers; i++) {
+		merge_cb(udata, udatas[i]);
+	}
+
+	*p_n_waits += job.n_waits;
+}
+
+//------------------------------------------------
+// Expire records using the partitions' void-time
+// indexes, instead of reducing all records. Cost is
+// proportional to the number of due entries, so it
+// runs on every nsup wake-up, spreading the work.
+//
+typedef struct expire_index_due_s {
+	cf_digest*		digests;
+	uint32_t		n_due;
+	uint32_t		capacity;
+} expire_index_due;
+
+static void
+expire_index_collect_cb(void* ele, uint64_t void_time, void* udata)
+{
+	expire_index_due* p_due = (expire_index_due*)udata;
+
+	if (p_due->n_due == p_due->capacity) {
+		p_due->capacity = p_due->capacity == 0 ? 1024 : p_due->capacity * 2;
+		p_due->digests = cf_realloc(p_due->digests, p_due->capacity * sizeof(cf_digest));
+
+		cf_assert(p_due->digests, AS_NSUP, CF_CRITICAL, "realloc failed: %s", cf_strerror(errno));
+	}
+
+	p_due->digests[p_due->n_due++] = *(cf_digest*)ele;
+}
+
+static void
+expire_index_add(as_partition* p, uint32_t void_time, cf_digest* keyd)
+{
+	pthread_mutex_lock(&p->expire_lock);
+
+	if (0 != cf_timer_wheel_add(p->expire_wheel, void_time, keyd)) {
+		cf_warning(AS_NSUP, "couldn't add to partition expire index");
+	}
+
+	pthread_mutex_unlock(&p->expire_lock);
+}
+
+static void
+expire_index_drain(as_namespace* ns, uint32_t now, expire_index_due* p_due, uint64_t* p_n_expired)
+{
+	as_partition_reservation rsv;
+
+	for (int n = 0; n < AS_PARTITIONS; n++) {
+		as_partition* p = &ns->partitions[n];
+
+		p_due->n_due = 0;
+
+		// Entries keyed before now are due - records expire when now passes
+		// their void-time, as in expire_reduce_cb().
+		pthread_mutex_lock(&p->expire_lock);
+		cf_timer_wheel_advance(p->expire_wheel, now - 1, expire_index_collect_cb, p_due);
+		pthread_mutex_unlock(&p->expire_lock);
+
+		if (p_due->n_due == 0) {
+			continue;
+		}
+
+		// Replicas keep their entries going, in case they become master.
+		bool is_master = true;
+
+		if (0 != as_partition_reserve_write(ns, n, &rsv, 0, 0)) {
+			as_partition_reserve_migrate(ns, n, &rsv, 0);
+			is_master = false;
+		}
+
+		cf_atomic_int_incr(&g_config.nsup_tree_count);
+
+		for (uint32_t i = 0; i < p_due->n_due; i++) {
+			cf_digest* keyd = &p_due->digests[i];
+			as_index_ref r_ref;
+
+			r_ref.skip_lock = false;
+
+			if (0 != as_record_get(rsv.tree, keyd, &r_ref, ns)) {
+				continue; // record is gone - drop entry
+			}
+
+			uint32_t void_time = r_ref.r->void_time;
+
+			as_record_done(&r_ref, ns);
+
+			if (void_time == 0) {
+				continue; // record no longer expires - drop entry
+			}
+
+			if (now > void_time) {
+				if (is_master) {
+					queue_for_delete(ns, keyd);
+					(*p_n_expired)++;
+				}
+
+				// Look again next lap, in case the delete doesn't happen, or
+				// (as replica) the master's delete hasn't arrived yet.
+				expire_index_add(p, now + g_config.nsup_period, keyd);
+			}
+			else {
+				// Void-time was pushed out since the entry was added.
+				expire_index_add(p, void_time, keyd);
+			}
+		}
+
+		as_partition_release(&rsv);
+		cf_atomic_int_decr(&g_config.nsup_tree_count);
+
+		while (cf_queue_sz(g_p_nsup_delete_q) > DELETE_Q_SAFETY_THRESHOLD) {
+			usleep(DELETE_Q_SAFETY_SLEEP_us);
+		}
 	}
 }
 
@@ -1183,276 +1498,369 @@ thr_ldt_sup(void *arg)
 }
 
 //------------------------------------------------
-// Namespace supervisor thread "run" function.
+// Namespace lap "run" function - each period, every
+// namespace's lap runs concurrently on its own thread.
 //
-void *
-thr_nsup(void *arg)
+typedef struct nsup_lap_info_s {
+	pthread_t		thread;
+	as_namespace*	ns;
+	int				prole_pid; // garbage-collect long-expired proles, one partition per lap
+} nsup_lap_info;
+
+static void*
+run_nsup_lap(void* pv_data)
 {
-	cf_info(AS_NSUP, "namespace supervisor started");
+	nsup_lap_info* p_lap = (nsup_lap_info*)pv_data;
 
-	// Garbage-collect long-expired proles, one partition per loop.
-	int prole_pids[g_config.namespaces];
+	uint64_t start_ms = cf_getms();
 
-	for (int n = 0; n < g_config.namespaces; n++) {
-		prole_pids[n] = -1;
-	}
+	as_namespace *ns = p_lap->ns;
 
-	uint64_t last_time = cf_get_seconds();
+	cf_info(AS_NSUP, "{%s} nsup start", ns->name);
 
-	for ( ; ; ) {
-		// Wake up every 1 second to check the nsup timeout.
-		struct timespec delay = { 1, 0 };
-		nanosleep(&delay, NULL);
+	// The "now" used for all expiration and eviction.
+	uint32_t now = as_record_void_time_get();
 
-		uint64_t curr_time = cf_get_seconds();
+	// Get the histogram range - used by all histograms.
+	uint64_t ttl_range = get_ttl_range(ns, now);
 
-		if ((curr_time - last_time) < g_config.nsup_period) {
-			continue; // period has not been reached for running eviction check
-		}
+	linear_histogram_clear(ns->obj_size_hist, 0, cf_atomic32_get(ns->obj_size_hist_max));
+	linear_histogram_clear(ns->ttl_hist, now, ttl_range);
 
-		last_time = curr_time;
+	uint64_t n_expired_records = 0;
+	uint64_t n_0_void_time_records = 0;
+	uint64_t n_deleted_set_records = 0;
+	uint64_t n_evicted_set_records = 0;
+	uint32_t n_set_waits = 0;
 
-		// Iterate over every namespace.
-		for (int i = 0; i < g_config.namespaces; i++) {
-			uint64_t start_ms = cf_getms();
+	uint32_t num_sets = cf_vmapx_count(ns->p_sets_vmap);
 
-			as_namespace *ns = g_config.namespace[i];
+	bool do_set_deletion = false;
+	bool do_set_eviction = false;
 
-			cf_info(AS_NSUP, "{%s} nsup start", ns->name);
+	// Giving these max possible size to spare us checking each record's
+	// set-id during index reduce.
+	bool sets_deleting[AS_SET_MAX_COUNT + 1];
+	bool sets_evicting[AS_SET_MAX_COUNT + 1];
 
-			linear_histogram_clear(ns->obj_size_hist, 0, cf_atomic32_get(ns->obj_size_hist_max));
+	memset(sets_deleting, 0, sizeof(sets_deleting));
+	memset(sets_evicting, 0, sizeof(sets_evicting));
 
-			// The "now" used for all expiration and eviction.
-			uint32_t now = as_record_void_time_get();
+	for (uint32_t j = 0; j < num_sets; j++) {
+		uint32_t set_id = j + 1;
 
-			// Get the histogram range - used by all histograms.
-			uint64_t ttl_range = get_ttl_range(ns, now);
+		clear_set_evict_hist(ns, set_id, now, ttl_range);
+		clear_set_ttl_hist(ns, set_id, now, ttl_range);
 
-			linear_histogram_clear(ns->ttl_hist, now, ttl_range);
+		as_set* p_set;
 
-			uint64_t n_expired_records = 0;
-			uint64_t n_0_void_time_records = 0;
-			uint64_t n_deleted_set_records = 0;
-			uint64_t n_evicted_set_records = 0;
-			uint32_t n_set_waits = 0;
+		if (cf_vmapx_get_by_index(ns->p_sets_vmap, j, (void**)&p_set) == CF_VMAPX_OK) {
+			uint64_t num_elements = cf_atomic64_get(p_set->num_elements);
 
-			uint32_t num_sets = cf_vmapx_count(ns->p_sets_vmap);
+			if (IS_SET_DELETED(p_set)) {
+				if (num_elements != 0) {
+					sets_deleting[set_id] = true;
+					do_set_deletion = true;
 
-			bool do_set_deletion = false;
-			bool do_set_eviction = false;
+					cf_info(AS_NSUP, "{%s} deleting set %s", ns->name, p_set->name);
+					// If we're deleting, that'll take care of eviction.
+					continue;
+				}
 
-			// Giving these max possible size to spare us checking each record's
-			// set-id during index reduce.
-			bool sets_deleting[AS_SET_MAX_COUNT + 1];
-			bool sets_evicting[AS_SET_MAX_COUNT + 1];
+				SET_DELETED_OFF(p_set);
+			}
 
-			memset(sets_deleting, 0, sizeof(sets_deleting));
-			memset(sets_evicting, 0, sizeof(sets_evicting));
+			uint64_t evict_hwm_count = cf_atomic64_get(p_set->evict_hwm_count);
 
-			for (uint32_t j = 0; j < num_sets; j++) {
-				uint32_t set_id = j + 1;
+			if (evict_hwm_count != 0 && num_elements > evict_hwm_count) {
+				sets_evicting[set_id] = true;
+				do_set_eviction = true;
 
-				clear_set_evict_hist(ns, set_id, now, ttl_range);
-				clear_set_ttl_hist(ns, set_id, now, ttl_range);
+				cf_info(AS_NSUP, "{%s} evicting set %s [%d %d]", ns->name, p_set->name, num_elements, evict_hwm_count);
+			}
+		}
+	}
 
-				as_set* p_set;
+	if (do_set_eviction) {
+		// Set eviction is necessary.
 
-				if (cf_vmapx_get_by_index(ns->p_sets_vmap, j, (void**)&p_set) == CF_VMAPX_OK) {
-					uint64_t num_elements = cf_atomic64_get(p_set->num_elements);
+		sets_evict_prep_info cb_info1;
 
-					if (IS_SET_DELETED(p_set)) {
-						if (num_elements != 0) {
-							sets_deleting[set_id] = true;
-							do_set_deletion = true;
+		memset(&cb_info1, 0, sizeof(cb_info1));
+		cb_info1.ns = ns;
+		cb_info1.now = now;
+		cb_info1.sets_deleting = sets_deleting;
+		cb_info1.sets_evicting = sets_evicting;
 
-							cf_info(AS_NSUP, "{%s} deleting set %s", ns->name, p_set->name);
-							// If we're deleting, that'll take care of eviction.
-							continue;
-						}
+		// Reduce master partitions, building histograms to calculate
+		// set thresholds. Also do set deletion and general expiration.
+		reduce_master_partitions(ns, sets_evict_prep_reduce_cb, sets_evict_prep_merge, &cb_info1, sizeof(sets_evict_prep_info), &n_set_waits, "sets-evict-prep");
 
-						SET_DELETED_OFF(p_set);
-					}
+		n_deleted_set_records = cb_info1.num_deleted;
+		n_expired_records = cb_info1.num_expired;
 
-					uint64_t evict_hwm_count = cf_atomic64_get(p_set->evict_hwm_count);
+		// Determine sets' eviction thresholds.
+		uint32_t low_void_times[num_sets];
+		uint32_t high_void_times[num_sets];
+		uint32_t mid_tenths_pcts[num_sets];
 
-					if (evict_hwm_count != 0 && num_elements > evict_hwm_count) {
-						sets_evicting[set_id] = true;
-						do_set_eviction = true;
+		memset(low_void_times, 0, sizeof(low_void_times));
+		memset(high_void_times, 0, sizeof(high_void_times));
+		memset(mid_tenths_pcts, 0, sizeof(mid_tenths_pcts));
 
-						cf_info(AS_NSUP, "{%s} evicting set %s [%d %d]", ns->name, p_set->name, num_elements, evict_hwm_count);
-					}
-				}
-			}
+		get_set_thresholds(ns, sets_evicting, num_sets, now, low_void_times, high_void_times, mid_tenths_pcts);
 
-			if (do_set_eviction) {
-				// Set eviction is necessary.
+		sets_evict_info cb_info2;
 
-				sets_evict_prep_info cb_info1;
+		memset(&cb_info2, 0, sizeof(cb_info2));
+		cb_info2.ns = ns;
+		cb_info2.sets_evicting = sets_evicting;
+		cb_info2.low_void_times = low_void_times;
+		cb_info2.high_void_times = high_void_times;
+		cb_info2.mid_tenths_pcts = mid_tenths_pcts;
 
-				memset(&cb_info1, 0, sizeof(cb_info1));
-				cb_info1.ns = ns;
-				cb_info1.now = now;
-				cb_info1.sets_deleting = sets_deleting;
-				cb_info1.sets_evicting = sets_evicting;
+		// Reduce master partitions, deleting records up to thresholds.
+		reduce_master_partitions(ns, sets_evict_reduce_cb, sets_evict_merge, &cb_info2, sizeof(sets_evict_info), &n_set_waits, "sets-evict");
 
-				// Reduce master partitions, building histograms to calculate
-				// set thresholds. Also do set deletion and general expiration.
-				reduce_master_partitions(ns, sets_evict_prep_reduce_cb, &cb_info1, &n_set_waits, "sets-evict-prep");
+		n_evicted_set_records = cb_info2.num_evicted;
+		n_0_void_time_records = cb_info2.num_0_void_time;
+	}
+	else if (do_set_deletion) {
+		// Set eviction is not necessary, only set deletion.
 
-				n_deleted_set_records = cb_info1.num_deleted;
-				n_expired_records = cb_info1.num_expired;
+		sets_delete_info cb_info;
 
-				// Determine sets' eviction thresholds.
-				uint32_t low_void_times[num_sets];
-				uint32_t high_void_times[num_sets];
-				uint32_t mid_tenths_pcts[num_sets];
+		memset(&cb_info, 0, sizeof(cb_info));
+		cb_info.ns = ns;
+		cb_info.now = now;
+		cb_info.sets_deleting = sets_deleting;
 
-				memset(low_void_times, 0, sizeof(low_void_times));
-				memset(high_void_times, 0, sizeof(high_void_times));
-				memset(mid_tenths_pcts, 0, sizeof(mid_tenths_pcts));
+		// Reduce master partitions, doing set deletion and general
+		// expiration.
+		reduce_master_partitions(ns, sets_delete_reduce_cb, sets_delete_merge, &cb_info, sizeof(sets_delete_info), &n_set_waits, "sets-delete");
 
-				get_set_thresholds(ns, sets_evicting, num_sets, now, low_void_times, high_void_times, mid_tenths_pcts);
+		n_deleted_set_records = cb_info.num_deleted;
+		n_expired_records = cb_info.num_expired;
+		n_0_void_time_records = cb_info.num_0_void_time;
+	}
 
-				sets_evict_info cb_info2;
+	// Wait for delete queue to clear, to reduce the chance we'll need
+	// to do general eviction.
 
-				memset(&cb_info2, 0, sizeof(cb_info2));
-				cb_info2.ns = ns;
-				cb_info2.sets_evicting = sets_evicting;
-				cb_info2.low_void_times = low_void_times;
-				cb_info2.high_void_times = high_void_times;
-				cb_info2.mid_tenths_pcts = mid_tenths_pcts;
+	uint32_t n_clear_waits = 0;
 
-				// Reduce master partitions, deleting records up to thresholds.
-				reduce_master_partitions(ns, sets_evict_reduce_cb, &cb_info2, &n_set_waits, "sets-evict");
+	while (cf_queue_sz(g_p_nsup_delete_q) > 0) {
+		usleep(DELETE_Q_CLEAR_SLEEP_us);
+		n_clear_waits++;
+	}
 
-				n_evicted_set_records = cb_info2.num_evicted;
-				n_0_void_time_records = cb_info2.num_0_void_time;
-			}
-			else if (do_set_deletion) {
-				// Set eviction is not necessary, only set deletion.
+	uint64_t n_evicted_records = 0;
+	uint32_t evict_ttl_low = 0;
+	uint32_t evict_ttl_high = 0;
+	uint32_t evict_mid_tenths_pct = 0;
+	uint32_t n_general_waits = 0;
 
-				sets_delete_info cb_info;
+	// Check whether or not we need to do general eviction.
 
-				memset(&cb_info, 0, sizeof(cb_info));
-				cb_info.ns = ns;
-				cb_info.now = now;
-				cb_info.sets_deleting = sets_deleting;
+	bool hwm_breached = false, stop_writes = false;
 
-				// Reduce master partitions, doing set deletion and general
-				// expiration.
-				reduce_master_partitions(ns, sets_delete_reduce_cb, &cb_info, &n_set_waits, "sets-delete");
+	as_namespace_eval_write_state(ns, &hwm_breached, &stop_writes);
 
-				n_deleted_set_records = cb_info.num_deleted;
-				n_expired_records = cb_info.num_expired;
-				n_0_void_time_records = cb_info.num_0_void_time;
-			}
+	// Store the state of the threshold breaches.
+	cf_atomic32_set(&ns->stop_writes, stop_writes ? 1 : 0);
+	cf_atomic32_set(&ns->hwm_breached, hwm_breached ? 1 : 0);
 
-			// Wait for delete queue to clear, to reduce the chance we'll need
-			// to do general eviction.
+	if (hwm_breached) {
+		// Eviction is necessary.
 
-			uint32_t n_clear_waits = 0;
+		linear_histogram_clear(ns->obj_size_hist, 0, cf_atomic32_get(ns->obj_size_hist_max));
+		linear_histogram_clear(ns->evict_hist, now, MIN(ttl_range, EVICT_HIST_TTL_RANGE));
+		linear_histogram_clear(ns->ttl_hist, now, ttl_range);
 
-			while (cf_queue_sz(g_p_nsup_delete_q) > 0) {
-				usleep(DELETE_Q_CLEAR_SLEEP_us);
-				n_clear_waits++;
-			}
+		evict_prep_info cb_info1;
 
-			uint64_t n_evicted_records = 0;
-			uint32_t evict_ttl_low = 0;
-			uint32_t evict_ttl_high = 0;
-			uint32_t evict_mid_tenths_pct = 0;
-			uint32_t n_general_waits = 0;
+		memset(&cb_info1, 0, sizeof(cb_info1));
+		cb_info1.ns = ns;
 
-			// Check whether or not we need to do general eviction.
+		// Reduce master partitions, building histograms to calculate
+		// general eviction threshold.
+		reduce_master_partitions(ns, evict_prep_reduce_cb, evict_prep_merge, &cb_info1, sizeof(evict_prep_info), &n_general_waits, "evict-prep");
 
-			bool hwm_breached = false, stop_writes = false;
+		n_0_void_time_records = cb_info1.num_0_void_time;
 
-			as_namespace_eval_write_state(ns, &hwm_breached, &stop_writes);
+		evict_info cb_info2;
 
-			// Store the state of the threshold breaches.
-			cf_atomic32_set(&ns->stop_writes, stop_writes ? 1 : 0);
-			cf_atomic32_set(&ns->hwm_breached, hwm_breached ? 1 : 0);
+		memset(&cb_info2, 0, sizeof(cb_info2));
+		cb_info2.ns = ns;
 
-			if (hwm_breached) {
-				// Eviction is necessary.
+		// Determine general eviction thresholds.
+		get_thresholds(ns, &cb_info2.low_void_time, &cb_info2.high_void_time, &cb_info2.mid_tenths_pct);
 
-				linear_histogram_clear(ns->obj_size_hist, 0, cf_atomic32_get(ns->obj_size_hist_max));
-				linear_histogram_clear(ns->evict_hist, now, MIN(ttl_range, EVICT_HIST_TTL_RANGE));
-				linear_histogram_clear(ns->ttl_hist, now, ttl_range);
+		evict_ttl_low = void_time_to_ttl(cb_info2.low_void_time, now);
+		evict_ttl_high = void_time_to_ttl(cb_info2.high_void_time, now);
+		evict_mid_tenths_pct = cb_info2.mid_tenths_pct;
 
-				evict_prep_info cb_info1;
+		cf_info(AS_NSUP, "{%s} evict ttls %u,%d,0.%03u", ns->name, evict_ttl_low, evict_ttl_high, evict_mid_tenths_pct);
 
-				memset(&cb_info1, 0, sizeof(cb_info1));
-				cb_info1.ns = ns;
+		// Reduce master partitions, deleting records up to threshold.
+		// (This automatically deletes expired records.)
+		reduce_master_partitions(ns, evict_reduce_cb, evict_merge, &cb_info2, sizeof(evict_info), &n_general_waits, "evict");
 
-				// Reduce master partitions, building histograms to calculate
-				// general eviction threshold.
-				reduce_master_partitions(ns, evict_prep_reduce_cb, &cb_info1, &n_general_waits, "evict-prep");
+		n_evicted_records = cb_info2.num_evicted;
 
-				n_0_void_time_records = cb_info1.num_0_void_time;
+		linear_histogram_dump(ns->evict_hist);
+		linear_histogram_save_info(ns->evict_hist);
 
-				evict_info cb_info2;
+		// Save the eviction depth in the device header(s) so it can be
+		// used to speed up cold start.
+		as_storage_save_evict_void_time(ns, cb_info2.low_void_time);
+	}
+	else if (! (do_set_deletion || do_set_eviction)) {
+		// Eviction is not necessary, only expiration. (But if set
+		// deletion and/or eviction was done, expiration has already
+		// been done.)
 
-				memset(&cb_info2, 0, sizeof(cb_info2));
-				cb_info2.ns = ns;
+		if (ns->nsup_expire_index) {
+			// Expiration is done continuously from the void-time
+			// index - just rebuild the histograms.
+			hist_info cb_info;
 
-				// Determine general eviction thresholds.
-				get_thresholds(ns, &cb_info2.low_void_time, &cb_info2.high_void_time, &cb_info2.mid_tenths_pct);
+			memset(&cb_info, 0, sizeof(cb_info));
+			cb_info.ns = ns;
+			cb_info.now = now;
 
-				evict_ttl_low = void_time_to_ttl(cb_info2.low_void_time, now);
-				evict_ttl_high = void_time_to_ttl(cb_info2.high_void_time, now);
-				evict_mid_tenths_pct = cb_info2.mid_tenths_pct;
+			reduce_master_partitions(ns, hist_reduce_cb, hist_merge, &cb_info, sizeof(hist_info), &n_general_waits, "hist");
 
-				cf_info(AS_NSUP, "{%s} evict ttls %u,%d,0.%03u", ns->name, evict_ttl_low, evict_ttl_high, evict_mid_tenths_pct);
+			n_0_void_time_records = cb_info.num_0_void_time;
+		}
+		else {
+			expire_info cb_info;
+
+			memset(&cb_info, 0, sizeof(cb_info));
+			cb_info.ns = ns;
+			cb_info.now = now;
 
-				// Reduce master partitions, deleting records up to threshold.
-				// (This automatically deletes expired records.)
-				reduce_master_partitions(ns, evict_reduce_cb, &cb_info2, &n_general_waits, "evict");
+			// Reduce master partitions, deleting expired records.
+			reduce_master_partitions(ns, expire_reduce_cb, expire_merge, &cb_info, sizeof(expire_info), &n_general_waits, "expire");
+
+			n_expired_records = cb_info.num_expired;
+			n_0_void_time_records = cb_info.num_0_void_time;
+		}
+	}
+
+	// Report what the void-time index expired since the last lap along with
+	// this lap's own.
+	if (ns->nsup_expire_index) {
+		uint64_t n_index_expired = cf_atomic_int_get(ns->n_index_expired_objects);
+
+		cf_atomic_int_sub(&ns->n_index_expired_objects, n_index_expired);
+		n_expired_records += n_index_expired;
+	}
 
-				n_evicted_records = cb_info2.num_evicted;
+	linear_histogram_dump(ns->obj_size_hist);
+	linear_histogram_save_info(ns->obj_size_hist);
+	linear_histogram_dump(ns->ttl_hist);
+	linear_histogram_save_info(ns->ttl_hist);
 
-				linear_histogram_dump(ns->evict_hist);
-				linear_histogram_save_info(ns->evict_hist);
+	update_stats(ns, linear_histogram_get_total(ns->ttl_hist) + n_0_void_time_records, n_0_void_time_records,
+			n_expired_records, n_evicted_records,
+			n_deleted_set_records, n_evicted_set_records,
+			evict_ttl_low, evict_ttl_high, evict_mid_tenths_pct,
+			n_set_waits, n_clear_waits, n_general_waits, start_ms);
 
-				// Save the eviction depth in the device header(s) so it can be
-				// used to speed up cold start.
-				as_storage_save_evict_void_time(ns, cb_info2.low_void_time);
+	// Garbage-collect long-expired proles, one partition per loop.
+	if (g_config.prole_extra_ttl != 0) {
+		p_lap->prole_pid = garbage_collect_next_prole_partition(ns, p_lap->prole_pid);
+	}
+
+	return NULL;
+}
+
+//------------------------------------------------
+// Void-time index thread "run" function - every
+// second, expire what's due in namespaces with a
+// void-time index. Separate from thr_nsup(), which
+// waits for whole laps. Expirations are counted in
+// the next lap's stats.
+//
+static void *
+thr_nsup_expire_index(void *arg)
+{
+	expire_index_due due;
+
+	memset(&due, 0, sizeof(due));
+
+	for ( ; ; ) {
+		struct timespec delay = { 1, 0 };
+		nanosleep(&delay, NULL);
+
+		for (int i = 0; i < g_config.namespaces; i++) {
+			as_namespace *ns = g_config.namespace[i];
+
+			if (! ns->nsup_expire_index) {
+				continue;
 			}
-			else if (! (do_set_deletion || do_set_eviction)) {
-				// Eviction is not necessary, only expiration. (But if set
-				// deletion and/or eviction was done, expiration has already
-				// been done.)
 
-				expire_info cb_info;
+			uint64_t n_expired_records = 0;
 
-				memset(&cb_info, 0, sizeof(cb_info));
-				cb_info.ns = ns;
-				cb_info.now = now;
+			expire_index_drain(ns, as_record_void_time_get(), &due, &n_expired_records);
 
-				// Reduce master partitions, deleting expired records.
-				reduce_master_partitions(ns, expire_reduce_cb, &cb_info, &n_general_waits, "expire");
+			if (n_expired_records != 0) {
+				cf_atomic_int_add(&ns->n_index_expired_objects, n_expired_records);
 
-				n_expired_records = cb_info.num_expired;
-				n_0_void_time_records = cb_info.num_0_void_time;
+				cf_detail(AS_NSUP, "{%s} expire index: %"PRIu64" expired", ns->name, n_expired_records);
 			}
+		}
+	}
+
+	return NULL;
+}
 
-			linear_histogram_dump(ns->obj_size_hist);
-			linear_histogram_save_info(ns->obj_size_hist);
-			linear_histogram_dump(ns->ttl_hist);
-			linear_histogram_save_info(ns->ttl_hist);
+//------------------------------------------------
+// Namespace supervisor thread "run" function.
+//
+void *
+thr_nsup(void *arg)
+{
+	cf_info(AS_NSUP, "namespace supervisor started");
 
-			update_stats(ns, linear_histogram_get_total(ns->ttl_hist) + n_0_void_time_records, n_0_void_time_records,
-					n_expired_records, n_evicted_records,
-					n_deleted_set_records, n_evicted_set_records,
-					evict_ttl_low, evict_ttl_high, evict_mid_tenths_pct,
-					n_set_waits, n_clear_waits, n_general_waits, start_ms);
+	nsup_lap_info laps[g_config.namespaces];
 
-			// Garbage-collect long-expired proles, one partition per loop.
-			if (g_config.prole_extra_ttl != 0) {
-				prole_pids[i] = garbage_collect_next_prole_partition(ns, prole_pids[i]);
+	for (int n = 0; n < g_config.namespaces; n++) {
+		laps[n].ns = g_config.namespace[n];
+		laps[n].prole_pid = -1;
+	}
+
+	uint64_t last_time = cf_get_seconds();
+
+	for ( ; ; ) {
+		// Wake up every 1 second to check the nsup timeout.
+		struct timespec delay = { 1, 0 };
+		nanosleep(&delay, NULL);
+
+		uint64_t curr_time = cf_get_seconds();
+
+		if ((curr_time - last_time) < g_config.nsup_period) {
+			continue; // period has not been reached for running eviction check
+		}
+
+		last_time = curr_time;
+
+		// Hold all of this lap's reducing to nsup-reduce-rate.
+		cf_atomic64_set(&g_nsup_reduce_count, 0);
+		g_nsup_reduce_start_ms = cf_getms();
+
+		// Run every namespace's lap concurrently.
+		for (int i = 0; i < g_config.namespaces; i++) {
+			if (0 != pthread_create(&laps[i].thread, NULL, run_nsup_lap, &laps[i])) {
+				cf_crash(AS_NSUP, "nsup lap thread create failed");
 			}
 		}
 
+		for (int i = 0; i < g_config.namespaces; i++) {
+			pthread_join(laps[i].thread, NULL);
+		}
+
 		uint32_t n_clear_waits = 0;
 
 		while (cf_queue_sz(g_p_nsup_delete_q) > 0) {
@@ -1492,6 +1900,11 @@ as_nsup_start()
 		cf_crash(AS_NSUP, "nsup thread create failed");
 	}
 
+	// Start thread to expire from void-time indexes between laps.
+	if (0 != pthread_create(&g_nsup_expire_index_thread, NULL, thr_nsup_expire_index, NULL)) {
+		cf_crash(AS_NSUP, "nsup expire index thread create failed");
+	}
+
 	// Start LDT supervisor thread to do all sub-record deletions.
 	if (0 != pthread_create(&g_ldt_sub_gc_thread, 0, thr_ldt_sup, NULL)) {
 		cf_crash(AS_NSUP, "ldt nsup thread create failed");
@@ -45,6 +45,7 @@
 
 #include "fault.h"
 #include "msg.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 #include "base/datamodel.h"
@@ -96,6 +97,7 @@ typedef struct {
 	msg		        *fab_msg;    // this is the fabric message in case we have to retransmit
 	cf_clock         xmit_ms;    // the ms time of the NEXT retransmit
 	uint32_t         retry_interval_ms; // number of ms to wait next time
+	cf_clock         timer_ms;   // deadline of the live retransmit timer entry
 	uint64_t         start_time;
 	uint64_t         end_time;
 
@@ -115,6 +117,13 @@ static cf_atomic32   g_proxy_tid = 0;
 
 static shash *g_proxy_hash = 0;
 
+// Retransmit deadlines, keyed by tid, so the retransmit thread only visits
+// requests that are due instead of reducing over the whole hash.
+#define PROXY_TIMER_TICK_MS 10
+
+static cf_timer_wheel *g_proxy_wheel = 0;
+static pthread_mutex_t g_proxy_wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static pthread_t g_proxy_retransmit_th;
 
 
@@ -125,6 +134,24 @@ proxy_id_hash(void *value)
 }
 
 
+// (Re-)arm a request's retransmit timer at its xmit_ms. Caller holds the
+// request's lock, or hasn't yet put it in the hash. An earlier entry left on
+// the wheel is recognized as stale by its deadline no longer matching.
+static void
+proxy_timer_arm(uint32_t tid, proxy_request *pr)
+{
+	pthread_mutex_lock(&g_proxy_wheel_lock);
+
+	pr->timer_ms = pr->xmit_ms;
+
+	if (0 != cf_timer_wheel_add(g_proxy_wheel, pr->timer_ms, &tid)) {
+		cf_warning(AS_PROXY, "failed adding proxy timer for tid %u", tid);
+	}
+
+	pthread_mutex_unlock(&g_proxy_wheel_lock);
+}
+
+
 // Sometimes it's good for other units (currently, thr_write) to be able to tell
 // whether two proxy messages are really the "same". This function assumes
 // you've already compared the nodes they came from.
@@ -141,10 +168,10 @@ as_proxy_msg_compare(msg *m1, msg *m2)
 
 void as_proxy_set_stat_counters(int rv) {
 	if (rv == 0) {
-		cf_atomic_int_incr(&g_config.stat_proxy_success);
+		cf_shard_counter_incr(&g_config.stat_proxy_success);
 	}
 	else {
-		cf_atomic_int_incr(&g_config.stat_proxy_errs);
+		cf_shard_counter_incr(&g_config.stat_proxy_errs);
 	}
 }
 
@@ -159,9 +186,9 @@ as_proxy_divert(cf_node dst, as_transaction *tr, as_namespace *ns, uint64_t clus
 {
 	cf_detail(AS_PROXY, "proxy divert");
 
-	cf_atomic_int_incr(&g_config.stat_proxy_reqs);
+	cf_shard_counter_incr(&g_config.stat_proxy_reqs);
 	if (tr->msgp && (tr->msgp->msg.info1 & AS_MSG_INFO1_XDR)) {
-		cf_atomic_int_incr(&g_config.stat_proxy_reqs_xdr);
+		cf_shard_counter_incr(&g_config.stat_proxy_reqs_xdr);
 	}
 	as_partition_id pid = as_partition_getid(tr->keyd);
 
@@ -204,6 +231,8 @@ as_proxy_divert(cf_node dst, as_transaction *tr, as_namespace *ns, uint64_t clus
 	pr.ns = ns;
 	pr.wr = NULL;
 
+	proxy_timer_arm(tid, &pr);
+
 	if (0 != shash_put(g_proxy_hash, &tid, &pr)) {
 		cf_debug(AS_PROXY, " shash_put failed, need cleanup code");
 		return -1;
@@ -216,7 +245,7 @@ as_proxy_divert(cf_node dst, as_transaction *tr, as_namespace *ns, uint64_t clus
 		as_fabric_msg_put(m);
 	}
 
-	cf_atomic_int_incr(&g_config.proxy_initiate);
+	cf_shard_counter_incr(&g_config.proxy_initiate);
 
 	return 0;
 }
@@ -269,6 +298,8 @@ as_proxy_shipop(cf_node dst, write_request *wr)
 	pr.pid         = pid;
 	pr.fd_h        = NULL;
 
+	proxy_timer_arm(tid, &pr);
+
 	if (0 != shash_put(g_proxy_hash, &tid, &pr)) {
 		cf_info(AS_PROXY, " shash_put failed, need cleanup code");
 		return -1;
@@ -281,7 +312,7 @@ as_proxy_shipop(cf_node dst, write_request *wr)
 		as_fabric_msg_put(m);
 	}
 
-	cf_atomic_int_incr(&g_config.proxy_initiate);
+	cf_shard_counter_incr(&g_config.proxy_initiate);
 
 	return 0;
 }
@@ -379,30 +410,9 @@ as_proxy_shipop_response_hdlr(msg *m, proxy_request *pr, bool *free_msg)
 				if (0 != msg_get_buf(m, PROXY_FIELD_AS_PROTO, (byte **) &proto, &proto_sz, MSG_GET_DIRECT)) {
 					cf_info(AS_PROXY, "msg get buf failed!");
 				}
-				size_t pos = 0;
-				while (pos < proto_sz) {
-					rv = send(wr->proto_fd_h->fd, (((uint8_t *)proto) + pos), proto_sz - pos, MSG_NOSIGNAL);
-					if (rv > 0) {
-						pos += rv;
-					}
-					else if (rv < 0) {
-						if (errno != EWOULDBLOCK) {
-							// Common message when a client aborts.
-							cf_debug(AS_PROTO, "protocol proxy write fail: fd %d "
-									"sz %d pos %d rv %d errno %d",
-									wr->proto_fd_h->fd, proto_sz, pos, rv, errno);
-							shutdown(wr->proto_fd_h->fd, SHUT_RDWR);
-							break;
-						}
-						usleep(1); // yield
-					}
-					else {
-						cf_info(AS_PROTO, "protocol write fail zero return: fd %d sz %d pos %d ",
-								wr->proto_fd_h->fd, proto_sz, pos);
-						shutdown(wr->proto_fd_h->fd, SHUT_RDWR);
-						break;
-					}
-				}
+				// Never blocks - a failed write is logged and the
+				// connection shut down in there.
+				as_msg_send_fh(wr->proto_fd_h, (uint8_t *)proto, proto_sz, false);
 				cf_detail(AS_PROXY, "SHIPPED_OP ORIG [Digest %"PRIx64"] Response Sent to Client",
 						*(uint64_t *)&wr->keyd);
 				PRINTD(&wr->keyd);
@@ -450,7 +460,7 @@ proxy_msg_fn(cf_node id, msg *m, void *udata)
 	switch (op) {
 		case PROXY_OP_REQUEST:
 		{
-			cf_atomic_int_incr(&g_config.proxy_action);
+			cf_shard_counter_incr(&g_config.proxy_action);
 
 #ifdef DEBUG
 			cf_debug(AS_PROXY, "Proxy_msg: received request");
@@ -560,36 +570,17 @@ proxy_msg_fn(cf_node id, msg *m, void *udata)
 					}
 #endif
 
-					// Write to the file descriptor.
+					// Write to the file descriptor. Never blocks - a slow
+					// client mustn't hold up the fabric thread.
 					cf_detail(AS_PROXY, "direct write fd %d", pr.fd_h->fd);
 					cf_assert(pr.fd_h->fd, AS_PROXY, CF_WARNING, "attempted write to fd 0");
-					{
-						size_t pos = 0;
-						while (pos < proto_sz) {
-							rv = send(pr.fd_h->fd, (((uint8_t *)proto) + pos), proto_sz - pos, MSG_NOSIGNAL);
-							if (rv > 0) {
-								pos += rv;
-							}
-							else if (rv < 0) {
-								if (errno != EWOULDBLOCK) {
-									// Common message when a client aborts.
-									cf_debug(AS_PROTO, "protocol proxy write fail: fd %d sz %d pos %d rv %d errno %d", pr.fd_h->fd, proto_sz, pos, rv, errno);
-									shutdown(pr.fd_h->fd, SHUT_RDWR);
-									as_proxy_set_stat_counters(-1);
-									goto SendFin;
-								}
-								usleep(1); // yield
-							}
-							else {
-								cf_info(AS_PROTO, "protocol write fail zero return: fd %d sz %d pos %d ", pr.fd_h->fd, proto_sz, pos);
-								shutdown(pr.fd_h->fd, SHUT_RDWR);
-								as_proxy_set_stat_counters(-1);
-								goto SendFin;
-							}
-						}
+					if (0 != as_msg_send_fh(pr.fd_h, (uint8_t *)proto, proto_sz, false)) {
+						as_proxy_set_stat_counters(-1);
+					}
+					else {
 						as_proxy_set_stat_counters(0);
 					}
-SendFin:
+
 					cf_hist_track_insert_data_point(g_config.px_hist, pr.start_time);
 
 					// Return the fabric message or the direct file descriptor -
@@ -677,6 +668,7 @@ SendFin:
 				// Change the destination, update the retransmit time.
 				pr->dest = new_dst;
 				pr->xmit_ms = cf_getms() + 1;
+				proxy_timer_arm(transaction_id, pr);
 
 				// Send it.
 				msg_incr_ref(pr->fab_msg);
@@ -825,7 +817,7 @@ Retry:
 			return 0;
 		}
 
-		cf_atomic_int_incr(&g_config.proxy_retry);
+		cf_shard_counter_incr(&g_config.proxy_retry);
 
 		int rv = as_fabric_send(pr->dest, pr->fab_msg, AS_FABRIC_PRIORITY_MEDIUM);
 		// TODO: make sure the retransmit op does not apply more than once?
@@ -922,19 +914,85 @@ Retry:
 } // end proxy_retransmit_reduce_fn()
 
 
+typedef struct proxy_due_s {
+	uint64_t expire_ms;
+	uint32_t tid;
+} proxy_due;
+
+typedef struct proxy_due_list_s {
+	proxy_due *due;
+	uint32_t n_due;
+	uint32_t capacity;
+} proxy_due_list;
+
+void
+proxy_timer_collect_fn(void *ele, uint64_t expire_ms, void *udata)
+{
+	proxy_due_list *list = (proxy_due_list *)udata;
+
+	if (list->n_due == list->capacity) {
+		uint32_t capacity = list->capacity ? list->capacity * 2 : 1024;
+
+		list->due = cf_realloc(list->due, capacity * sizeof(proxy_due));
+
+		if (! list->due) {
+			cf_crash(AS_PROXY, "cf_realloc");
+		}
+
+		list->capacity = capacity;
+	}
+
+	proxy_due *due = &list->due[list->n_due++];
+
+	due->expire_ms = expire_ms;
+	due->tid = *(uint32_t *)ele;
+}
+
+
 void *
 proxy_retransmit_fn(void *gcc_is_ass)
 {
-	while (1) {
-		usleep(75 * 1000);
+	proxy_due_list list = { 0 };
 
-		cf_detail(AS_PROXY, "proxy retransmit: size %d", shash_get_size(g_proxy_hash));
+	while (1) {
+		usleep(PROXY_TIMER_TICK_MS * 1000);
 
 		now_times now;
 		now.now_ns = cf_getns();
 		now.now_ms = now.now_ns / 1000000;
 
-		shash_reduce_delete(g_proxy_hash, proxy_retransmit_reduce_fn, (void *) &now);
+		list.n_due = 0;
+
+		pthread_mutex_lock(&g_proxy_wheel_lock);
+		cf_timer_wheel_advance(g_proxy_wheel, now.now_ms, proxy_timer_collect_fn, &list);
+		pthread_mutex_unlock(&g_proxy_wheel_lock);
+
+		if (list.n_due != 0) {
+			cf_detail(AS_PROXY, "proxy retransmit: size %d due %u", shash_get_size(g_proxy_hash), list.n_due);
+		}
+
+		for (uint32_t i = 0; i < list.n_due; i++) {
+			uint32_t tid = list.due[i].tid;
+			proxy_request *pr;
+			pthread_mutex_t *pr_lock;
+
+			// Request already finished.
+			if (SHASH_OK != shash_get_vlock(g_proxy_hash, &tid, (void **)&pr, &pr_lock)) {
+				continue;
+			}
+
+			// Only act on the request's live timer entry, not stale ones.
+			if (pr->timer_ms == list.due[i].expire_ms) {
+				if (SHASH_REDUCE_DELETE == proxy_retransmit_reduce_fn(&tid, pr, &now)) {
+					shash_delete_lockfree(g_proxy_hash, &tid);
+				}
+				else {
+					proxy_timer_arm(tid, pr);
+				}
+			}
+
+			pthread_mutex_unlock(pr_lock);
+		}
 	}
 
 	return NULL;
@@ -953,6 +1011,7 @@ proxy_node_delete_reduce_fn(void *key, void *data, void *udata)
 
 	if (pr->dest == *node) {
 		pr->xmit_ms = 0;
+		proxy_timer_arm(*(uint32_t *)key, pr);
 
 		uint32_t	*tid = (uint32_t *) data;
 		cf_debug(AS_PROXY, "node fail: speed proxy transaction tid %d", *tid);
@@ -1056,6 +1115,10 @@ as_proxy_init()
 
 	shash_create(&g_proxy_hash, proxy_id_hash, sizeof(uint32_t), sizeof(proxy_request), 4 * 1024, SHASH_CR_MT_MANYLOCK);
 
+	if (! (g_proxy_wheel = cf_timer_wheel_create(sizeof(uint32_t), PROXY_TIMER_TICK_MS, cf_getms()))) {
+		cf_crash(AS_PROXY, "couldn't create proxy timer wheel");
+	}
+
 	pthread_create(&g_proxy_retransmit_th, 0, proxy_retransmit_fn, 0);
 
 	as_fabric_register_msg_fn(M_TYPE_PROXY, proxy_mt, sizeof(proxy_mt), proxy_msg_fn, NULL);
@@ -102,6 +102,7 @@
 #include "ai_btree.h"
 #include "bt.h"
 #include "bt_iterator.h"
+#include "stream.h"
 
 #include "base/datamodel.h"
 #include "base/secondary_index.h"
@@ -774,6 +775,7 @@ as_query__transaction_done(as_query_transaction *qtr)
 
 	as_query__release_fd(qtr);
 
+	if (qtr->inited)      ai_objFree(&qtr->bkey);
 	if (qtr->srange)      as_sindex_range_free(&qtr->srange);
 	if (qtr->si)          AS_SINDEX_RELEASE(qtr->si);
 	if (qtr->binlist)     cf_vector_destroy(qtr->binlist);
@@ -1017,33 +1019,18 @@ as_query__send_response(as_query_transaction *qtr)
 
 	if (qtr->fd_h == 0) return AS_QUERY_ERR;
 
-	int pos = 0, rv;
-	while (pos < 8) {
-		rv = send(qtr->fd_h->fd, ((uint8_t *) &proto) + pos, 8 - pos , MSG_NOSIGNAL | MSG_MORE);
-		if (rv <= 0) {
-			if (errno != EAGAIN) {
-				cf_debug( AS_QUERY, "query send response error returned %d errno %d fd %d", rv, errno, qtr->fd_h->fd);
-				as_query__release_fd(qtr);
-				return AS_QUERY_ERR;
-			}
-		}
-		else {
-			pos += rv;
-		}
-	};
-	pos = 0;
-	while (pos < len) {
-		rv = send(qtr->fd_h->fd, buf + pos, len - pos, MSG_NOSIGNAL );
-		if (rv <= 0) {
-			if (errno != EAGAIN) {
-				cf_debug( AS_QUERY, "query send response error returned %d errno %d fd %d", rv, errno, qtr->fd_h->fd);
-				as_query__release_fd(qtr);
-				return AS_QUERY_ERR;
-			}
-		}
-		else {
-			pos += rv;
-		}
+	struct iovec iov[2];
+	iov[0].iov_base = &proto;
+	iov[0].iov_len  = 8;
+	iov[1].iov_base = buf;
+	iov[1].iov_len  = len;
+
+	// Throttled - waits for a slow client to drain the backlog instead of
+	// piling up the whole result set in memory.
+	if (as_msg_send_fh_iov(qtr->fd_h, iov, 2, true) != 0) {
+		cf_debug( AS_QUERY, "query send response error fd %d", qtr->fd_h->fd);
+		as_query__release_fd(qtr);
+		return AS_QUERY_ERR;
 	}
 	qtr->net_io_bytes += ( len + 8 );
 	return AS_QUERY_OK;
@@ -1182,9 +1169,8 @@ as_query_record_matches(as_query_transaction *qtr, as_storage_rd *rd)
 			char buf[psz + 1];
 			as_particle_tobuf(b, (uint8_t *) buf, &psz);
 			buf[psz]     = '\0';
-			cf_digest bin_digest;
-			cf_digest_compute( buf, psz, &bin_digest);
-			if (memcmp(&bin_digest, &start->digest, AS_DIGEST_KEY_SZ)) {
+			if ((strLenCmp(buf, psz, start->u.str.val, start->u.str.len) < 0)
+					|| (strLenCmp(buf, psz, end->u.str.val, end->u.str.len) > 0)) {
 				cf_detail(AS_QUERY, "as_query_record_validation: "
 						" String mismatch |%s|  of size %d", buf, psz);
 				return false;
@@ -2253,7 +2239,7 @@ as_query(as_transaction *tr)
 		tr->result_code = AS_PROTO_RESULT_OK;
 		cf_info(AS_QUERY, "Query on non-existent set %s", setname);
 		// Send FIN packet to client to ignore this.
-		as_msg_send_fin(tr->proto_fd_h->fd, AS_PROTO_RESULT_OK);
+		as_msg_send_fin(tr->proto_fd_h, AS_PROTO_RESULT_OK);
 		if (tr->msgp) {
 			cf_free(tr->msgp);
 			tr->msgp = NULL;
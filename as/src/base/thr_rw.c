@@ -56,6 +56,7 @@
 #include "jem.h"
 
 #include "base/datamodel.h"
+#include "base/hot_keys.h"
 #include "base/ldt.h"
 #include "base/rec_props.h"
 #include "base/secondary_index.h"
@@ -69,6 +70,7 @@
 #include "fabric/fabric.h"
 #include "fabric/paxos.h"
 #include "storage/storage.h"
+#include "timer_wheel.h"
 
 
 // Per-Transaction Consistency Guarantees:
@@ -116,6 +118,7 @@ msg_template rw_mt[] =
 	{ RW_FIELD_INFO, M_FT_UINT32 },
 	{ RW_FIELD_REC_PROPS, M_FT_BUF },
 	{ RW_FIELD_MULTIOP, M_FT_BUF },
+	{ RW_FIELD_BATCH, M_FT_BUF },
 };
 // General Debug Stmts
 // #define DEBUG 1
@@ -125,9 +128,26 @@ msg_template rw_mt[] =
 // #define EXTRA_CHECKS 1
 static cf_atomic32 init_counter = 0;
 static cf_atomic32 g_rw_tid = 0;
-static rchash *g_write_hash = 0;
 static pthread_t g_rw_retransmit_th;
 
+//
+// The write request table is split into independently locked shards, each
+// with a timer wheel holding the next retransmit or timeout deadline of every
+// request in it. The retransmit thread then only visits requests that are due,
+// instead of reducing over the whole table every pass.
+//
+#define RW_N_SHARDS 16
+#define RW_TIMER_TICK_MS 10
+
+typedef struct rw_shard_s {
+	rchash *hash;
+	pthread_mutex_t wheel_lock;
+	cf_timer_wheel *wheel; // entries are global_keyd
+} rw_shard;
+
+static rw_shard g_rw_shards[RW_N_SHARDS];
+static bool g_rw_shards_ready = false;
+
 // HELPER
 void print_digest(u_char *d) {
 	printf("0x");
@@ -157,6 +177,10 @@ void rw_replicate_process_ack(cf_node node, msg * m, bool is_write);
 void rw_replicate_async(cf_node node, msg *m);
 int rw_replicate_init(void);
 int rw_multi_process(cf_node node, msg *m);
+int rw_batch_enqueue(cf_node node, msg *m);
+int rw_batch_init(void);
+int rw_write_batch_process(cf_node node, msg *m);
+void rw_write_batch_process_ack(cf_node node, msg *m);
 
 uint32_t
 write_digest_hash(void *value, uint32_t value_len)
@@ -168,6 +192,83 @@ write_digest_hash(void *value, uint32_t value_len)
 			| (gkd->keyd.digest[DIGEST_SCRAMBLE_BYTE3]));
 }
 
+// Choose the shard with a digest byte not used by write_digest_hash() or for
+// the partition id, so neither distribution skews the other.
+#define DIGEST_SHARD_BYTE 3
+
+static inline rw_shard *
+rw_shard_get(const global_keyd *gk)
+{
+	return &g_rw_shards[gk->keyd.digest[DIGEST_SHARD_BYTE] % RW_N_SHARDS];
+}
+
+static int
+rw_hash_put_unique(global_keyd *gk, write_request *wr)
+{
+	return rchash_put_unique(rw_shard_get(gk)->hash, gk, sizeof(global_keyd), wr);
+}
+
+static int
+rw_hash_get(global_keyd *gk, write_request **wr)
+{
+	return rchash_get(rw_shard_get(gk)->hash, gk, sizeof(global_keyd), (void **)wr);
+}
+
+static int
+rw_hash_delete(global_keyd *gk)
+{
+	return rchash_delete(rw_shard_get(gk)->hash, gk, sizeof(global_keyd));
+}
+
+static void
+rw_hash_reduce(rchash_reduce_fn reduce_fn, void *udata)
+{
+	for (int i = 0; i < RW_N_SHARDS; i++) {
+		rchash_reduce(g_rw_shards[i].hash, reduce_fn, udata);
+	}
+}
+
+static uint32_t
+rw_hash_size()
+{
+	uint32_t size = 0;
+
+	for (int i = 0; i < RW_N_SHARDS; i++) {
+		size += rchash_get_size(g_rw_shards[i].hash);
+	}
+
+	return size;
+}
+
+//
+// (Re-)arm a request's timer at its next deadline - the retransmit time if
+// it's ready, otherwise (or if sooner) the transaction timeout. An earlier
+// entry left on the wheel is recognized as stale by its deadline no longer
+// matching wr->timer_ms, so there's no need to find and remove it.
+//
+static void
+rw_timer_arm(const global_keyd *gk, write_request *wr)
+{
+	rw_shard *shard = rw_shard_get(gk);
+	cf_clock end_ms = cf_atomic64_get(wr->end_time) / 1000000;
+	cf_clock deadline_ms = end_ms;
+
+	if (wr->ready && wr->xmit_ms < end_ms) {
+		deadline_ms = wr->xmit_ms;
+	}
+
+	pthread_mutex_lock(&shard->wheel_lock);
+
+	wr->timer_ms = deadline_ms;
+
+	if (0 != cf_timer_wheel_add(shard->wheel, deadline_ms, gk)) {
+		cf_warning(AS_RW, "failed adding write request timer %"PRIx64"",
+				*(uint64_t *)&gk->keyd);
+	}
+
+	pthread_mutex_unlock(&shard->wheel_lock);
+}
+
 /*
  Put pending transaction request back on the main transaction queue
  */
@@ -227,6 +328,7 @@ write_request_create(void) {
 
 	// initialize waiting transaction queue
 	wr->wait_queue_head = NULL;
+	wr->wait_queue_depth = 0;
 	if (0 != pthread_mutex_init(&wr->lock, 0))
 		cf_crash(AS_RW, "couldn't initialize partition vinfo set lock: %s",
 				cf_strerror(errno));
@@ -238,6 +340,7 @@ write_request_create(void) {
 	wr->dest_sz = 0;
 	UREQ_DATA_INIT(&wr->udata);
 	memset((void *) & (wr->dup_msg[0]), 0, sizeof(wr->dup_msg));
+	wr->trace.sampled = false;
 
 	return (wr);
 }
@@ -274,6 +377,7 @@ int write_request_init_tr(as_transaction *tr, void *wreq) {
 	UREQ_DATA_COPY(&tr->udata, &wr->udata);
 	UREQ_DATA_RESET(&wr->udata);
 	tr->microbenchmark_time = wr->microbenchmark_time;
+	tr->trace = wr->trace;
 
 #if 0
 	if (wr->is_read) {
@@ -363,8 +467,16 @@ int rw_dump_reduce(void *key, uint32_t keylen, void *data, void *udata) {
 /*
  * An in-flight transaction has dependencies on proles - send
  * the transaction message to any prole which has not yet responded.
+ * If allow_batch is set, writes may be grouped with others for the same prole
+ * (see rw_batch_enqueue()). Retransmits go direct, so that a departed node is
+ * still noticed here.
  */
-void send_messages(write_request *wr) {
+void send_messages(write_request *wr, bool allow_batch) {
+	uint32_t op = 0;
+	bool batch = allow_batch && g_config.replication_batch &&
+			0 == msg_get_uint32(wr->dest_msg, RW_FIELD_OP, &op) &&
+			op == RW_OP_WRITE;
+
 	/* Iterate over every destination node -- send what we have to */
 	for (int i = 0; i < wr->dest_sz; i++) {
 
@@ -382,6 +494,9 @@ void send_messages(write_request *wr) {
 			cf_debug(AS_RW,
 					"resending rw request: no reservation node %"PRIx64" digest %"PRIx64"",
 					wr->dest_nodes[i], wr->keyd);
+		if (batch && 0 == rw_batch_enqueue(wr->dest_nodes[i], wr->dest_msg)) {
+			continue;
+		}
 		int rv = as_fabric_send(wr->dest_nodes[i], wr->dest_msg,
 				AS_FABRIC_PRIORITY_MEDIUM);
 		if (rv != 0) {
@@ -413,20 +528,20 @@ void as_rw_set_stat_counters(bool is_read, int rv, as_transaction *tr) {
 	if (is_read) {
 		if (rv == 0) {
 			if (result_code == AS_PROTO_RESULT_FAIL_NOTFOUND)
-				cf_atomic_int_incr(&g_config.stat_read_errs_notfound);
+				cf_shard_counter_incr(&g_config.stat_read_errs_notfound);
 			else
-				cf_atomic_int_incr(&g_config.stat_read_success);
+				cf_shard_counter_incr(&g_config.stat_read_success);
 		} else
-			cf_atomic_int_incr(&g_config.stat_read_errs_other);
+			cf_shard_counter_incr(&g_config.stat_read_errs_other);
 	} else {
 		if (rv == 0)
-			cf_atomic_int_incr(&g_config.stat_write_success);
+			cf_shard_counter_incr(&g_config.stat_write_success);
 		else {
-			cf_atomic_int_incr(&g_config.stat_write_errs);
+			cf_shard_counter_incr(&g_config.stat_write_errs);
 			if (result_code == AS_PROTO_RESULT_FAIL_NOTFOUND)
-				cf_atomic_int_incr(&g_config.stat_write_errs_notfound);
+				cf_shard_counter_incr(&g_config.stat_write_errs_notfound);
 			else
-				cf_atomic_int_incr(&g_config.stat_write_errs_other);
+				cf_shard_counter_incr(&g_config.stat_write_errs_other);
 		}
 	}
 }
@@ -628,6 +743,8 @@ int rw_cleanup(write_request *wr, as_transaction *tr, bool first_time,
 			cf_hist_track_insert_data_point(g_config.wt_hist, tr->start_time);
 		}
 	}
+
+	AS_TR_TRACE_FINISH(tr, wr->is_read);
 	if (first_time) {
 		if ((wr->msgp != NULL) || wr->rsv_valid) {
 			cf_warning_digest(AS_RW, &wr->keyd,
@@ -720,7 +837,7 @@ internal_rw_start(as_transaction *tr, write_request *wr, bool *delete)
 	}
 
 	if (wr->is_read == false) {
-		cf_atomic_int_incr(&g_config.write_master);
+		cf_shard_counter_incr(&g_config.write_master);
 	}
 
 	// 1. Short Circuit Read if a record is found locally, and we don't need
@@ -1078,12 +1195,13 @@ internal_rw_start(as_transaction *tr, write_request *wr, bool *delete)
 #endif
 
 	wr->microbenchmark_time = cf_getns();
+	wr->trace = tr->trace;
 
 	if (tr->flag & AS_TRANSACTION_FLAG_SHIPPED_OP)
 		cf_detail(AS_RW, "[Digest %"PRIx64" Shipped OP] Replication Initiated",
 				*(uint64_t *)&tr->keyd);
 
-	send_messages(wr);
+	send_messages(wr, true);
 
 	if (wr->is_read == false) {
 		if (!is_delete) {
@@ -1165,12 +1283,12 @@ int as_rw_start(as_transaction *tr, bool is_read) {
 	gk.keyd = tr->keyd;
 
 	cf_rc_reserve(wr); // need to keep an extra reference count in case it inserts
-	rv = rchash_put_unique(g_write_hash, &gk, sizeof(gk), wr);
+	rv = rw_hash_put_unique(&gk, wr);
 	if (rv == RCHASH_ERR_FOUND) {
 		// could be a retransmit. Get the transaction that's there and compare
 		// of course it might not be there anymore, but that's OK
 		write_request *wr2;
-		if (0 == rchash_get(g_write_hash, &gk, sizeof(gk), (void **) &wr2)) {
+		if (0 == rw_hash_get(&gk, &wr2)) {
 			pthread_mutex_lock(&wr2->lock);
 			if ((wr2->ready == true) && (wr2->proxy_msg != 0)
 					&& (wr2->proxy_node == tr->proxy_node)) {
@@ -1194,15 +1312,9 @@ int as_rw_start(as_transaction *tr, bool is_read) {
 			// then get re-queued. HACK for now - making the algorithm non-n2, or
 			// punting out expired transactions from this list, would be a very good thing
 			// too
-			if (wr2->wait_queue_head && g_config.transaction_pending_limit) {
-				int wq_depth = 0;
-				wreq_tr_element *e = wr2->wait_queue_head;
-				while (e) {
-					wq_depth++;
-					e = e->next;
-				}
+			if (g_config.transaction_pending_limit) {
 				// allow a depth of 2 - only
-				if (wq_depth > g_config.transaction_pending_limit) {
+				if (wr2->wait_queue_depth > g_config.transaction_pending_limit) {
 					cf_debug(AS_RW,
 							"as_rw_start: pending limit, ignoring {%s:%d} %"PRIx64"",
 							tr->rsv.ns->name, tr->rsv.pid, *(uint64_t*)&tr->keyd);
@@ -1239,14 +1351,18 @@ int as_rw_start(as_transaction *tr, bool is_read) {
 			tr->msgp = 0;
 			e->tr.preprocessed = true;
 			e->tr.flag = 0;
+			e->tr.trace = tr->trace;
 			UREQ_DATA_COPY(&e->tr.udata, &tr->udata);
 
 			// add this transactions to the queue
 			e->next = wr2->wait_queue_head;
 			wr2->wait_queue_head = e;
+			uint32_t wq_depth = ++wr2->wait_queue_depth;
 
 			pthread_mutex_unlock(&wr2->lock);
 
+			as_hot_keys_queued(&tr->keyd, wq_depth);
+
 			WR_TRACK_INFO(wr, "as_rw_start: add: wait queue");
 
 			cf_atomic_int_incr(&g_config.n_waiting_transactions);
@@ -1286,14 +1402,14 @@ int as_rw_start(as_transaction *tr, bool is_read) {
 	}
 
 	if (is_read) {
-		cf_atomic_int_incr(&g_config.stat_read_reqs);
+		cf_shard_counter_incr(&g_config.stat_read_reqs);
 		if (tr->msgp->msg.info1 & AS_MSG_INFO1_XDR) {
-			cf_atomic_int_incr(&g_config.stat_read_reqs_xdr);
+			cf_shard_counter_incr(&g_config.stat_read_reqs_xdr);
 		}
 	} else {
-		cf_atomic_int_incr(&g_config.stat_write_reqs);
+		cf_shard_counter_incr(&g_config.stat_write_reqs);
 		if (tr->msgp->msg.info1 & AS_MSG_INFO1_XDR) {
-			cf_atomic_int_incr(&g_config.stat_write_reqs_xdr);
+			cf_shard_counter_incr(&g_config.stat_write_reqs_xdr);
 		}
 	}
 
@@ -1324,7 +1440,9 @@ int as_rw_start(as_transaction *tr, bool is_read) {
 		WR_TRACK_INFO(wr, "as_rw_start: deleting rchash");
 		cf_detail(AS_RW, "{%s:%d} as_rw_start: DELETING request %"PRIx64" %s",
 				str, pid, *(uint64_t *) & (wr->keyd), wr->is_read ? "READ" : "WRITE");
-		rchash_delete(g_write_hash, &gk, sizeof(gk));
+		rw_hash_delete(&gk);
+	} else {
+		rw_timer_arm(&gk, wr);
 	}
 
 	WR_TRACK_INFO(wr, "as_rw_start: returning");
@@ -1355,9 +1473,9 @@ int as_read_start(as_transaction *tr) {
 		&& (tr->rsv.n_dupl == 0)
 		&& (tr->msgp->msg.info1 & AS_MSG_INFO1_READ)
 		&& (TRANSACTION_CONSISTENCY_LEVEL(tr) == AS_POLICY_CONSISTENCY_LEVEL_ONE)) {
-		cf_atomic_int_incr(&g_config.stat_read_reqs);
+		cf_shard_counter_incr(&g_config.stat_read_reqs);
 		if (tr->msgp->msg.info1 & AS_MSG_INFO1_XDR) {
-			cf_atomic_int_incr(&g_config.stat_read_reqs_xdr);
+			cf_shard_counter_incr(&g_config.stat_read_reqs_xdr);
 		}
 
 		rw_complete(tr, NULL, 0);
@@ -1369,6 +1487,8 @@ int as_read_start(as_transaction *tr) {
 			cf_hist_track_insert_data_point(g_config.rt_hist, tr->start_time);
 		}
 
+		AS_TR_TRACE_FINISH(tr, true);
+
 		as_partition_release(&tr->rsv);
 		cf_atomic_int_decr(&g_config.rw_tree_count);
 		if (tr->msgp) {
@@ -1656,6 +1776,7 @@ finish_rw_process_ack(write_request *wr, uint32_t result_code)
 
 		tr.microbenchmark_time = wr->microbenchmark_time;
 		MICROBENCHMARK_HIST_INSERT_AND_RESET(wt_master_wait_prole_hist);
+		AS_TR_TRACE_STAGE(&tr, AS_TR_STAGE_REPLICATE);
 
 		tr.microbenchmark_is_resolve = false;
 
@@ -1745,7 +1866,7 @@ void rw_process_ack(cf_node node, msg *m, bool is_write) {
 	gk.ns_id = ns_id;
 	gk.keyd = *keyd;
 	write_request *wr;
-	if (RCHASH_OK != rchash_get(g_write_hash, &gk, sizeof(gk), (void **) &wr)) {
+	if (RCHASH_OK != rw_hash_get(&gk, &wr)) {
 		cf_debug(AS_RW, "rw_process_ack: pending transaction, drop");
 		as_fabric_msg_put(m);
 		cf_atomic_int_incr(&g_config.rw_err_ack_nomatch);
@@ -1816,7 +1937,7 @@ void rw_process_ack(cf_node node, msg *m, bool is_write) {
 		}
 		pthread_mutex_unlock(&wr->lock);
 		if (must_delete)
-			rchash_delete(g_write_hash, &gk, sizeof(gk));
+			rw_hash_delete(&gk);
 		goto Out;
 	}  // end if cluster key mismatch
 	else if (result_code != AS_PROTO_RESULT_OK) {
@@ -1899,7 +2020,7 @@ void rw_process_ack(cf_node node, msg *m, bool is_write) {
 				wr->rsv.ns->name, wr->rsv.pid, *(uint64_t *) & (wr->keyd), wr->is_read ? "READ" : "WRITE");
 
 		WR_TRACK_INFO(wr, "rw_process_ack: deleting rchash");
-		rchash_delete(g_write_hash, &gk, sizeof(gk));
+		rw_hash_delete(&gk);
 	}
 
 Out:
@@ -2099,7 +2220,7 @@ Out1:
 int
 rw_dup_process(cf_node node, msg *m)
 {
-	cf_atomic_int_incr(&g_config.read_dup_prole);
+	cf_shard_counter_incr(&g_config.read_dup_prole);
 	if (g_config.n_transaction_duplicate_threads == 0) {
 		rw_dup_prole(node, m);
 		return (0);
@@ -2244,6 +2365,8 @@ write_local_pickled(cf_digest *keyd, as_partition_reservation *rsv,
 		// Is there any clean up that must be done here???
 	}
 
+	as_partition_expire_index_update(rsv->p, keyd, r->void_time, void_time);
+
 	r->generation = generation;
 	r->void_time = void_time;
 
@@ -2301,7 +2424,7 @@ write_local_pickled(cf_digest *keyd, as_partition_reservation *rsv,
 int
 write_process(cf_node node, msg *m, bool respond)
 {
-	cf_atomic_int_incr(&g_config.write_prole);
+	cf_shard_counter_incr(&g_config.write_prole);
 #ifdef DEBUG_MSG
 	msg_dump(m, "rw incoming");
 #endif
@@ -2430,7 +2553,7 @@ write_process(cf_node node, msg *m, bool respond)
 						*(uint64_t*)keyd);
 			}
 			if (info & RW_INFO_UDF_WRITE) {
-				cf_atomic_int_incr(&g_config.udf_replica_writes);
+				cf_shard_counter_incr(&g_config.udf_replica_writes);
 			}
 			if (msgp->msg.info2 & AS_MSG_INFO2_DELETE) {
 				rv = write_delete_local(&tr, true, node);
@@ -2729,7 +2852,7 @@ write_delete_local(as_transaction *tr, bool journal, cf_node masternode)
 	uint16_t set_id = as_index_get_set_id(r);
 
 	as_index_delete(tree, &tr->keyd);
-	cf_atomic_int_incr(&g_config.stat_delete_success);
+	cf_shard_counter_incr(&g_config.stat_delete_success);
 	as_record_done(&r_ref, ns);
 
 	// Check if XDR needs to ship this delete
@@ -2828,6 +2951,7 @@ void write_local_post_processing(as_transaction *tr, as_namespace *ns,
 {
 
 	as_msg *m = tr ? (tr->msgp ? &tr->msgp->msg : NULL) : NULL;
+	uint32_t old_void_time = r->void_time;
 
 	if (m && m->record_ttl == 0xFFFFFFFF) {
 		// TTL = -1 sets record_void time to "never expires".
@@ -2860,12 +2984,11 @@ void write_local_post_processing(as_transaction *tr, as_namespace *ns,
 	}
 
 	if (r->void_time != 0) {
-		if (prsv) {
-			cf_atomic_int_setmax( &prsv->p->max_void_time, r->void_time);
-		} else {
-			cf_atomic_int_setmax( &tr->rsv.p->max_void_time, r->void_time);
-		}
+		as_partition *p = prsv ? prsv->p : tr->rsv.p;
+
+		cf_atomic_int_setmax( &p->max_void_time, r->void_time);
 		cf_atomic_int_setmax( &ns->max_void_time, r->void_time);
+		as_partition_expire_index_update(p, &r->key, old_void_time, r->void_time);
 	}
 
 	if (increment_generation) {
@@ -3362,6 +3485,8 @@ write_local(as_transaction *tr, write_local_generation *wlg,
 		return -1;
 	}
 
+	AS_TR_TRACE_STAGE(tr, AS_TR_STAGE_RECORD_LOCK);
+
 
 	//------------------------------------------------------
 	// Open or create the as_storage_rd. Read the existing
@@ -3451,6 +3576,8 @@ write_local(as_transaction *tr, write_local_generation *wlg,
 		return -1;
 	}
 
+	AS_TR_TRACE_STAGE(tr, AS_TR_STAGE_STORAGE_READ);
+
 	// If record-level replace will delete all existing bins, this makes
 	// accounting easier.
 	// TODO - roll into as_bin_get_and_size_all() ???
@@ -4458,7 +4585,7 @@ write_process_op(as_namespace *ns, cf_digest *keyd, cl_msg *msgp,
 		}
 	}
 	if (info & RW_INFO_UDF_WRITE) {
-		cf_atomic_int_incr(&g_config.udf_replica_writes);
+		cf_shard_counter_incr(&g_config.udf_replica_writes);
 	}
 
 	int rv = 0;
@@ -4734,7 +4861,7 @@ write_msg_fn(cf_node id, msg *m, void *udata)
 			start_ns = cf_getns();
 		}
 
-		cf_atomic_int_incr(&g_config.write_prole);
+		cf_shard_counter_incr(&g_config.write_prole);
 
 		write_process(id, m, true);
 
@@ -4758,7 +4885,7 @@ write_msg_fn(cf_node id, msg *m, void *udata)
 
 	case RW_OP_DUP:
 
-		cf_atomic_int_incr(&g_config.read_dup_prole);
+		cf_shard_counter_incr(&g_config.read_dup_prole);
 
 		rw_dup_process(id, m);
 
@@ -4786,6 +4913,18 @@ write_msg_fn(cf_node id, msg *m, void *udata)
 
 		break;
 
+	case RW_OP_WRITE_BATCH:
+
+		rw_write_batch_process(id, m);
+
+		break;
+
+	case RW_OP_WRITE_BATCH_ACK:
+
+		rw_write_batch_process_ack(id, m);
+
+		break;
+
 	default:
 		cf_debug(AS_RW,
 				"write_msg_fn: received unknown, unsupported message %d from remote endpoint",
@@ -4825,7 +4964,7 @@ rw_retransmit_reduce_fn(void *key, uint32_t keylen, void *data, void *udata)
 			}
 		}
 
-		cf_atomic_int_incr(&g_config.stat_rw_timeout);
+		cf_shard_counter_incr(&g_config.stat_rw_timeout);
 		if (wr->ready) {
 			if ( ! wr->has_udf ) {
 				cf_hist_track_insert_data_point(g_config.wt_hist, wr->start_time);
@@ -4875,7 +5014,7 @@ rw_retransmit_reduce_fn(void *key, uint32_t keylen, void *data, void *udata)
 		wr->retry_interval_ms *= 2;
 
 		WR_TRACK_INFO(wr, "rw_retransmit_reduce_fn: retransmitting ");
-		send_messages(wr);
+		send_messages(wr, false);
 		finished = finish_rw_process_ack(wr, AS_PROTO_RESULT_OK);
 		pthread_mutex_unlock(&wr->lock);
 
@@ -4896,24 +5035,112 @@ rw_retransmit_reduce_fn(void *key, uint32_t keylen, void *data, void *udata)
 	return (0);
 } // end rw_retransmit_reduce_fn()
 
+typedef struct rw_due_s {
+	cf_clock expire_ms;
+	global_keyd gk;
+} rw_due;
+
+typedef struct rw_due_list_s {
+	rw_due *due;
+	uint32_t n_due;
+	uint32_t capacity;
+} rw_due_list;
+
+void
+rw_timer_collect_fn(void *ele, uint64_t expire_ms, void *udata)
+{
+	rw_due_list *list = (rw_due_list *)udata;
+
+	if (list->n_due == list->capacity) {
+		uint32_t capacity = list->capacity ? list->capacity * 2 : 1024;
+
+		list->due = cf_realloc(list->due, capacity * sizeof(rw_due));
+
+		if (! list->due) {
+			cf_crash(AS_RW, "cf_realloc");
+		}
+
+		list->capacity = capacity;
+	}
+
+	rw_due *due = &list->due[list->n_due++];
+
+	due->expire_ms = expire_ms;
+	memcpy(&due->gk, ele, sizeof(global_keyd));
+}
+
+//
+// Pull everything due off a shard's wheel, then (with the wheel unlocked) give
+// each live request the same treatment the old full-table reduce did.
+//
+void
+rw_shard_retransmit(rw_shard *shard, now_times *p_now, rw_due_list *list)
+{
+	list->n_due = 0;
+
+	pthread_mutex_lock(&shard->wheel_lock);
+	cf_timer_wheel_advance(shard->wheel, p_now->now_ms, rw_timer_collect_fn, list);
+	pthread_mutex_unlock(&shard->wheel_lock);
+
+	for (uint32_t i = 0; i < list->n_due; i++) {
+		rw_due *due = &list->due[i];
+		write_request *wr;
+
+		// Request already finished.
+		if (RCHASH_OK != rchash_get(shard->hash, &due->gk, sizeof(global_keyd),
+				(void **)&wr)) {
+			continue;
+		}
+
+		// Request was re-armed since this entry was added.
+		if (wr->timer_ms != due->expire_ms) {
+			WR_RELEASE(wr);
+			continue;
+		}
+
+		if (RCHASH_REDUCE_DELETE == rw_retransmit_reduce_fn(&due->gk,
+				sizeof(global_keyd), wr, p_now)) {
+			write_request *wr2;
+
+			// Make sure we don't delete a newer request for the same digest.
+			if (RCHASH_OK == rchash_get(shard->hash, &due->gk,
+					sizeof(global_keyd), (void **)&wr2)) {
+				if (wr2 == wr) {
+					rchash_delete(shard->hash, &due->gk, sizeof(global_keyd));
+				}
+
+				WR_RELEASE(wr2);
+			}
+		} else {
+			rw_timer_arm(&due->gk, wr);
+		}
+
+		WR_RELEASE(wr);
+	}
+}
+
 void *
 rw_retransmit_fn(void *gcc_is_ass)
 {
+	rw_due_list list = { 0 };
+
 	while (1) {
 
-		usleep(130 * 1000);
+		usleep(RW_TIMER_TICK_MS * 1000);
 
 		now_times now;
 		now.now_ns = cf_getns();
 		now.now_ms = now.now_ns / 1000000;
 
-		rchash_reduce_delete(g_write_hash, rw_retransmit_reduce_fn, &now);
+		for (int i = 0; i < RW_N_SHARDS; i++) {
+			rw_shard_retransmit(&g_rw_shards[i], &now, &list);
+		}
 
 #ifdef DEBUG
 		// SUPER DEBUG --- catching some kind of leak of rchash
-		if ( rchash_get_size(g_write_hash) > 1000) {
+		if (rw_hash_size() > 1000) {
 
-			rchash_reduce( g_write_hash, rw_dump_reduce, 0);
+			rw_hash_reduce(rw_dump_reduce, 0);
 		}
 #endif
 
@@ -4998,6 +5225,372 @@ int rw_replicate_init(void) {
 	return (0);
 }
 
+//
+// Replica write batching (group commit to proles). With replication-batch on,
+// the first transmit of each RW_OP_WRITE is queued here instead of going
+// straight to fabric. A batch thread drains whatever has queued up since its
+// last pass and sends each prole a single RW_OP_WRITE_BATCH carrying all of
+// that node's writes. The prole applies them in order and returns a single
+// RW_OP_WRITE_BATCH_ACK carrying the individual acks, each of which is then
+// handled by rw_process_ack() exactly as if it had arrived on its own.
+//
+// Nothing waits for a batch to fill - when writes are sparse every "batch" is
+// one write, sent as a plain RW_OP_WRITE. Batches only grow when writes arrive
+// faster than the batch threads can turn them around.
+//
+cf_queue *g_rw_batch_q = 0;
+#define RW_BATCH_THREADS 2
+#define RW_BATCH_MAX_WRITES 128 // per drain, over all nodes
+#define RW_BATCH_MAX_BYTES (1024 * 1024)
+pthread_t g_rw_batch_th[RW_BATCH_THREADS];
+
+typedef struct {
+	cf_node node;
+	msg *m;
+} rw_batch_element;
+
+// Writes gathered for one node during one drain.
+typedef struct {
+	cf_node node;
+	msg *first; // not yet serialized - sent as is if nothing joins it
+	uint8_t *buf;
+	size_t len;
+	size_t alloc;
+	uint32_t n_writes;
+} rw_batch;
+
+// Queue a write for batching. On success the queue owns the caller's msg ref.
+int
+rw_batch_enqueue(cf_node node, msg *m)
+{
+	rw_batch_element e;
+	e.node = node;
+	e.m = m;
+
+	return (cf_queue_push(g_rw_batch_q, &e));
+}
+
+// Serialize a msg onto the end of a growable buffer.
+static bool
+rw_batch_append(uint8_t **buf, size_t *len, size_t *alloc, msg *m)
+{
+	size_t remain = *alloc - *len;
+
+	if (0 != msg_fillbuf(m, *buf + *len, &remain)) {
+		// remain has been set to the size needed
+		size_t new_alloc = *alloc ? *alloc : 16 * 1024;
+
+		while (new_alloc < *len + remain) {
+			new_alloc *= 2;
+		}
+
+		uint8_t *new_buf = cf_realloc(*buf, new_alloc);
+
+		if (!new_buf) {
+			return (false);
+		}
+
+		*buf = new_buf;
+		*alloc = new_alloc;
+
+		if (0 != msg_fillbuf(m, *buf + *len, &remain)) {
+			return (false);
+		}
+	}
+
+	*len += remain;
+
+	return (true);
+}
+
+static void
+rw_batch_send(rw_batch *b)
+{
+	msg *m = b->first;
+
+	if (!m) {
+		if (!(m = as_fabric_msg_get(M_TYPE_RW))) {
+			// The writes are still in the write hash - they'll be
+			// retransmitted individually.
+			cf_warning(AS_RW, "write batch: can't get msg, dropping %u writes for node %"PRIx64,
+					b->n_writes, b->node);
+			cf_free(b->buf);
+			goto Done;
+		}
+
+		msg_set_uint32(m, RW_FIELD_OP, RW_OP_WRITE_BATCH);
+		msg_set_buf(m, RW_FIELD_BATCH, b->buf, b->len, MSG_SET_HANDOFF_MALLOC);
+
+		cf_shard_counter_incr(&g_config.write_batch_sent);
+		cf_shard_counter_add(&g_config.write_batch_writes, b->n_writes);
+	}
+	else if (b->buf) {
+		cf_free(b->buf);
+	}
+
+	int rv = as_fabric_send(b->node, m, AS_FABRIC_PRIORITY_MEDIUM);
+
+	if (rv != 0) {
+		// Again, the retransmit will sort it out.
+		cf_debug(AS_RW, "write batch: send to node %"PRIx64" failed %d", b->node, rv);
+		as_fabric_msg_put(m);
+	}
+
+Done:
+	b->first = NULL;
+	b->buf = NULL;
+	b->len = 0;
+	b->alloc = 0;
+	b->n_writes = 0;
+}
+
+static void
+rw_batch_add(rw_batch *b, msg *m)
+{
+	if (b->n_writes == 0) {
+		b->first = m;
+		b->n_writes = 1;
+		return;
+	}
+
+	// Second write for this node - fold the first into the batch buffer.
+	if (b->first) {
+		if (! rw_batch_append(&b->buf, &b->len, &b->alloc, b->first)) {
+			rw_batch_send(b);
+			b->first = m;
+			b->n_writes = 1;
+			return;
+		}
+
+		as_fabric_msg_put(b->first);
+		b->first = NULL;
+	}
+
+	if (! rw_batch_append(&b->buf, &b->len, &b->alloc, m)) {
+		// Out of memory - ship what we have, start again with this one.
+		rw_batch_send(b);
+		b->first = m;
+		b->n_writes = 1;
+		return;
+	}
+
+	as_fabric_msg_put(m);
+	b->n_writes++;
+
+	if (b->len >= RW_BATCH_MAX_BYTES) {
+		rw_batch_send(b);
+	}
+}
+
+void *
+rw_batch_worker_fn(void *yeah_yeah_yeah)
+{
+	rw_batch batches[AS_CLUSTER_SZ];
+
+	for (;;) {
+
+		rw_batch_element e;
+
+		if (0 != cf_queue_pop(g_rw_batch_q, &e, CF_QUEUE_FOREVER)) {
+			cf_crash(AS_RW, "unable to pop from write batch queue");
+		}
+
+		int n_batches = 0;
+		int n_writes = 0;
+
+		// Take everything that's waiting, up to a limit, grouped by node.
+		do {
+			rw_batch *b = NULL;
+
+			for (int i = 0; i < n_batches; i++) {
+				if (batches[i].node == e.node) {
+					b = &batches[i];
+					break;
+				}
+			}
+
+			if (!b) {
+				b = &batches[n_batches++];
+				memset(b, 0, sizeof(rw_batch));
+				b->node = e.node;
+			}
+
+			rw_batch_add(b, e.m);
+
+		} while (++n_writes < RW_BATCH_MAX_WRITES && n_batches < AS_CLUSTER_SZ &&
+				CF_QUEUE_OK == cf_queue_pop(g_rw_batch_q, &e, CF_QUEUE_NOWAIT));
+
+		for (int i = 0; i < n_batches; i++) {
+			if (batches[i].n_writes != 0) {
+				rw_batch_send(&batches[i]);
+			}
+		}
+	}
+
+	return (0);
+}
+
+int
+rw_batch_init(void)
+{
+	// Always start the threads, so replication-batch can be switched on
+	// dynamically.
+	g_rw_batch_q = cf_queue_create(sizeof(rw_batch_element), true);
+	if (!g_rw_batch_q)
+		return (-1);
+
+	for (int i = 0; i < RW_BATCH_THREADS; i++) {
+		if (0 != pthread_create(&g_rw_batch_th[i], 0, rw_batch_worker_fn, 0)) {
+			cf_crash(AS_RW, "can't create write batch threads");
+		}
+	}
+
+	return (0);
+}
+
+//
+// Prole side of a write batch - apply each write in order, as write_process()
+// would for a lone RW_OP_WRITE, and return all the acks in one msg.
+//
+int
+rw_write_batch_process(cf_node node, msg *m)
+{
+	uint8_t *batch_buf = NULL;
+	size_t batch_sz = 0;
+
+	if (0 != msg_get_buf(m, RW_FIELD_BATCH, &batch_buf, &batch_sz,
+			MSG_GET_DIRECT)) {
+		cf_warning(AS_RW, "write batch process: message without batch");
+		cf_atomic_int_incr(&g_config.rw_err_write_internal);
+		as_fabric_msg_put(m);
+		return (0);
+	}
+
+	uint8_t *ack_buf = NULL;
+	size_t ack_len = 0;
+	size_t ack_alloc = 0;
+	size_t offset = 0;
+
+	// Anything not acked, because the batch is cut short here, will be
+	// retransmitted by the master.
+	while (offset < batch_sz) {
+		uint32_t op_msg_len = 0;
+		msg_type op_msg_type = 0;
+
+		if (0 != msg_get_initial(&op_msg_len, &op_msg_type,
+				batch_buf + offset, batch_sz - offset)
+				|| op_msg_type != M_TYPE_RW
+				|| op_msg_len > batch_sz - offset) {
+			cf_warning(AS_RW, "write batch process: corrupt batch from node %"PRIx64, node);
+			cf_atomic_int_incr(&g_config.rw_err_write_internal);
+			break;
+		}
+
+		msg *op_msg = as_fabric_msg_get(M_TYPE_RW);
+
+		if (!op_msg) {
+			cf_warning(AS_RW, "write batch process: running out of fabric messages");
+			break;
+		}
+
+		if (0 != msg_parse(op_msg, batch_buf + offset, op_msg_len, false)) {
+			cf_warning(AS_RW, "write batch process: can't parse write from node %"PRIx64, node);
+			cf_atomic_int_incr(&g_config.rw_err_write_internal);
+			as_fabric_msg_put(op_msg);
+			break;
+		}
+
+		offset += op_msg_len;
+
+		// Turns op_msg into the write's ack.
+		write_process(node, op_msg, false);
+
+		if (! rw_batch_append(&ack_buf, &ack_len, &ack_alloc, op_msg)) {
+			cf_warning(AS_RW, "write batch process: can't append ack");
+		}
+
+		as_fabric_msg_put(op_msg);
+	}
+
+	msg_set_uint32(m, RW_FIELD_OP, RW_OP_WRITE_BATCH_ACK);
+
+	if (ack_len != 0) {
+		msg_set_buf(m, RW_FIELD_BATCH, ack_buf, ack_len, MSG_SET_HANDOFF_MALLOC);
+	}
+	else {
+		msg_set_unset(m, RW_FIELD_BATCH);
+		cf_free(ack_buf);
+	}
+
+	int rv = as_fabric_send(node, m, AS_FABRIC_PRIORITY_MEDIUM);
+
+	if (rv != 0) {
+		cf_debug(AS_RW, "write batch process: send fabric message bad return %d", rv);
+		as_fabric_msg_put(m);
+		cf_atomic_int_incr(&g_config.rw_err_write_send);
+	}
+
+	return (0);
+}
+
+//
+// Master side of a write batch ack - unpack the individual write acks.
+//
+void
+rw_write_batch_process_ack(cf_node node, msg *m)
+{
+	uint8_t *batch_buf = NULL;
+	size_t batch_sz = 0;
+
+	if (0 != msg_get_buf(m, RW_FIELD_BATCH, &batch_buf, &batch_sz,
+			MSG_GET_DIRECT)) {
+		// every write in the batch failed to parse - let retransmit handle it
+		as_fabric_msg_put(m);
+		return;
+	}
+
+	size_t offset = 0;
+
+	while (offset < batch_sz) {
+		uint32_t ack_len = 0;
+		msg_type ack_type = 0;
+
+		if (0 != msg_get_initial(&ack_len, &ack_type, batch_buf + offset,
+				batch_sz - offset)
+				|| ack_type != M_TYPE_RW
+				|| ack_len > batch_sz - offset) {
+			cf_warning(AS_RW, "write batch ack: corrupt batch from node %"PRIx64, node);
+			cf_atomic_int_incr(&g_config.rw_err_ack_internal);
+			break;
+		}
+
+		msg *ack = as_fabric_msg_get(M_TYPE_RW);
+
+		if (!ack) {
+			cf_warning(AS_RW, "write batch ack: running out of fabric messages");
+			break;
+		}
+
+		// Not copied - rw_process_ack() doesn't keep write acks.
+		if (0 != msg_parse(ack, batch_buf + offset, ack_len, false)) {
+			cf_warning(AS_RW, "write batch ack: can't parse ack from node %"PRIx64, node);
+			cf_atomic_int_incr(&g_config.rw_err_ack_internal);
+			as_fabric_msg_put(ack);
+			break;
+		}
+
+		offset += ack_len;
+
+		if (g_config.replication_fire_and_forget) {
+			rw_replicate_process_ack(node, ack, true);
+		} else {
+			rw_process_ack(node, ack, true);
+		}
+	}
+
+	as_fabric_msg_put(m);
+}
+
 //
 // This function is called right after a partition re-balance
 // Any write in progress to the now-gone node can be quickly retransmitted to the proper node
@@ -5009,14 +5602,20 @@ write_node_delete_reduce_fn(void *key, uint32_t keylen, void *data,
 {
 	write_request *wr = data;
 	cf_node *node = (cf_node *) udata;
+	bool rearm = false;
 
 	for (int i = 0; i < wr->dest_sz; i++) {
 		if ((wr->dest_complete[i] == 0) && (wr->dest_nodes[i] == *node)) {
 			cf_debug(AS_RW, "removed: speed up retransmit");
 			wr->xmit_ms = 0;
+			rearm = true;
 		}
 	}
 
+	if (rearm) {
+		rw_timer_arm((global_keyd *)key, wr);
+	}
+
 	return (0);
 }
 
@@ -5085,7 +5684,7 @@ rw_paxos_change(as_paxos_generation gen, as_paxos_change *change,
 		 * Iterate through the write hash table and find nodes that are not in the succession list
 		 * Remove these entries from the hash table
 		 */
-		rchash_reduce(g_write_hash, write_node_succession_reduce_fn,
+		rw_hash_reduce(write_node_succession_reduce_fn,
 				(void *) &del);
 
 		/*
@@ -5095,7 +5694,7 @@ rw_paxos_change(as_paxos_generation gen, as_paxos_change *change,
 			if ((cf_node) 0 != del.deletions[i]) {
 				cf_debug(AS_RW, "notified: REMOVE node %"PRIx64"",
 						del.deletions[i]);
-				rchash_reduce(g_write_hash, write_node_delete_reduce_fn,
+				rw_hash_reduce(write_node_delete_reduce_fn,
 						(void *) & (del.deletions[i]));
 			}
 		}
@@ -5112,7 +5711,7 @@ rw_paxos_change(as_paxos_generation gen, as_paxos_change *change,
 			xdr_clmap_update(change->type[i], changed_nodes, 1);
 
 			cf_debug(AS_RW, "notified: REMOVE node %"PRIx64, change->id[i]);
-			rchash_reduce(g_write_hash, write_node_delete_reduce_fn,
+			rw_hash_reduce(write_node_delete_reduce_fn,
 					(void *)&(change->id[i]));
 		} else if (change->type[i] == AS_PAXOS_CHANGE_SUCCESSION_ADD) {
 
@@ -5127,8 +5726,8 @@ rw_paxos_change(as_paxos_generation gen, as_paxos_change *change,
 uint32_t
 as_write_inprogress()
 {
-	if (g_write_hash)
-		return (rchash_get_size(g_write_hash));
+	if (g_rw_shards_ready)
+		return (rw_hash_size());
 	else
 		return (0);
 
@@ -5141,8 +5740,22 @@ as_write_init()
 		return;
 	}
 
-	rchash_create(&g_write_hash, write_digest_hash, write_request_destructor,
-			sizeof(global_keyd), 16 * 1024, RCHASH_CR_MT_MANYLOCK);
+	for (int i = 0; i < RW_N_SHARDS; i++) {
+		rw_shard *shard = &g_rw_shards[i];
+
+		rchash_create(&shard->hash, write_digest_hash, write_request_destructor,
+				sizeof(global_keyd), (16 * 1024) / RW_N_SHARDS,
+				RCHASH_CR_MT_MANYLOCK);
+
+		pthread_mutex_init(&shard->wheel_lock, 0);
+
+		if (! (shard->wheel = cf_timer_wheel_create(sizeof(global_keyd),
+				RW_TIMER_TICK_MS, cf_getms()))) {
+			cf_crash(AS_RW, "couldn't create write request timer wheel");
+		}
+	}
+
+	g_rw_shards_ready = true;
 
 	pthread_create(&g_rw_retransmit_th, 0, rw_retransmit_fn, 0);
 
@@ -5156,6 +5769,11 @@ as_write_init()
 		return;
 	}
 
+	if (0 != rw_batch_init()) {
+		cf_crash(AS_RW, "couldn't initialize write batch threads");
+		return;
+	}
+
 	as_fabric_register_msg_fn(M_TYPE_RW, rw_mt, sizeof(rw_mt), write_msg_fn,
 			0 /* udata */);
 
@@ -5247,18 +5865,18 @@ dump_rw_reduce_fn(void *key, uint32_t keylen, void *data,
 	return (0);
 }
 
-// Dump info. about all wr objects in the "g_write_hash".
+// Dump info. about all wr objects in the write request table shards.
 void
 as_dump_wr()
 {
-	if (g_write_hash) {
+	if (g_rw_shards_ready) {
 		int counter = 0;
 		g_now = cf_getms();
-		cf_info(AS_RW, "There are %d entries in g_write_hash @ time = %ld:",
-				rchash_get_size(g_write_hash), g_now);
-		rchash_reduce(g_write_hash, dump_rw_reduce_fn, &counter);
+		cf_info(AS_RW, "There are %d entries in write request table @ time = %ld:",
+				rw_hash_size(), g_now);
+		rw_hash_reduce(dump_rw_reduce_fn, &counter);
 	} else {
-		cf_warning(AS_RW, "No g_write_hash!");
+		cf_warning(AS_RW, "No write request table!");
 	}
 }
 
@@ -5308,6 +5926,7 @@ thr_tsvc_read(as_transaction *tr, as_record_lock *rl, int record_get_rv)
 				rv = as_record_get(tr->rsv.tree, &tr->keyd, r_ref, ns);
 
 			MICROBENCHMARK_HIST_INSERT_AND_RESET_P(rt_tree_hist);
+			AS_TR_TRACE_STAGE(tr, AS_TR_STAGE_RECORD_LOCK);
 
 			if (-2 == rv || -3 == rv) {
 				cf_info(AS_RW, "as_record_get failure %d - will retry", rv);
@@ -5422,6 +6041,7 @@ thr_tsvc_read(as_transaction *tr, as_record_lock *rl, int record_get_rv)
 			}
 
 			MICROBENCHMARK_HIST_INSERT_AND_RESET_P(rt_storage_read_hist);
+			AS_TR_TRACE_STAGE(tr, AS_TR_STAGE_STORAGE_READ);
 
 #ifdef DEBUG
 			if (bin_counter == 0) {
@@ -5444,6 +6064,7 @@ thr_tsvc_read(as_transaction *tr, as_record_lock *rl, int record_get_rv)
 				(m->info1 & AS_MSG_INFO1_XDR) ? (char *) set_name : NULL);
 
 		MICROBENCHMARK_HIST_INSERT_AND_RESET_P(rt_net_hist);
+		AS_TR_TRACE_STAGE(tr, AS_TR_STAGE_REPLY);
 	}
 	else {
 		// In case of write request has UDF udf_rw_complete
@@ -5464,6 +6085,7 @@ thr_tsvc_read(as_transaction *tr, as_record_lock *rl, int record_get_rv)
 			}
 			cf_hist_track_insert_data_point(g_config.wt_reply_hist,
 					tr->start_time);
+			AS_TR_TRACE_STAGE(tr, AS_TR_STAGE_REPLY);
 			tr->proto_fd_h = 0;
 		} else if (tr->proxy_msg) {
 			// it was a proxy request - hand it back to the proxy for responding
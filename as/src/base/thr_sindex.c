@@ -45,6 +45,7 @@
 
 #define RELEASE_ITERATORS(icol) \
 do {                                \
+	ai_objFree(&i_col);              \
 	init_ai_obj(&i_col);             \
 	n_offset = 0;                   \
 } while(0);
@@ -85,6 +86,11 @@ ll_sindex_gc_destroy_fn(cf_ll_element *ele)
 {
 	ll_sindex_gc_element * node = (ll_sindex_gc_element *) ele;
 	if (node) {
+		// Entries not yet defragged may still own string keys
+		objs_to_defrag_arr *dt = node->objs_to_defrag;
+		for (uint32_t i = 0; i < dt->num; i++) {
+			ai_objFree(&dt->acol_digs[i].acol);
+		}
 		as_sindex_gc_release_defrag_arr_to_queue((void *)(node->objs_to_defrag));	
 		cf_free(node);
 	}
@@ -84,6 +84,7 @@
 #define SCAN_PRIORITY_MEDIUM 2
 #define SCAN_PRIORITY_HIGH  3
 #define SCAN_JOB_HASH_PERSIST_TIME 5*60*1000 // For how long do we want to persist the scan job hash - 5 mins
+#define SCAN_DEVICE_RESPONSE_SIZE (1024 * 1024) // device-order scans send results to the client in chunks of about this size
 
 #define TSCAN_FIELD_OP          0
 #define TSCAN_FIELD_NAMESPACE   1
@@ -216,6 +217,16 @@ as_tscan_udf_tr_complete( as_transaction *tr, int retcode )
 static inline void
 tscan_job_update_pstatus(tscan_job *job, uint32_t pid, int status)
 {
+	if (job->job_type == SCAN_JOB_TYPE_STORAGE) {
+		// For device-order scans pid is the device index - each device
+		// accounts for an equal share of the tracker, so progress still works.
+		for (uint32_t i = pid; i < AS_PARTITIONS; i += job->n_devices) {
+			((scan_job_partitions_tracker *) job->udata)->partition_done[i] = status;
+			cf_atomic_int_incr(&job->n_partitions_scanned);
+		}
+		return;
+	}
+
 	((scan_job_partitions_tracker *) job->udata)->partition_done[pid] = status;
 
 	//scan progress update after each partition scanned
@@ -352,6 +363,7 @@ tscan_job_destructor( void *udata )
 	}
 	if (job->udata) {
 		if ((job->job_type == SCAN_JOB_TYPE_PARTITION)
+				|| (job->job_type == SCAN_JOB_TYPE_STORAGE)
 				|| (job->job_type == SCAN_JOB_TYPE_SINDEX_POPULATE))
 		{
 			cf_free(job->udata);
@@ -361,7 +373,6 @@ tscan_job_destructor( void *udata )
 				AS_SINDEX_RELEASE(job->si);
 			}
 		}
-		// @TODO clean job type specific allocation for storage-based scanning
 	}
 	pthread_mutex_destroy(&job->LOCK);
 
@@ -512,7 +523,7 @@ as_tscan_sindex_populateall(void *param)
 
 // Send ack for successful start of disconnected job to client.
 int
-tscan_send_disconnected_job_ack_to_client(int fd)
+tscan_send_disconnected_job_ack_to_client(as_file_handle *fd_h)
 {
 	cl_msg m;
 
@@ -533,21 +544,9 @@ tscan_send_disconnected_job_ack_to_client(int fd)
 	m.msg.n_ops = 0;
 	as_msg_swap_header(&m.msg);
 
-	uint8_t *buf = (uint8_t *)&m;
-	int pos = 0;
-
-	while (pos < sizeof(m)) {
-		int rv = send(fd, buf + pos, sizeof(m) - pos, MSG_NOSIGNAL);
-
-		if (rv <= 0) {
-			if (errno != EAGAIN) {
-				cf_info(AS_SCAN, "disconnected-job ack %d errno %d fd %d", rv, errno, fd);
-				return -1;
-			}
-		}
-		else {
-			pos += rv;
-		}
+	if (as_msg_send_fh(fd_h, (uint8_t *)&m, sizeof(m), false) != 0) {
+		cf_info(AS_SCAN, "disconnected-job ack failed fd %d", fd_h->fd);
+		return -1;
 	}
 
 	return 0;
@@ -617,6 +616,7 @@ int tscan_start_job(tscan_job *job, as_transaction *tr, bool scan_disconnected_j
 {
 	int rsp = 0;
 	if ((job->job_type == SCAN_JOB_TYPE_PARTITION)
+			|| (job->job_type == SCAN_JOB_TYPE_STORAGE)
 			|| (SCAN_JOB_IS_POPULATOR(job))) {
 		scan_job_partitions_tracker * ptracker = cf_malloc(sizeof(scan_job_partitions_tracker));
 		if (ptracker == NULL) {
@@ -627,7 +627,7 @@ int tscan_start_job(tscan_job *job, as_transaction *tr, bool scan_disconnected_j
 		job->udata = ptracker;
 		// Disconnected job that started successfully - tell the client.
 		if (scan_disconnected_job) {
-			tscan_send_disconnected_job_ack_to_client(tr->proto_fd_h->fd);
+			tscan_send_disconnected_job_ack_to_client(tr->proto_fd_h);
 			AS_RELEASE_FILE_HANDLE(tr->proto_fd_h);
 			tr->proto_fd_h = 0;
 		}
@@ -647,24 +647,32 @@ int tscan_start_job(tscan_job *job, as_transaction *tr, bool scan_disconnected_j
 					(job->job_type == SCAN_JOB_TYPE_SINDEX_POPULATEALL) ? "SINDEX_POPULATEALL" : "SINDEX_POPULATE");
 		}
 
-		for (int i = 0; i < AS_PARTITIONS; i++) {
-			scan_job_workitem workitem;
-			workitem.tid = job->tid;
-			workitem.pid = i;
-			// Note : tscan_partition_thr() is the function that gets called by this queue-push.
-			// This gets called during tscan_init and a separate thread gets created for each index
-			// of the work-q. This thread i then infinitely waits on a queue-push for index i and
-			// processes the work item.
-			cf_queue_push( g_scan_partition_work_q_array[cycler++ % job->n_threads], &workitem);
+		if (job->job_type == SCAN_JOB_TYPE_STORAGE) {
+			// One workitem per device - the workitem's pid is the device index.
+			for (uint32_t i = 0; i < job->n_devices; i++) {
+				scan_job_workitem workitem;
+				workitem.tid = job->tid;
+				workitem.pid = i;
+				cf_queue_push( g_scan_partition_work_q_array[cycler++ % job->n_threads], &workitem);
+			}
+		}
+		else {
+			for (int i = 0; i < AS_PARTITIONS; i++) {
+				scan_job_workitem workitem;
+				workitem.tid = job->tid;
+				workitem.pid = i;
+				// Note : tscan_partition_thr() is the function that gets called by this queue-push.
+				// This gets called during tscan_init and a separate thread gets created for each index
+				// of the work-q. This thread i then infinitely waits on a queue-push for index i and
+				// processes the work item.
+				cf_queue_push( g_scan_partition_work_q_array[cycler++ % job->n_threads], &workitem);
+			}
 		}
 
 		// Debug only, check how many of the queues have workitems.
 		for (int i = 0; i < MAX_SCAN_THREADS; i++) {
 			cf_detail(AS_SCAN, "%d has %d workitems", i, cf_queue_sz(g_scan_partition_work_q_array[i]));
 		}
-	} else if (job->job_type == SCAN_JOB_TYPE_STORAGE) {
-		// @TODO streaming disk
-		//rsp = as_storage_init_scan_job(job);
 	} else {
 		rsp = -2;
 	}
@@ -876,6 +884,16 @@ as_tscan(as_transaction *tr)
 		job->n_threads          = 5;
 	}
 
+	// Full scans of data-on-disk may read the devices sequentially instead of
+	// reading each record found in the index.
+	if (ns->storage_type == AS_STORAGE_ENGINE_SSD && ns->storage_scan_device_order
+			&& ! ns->storage_data_in_memory && ! job->hasudf && scan_pct == 100) {
+		as_storage_attributes s_attr;
+		as_storage_namespace_attributes_get(ns, &s_attr);
+		job->job_type           = SCAN_JOB_TYPE_STORAGE;
+		job->n_devices          = (uint32_t)s_attr.n_devices;
+	}
+
 	cf_info(AS_SCAN, "scan option: Fail if cluster change %s", scan_fail_on_cluster_change ? "True" : "False");
 	cf_info(AS_SCAN, "scan option: Background Job %s", scan_disconnected_job ? "True" : "False");
 	cf_info(AS_SCAN, "scan option: priority is %d n_threads %d job_type %d", scan_priority, job->n_threads, job->job_type);
@@ -1174,35 +1192,19 @@ tscan_send_response_to_client( tscan_job *job, uint8_t *buf, size_t len)
 	// Keep the reaper at bay.
 	job->fd_h->last_used = cf_getms();
 
-	int pos = 0, rv;
-	while (pos < 8) {
-		rv = send(job->fd_h->fd, ((uint8_t *) &proto) + pos, 8 - pos , MSG_NOSIGNAL | MSG_MORE);
-		if (rv <= 0) {
-			if (errno != EAGAIN) {
-				cf_info(AS_SCAN, "tid %"PRIu64": scan send response error returned %d errno %d fd %d ", job->tid, rv, errno, job->fd_h->fd);
-				AS_RELEASE_FILE_HANDLE(job->fd_h);
-				job->fd_h = 0;
-				return(-1);
-			}
-		}
-		else {
-			pos += rv;
-		}
-	};
-	pos = 0;
-	while (pos < len) {
-		rv = send(job->fd_h->fd, buf + pos, len - pos, MSG_NOSIGNAL );
-		if (rv <= 0) {
-			if (errno != EAGAIN) {
-				cf_info(AS_SCAN, "tid %"PRIu64": scan send response error returned %d errno %d fd %d ", job->tid, rv, errno, job->fd_h->fd);
-				AS_RELEASE_FILE_HANDLE(job->fd_h);
-				job->fd_h = 0;
-				return(-1);
-			}
-		}
-		else {
-			pos += rv;
-		}
+	struct iovec iov[2];
+	iov[0].iov_base = &proto;
+	iov[0].iov_len = 8;
+	iov[1].iov_base = buf;
+	iov[1].iov_len = len;
+
+	// Throttled - a slow client slows the scan down, rather than spin this
+	// thread or have the scan's output pile up in memory.
+	if (as_msg_send_fh_iov(job->fd_h, iov, 2, true) != 0) {
+		cf_info(AS_SCAN, "tid %"PRIu64": scan send response error fd %d ", job->tid, job->fd_h->fd);
+		AS_RELEASE_FILE_HANDLE(job->fd_h);
+		job->fd_h = 0;
+		return(-1);
 	}
 	cf_atomic_int_add(&job->net_io_bytes, (len + 8));   // 8 bytes for proto header
 	cf_debug(AS_SCAN, "tid %"PRIu64": response to client fd %d bytes %u", job->tid, job->fd_h->fd, len);
@@ -1248,20 +1250,9 @@ tscan_send_fin_to_client(tscan_job *job, uint32_t result_code)
 	m.msg.n_ops = 0;
 	as_msg_swap_header(&m.msg);
 
-	uint8_t *buf = (uint8_t *) &m;
-
-	int pos = 0;
-	while (pos < sizeof(m)) {
-		int rv = send(fd, buf + pos, sizeof(m) - pos, MSG_NOSIGNAL);
-		if (rv <= 0) {
-			if (errno != EAGAIN) {
-				cf_info(AS_SCAN, "write fin %d errno %d fd %d", rv, errno, fd);
-				return(-1);
-			}
-		}
-		else {
-			pos += rv;
-		}
+	if (as_msg_send_fh(job->fd_h, (uint8_t *) &m, sizeof(m), false) != 0) {
+		cf_info(AS_SCAN, "write fin failed fd %d", fd);
+		return(-1);
 	}
 	cf_atomic_int_add(&job->net_io_bytes, (sizeof(m)));
 	return(0);
@@ -1540,6 +1531,178 @@ as_tscan_list(char *name, cf_dyn_buf *db)
 	return 0;
 }
 
+//
+// Callback function that gets called for every current record found by a
+// device-order scan. The record is locked and its device block is already in
+// the rd. Returns false to stop the device sweep.
+//
+static bool
+tscan_device_reduce(as_index_ref *r_ref, as_storage_rd *rd, void *udata)
+{
+	tscan_task_data *u = (tscan_task_data *) udata;
+	tscan_job *job = u->pjob;
+	cf_buf_builder **bb_r = &(u->bb);
+
+	if (IS_SCAN_JOB_ABORTED(job)) {
+		return false;
+	}
+
+	if (job->fail_on_cluster_change && job->cluster_key != as_paxos_get_cluster_key()) {
+		job->result = AS_PROTO_RESULT_FAIL_CLUSTER_KEY_MISMATCH;
+		return false;
+	}
+
+	as_index *r = r_ref->r;
+	// Check to see that this isn't an expired record waiting to die.
+	if (r->void_time && r->void_time < as_record_void_time_get()) {
+		cf_atomic_int_incr(&job->n_obj_expired);
+		return true;
+	}
+
+	// If this is a valid set, check against the set of the record.
+	if (u->set_id != INVALID_SET_ID && as_index_get_set_id(r) != u->set_id) {
+		cf_atomic_int_incr(&job->n_obj_set_diff);
+		return true;
+	}
+
+	cf_atomic_int_incr(&job->n_obj_scanned);
+
+	if (! *bb_r) {
+		*bb_r = cf_buf_builder_create_size(INITIAL_BUFBUILDER_SIZE);
+		cf_atomic_int_add(&job->mem_buf, (*bb_r)->alloc_sz);
+	}
+
+	size_t old_allocsz = (*bb_r)->alloc_sz;
+
+	if (u->nobindata) {
+		if (as_index_is_flag_set(r, AS_INDEX_FLAG_KEY_STORED)) {
+			as_msg_make_response_bufbuilder(r, rd, bb_r, true, NULL, true, true, u->binlist);
+		}
+		else {
+			as_msg_make_response_bufbuilder(r, NULL, bb_r, true, u->ns->name, true, false, u->binlist);
+		}
+	}
+	else {
+		rd->n_bins = as_bin_get_n_bins(r, rd);
+
+		as_bin stack_bins[rd->ns->storage_data_in_memory ? 0 : rd->n_bins];
+
+		rd->bins = as_bin_get_all(r, rd, stack_bins);
+		rd->n_bins = as_bin_inuse_count(rd);
+
+		as_msg_make_response_bufbuilder(r, rd, bb_r, false, NULL, true, true, u->binlist);
+	}
+
+	if ((*bb_r)->alloc_sz > old_allocsz) {
+		cf_atomic_int_add(&job->mem_buf, (*bb_r)->alloc_sz - old_allocsz);
+	}
+
+	// Sending waits for tscan_device_flush() - not here, where the record and
+	// its partition are held.
+
+	u->yield_count++;
+	if (u->yield_count % g_config.scan_priority == 0) {
+		usleep(g_config.scan_sleep);
+	}
+
+	return true;
+}
+
+//
+// Called between wblocks of a device-order scan, with no record or partition
+// held. Unlike a partition, a device is too big to buffer - stream as we go.
+// Returns false to stop the device sweep.
+//
+static bool
+tscan_device_flush(void *udata)
+{
+	tscan_task_data *u = (tscan_task_data *) udata;
+	tscan_job *job = u->pjob;
+
+	if (! u->bb || u->bb->used_sz < SCAN_DEVICE_RESPONSE_SIZE) {
+		return true;
+	}
+
+	pthread_mutex_lock(&job->LOCK);
+	int sresp = tscan_send_response_to_client(job, u->bb->buf, u->bb->used_sz);
+	pthread_mutex_unlock(&job->LOCK);
+
+	u->bb->used_sz = 0;
+
+	return sresp == 0;
+}
+
+//
+// Scans a device of an SSD namespace in device order, i.e. a wblock at a time.
+// Returns the partition state to record for the device's share of the tracker.
+//
+static uint32_t
+tscan_device(tscan_job *job, uint32_t device_ix, bool *early_terminate)
+{
+	tscan_task_data u;
+	memset(&u, 0, sizeof(tscan_task_data));
+
+	if (job->fd_h) {
+		u.bb = cf_buf_builder_create_size(INITIAL_BUFBUILDER_SIZE);
+		if (u.bb == NULL) {
+			cf_info(AS_SCAN, "scan_device: could not create buf builder: %d {%s:%d}", job->tid, job->ns->name, device_ix);
+			return SCAN_PARTITION_STATE_FAILED;
+		}
+		cf_atomic_int_add(&job->mem_buf, u.bb->alloc_sz);
+		u.fd_h = job->fd_h;
+	}
+
+	u.ns          = job->ns;
+	u.yield_count = 0;
+	u.nobindata   = job->nobindata;
+	u.nodata      = job->fd_h ? false : true;
+	u.set_id      = job->set_id;
+	u.binlist     = job->binlist;
+	u.job_id      = job->tid;
+	u.pjob        = job;
+
+	uint32_t state = SCAN_PARTITION_STATE_FINISHED;
+
+	cf_atomic_int_incr(&g_config.scan_tree_count);
+
+	if (0 != as_storage_scan_device(job->ns, device_ix, tscan_device_reduce, tscan_device_flush, (void *)&u)) {
+		state = SCAN_PARTITION_STATE_FAILED;
+	}
+
+	cf_atomic_int_decr(&g_config.scan_tree_count);
+
+	// Send what's left back to client.
+	if (u.bb && u.bb->used_sz) {
+		pthread_mutex_lock(&job->LOCK);
+		if (tscan_send_response_to_client(job, u.bb->buf, u.bb->used_sz) != 0) {
+			*early_terminate = true;
+		}
+		pthread_mutex_unlock(&job->LOCK);
+	}
+
+	if (u.bb) {
+		cf_atomic_int_sub(&job->mem_buf, u.bb->alloc_sz);
+		cf_buf_builder_free(u.bb);
+	}
+
+	// Sweep may have stopped early - the client went away, or the job was
+	// aborted, or the cluster changed.
+	if (job->fd_h == NULL && ! u.nodata) {
+		*early_terminate = true;
+	}
+
+	if (IS_SCAN_JOB_ABORTED(job)) {
+		cf_atomic_int_incr(&g_config.tscan_aborted);
+		job->result = AS_PROTO_RESULT_FAIL_SCAN_ABORT;
+		*early_terminate = true;
+	}
+	else if (job->result == AS_PROTO_RESULT_FAIL_CLUSTER_KEY_MISMATCH) {
+		*early_terminate = true;
+	}
+
+	return state;
+}
+
 // This function gets called for both scan and udf on a per-partition basis.
 void *
 tscan_partition_thr(void *q_to_wait_on)
@@ -1583,6 +1746,12 @@ tscan_partition_thr(void *q_to_wait_on)
 			goto WorkItemDone;
 		}
 
+		// Device-order scans read a whole device per workitem.
+		if (job->job_type == SCAN_JOB_TYPE_STORAGE) {
+			partition_state = tscan_device(job, workitem.pid, &job_early_terminate);
+			goto WorkItemDone;
+		}
+
 		// Iterating through the partition data.
 		as_partition_reservation rsv;
 		AS_PARTITION_RESERVATION_INIT(rsv);
@@ -1848,7 +2017,7 @@ tscan_fabric_msg_receiver(cf_node node, msg *m, void *udata)
 		case TSCAN_OP_SPROC_UPDATE:
 		{
 			// @TODO need to grab prole job and update status.
-			// cf_atomic_int_incr(&g_config.write_prole);
+			// cf_shard_counter_incr(&g_config.write_prole);
 
 			scan_udf_commit_prole(node, m);
 			break;
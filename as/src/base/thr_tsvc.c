@@ -31,9 +31,12 @@
 
 #include "citrusleaf/alloc.h"
 #include "citrusleaf/cf_atomic.h"
+#include "citrusleaf/cf_clock.h"
 
+#include "dynbuf.h"
 #include "fault.h"
 #include "queue.h"
+#include "ring.h"
 #include "util.h"
 
 #include "base/cfg.h"
@@ -199,7 +202,7 @@ transaction_check_msg(as_transaction *tr)
 					0, 0, 0, 0, 0, 0, 0, tr->trid, NULL);
 			tr->proto_fd_h = 0;
 			MICROBENCHMARK_HIST_INSERT_P(error_hist);
-			cf_atomic_int_incr(&g_config.err_tsvc_requests);
+			cf_shard_counter_incr(&g_config.err_tsvc_requests);
 		}
 		return -1;
 	}
@@ -234,7 +237,7 @@ transaction_check_msg(as_transaction *tr)
 			tr->proto_fd_h = 0;
 			// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 			MICROBENCHMARK_HIST_INSERT_P(error_hist);
-			cf_atomic_int_incr(&g_config.err_tsvc_requests);
+			cf_shard_counter_incr(&g_config.err_tsvc_requests);
 		}
 		return 1;
 	}
@@ -250,7 +253,7 @@ transaction_check_msg(as_transaction *tr)
 			tr->proto_fd_h = 0;
 			// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 			MICROBENCHMARK_HIST_INSERT_P(error_hist);
-			cf_atomic_int_incr(&g_config.err_tsvc_requests);
+			cf_shard_counter_incr(&g_config.err_tsvc_requests);
 		}
 		return 1;
 	}
@@ -266,7 +269,7 @@ transaction_check_msg(as_transaction *tr)
 			tr->proto_fd_h = 0;
 			// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 			MICROBENCHMARK_HIST_INSERT_P(error_hist);
-			cf_atomic_int_incr(&g_config.err_tsvc_requests);
+			cf_shard_counter_incr(&g_config.err_tsvc_requests);
 		}
 		return 1;
 	}
@@ -278,7 +281,7 @@ transaction_check_msg(as_transaction *tr)
 			tr->proto_fd_h = 0;
 			// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 			MICROBENCHMARK_HIST_INSERT_P(error_hist);
-			cf_atomic_int_incr(&g_config.err_tsvc_requests);
+			cf_shard_counter_incr(&g_config.err_tsvc_requests);
 		}
 		return 2;
 	}
@@ -318,6 +321,66 @@ is_udf(cl_msg *msgp)
 }
 
 
+// Prefetch completion - runs on the storage engine's completion thread. Put the
+// parked transaction back on the queue, carrying the record data.
+static void
+read_prefetch_done(as_storage_prefetch *pf, void *udata)
+{
+	as_transaction *tr = (as_transaction *)udata;
+
+	tr->prefetch = pf;
+	tr->flag |= AS_TRANSACTION_FLAG_PREFETCH;
+
+	if (0 != thr_tsvc_enqueue(tr)) {
+		cf_warning(AS_TSVC, "failed re-queueing prefetched read");
+		as_storage_prefetch_destroy(pf);
+		cf_free(tr->msgp);
+	}
+
+	cf_free(tr);
+}
+
+
+// With io-engine uring, rather than have this thread wait on the device, start
+// reading the record and park the transaction until the data is in. Returns
+// true if the transaction was parked - a copy now owns its msgp etc.
+static bool
+read_prefetch(as_transaction *tr)
+{
+	as_namespace *ns = tr->rsv.ns;
+
+	// Duplicate resolution may fetch the winning record from elsewhere.
+	if (ns->storage_data_in_memory || tr->rsv.n_dupl != 0 ||
+			(tr->msgp->msg.info1 & AS_MSG_INFO1_GET_NOBINDATA)) {
+		return false;
+	}
+
+	as_index_ref r_ref;
+	r_ref.skip_lock = true; // only need the record's device location
+
+	if (0 != as_record_get(tr->rsv.tree, &tr->keyd, &r_ref, ns)) {
+		return false;
+	}
+
+	as_transaction *parked = cf_malloc(sizeof(as_transaction));
+
+	cf_assert(parked, AS_TSVC, CF_CRITICAL, "failed transaction allocation");
+
+	*parked = *tr;
+
+	bool started = as_storage_record_prefetch(ns, r_ref.r, read_prefetch_done,
+			parked);
+
+	as_record_done(&r_ref, ns);
+
+	if (! started) {
+		cf_free(parked);
+	}
+
+	return started;
+}
+
+
 // Handle the transaction, including proxy to another node if necessary.
 void
 process_transaction(as_transaction *tr)
@@ -347,6 +410,17 @@ process_transaction(as_transaction *tr)
 	if (!tr || !tr->msgp) {
 		return;
 	}
+
+	// Prefetched record data is only good for this pass - if the transaction
+	// gets re-queued, it reads the device again.
+	as_storage_prefetch *prefetch = NULL;
+
+	if (tr->flag & AS_TRANSACTION_FLAG_PREFETCH) {
+		prefetch = tr->prefetch;
+		tr->flag &= ~AS_TRANSACTION_FLAG_PREFETCH;
+	}
+
+	AS_TR_TRACE_STAGE(tr, AS_TR_STAGE_DEQUEUE);
 	cl_msg *msgp = tr->msgp;
 
 	int retval = transaction_check_msg(tr);
@@ -450,7 +524,7 @@ process_transaction(as_transaction *tr)
 					as_msg_send_error(tr->proto_fd_h, AS_PROTO_RESULT_FAIL_PARAMETER);
 					tr->proto_fd_h = 0;
 					MICROBENCHMARK_HIST_INSERT_P(error_hist);
-					cf_atomic_int_incr(&g_config.batch_errors);
+					cf_shard_counter_incr(&g_config.batch_errors);
 				}
 			} else if (rv == -4) {
 				cf_info(AS_TSVC, "bailed due to bad protocol. Returning failure to client");
@@ -461,7 +535,7 @@ process_transaction(as_transaction *tr)
 					tr->proto_fd_h = 0;
 					// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 					MICROBENCHMARK_HIST_INSERT_P(error_hist);
-					cf_atomic_int_incr(&g_config.err_tsvc_requests);
+					cf_shard_counter_incr(&g_config.err_tsvc_requests);
 				}
 			}
 			else {
@@ -474,7 +548,7 @@ process_transaction(as_transaction *tr)
 					tr->proto_fd_h = 0;
 					// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 					MICROBENCHMARK_HIST_INSERT_P(error_hist);
-					cf_atomic_int_incr(&g_config.err_tsvc_requests);
+					cf_shard_counter_incr(&g_config.err_tsvc_requests);
 				}
 			}
 			goto Cleanup;
@@ -497,7 +571,7 @@ process_transaction(as_transaction *tr)
 		}
 		// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 		MICROBENCHMARK_HIST_INSERT_P(error_hist);
-		cf_atomic_int_incr(&g_config.err_tsvc_requests);
+		cf_shard_counter_incr(&g_config.err_tsvc_requests);
 		goto Cleanup;
 	}
 
@@ -511,7 +585,7 @@ process_transaction(as_transaction *tr)
 			tr->proto_fd_h = 0;
 			// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 			MICROBENCHMARK_HIST_INSERT_P(error_hist);
-			cf_atomic_int_incr(&g_config.err_tsvc_requests);
+			cf_shard_counter_incr(&g_config.err_tsvc_requests);
 		}
 		goto Cleanup;
 	}
@@ -535,7 +609,7 @@ process_transaction(as_transaction *tr)
 			tr->proto_fd_h = 0;
 			// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 			MICROBENCHMARK_HIST_INSERT_P(error_hist);
-			cf_atomic_int_incr(&g_config.err_tsvc_requests);
+			cf_shard_counter_incr(&g_config.err_tsvc_requests);
 		}
 		goto Cleanup;
 	}
@@ -681,6 +755,7 @@ process_transaction(as_transaction *tr)
 
 			ns = 0; // got a reservation
 			tr->microbenchmark_is_resolve = false;
+			AS_TR_TRACE_STAGE(tr, AS_TR_STAGE_RESERVE);
 			if (msgp->msg.info2 & AS_MSG_INFO2_WRITE) {
 				// Do the WRITE.
 				cf_detail_digest(AS_TSVC, &(tr->keyd),
@@ -694,13 +769,23 @@ process_transaction(as_transaction *tr)
 				}
 			}
 			else {
-				// Do the READ.
+				// Do the READ - once the record data is in, if the device
+				// read can be done asynchronously.
+				if (! prefetch && read_prefetch(tr)) {
+					as_partition_release(&tr->rsv);
+					cf_atomic_int_decr(&g_config.rw_tree_count);
+					free_msgp = false;
+					goto Cleanup;
+				}
+
 				cf_detail_digest(AS_TSVC, &(tr->keyd),
 						"AS_READ_START  dupl(%d) :", tr->rsv.n_dupl);
 
 				MICROBENCHMARK_HIST_INSERT_AND_RESET_P(rt_q_process_hist);
 
+				as_storage_prefetch_attach(prefetch);
 				rv = as_read_start(tr); // <><> READ <><>
+				as_storage_prefetch_attach(NULL);
 				if (rv == 0) {
 					free_msgp = false;
 				}
@@ -751,7 +836,7 @@ process_transaction(as_transaction *tr)
 						tr->proto_fd_h = 0;
 						// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 						MICROBENCHMARK_HIST_INSERT_P(error_hist);
-						cf_atomic_int_incr(&g_config.err_tsvc_requests);
+						cf_shard_counter_incr(&g_config.err_tsvc_requests);
 					}
 					else if (tr->proxy_msg) {
 						MICROBENCHMARK_HIST_INSERT_P(error_hist);
@@ -844,7 +929,7 @@ process_transaction(as_transaction *tr)
 			tr->proto_fd_h = 0;
 			// histogram_insert_data_point(g_config.rt_hist, tr->start_time);
 			MICROBENCHMARK_HIST_INSERT_P(error_hist);
-			cf_atomic_int_incr(&g_config.err_tsvc_requests);
+			cf_shard_counter_incr(&g_config.err_tsvc_requests);
 			if (free_msgp == true) {
 				cf_free(msgp);
 				free_msgp = false;
@@ -877,71 +962,223 @@ Cleanup:
 	if (free_msgp) {
 		cf_free(msgp);
 	}
+
+	if (prefetch) {
+		as_storage_prefetch_destroy(prefetch);
+	}
 } // end process_transaction()
 
 
-// Service transactions - arg is the queue we're to service.
+//==========================================================
+// Transaction queues.
+//
+
+// Each queue is a lock-free ring, with a locked overflow queue for when the
+// ring is full. Threads serve their own (home) queue first, and steal from the
+// other queues when it's empty - so in queue-per-device mode, device affinity
+// is a preference rather than a hard partition, and one slow device or hot key
+// range can't leave threads on the other queues idle.
+
+#define TSVC_RING_CAPACITY (4 * 1024)
+
+typedef struct tsvc_entry_s {
+	uint64_t		enqueue_us;
+	as_transaction	tr;
+} tsvc_entry;
+
+typedef struct tsvc_queue_s {
+	cf_ring			*ring;
+	cf_queue		*overflow_q;
+	cf_atomic64		n_popped;
+	cf_atomic64		n_stolen;	// popped by threads from other queues
+	cf_atomic64		wait_us;	// total time popped entries spent queued
+} tsvc_queue;
+
+static tsvc_queue g_tsvc_queues[MAX_TRANSACTION_QUEUES];
+
+// Threads with nothing to do, even by stealing, wait here.
+static pthread_mutex_t g_tsvc_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_tsvc_idle_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t g_tsvc_n_idle = 0;
+
+static void
+tsvc_queue_push(uint32_t q_ix, as_transaction *tr)
+{
+	tsvc_queue *q = &g_tsvc_queues[q_ix];
+	tsvc_entry e;
+
+	e.enqueue_us = cf_getus();
+	e.tr = *tr;
+
+	if (! cf_ring_push(q->ring, &e)) {
+		cf_queue_push(q->overflow_q, &e);
+	}
+
+	// Pairs with the barrier in tsvc_wait() - either we see the idle thread,
+	// or it sees our entry.
+	smb_mb();
+
+	if (__atomic_load_n(&g_tsvc_n_idle, __ATOMIC_RELAXED) != 0) {
+		pthread_mutex_lock(&g_tsvc_idle_lock);
+		pthread_cond_signal(&g_tsvc_idle_cond);
+		pthread_mutex_unlock(&g_tsvc_idle_lock);
+	}
+}
+
+static inline bool
+tsvc_queue_pop(tsvc_queue *q, tsvc_entry *e)
+{
+	return cf_ring_pop(q->ring, e) ||
+			cf_queue_pop(q->overflow_q, e, CF_QUEUE_NOWAIT) == CF_QUEUE_OK;
+}
+
+// Pop from the home queue, or failing that, steal from the others.
+static bool
+tsvc_get(uint32_t home_ix, tsvc_entry *e)
+{
+	uint32_t n_queues = g_config.n_transaction_queues;
+	tsvc_queue *q = &g_tsvc_queues[home_ix];
+
+	if (! tsvc_queue_pop(q, e)) {
+		uint32_t n;
+
+		for (n = 1; n < n_queues; n++) {
+			q = &g_tsvc_queues[(home_ix + n) % n_queues];
+
+			if (tsvc_queue_pop(q, e)) {
+				cf_atomic64_incr(&q->n_stolen);
+				break;
+			}
+		}
+
+		if (n == n_queues) {
+			return false;
+		}
+	}
+
+	cf_atomic64_incr(&q->n_popped);
+	cf_atomic64_add(&q->wait_us, (int64_t)(cf_getus() - e->enqueue_us));
+
+	return true;
+}
+
+static void
+tsvc_wait(uint32_t home_ix, tsvc_entry *e)
+{
+	pthread_mutex_lock(&g_tsvc_idle_lock);
+
+	__atomic_fetch_add(&g_tsvc_n_idle, 1, __ATOMIC_RELAXED);
+	smb_mb();
+
+	while (! tsvc_get(home_ix, e)) {
+		pthread_cond_wait(&g_tsvc_idle_cond, &g_tsvc_idle_lock);
+	}
+
+	__atomic_fetch_sub(&g_tsvc_n_idle, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&g_tsvc_idle_lock);
+}
+
+
+// Service transactions - arg is the index of our home queue.
 void *
 thr_tsvc(void *arg)
 {
-	cf_queue *q = (cf_queue *) arg;
-
-	cf_assert(arg, AS_TSVC, CF_CRITICAL, "invalid argument");
+	uint32_t home_ix = (uint32_t)(uint64_t)arg;
 
 	// Wait for a transaction to arrive.
 	for ( ; ; ) {
-		as_transaction tr;
-		if (0 != cf_queue_pop(q, &tr, CF_QUEUE_FOREVER)) {
-			cf_crash(AS_TSVC, "unable to pop from transaction queue");
+		tsvc_entry e;
+
+		if (! tsvc_get(home_ix, &e)) {
+			tsvc_wait(home_ix, &e);
 		}
-		process_transaction(&tr);
+
+		process_transaction(&e.tr);
 	}
 
 	return NULL;
 } // end thr_tsvc()
 
 
-// The weak cousin of thr_tsvc(), this thread waits for one or more transactions
-// to appear on the slow queue - waits for a brief moment, then pushes all of
-// the "slow" queue transactions back on to "fast" queue. The purpose of this
-// queue is to delay processing for those transactions that are not currently
-// ready to be processed - usually because they are seeing a "cluster key
-// mismatch" state. Note that we process ALL transactions on the slow queue
-// after a brief wait, so that none of the transactions on the queue are
-// unequally penalized.
+//==========================================================
+// Slow queue.
+//
+
+// Transactions that aren't ready to be processed - usually because they are
+// seeing a "cluster key mismatch" state - are parked on a timer wheel for a
+// brief moment, then pushed back on to the "fast" queues. Every transaction is
+// delayed by the same amount, so none are unequally penalized.
+
+#define SLOW_WHEEL_TICK_US	250
+#define SLOW_WHEEL_N_SLOTS	64
+#define SLOW_DELAY_TICKS	2 // 500 micro-seconds
+
+typedef struct tsvc_slow_wheel_s {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;		// signaled when the wheel stops being empty
+	uint64_t		cur_tick;	// next tick to be served
+	uint64_t		wake_tick;	// tick of the first push into an empty wheel
+	uint32_t		n_pending;
+	cf_queue		*slots[SLOW_WHEEL_N_SLOTS];
+} tsvc_slow_wheel;
+
+static tsvc_slow_wheel g_slow_wheel = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER
+};
+
+// The weak cousin of thr_tsvc(), this thread turns the wheel, re-enqueueing
+// transactions as their slots come due. It sleeps when the wheel is empty.
 void *
 thr_tsvc_slow(void *null_arg)
 {
-	cf_queue *q = g_config.transaction_slow_q;
+	tsvc_slow_wheel *w = &g_slow_wheel;
 
-	cf_assert(q, AS_TSVC, CF_CRITICAL, "invalid Q argument");
+	pthread_mutex_lock(&w->lock);
 
-	// Wait for a transaction to arrive.
 	for ( ; ; ) {
-		as_transaction tr;
-		if (0 != cf_queue_pop(q, &tr, CF_QUEUE_FOREVER)) {
-			cf_crash(AS_TSVC, "unable to pop from SLOW transaction queue");
+		if (w->n_pending == 0) {
+			do {
+				pthread_cond_wait(&w->cond, &w->lock);
+			} while (w->n_pending == 0);
+
+			// Nothing was served while idle - start from the first push, not
+			// from where we stopped, or this pass would serve every slot.
+			w->cur_tick = w->wake_tick;
 		}
-		cf_atomic_int_incr(&g_config.stat_slow_trans_queue_pop);
-		cf_atomic_int_incr(&g_config.stat_slow_trans_queue_batch_pop);
 
-		usleep(500); // sleep 500 micro-seconds
+		uint64_t now_tick = cf_getus() / SLOW_WHEEL_TICK_US;
 
-		// Get the current size of the queue to transfer all remaining ...
-		int counter = cf_queue_sz(q);
-		// ... then transfer the one just popped, so it's not included in the
-		// count even if it gets returned to the slow queue immediately.
-		thr_tsvc_enqueue(&tr);
+		// If we fell more than a revolution behind, one pass serves all slots.
+		if (now_tick >= w->cur_tick + SLOW_WHEEL_N_SLOTS) {
+			w->cur_tick = now_tick - SLOW_WHEEL_N_SLOTS + 1;
+		}
 
-		// Transfer all.
-		while (counter-- > 0) {
-			if (0 != cf_queue_pop(q, &tr, CF_QUEUE_NOWAIT)) {
-				cf_warning(AS_TSVC, "Empty Queue during Slow Trans Queue Clear");
-				break;
+		for ( ; w->cur_tick <= now_tick; w->cur_tick++) {
+			cf_queue *slot = w->slots[w->cur_tick % SLOW_WHEEL_N_SLOTS];
+			as_transaction tr;
+
+			if (cf_queue_sz(slot) != 0) {
+				cf_atomic_int_incr(&g_config.stat_slow_trans_queue_batch_pop);
+			}
+
+			while (cf_queue_pop(slot, &tr, CF_QUEUE_NOWAIT) == CF_QUEUE_OK) {
+				w->n_pending--;
+				cf_atomic_int_incr(&g_config.stat_slow_trans_queue_pop);
+				thr_tsvc_enqueue(&tr);
 			}
-			cf_atomic_int_incr(&g_config.stat_slow_trans_queue_pop);
-			thr_tsvc_enqueue(&tr);
 		}
+
+		pthread_mutex_unlock(&w->lock);
+
+		// Sleep until the next tick.
+		uint64_t now_us = cf_getus();
+		uint64_t next_us = (now_us / SLOW_WHEEL_TICK_US + 1) * SLOW_WHEEL_TICK_US;
+
+		usleep(next_us - now_us);
+
+		pthread_mutex_lock(&w->lock);
 	}
 
 	return NULL;
@@ -1001,7 +1238,14 @@ as_tsvc_init()
 
 	// Create the transaction queues.
 	for (int i = 0; i < g_config.n_transaction_queues ; i++) {
-		g_config.transactionq_a[i] = cf_queue_create(sizeof(as_transaction), true);
+		tsvc_queue *q = &g_tsvc_queues[i];
+
+		q->ring = cf_ring_create(sizeof(tsvc_entry), TSVC_RING_CAPACITY);
+		q->overflow_q = cf_queue_create(sizeof(tsvc_entry), true);
+
+		if (! q->ring || ! q->overflow_q) {
+			cf_crash(AS_TSVC, "tsvc queue %d create failed", i);
+		}
 	}
 
 	// Allocate the transaction threads that service all the queues.
@@ -1014,7 +1258,7 @@ as_tsvc_init()
 	// Start all the transaction threads.
 	for (int i = 0; i < g_config.n_transaction_queues; i++) {
 		for (int j = 0; j < g_config.n_transaction_threads_per_queue; j++) {
-			if (0 != pthread_create(transaction_thread(i, j), NULL, thr_tsvc, (void*)g_config.transactionq_a[i])) {
+			if (0 != pthread_create(transaction_thread(i, j), NULL, thr_tsvc, (void*)(uint64_t)i)) {
 				cf_crash(AS_TSVC, "tsvc thread %d:%d create failed", i, j);
 			}
 		}
@@ -1023,7 +1267,12 @@ as_tsvc_init()
 	// Now that we have the regular transaction queues set up, we set up the
 	// special SLOW queue - where we place transactions that need to pause a bit
 	// before running again.
-	g_config.transaction_slow_q = cf_queue_create(sizeof(as_transaction), true);
+	for (int i = 0; i < SLOW_WHEEL_N_SLOTS; i++) {
+		// Protected by the wheel's lock.
+		if (! (g_slow_wheel.slots[i] = cf_queue_create(sizeof(as_transaction), false))) {
+			cf_crash(AS_TSVC, "tsvc slow queue create failed");
+		}
+	}
 
 	// Start the thread that manages the slow queue.
 	if (0 != pthread_create(&g_slow_queue_thread, NULL, thr_tsvc_slow, NULL)) {
@@ -1096,14 +1345,14 @@ thr_tsvc_enqueue(as_transaction *tr)
 		n_q = (g_config.transactionq_current++) % g_config.n_transaction_queues;
 	}
 
-	cf_queue *q;
-
-	if ((q = g_config.transactionq_a[n_q]) == NULL) {
+	if (! g_tsvc_queues[n_q].ring) {
 		cf_warning(AS_TSVC, "transaction queue #%d not initialized!", n_q);
 		return -1;
 	}
 
-	return cf_queue_push(q, tr);
+	tsvc_queue_push(n_q, tr);
+
+	return 0;
 } // end thr_tsvc_enqueue()
 
 
@@ -1112,18 +1361,37 @@ thr_tsvc_enqueue(as_transaction *tr)
 // down the processing of any transaction placed here, as the transaction is
 // likely not ready for processing for the next milli-second or two. Rather than
 // re-queue it on the regular (fast) thr_tsvc queue (which results in "spin"),
-// we enqueue transactions here that need to take a small breather before being
+// we park transactions here that need to take a small breather before being
 // thrust back into action.
 int
 thr_tsvc_enqueue_slow(as_transaction *tr)
 {
-	cf_queue *q = g_config.transaction_slow_q;
-
-	cf_assert(q, AS_TSVC, CF_CRITICAL, "invalid Q argument");
+	tsvc_slow_wheel *w = &g_slow_wheel;
 
 	cf_atomic_int_incr(&g_config.stat_slow_trans_queue_push);
 
-	return cf_queue_push(q, tr);
+	pthread_mutex_lock(&w->lock);
+
+	uint64_t tick = cf_getus() / SLOW_WHEEL_TICK_US;
+
+	if (w->n_pending == 0) {
+		w->wake_tick = tick;
+	}
+
+	// The wheel thread may be ahead of us - don't push into a served slot.
+	if (tick < w->cur_tick) {
+		tick = w->cur_tick;
+	}
+
+	int rv = cf_queue_push(w->slots[(tick + SLOW_DELAY_TICKS) % SLOW_WHEEL_N_SLOTS], tr);
+
+	if (rv == CF_QUEUE_OK && w->n_pending++ == 0) {
+		pthread_cond_signal(&w->cond);
+	}
+
+	pthread_mutex_unlock(&w->lock);
+
+	return rv;
 } // end thr_tsvc_enqueue_slow()
 
 
@@ -1134,8 +1402,10 @@ thr_tsvc_queue_get_size()
 	int qs = 0;
 
 	for (int i = 0; i < g_config.n_transaction_queues; i++) {
-		if (g_config.transactionq_a[i]) {
-			qs += cf_queue_sz(g_config.transactionq_a[i]);
+		tsvc_queue *q = &g_tsvc_queues[i];
+
+		if (q->ring) {
+			qs += cf_ring_sz(q->ring) + cf_queue_sz(q->overflow_q);
 		}
 		else {
 			cf_detail(AS_TSVC, "no queue when getting size");
@@ -1144,3 +1414,61 @@ thr_tsvc_queue_get_size()
 
 	return qs;
 } // end thr_tsvc_queue_get_size()
+
+
+// Per-queue depth, steals and wait times. In queue-per-device mode, queues are
+// named by namespace, read/write and device index.
+int
+thr_tsvc_queue_info(char *name, cf_dyn_buf *db)
+{
+	for (int i = 0; i < g_config.n_transaction_queues; i++) {
+		tsvc_queue *q = &g_tsvc_queues[i];
+
+		if (! q->ring) {
+			continue;
+		}
+
+		if (g_config.use_queue_per_device) {
+			for (int n = 0; n < g_config.namespaces; n++) {
+				tsvc_namespace_devices *dev = &g_tsvc_devices_a[n];
+				int n_per_op = dev->n_devices ? dev->n_devices : 1;
+				int q_ix = i - dev->queue_offset;
+
+				if (q_ix < 0 || q_ix >= n_per_op * 2) {
+					continue;
+				}
+
+				cf_dyn_buf_append_string(db, dev->n_name);
+				cf_dyn_buf_append_string(db, q_ix < n_per_op ? ":read" : ":write");
+
+				if (dev->n_devices) {
+					cf_dyn_buf_append_char(db, ':');
+					cf_dyn_buf_append_int(db, q_ix % n_per_op);
+				}
+
+				break;
+			}
+		}
+		else {
+			cf_dyn_buf_append_string(db, "queue-");
+			cf_dyn_buf_append_int(db, i);
+		}
+
+		uint64_t n_popped = cf_atomic64_get(q->n_popped);
+		uint64_t wait_us = cf_atomic64_get(q->wait_us);
+
+		cf_dyn_buf_append_string(db, ":depth=");
+		cf_dyn_buf_append_uint32(db, cf_ring_sz(q->ring) + cf_queue_sz(q->overflow_q));
+		cf_dyn_buf_append_string(db, ",popped=");
+		cf_dyn_buf_append_uint64(db, n_popped);
+		cf_dyn_buf_append_string(db, ",stolen=");
+		cf_dyn_buf_append_uint64(db, cf_atomic64_get(q->n_stolen));
+		cf_dyn_buf_append_string(db, ",avg-wait-us=");
+		cf_dyn_buf_append_uint64(db, n_popped ? wait_us / n_popped : 0);
+		cf_dyn_buf_append_char(db, ';');
+	}
+
+	cf_dyn_buf_chomp(db);
+
+	return 0;
+} // end thr_tsvc_queue_info()
@@ -26,8 +26,10 @@
 
 #include "base/transaction.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -36,6 +38,7 @@
 #include "citrusleaf/cf_clock.h"
 #include "citrusleaf/cf_digest.h"
 
+#include "dynbuf.h"
 #include "fault.h"
 
 #include "base/datamodel.h"
@@ -94,6 +97,8 @@ as_transaction_init(as_transaction *tr, cf_digest *keyd, cl_msg *msgp)
 	tr->microbenchmark_time       = 0;
 	tr->microbenchmark_is_resolve = false;
 
+	tr->trace.sampled             = false;
+
 	tr->proxy_node                = 0;
 	tr->proxy_msg                 = 0;
 
@@ -327,6 +332,7 @@ as_transaction_create( as_transaction *tr, tr_create_data *  trc_data)
 	tr->trid         = 0;	// at this point we don't know the transaction-id
 	tr->generation   = 0;
 	tr->microbenchmark_time = 0;
+	tr->trace.sampled = false;
 	tr->flag         = 0;
 	tr->msgp         = (cl_msg *) buf_r;
 	tr->keyd         = d->digest;
@@ -357,10 +363,172 @@ as_release_file_handle(as_file_handle *proto_fd_h)
 		}
 	}
 
+	if (proto_fd_h->recv_buf) {
+		cf_free(proto_fd_h->recv_buf);
+		proto_fd_h->recv_buf = NULL;
+	}
+
 	if (proto_fd_h->security_filter) {
 		as_security_filter_destroy(proto_fd_h->security_filter);
 		proto_fd_h->security_filter = NULL;
 	}
 
+	as_msg_send_fh_destroy(proto_fd_h);
+
 	cf_atomic_int_incr(&g_config.proto_connections_closed);
 }
+
+
+//==========================================================
+// Transaction trace sampling.
+//
+// Sampled transactions are copied into a ring at finish. Writers claim slots
+// with an atomic increment and don't wait for each other or for readers - each
+// slot has a sequence number which is odd while the slot is being written, so
+// readers can skip slots caught mid-write.
+//
+
+#define TR_TRACE_RING_SIZE 1024
+
+typedef struct tr_trace_record_s {
+	uint64_t		seq;
+	cf_digest		keyd;
+	as_namespace*	ns;
+	bool			is_read;
+	int				result_code;
+	uint32_t		total_us;
+	as_tr_trace		trace;
+} tr_trace_record;
+
+static tr_trace_record g_tr_trace_ring[TR_TRACE_RING_SIZE];
+static uint64_t g_tr_trace_n = 0;
+
+static const char* TR_STAGE_NAMES[AS_TR_N_STAGES] = {
+		"demarshal",
+		"dequeue",
+		"reserve",
+		"record-lock",
+		"storage-read",
+		"replicate",
+		"reply"
+};
+
+// Decide whether to trace a newly demarshaled transaction - 1 in every
+// transaction-trace-sample-rate, counted per demarshal thread.
+void
+as_tr_trace_sample(as_transaction *tr)
+{
+	static __thread uint32_t n_seen = 0;
+
+	uint32_t rate = g_config.transaction_trace_sample_rate;
+
+	tr->trace.sampled = rate != 0 && n_seen++ % rate == 0;
+	tr->trace.stages = 0;
+}
+
+// Copy a finished sampled transaction's trace into the ring.
+void
+as_tr_trace_finish(as_transaction *tr, bool is_read)
+{
+	if ((tr->trace.stages & (1 << AS_TR_STAGE_REPLY)) == 0) {
+		AS_TR_TRACE_STAGE(tr, AS_TR_STAGE_REPLY);
+	}
+
+	uint64_t n = __atomic_fetch_add(&g_tr_trace_n, 1, __ATOMIC_RELAXED);
+	tr_trace_record *rec = &g_tr_trace_ring[n % TR_TRACE_RING_SIZE];
+
+	__atomic_store_n(&rec->seq, (n * 2) + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	rec->keyd = tr->keyd;
+	rec->ns = tr->rsv.ns;
+	rec->is_read = is_read;
+	rec->result_code = tr->result_code;
+	rec->total_us = (uint32_t)((cf_getns() - tr->start_time) / 1000);
+	rec->trace = tr->trace;
+
+	__atomic_store_n(&rec->seq, (n * 2) + 2, __ATOMIC_RELEASE);
+}
+
+static int
+tr_trace_record_cmp(const void *pa, const void *pb)
+{
+	uint32_t a = ((const tr_trace_record*)pa)->total_us;
+	uint32_t b = ((const tr_trace_record*)pb)->total_us;
+
+	return a < b ? 1 : (a > b ? -1 : 0);
+}
+
+// Get the slowest traces in the ring, slowest first, e.g.:
+// ns=test,digest=7e3b41c6a2f0d812,op=read,result=0,total=5238,demarshal=4,
+// dequeue=4870,reserve=2,record-lock=3,storage-read=342,reply=17;
+// Each stage shows microseconds since the previous stage reached.
+void
+as_tr_trace_get_info(uint32_t max_traces, cf_dyn_buf *db)
+{
+	tr_trace_record *recs =
+			cf_malloc(sizeof(tr_trace_record) * TR_TRACE_RING_SIZE);
+
+	if (! recs) {
+		cf_dyn_buf_append_string(db, "error-allocation");
+		return;
+	}
+
+	uint32_t n_recs = 0;
+
+	for (uint32_t i = 0; i < TR_TRACE_RING_SIZE; i++) {
+		tr_trace_record *rec = &g_tr_trace_ring[i];
+		uint64_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == 0 || (seq & 1) != 0) {
+			continue; // never written, or being written
+		}
+
+		recs[n_recs] = *rec;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (__atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == seq) {
+			n_recs++;
+		}
+	}
+
+	qsort(recs, n_recs, sizeof(tr_trace_record), tr_trace_record_cmp);
+
+	if (max_traces > n_recs) {
+		max_traces = n_recs;
+	}
+
+	for (uint32_t i = 0; i < max_traces; i++) {
+		tr_trace_record *rec = &recs[i];
+
+		cf_dyn_buf_append_string(db, "ns=");
+		cf_dyn_buf_append_string(db, rec->ns ? rec->ns->name : "");
+		cf_dyn_buf_append_string(db, ",digest=");
+		cf_dyn_buf_append_uint64_x(db, *(uint64_t*)&rec->keyd);
+		cf_dyn_buf_append_string(db, rec->is_read ? ",op=read" : ",op=write");
+		cf_dyn_buf_append_string(db, ",result=");
+		cf_dyn_buf_append_int(db, rec->result_code);
+		cf_dyn_buf_append_string(db, ",total=");
+		cf_dyn_buf_append_uint32(db, rec->total_us);
+
+		uint32_t prev_us = 0;
+
+		for (int s = 0; s < AS_TR_N_STAGES; s++) {
+			if ((rec->trace.stages & (1 << s)) == 0) {
+				continue;
+			}
+
+			uint32_t us = rec->trace.stage_us[s];
+
+			cf_dyn_buf_append_char(db, ',');
+			cf_dyn_buf_append_string(db, TR_STAGE_NAMES[s]);
+			cf_dyn_buf_append_char(db, '=');
+			cf_dyn_buf_append_uint32(db, us > prev_us ? us - prev_us : 0);
+			prev_us = us;
+		}
+
+		cf_dyn_buf_append_char(db, ';');
+	}
+
+	cf_free(recs);
+}
@@ -422,9 +422,9 @@ udf_call_init(udf_call * call, as_transaction * tr)
 			call->arglist     = ucall->arglist;
 			call->udf_type    = ucall->udf_type;
 			if (tr->udata.req_type == UDF_SCAN_REQUEST) {
-				cf_atomic_int_incr(&g_config.udf_scan_rec_reqs);
+				cf_shard_counter_incr(&g_config.udf_scan_rec_reqs);
 			} else if (tr->udata.req_type == UDF_QUERY_REQUEST) {
-				cf_atomic_int_incr(&g_config.udf_query_rec_reqs);
+				cf_shard_counter_incr(&g_config.udf_query_rec_reqs);
 			}
 		}
 		// TODO: return proper macros
@@ -654,19 +654,19 @@ udf_rw_update_stats(as_namespace *ns, udf_optype op, int ret, bool is_success)
 			cf_atomic_int_incr(&g_config.udf_lua_errs);
 		}
 	} else {
-		if (UDF_OP_IS_READ(op))        cf_atomic_int_incr(&g_config.udf_read_reqs);
-		else if (UDF_OP_IS_DELETE(op)) cf_atomic_int_incr(&g_config.udf_delete_reqs);
-		else if (UDF_OP_IS_WRITE (op)) cf_atomic_int_incr(&g_config.udf_write_reqs);
+		if (UDF_OP_IS_READ(op))        cf_shard_counter_incr(&g_config.udf_read_reqs);
+		else if (UDF_OP_IS_DELETE(op)) cf_shard_counter_incr(&g_config.udf_delete_reqs);
+		else if (UDF_OP_IS_WRITE (op)) cf_shard_counter_incr(&g_config.udf_write_reqs);
 
 		if (ret == 0) {
 			if (is_success) {
-				if (UDF_OP_IS_READ(op))        cf_atomic_int_incr(&g_config.udf_read_success);
-				else if (UDF_OP_IS_DELETE(op)) cf_atomic_int_incr(&g_config.udf_delete_success);
-				else if (UDF_OP_IS_WRITE (op)) cf_atomic_int_incr(&g_config.udf_write_success);
+				if (UDF_OP_IS_READ(op))        cf_shard_counter_incr(&g_config.udf_read_success);
+				else if (UDF_OP_IS_DELETE(op)) cf_shard_counter_incr(&g_config.udf_delete_success);
+				else if (UDF_OP_IS_WRITE (op)) cf_shard_counter_incr(&g_config.udf_write_success);
 			} else {
-				if (UDF_OP_IS_READ(op))        cf_atomic_int_incr(&g_config.udf_read_errs_other);
-				else if (UDF_OP_IS_DELETE(op)) cf_atomic_int_incr(&g_config.udf_delete_errs_other);
-				else if (UDF_OP_IS_WRITE (op)) cf_atomic_int_incr(&g_config.udf_write_errs_other);
+				if (UDF_OP_IS_READ(op))        cf_shard_counter_incr(&g_config.udf_read_errs_other);
+				else if (UDF_OP_IS_DELETE(op)) cf_shard_counter_incr(&g_config.udf_delete_errs_other);
+				else if (UDF_OP_IS_WRITE (op)) cf_shard_counter_incr(&g_config.udf_write_errs_other);
 			}
 		} else {
             cf_info(AS_UDF,"lua error, ret:%d",ret);
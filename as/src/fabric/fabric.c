@@ -246,6 +246,12 @@ typedef struct {
 	uint32_t	parameter_gather_usec;
 	uint32_t	parameter_msg_size;
 
+	// transmit statistics
+	cf_atomic64	xmit_bytes;         // bytes handed to the socket
+	cf_atomic64	xmit_msgs;          // msgs sent
+	cf_atomic64	xmit_batches;       // completed batches, each one or more msgs
+	cf_atomic64	xmit_writes;        // sendmsg() calls, including partial writes
+
 } fabric_node_element;
 
 
@@ -269,6 +275,15 @@ typedef enum fb_status_e {
 // Inplace size
 #define FB_INPLACE_SZ (1024 * 128)
 
+// Write batching - queued msgs are serialized back to back into w_data, except
+// for fields of FB_IOV_REF_MIN bytes or more, which are written straight out
+// of the msg. The whole batch goes out in one sendmsg(). Only msgs the batch
+// holds the sole reference to are referenced - if the sender kept a ref (e.g.
+// for retransmit) it may modify the msg while queued, so it's copied whole.
+#define FB_MAX_BATCH_MSGS 128
+#define FB_MAX_IOV 256 // well under IOV_MAX
+#define FB_IOV_REF_MIN (1024 * 4)
+
 typedef struct {
 
 	int fd;
@@ -285,9 +300,15 @@ typedef struct {
 	// this is the write section
 	size_t		w_total_len;		// total size to write
 	size_t		w_len;				// current size we've written
-	bool		w_in_place;
+	bool		w_in_place;			// false if w_buf is the scratch buffer
+	size_t		w_data_len;			// bytes of scratch buffer used
 	byte		w_data[ FB_INPLACE_SZ ];
-	byte		*w_buf;
+	byte		*w_buf;				// scratch for a lone msg too big for w_data
+	struct iovec w_iov[ FB_MAX_IOV ];
+	int			w_iov_count;
+	int			w_iov_idx;			// first iovec not yet completely written
+	msg			*w_msgs[ FB_MAX_BATCH_MSGS ]; // referenced until written
+	int			w_n_msgs;
 
 	// This is the read section
 	uint32_t	r_msg_size; 		// size of the incoming message
@@ -322,6 +343,7 @@ void fabric_worker_delete(fabric_args *fa, fabric_buffer *fb);
 void fabric_buffer_set_epoll_state(fabric_buffer *fb);
 static void fabric_heartbeat_event(int nevents, as_hb_event_node *events, void *udata);
 void fabric_buffer_release(fabric_buffer *fb);
+void fabric_buffer_write_reset(fabric_buffer *fb);
 
 
 //
@@ -478,7 +500,11 @@ fabric_buffer_create(int fd)
 	fb->w_total_len = 0;
 	fb->w_len = 0;
 	fb->w_in_place = true;
+	fb->w_data_len = 0;
 	fb->w_buf = NULL;
+	fb->w_iov_count = 0;
+	fb->w_iov_idx = 0;
+	fb->w_n_msgs = 0;
 
 	fb->r_msg_size = 0;
 	fb->r_type = M_TYPE_FABRIC; // since we don't have an "invalid"
@@ -574,7 +600,7 @@ fabric_buffer_release(fabric_buffer *fb)
 			cf_free(fb->r_buf);
 		}
 
-		if (fb->w_in_place == false && fb->w_buf) cf_free(fb->w_buf);
+		fabric_buffer_write_reset(fb);
 
 #ifdef EXTRA_CHECKS
 		// DEBUG - this is a large memset - not good for production
@@ -589,6 +615,103 @@ fabric_buffer_release(fabric_buffer *fb)
 
 }
 
+//
+// Drop the current write batch - releases the msgs it references and any
+// malloc'd scratch buffer
+
+void
+fabric_buffer_write_reset(fabric_buffer *fb)
+{
+	for (int i = 0; i < fb->w_n_msgs; i++) {
+		as_fabric_msg_put(fb->w_msgs[i]);
+	}
+	fb->w_n_msgs = 0;
+
+	if (fb->w_buf) {
+		cf_free(fb->w_buf);
+		fb->w_buf = 0;
+	}
+
+	fb->w_len = 0;
+	fb->w_total_len = 0;
+	fb->w_in_place = true;
+	fb->w_data_len = 0;
+	fb->w_iov_count = 0;
+	fb->w_iov_idx = 0;
+}
+
+//
+// Append a msg to the write batch. Returns false if it doesn't fit, in which
+// case the msg still belongs to the caller. On success the batch holds the
+// caller's reference until the batch has been written.
+
+static bool
+fabric_buffer_add_msg(fabric_buffer *fb, msg *m)
+{
+	if (fb->w_n_msgs == FB_MAX_BATCH_MSGS || ! fb->w_in_place)
+		return(false);
+
+	// Once queued, nobody else should touch a msg we hold the only ref to.
+	size_t ref_min = cf_rc_count(m) > 1 ? SIZE_MAX : FB_IOV_REF_MIN;
+
+	size_t remain = FB_INPLACE_SZ - fb->w_data_len;
+	int n_iov = FB_MAX_IOV - fb->w_iov_count;
+	struct iovec *iov = &fb->w_iov[fb->w_iov_count];
+	int rv = msg_fill_iov(m, &fb->w_data[fb->w_data_len], &remain, iov, &n_iov, ref_min);
+
+	if (rv != 0) {
+		// Not enough room left - the normal way we find the batch is full. If
+		// the batch is empty the msg is simply too big for w_data, so give it
+		// a malloc'd scratch buffer of its own.
+		if (fb->w_n_msgs != 0)
+			return(false);
+
+		cf_detail(AS_FABRIC, "msg fill iov returned %d, allocating scratch %zu", rv, remain);
+
+		if (rv != -2)
+			return(false);
+
+		fb->w_buf = cf_malloc(remain);
+		if (! fb->w_buf)
+			return(false);
+		fb->w_in_place = false;
+
+		n_iov = FB_MAX_IOV;
+		iov = fb->w_iov;
+		if (0 != msg_fill_iov(m, fb->w_buf, &remain, iov, &n_iov, ref_min)) {
+			cf_free(fb->w_buf);
+			fb->w_buf = 0;
+			fb->w_in_place = true;
+			return(false);
+		}
+	}
+
+	// Scratch bytes are contiguous with the previous msg's last iovec, if that
+	// was also scratch - merge them.
+	size_t msg_len = 0;
+	for (int i = 0; i < n_iov; i++) {
+		msg_len += iov[i].iov_len;
+	}
+	if (fb->w_iov_count != 0) {
+		struct iovec *last = &fb->w_iov[fb->w_iov_count - 1];
+		if ((byte *) last->iov_base + last->iov_len == iov[0].iov_base) {
+			last->iov_len += iov[0].iov_len;
+			memmove(iov, iov + 1, (n_iov - 1) * sizeof(struct iovec));
+			n_iov--;
+		}
+	}
+
+	fb->w_iov_count += n_iov;
+	fb->w_data_len += remain;
+	fb->w_total_len += msg_len;
+	fb->w_msgs[fb->w_n_msgs++] = m;
+
+	cf_shard_counter_incr(&g_config.fabric_msgs_sent);
+	cf_atomic64_add(&fb->fne->xmit_msgs, 1);
+
+	return(true);
+}
+
 //
 // Fill the write buffer from the fabric node element's stash
 // return false if there's nothing in this buffer
@@ -599,87 +722,57 @@ fabric_buffer_write_fill( fabric_buffer *fb )
 {
 	fabric_node_element *fne = fb->fne;
 
-	// check for fullness
-	if (fb->w_total_len >= FB_INPLACE_SZ)	return(true);
-
 	// See if we can fit any more
 	int q_rv;
 	do {
+		// check for fullness
+		if (fb->w_n_msgs == FB_MAX_BATCH_MSGS || fb->w_data_len >= FB_INPLACE_SZ || ! fb->w_in_place)
+			break;
+
 		msg *m;
 		q_rv = cf_queue_priority_pop(fne->xmit_msg_queue, &m, CF_QUEUE_NOWAIT);
 		if (q_rv == 0)
 		{
-			size_t	remain = FB_INPLACE_SZ - fb->w_total_len;
-			if (0 != msg_fillbuf(m, &fb->w_data[fb->w_total_len], &remain)) {
-
-				// this is OK in normal operation. It's the way we tell there's not enough
-				// data left in the buffer
-				cf_detail(AS_FABRIC, "write fill: fb %p return bad, either malloc or push back", fb);
-
-				// not enough room left. If it's the first part of a message,
-				// then malloc a new buffer
-				if (remain > FB_INPLACE_SZ && fb->w_len == 0) {
-					cf_debug(AS_FABRIC, "msg fillbuf returned fail, allocating new size %d", remain);
-					fb->w_buf = cf_malloc(remain);
-					if (fb->w_buf) {
-						cf_atomic_int_incr(&g_config.fabric_msgs_sent);
-						msg_fillbuf(m, fb->w_buf, &remain);
-						fb->w_in_place = false;
-						fb->w_total_len = remain;
-					}
-					as_fabric_msg_put(m); // this will drop, but we're out of memory
+			if (! fabric_buffer_add_msg(fb, m)) {
+				// a partially full buffer, kick it out and let this large one hit
+				// an empty case. Hope that's OK.
+				// put it back on the queue - don't know the priority, make it high
+				if (fb->w_n_msgs != 0) {
+					cf_queue_priority_push(fne->xmit_msg_queue, &m, CF_QUEUE_PRIORITY_HIGH);
 				}
 				else {
-					// a partially full buffer, kick it out and let this large one hit
-					// an empty case. Hope that's OK.
-					// put it back on the queue - don't know the priority, make it high
-					cf_queue_priority_push(fne->xmit_msg_queue, &m, CF_QUEUE_PRIORITY_HIGH);
+					cf_warning(AS_FABRIC, "write fill: fb %p can't serialize msg, dropping it", fb);
+					as_fabric_msg_put(m);
 				}
 
 				cf_detail(AS_FABRIC, "+ tot %d len %d", fb->w_total_len, fb->w_len);
 
-				return(true);
+				break;
 			}
-			cf_atomic_int_incr(&g_config.fabric_msgs_sent);
-			fb->w_total_len += remain;
-			as_fabric_msg_put(m);
 		}
 	} while(q_rv == 0 );
 
-	cf_detail(AS_FABRIC, "fabric_buffer_write_fill: fb %p inplace %d ( %d : %d )", fb, fb->w_in_place, fb->w_total_len, fb->w_len);
+	cf_detail(AS_FABRIC, "fabric_buffer_write_fill: fb %p inplace %d msgs %d iovs %d ( %d : %d )", fb, fb->w_in_place, fb->w_n_msgs, fb->w_iov_count, fb->w_total_len, fb->w_len);
 
 	return ( (fb->w_total_len == fb->w_len) ? false : true );
 
 }
 
 
-// Copies the contents of the message into the beginning of the linear store
-// write buffer and returns the message to the queue for reuse
+// Starts a new write batch with this message. The batch takes over the
+// caller's reference, and returns the message to the pool once written.
 
 bool
 fabric_buffer_set_write_msg( fabric_buffer *fb, msg *m )
 {
-	// statistic - doesn't really show the message went out, though
-	cf_atomic_int_incr(&g_config.fabric_msgs_sent);
+	fabric_buffer_write_reset(fb);
 
-	// Parse out the message to the inplace buffer
-	fb->w_len = 0;
-	fb->w_total_len = FB_INPLACE_SZ; // set the maximum for msg_fillbuf
-	if (0 != msg_fillbuf(m, &fb->w_data[0], &fb->w_total_len)) {
-		// msg_fillbuf says we don't have enough data, but has graciously suggested
-		// the real amount of size we need
-		cf_detail(AS_FABRIC, "msg fillbuf returned long buffer: allocating not-in-place %d", fb->w_total_len);
-		fb->w_buf = cf_malloc(fb->w_total_len);
-		if (fb->w_buf == 0)	return(false);
-		msg_fillbuf(m, fb->w_buf, &fb->w_total_len);
-		fb->w_in_place = false;
-	}
-	else {
-		fb->w_in_place = true;
-		fb->w_buf = 0;
-		fb->status = FB_STATUS_WRITE;
+	if (! fabric_buffer_add_msg(fb, m)) {
+		as_fabric_msg_put(m);
+		return(false);
 	}
-	as_fabric_msg_put(m);
+
+	fb->status = FB_STATUS_WRITE;
 	return(true);
 }
 
@@ -831,14 +924,10 @@ fabric_write_complete(fabric_buffer *fb)
 	if (fb->w_len != fb->w_total_len)
 		return;
 
-	// Reset the write components
-	fb->w_len = 0;
-	fb->w_total_len = 0;
-	fb->w_in_place = true;
-	if (fb->w_buf) {
-		cf_free(fb->w_buf);
-		fb->w_buf = 0;
-	}
+	cf_atomic64_add(&fb->fne->xmit_batches, 1);
+
+	// Reset the write components, returning the batch's msgs to the pool
+	fabric_buffer_write_reset(fb);
 
 	if (fb->fne->live == false) {
 		fabric_buffer_release(fb);
@@ -899,49 +988,52 @@ fabric_process_writable(fabric_buffer *fb)
 		fb->nodelay_isset = true;
 	}
 
-	if (fb->w_in_place) {
-		// cf_assert(fb->fd, AS_FABRIC, CF_WARNING, "attempted write to fd 0");
-		if (0 > (w_sz = send(fb->fd, &fb->w_data[fb->w_len], w_len, MSG_NOSIGNAL))) {
-			if (errno == EAGAIN)	return(0);
-			else if (errno == EFAULT) {
-				cf_debug(AS_FABRIC, "write returned efault: data %p len %d", &fb->w_data[fb->w_len], fb->w_total_len - fb->w_len);
-			}
-			else {
-				cf_debug(AS_FABRIC, "fabric_process_writable: write return less than 0 %d", errno);
-			}
-			return(-1);
-		}
-
-		// cf_detail(AS_FABRIC,"fabric_writable: wrote %d",w_sz);
+	// The whole batch in one go - scratch segments and msg fields alike.
+	struct msghdr mh;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &fb->w_iov[fb->w_iov_idx];
+	mh.msg_iovlen = fb->w_iov_count - fb->w_iov_idx;
 
-		// it was a very good write!
-		fb->fne->good_write_counter = 0;
-
-		fb->w_len += w_sz;
-		if (fb->w_len == fb->w_total_len) {
-			// side effect: fb might not be any good after here
-			fabric_write_complete(fb);
+	// cf_assert(fb->fd, AS_FABRIC, CF_WARNING, "attempted write to fd 0");
+	if (0 > (w_sz = sendmsg(fb->fd, &mh, MSG_NOSIGNAL))) {
+		if (errno == EAGAIN)	return(0);
+		else if (errno == EFAULT) {
+			cf_debug(AS_FABRIC, "write returned efault: iov %d of %d len %d", fb->w_iov_idx, fb->w_iov_count, fb->w_total_len - fb->w_len);
 		}
-	}
-	else {
-		// cf_assert(fb->fd, AS_FABRIC, CF_WARNING, "attempted write to fd 0");
-		if (0 > (w_sz = send(fb->fd, fb->w_buf + fb->w_len, w_len, MSG_NOSIGNAL))) {
-			if (errno == EAGAIN) {
-				return 0;
-			}
-			cf_debug(AS_FABRIC, "fabric_process_writable: return less than 0 %d", errno);
-			return(-1);
+		else {
+			cf_debug(AS_FABRIC, "fabric_process_writable: write return less than 0 %d", errno);
 		}
+		return(-1);
+	}
+
+	// cf_detail(AS_FABRIC,"fabric_writable: wrote %d",w_sz);
 
-		// cf_detail(AS_FABRIC,"fabric_writable: wrote malloc: %d",w_sz);
+	// it was a very good write!
+	fb->fne->good_write_counter = 0;
 
-		// it was a very good write!
-		fb->fne->good_write_counter = 0;
+	cf_atomic64_add(&fb->fne->xmit_writes, 1);
+	cf_atomic64_add(&fb->fne->xmit_bytes, w_sz);
 
-		fb->w_len += w_sz;
-		if (w_sz > 0) {
-			// side effect: fb might not be any good after here
-			fabric_write_complete(fb);
+	fb->w_len += w_sz;
+	if (fb->w_len == fb->w_total_len) {
+		// side effect: fb might not be any good after here
+		fabric_write_complete(fb);
+		return(0);
+	}
+
+	// Partial write - step over the iovecs that went out, trim the one that
+	// went out partway.
+	size_t adv = w_sz;
+	while (adv != 0) {
+		struct iovec *iov = &fb->w_iov[fb->w_iov_idx];
+		if (adv >= iov->iov_len) {
+			adv -= iov->iov_len;
+			fb->w_iov_idx++;
+		}
+		else {
+			iov->iov_base = (byte *) iov->iov_base + adv;
+			iov->iov_len -= adv;
+			adv = 0;
 		}
 	}
 
@@ -1181,7 +1273,7 @@ Next:
 		cf_detail(AS_FABRIC, "msg_read: received msg: type %d node %"PRIx64, m->type, fb->fne->node);
 
 		// statistic - received a message.
-		cf_atomic_int_incr(&g_config.fabric_msgs_rcvd);
+		cf_shard_counter_incr(&g_config.fabric_msgs_rcvd);
 		// and it was a good read
 		fb->fne->good_read_counter = 0;
 
@@ -1530,6 +1622,7 @@ fabric_accept_fn(void *argv)
 	sc.addr = "0.0.0.0";     // inaddr any!
 	sc.port = g_config.fabric_port;
 	sc.reuse_addr = (g_config.socket_reuse_addr) ? true : false;
+	sc.reuse_port = false;
 	sc.proto = SOCK_STREAM;
 	if (0 != cf_socket_init_svc(&sc)) {
 		cf_crash(AS_FABRIC, "Could not create fabric listener socket - check configuration");
@@ -2719,8 +2812,9 @@ as_fabric_dump(bool verbose)
 			cf_info(AS_FABRIC, "   %"PRIx64" node not found in hash although reported available", nl.nodes[i]);
 		}
 		else {
-			cf_info(AS_FABRIC, "    %"PRIx64" fds %d live %d goodwrite %d goodread %d q %d", fne->node,
-					fne->fd_counter, fne->live, fne->good_write_counter, fne->good_read_counter, cf_queue_priority_sz(fne->xmit_msg_queue));
+			cf_info(AS_FABRIC, "    %"PRIx64" fds %d live %d goodwrite %d goodread %d q %d sent: bytes %"PRIu64" msgs %"PRIu64" batches %"PRIu64" writes %"PRIu64, fne->node,
+					fne->fd_counter, fne->live, fne->good_write_counter, fne->good_read_counter, cf_queue_priority_sz(fne->xmit_msg_queue),
+					cf_atomic64_get(fne->xmit_bytes), cf_atomic64_get(fne->xmit_msgs), cf_atomic64_get(fne->xmit_batches), cf_atomic64_get(fne->xmit_writes));
 			fne_release(fne);
 		}
 	}
@@ -2731,3 +2825,47 @@ as_fabric_dump(bool verbose)
 		shash_reduce(g_fb_hash, fb_hash_dump_reduce_fn, &item_num);
 	}
 }
+
+// Per-node transmit statistics - bytes and msgs sent, and how well msgs are
+// being coalesced into batches and sendmsg() calls.
+int
+as_fabric_stats_info(char *name, cf_dyn_buf *db)
+{
+	as_node_list nl;
+	as_fabric_get_node_list(&nl);
+
+	for (int i = 0; i < nl.sz; i++) {
+		if (nl.nodes[i] == g_config.self_node) {
+			continue;
+		}
+
+		fabric_node_element *fne;
+		if (RCHASH_OK != rchash_get(g_fabric_node_element_hash, &nl.nodes[i], sizeof(cf_node), (void **)&fne)) {
+			continue;
+		}
+
+		uint64_t n_msgs = cf_atomic64_get(fne->xmit_msgs);
+		uint64_t n_batches = cf_atomic64_get(fne->xmit_batches);
+
+		cf_dyn_buf_append_uint64_x(db, fne->node);
+		cf_dyn_buf_append_string(db, ":bytes-sent=");
+		cf_dyn_buf_append_uint64(db, cf_atomic64_get(fne->xmit_bytes));
+		cf_dyn_buf_append_string(db, ",msgs-sent=");
+		cf_dyn_buf_append_uint64(db, n_msgs);
+		cf_dyn_buf_append_string(db, ",batches=");
+		cf_dyn_buf_append_uint64(db, n_batches);
+		cf_dyn_buf_append_string(db, ",writes=");
+		cf_dyn_buf_append_uint64(db, cf_atomic64_get(fne->xmit_writes));
+		cf_dyn_buf_append_string(db, ",avg-batch-msgs=");
+		cf_dyn_buf_append_uint64(db, n_batches ? n_msgs / n_batches : 0);
+		cf_dyn_buf_append_string(db, ",queue=");
+		cf_dyn_buf_append_int(db, cf_queue_priority_sz(fne->xmit_msg_queue));
+		cf_dyn_buf_append_char(db, ';');
+
+		fne_release(fne);
+	}
+
+	cf_dyn_buf_chomp(db);
+
+	return 0;
+}
@@ -44,7 +44,9 @@
  *                             node
  *
  * as_migrate_tree:            Workhorse function which does the tree migration.
- *                             (Needs optimization)
+ *                             Records are pickled and sent one at a time from
+ *                             the index reduce, packed into batch messages, and
+ *                             paced by a per-migration window of unacked bytes.
  *
  *
  * migrate_xmit_fn:            Function which serves all the migration requests.
@@ -62,8 +64,19 @@
  *
  * mig->xmit_control_q : Queue for migration related control messages per migration object
  *
- * mig->pickled_array  : Array of pickled record formed after migrate reduce used to do
- *                       record migration
+ * mig->retransmit_hash : Insert messages sent but not yet acked by every destination.
+ *                       mig->unacked_bytes is their total size - the sender stalls
+ *                       once it reaches migrate-window-size, so acks act as credits.
+ *
+ * mig->batch_buf      : Records pickled but not yet sent, packed back to back as
+ *                       migrate_batch_entry - shipped as one OPERATION_INSERT_BATCH.
+ *
+ * mig->delta_skip     : With migrate-delta, one bit per digest range whose summary
+ *                       (migrate_delta_range) matched the destination's - records
+ *                       in those ranges aren't sent at all. The sender's summary
+ *                       goes out with the START, the destination drops what
+ *                       doesn't match on g_migrate_delta_q's thread, and its own
+ *                       summary comes back with the START_ACK_OK.
  *
  * g_migrate_recv_control_hash: Hash for migrate_recv_control structure used to manage
  *                       incoming migration. Create when migration OPERATION_START is
@@ -189,6 +202,9 @@
 #define MIG_FIELD_EDIGEST 16
 #define MIG_FIELD_PGENERATION 17
 #define MIG_FIELD_PVOID_TIME 18
+#define MIG_FIELD_RECORDS 19      	// sent with INSERT_BATCH
+#define MIG_FIELD_FEATURES 20     	// sent with START_ACK_OK
+#define MIG_FIELD_SUMMARY 21      	// sent with START and START_ACK_OK
 
 #define OPERATION_INSERT 1
 #define OPERATION_ACK 2
@@ -200,6 +216,7 @@
 #define OPERATION_DONE 8
 #define OPERATION_DONE_ACK 9
 #define OPERATION_CANCEL 10
+#define OPERATION_INSERT_BATCH 11
 
 msg_template migrate_mt[] = {
 	{ MIG_FIELD_OP, M_FT_UINT32 },
@@ -221,8 +238,49 @@ msg_template migrate_mt[] = {
 	{ MIG_FIELD_EDIGEST, M_FT_BUF },
 	{ MIG_FIELD_PGENERATION, M_FT_UINT32 },
 	{ MIG_FIELD_PVOID_TIME, M_FT_UINT32 },
+	{ MIG_FIELD_RECORDS, M_FT_BUF },
+	{ MIG_FIELD_FEATURES, M_FT_UINT32 },
+	{ MIG_FIELD_SUMMARY, M_FT_BUF },
 };
 
+// Receiver capabilities advertised in START_ACK_OK - nodes that don't send
+// MIG_FIELD_FEATURES get one INSERT per record, as before.
+#define MIG_FEATURE_INSERT_BATCH 0x0001
+#define MIG_FEATURE_DELTA        0x0002
+
+#define MIG_FEATURES_SUPPORTED (MIG_FEATURE_INSERT_BATCH | MIG_FEATURE_DELTA)
+
+// Limits on how many records are packed into one INSERT_BATCH message.
+#define MIGRATE_BATCH_MAX_RECORDS 256
+#define MIGRATE_BATCH_MAX_BYTES (128 * 1024)
+
+// How often a sender stalled on its window retransmits unacked inserts.
+#define MIGRATE_WINDOW_RETRANSMIT_CHECK_MS 50
+
+// One record in a MIG_FIELD_RECORDS buffer, followed by its pickled vinfoset,
+// rec-props and record, in that order.
+typedef struct migrate_batch_entry_s {
+	cf_digest	key;
+	uint32_t	generation;
+	uint32_t	void_time;
+	uint32_t	record_len;
+	uint32_t	rec_props_len;
+	uint32_t	vinfo_len;
+	uint8_t		data[];
+} __attribute__((__packed__)) migrate_batch_entry;
+
+// Delta migration splits a partition into digest ranges and summarizes each
+// range by an XOR of per-record hashes over digest, generation and void-time.
+// Digest bytes 0-1 already pick the partition, so ranges come from bytes 2-3.
+#define MIGRATE_DELTA_RANGE_BITS 10
+#define MIGRATE_DELTA_N_RANGES (1 << MIGRATE_DELTA_RANGE_BITS)
+#define MIGRATE_DELTA_SUMMARY_SZ (sizeof(migrate_delta_range) * MIGRATE_DELTA_N_RANGES)
+
+typedef struct migrate_delta_range_s {
+	uint64_t	hash;
+	uint32_t	n_records;
+} __attribute__((__packed__)) migrate_delta_range;
+
 // If the bit is not set then it is normal record
 #define MIG_INFO_LDT_REC    0x0001
 #define MIG_INFO_LDT_SUBREC 0x0002
@@ -260,11 +318,6 @@ typedef struct migration_t {
 
 	as_partition_reservation rsv;
 
-	// reduce will gen this up
-	uint		pickled_alloc;
-	uint		pickled_size;
-	pickled_record *pickled_array;
-
 	uint32_t	id;
 	as_migrate_type mig_type;
 
@@ -280,11 +333,32 @@ typedef struct migration_t {
 	shash		*retransmit_hash;
 	cf_queue	*xmit_control_q;
 
+	// AND of the MIG_FEATURE_* bits every destination acked the START with
+	uint32_t	dst_features;
+
+	// flow control - total size of the inserts in retransmit_hash
+	cf_atomic64	unacked_bytes;
+
+	// streaming state, only touched by the xmit thread in as_migrate_tree
+	bool		use_batch;
+	bool		use_delta;
+	bool		is_subrecord;
+	char		*xmit_fail_reason;
+	uint8_t		*batch_buf;
+	size_t		batch_alloc;
+	size_t		batch_len;
+	uint32_t	batch_n_records;
+
+	// delta migration - our summary goes out with the START, the destination's
+	// lands here from the fabric thread with its START_ACK_OK, and delta_skip
+	// has a bit set for each range that matched
+	migrate_delta_range *src_summary;
+	migrate_delta_range *dst_summary;
+	uint8_t		delta_skip[MIGRATE_DELTA_N_RANGES / 8];
+
 	// Migrates with higher priority will be done first
 	int         migration_sort_priority;
 
-	uint64_t	yield_count;
-
 	as_migrate_callback    cb;
 	void				*udata;
 
@@ -323,6 +397,7 @@ typedef struct migrate_xmit_control_s {
 	uint32_t		mig_id;
 	uint32_t		node_offset; // which node in the local migrate table did the deed
 	int				op;
+	uint32_t		features; // MIG_FEATURE_* bits, only with START_ACK_OK
 } migrate_xmit_control;
 
 /*
@@ -347,6 +422,7 @@ typedef struct migrate_retransmit_s {
 	bool		done[AS_CLUSTER_SZ]; // could implement as a bitfield if we were cool
 	migration	*mig;
 	msg			*m;
+	uint32_t	size;      // bytes charged against the migration's window
 } migrate_retransmit;
 
 //
@@ -393,6 +469,10 @@ typedef struct migrate_recv_control_t {
 	cf_node source_node;
 	as_migrate_type mig_type;
 	as_partition_vinfoset vinfoset;
+	// delta migration - set while the delta thread compares and prunes, START
+	// retransmits aren't acked until it's done
+	cf_atomic32 delta_pending;
+	migrate_delta_range *delta_summary; // ours, returned with START_ACK_OK
 } migrate_recv_control;
 
 void as_migrate_print_cluster_key(const char *message)
@@ -435,6 +515,9 @@ void
 migrate_recv_control_destroy(void *parm)
 {
 	migrate_recv_control *mc = (migrate_recv_control *) parm;
+	if (mc->delta_summary) {
+		cf_free(mc->delta_summary);
+	}
 	if (mc->rsv.p) {
 		as_partition_release(&mc->rsv);
 		cf_atomic_int_decr(&g_config.migrx_tree_count);
@@ -697,17 +780,9 @@ migrate_migrate_destroy(void *parm)
 	migration *mig = (migration *) parm;
 	if (mig->start_m)		as_fabric_msg_put(mig->start_m);
 	if (mig->done_m)		as_fabric_msg_put(mig->done_m);
-	if (mig->pickled_array)	{
-		for (uint i = 0; i < mig->pickled_size; i++) {
-			if (mig->pickled_array[i].record_buf) {
-				cf_free(mig->pickled_array[i].record_buf);
-			}
-			if  (mig->pickled_array[i].rec_props.p_data) {
-				cf_free(mig->pickled_array[i].rec_props.p_data);
-			}
-		}
-		cf_free(mig->pickled_array);
-	}
+	if (mig->batch_buf)		cf_free(mig->batch_buf);
+	if (mig->src_summary)	cf_free(mig->src_summary);
+	if (mig->dst_summary)	cf_free(mig->dst_summary);
 	if (mig->retransmit_hash) shash_destroy(mig->retransmit_hash);
 	if (mig->xmit_control_q) cf_queue_destroy(mig->xmit_control_q);
 	if (mig->rsv.p) {
@@ -839,7 +914,9 @@ migrate_process_ack(cf_node src, msg *m)
 		}
 
 		// if done, delete from hash table, but lockfree since we have the lock
+		// - and hand the bytes back to the sender's window
 		if (done == true) {
+			cf_atomic64_sub(&mig->unacked_bytes, (int64_t)rt->size);
 			as_fabric_msg_put(rt->m);
 			// at this point, the rt is *GONE*
 			shash_delete_lockfree(mig->retransmit_hash, &tid);
@@ -867,7 +944,7 @@ migrate_process_ack(cf_node src, msg *m)
 
 
 int
-migrate_send_reliable(migration *mig, msg *m)
+migrate_send_reliable(migration *mig, msg *m, uint32_t size)
 {
 #ifdef EXTRA_CHECKS
 	if (cf_rc_count(m) <= 0) {
@@ -892,11 +969,16 @@ migrate_send_reliable(migration *mig, msg *m)
 	rt.m = m;
 	rt.mig = mig;
 	rt.xmit_ms = cf_getms();
+	rt.size = size;
 	for (uint i = 0; i < mig->dst_nodes_sz; i++)
 		rt.done[i] = false;
 
+	// charge the window before the insert is visible to acks
+	cf_atomic64_add(&mig->unacked_bytes, (int64_t)size);
+
 	if (SHASH_OK != shash_put(mig->retransmit_hash, &tid, &rt) ) {
 		cf_debug(AS_MIGRATE, "send reliable put failed *SERIOUS!*");
+		cf_atomic64_sub(&mig->unacked_bytes, (int64_t)size);
 		as_fabric_msg_put(m);
 		return(-1);
 	}
@@ -1227,6 +1309,316 @@ migrate_debug_reduce_fn(void *key, uint32_t len, void *object, void *udata)
 }
 
 
+//
+// Delta migration summaries.
+//
+
+static inline uint32_t
+migrate_delta_range_id(cf_digest *keyd)
+{
+	return (uint32_t)((keyd->digest[2] << 8) | keyd->digest[3]) >> (16 - MIGRATE_DELTA_RANGE_BITS);
+}
+
+static inline uint64_t
+migrate_delta_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static inline uint64_t
+migrate_delta_record_hash(as_index *r)
+{
+	uint64_t d0, d1;
+
+	memcpy(&d0, &r->key.digest[4], sizeof(d0));
+	memcpy(&d1, &r->key.digest[12], sizeof(d1));
+
+	return migrate_delta_mix(d0 ^ migrate_delta_mix(d1 ^ (((uint64_t)r->generation << 32) | r->void_time)));
+}
+
+void
+migrate_delta_summarize_reduce_fn(as_index *r, void *udata)
+{
+	if (r == 0)	return;
+
+	migrate_delta_range *ranges = (migrate_delta_range *) udata;
+	migrate_delta_range *range = &ranges[migrate_delta_range_id(&r->key)];
+
+	range->hash ^= migrate_delta_record_hash(r);
+	range->n_records++;
+}
+
+// Index only - no storage reads - so this is cheap enough to do under the
+// tree lock, as migrate_mark() does.
+migrate_delta_range *
+migrate_delta_summarize(as_index_tree *tree)
+{
+	migrate_delta_range *ranges = cf_malloc(MIGRATE_DELTA_SUMMARY_SZ);
+	cf_assert(ranges, AS_MIGRATE, CF_CRITICAL, "malloc");
+
+	memset(ranges, 0, MIGRATE_DELTA_SUMMARY_SZ);
+	as_index_reduce_sync(tree, migrate_delta_summarize_reduce_fn, ranges);
+
+	return ranges;
+}
+
+// Both sides must agree on this - a range the sender skips has to be one the
+// destination kept.
+static inline bool
+migrate_delta_range_matches(const migrate_delta_range *src, const migrate_delta_range *dst)
+{
+	return src->n_records != 0 &&
+			src->n_records == dst->n_records &&
+			src->hash == dst->hash;
+}
+
+//
+// Delta migration - destination side. A DESYNC partition keeps its tree (see
+// set_partition_desync_lockfree()), so before the first migration in is acked,
+// records in ranges that don't match the sender's summary must go. Summarizing
+// and pruning walk the whole tree, so they run here rather than on the fabric
+// msg thread.
+//
+
+typedef struct migrate_delta_job_s {
+	migrate_recv_control *mc;			// reserved for the job
+	uint32_t	mig_id;
+	migrate_delta_range *src_summary;	// NULL if the sender isn't doing delta
+} migrate_delta_job;
+
+static cf_queue *g_migrate_delta_q;
+static pthread_t g_migrate_delta_th;
+
+typedef struct migrate_delta_drop_info_s {
+	migrate_recv_control *mc;
+	uint8_t		drop[MIGRATE_DELTA_N_RANGES / 8];
+	uint64_t	n_dropped;
+} migrate_delta_drop_info;
+
+void
+migrate_delta_drop_reduce_fn(as_index_ref *r_ref, void *udata)
+{
+	migrate_delta_drop_info *info = (migrate_delta_drop_info *) udata;
+	migrate_recv_control *mc = info->mc;
+	as_record *r = r_ref->r;
+	uint32_t range_id = migrate_delta_range_id(&r->key);
+
+	if (info->drop[range_id >> 3] & (1 << (range_id & 7))) {
+		// bookkeeping as in migrate_delete()
+		if (mc->rsv.ns->storage_data_in_memory) {
+			as_storage_rd rd;
+			rd.ns = mc->rsv.ns;
+			rd.n_bins = as_bin_get_n_bins(r, &rd);
+			rd.bins = as_bin_get_all(r, &rd, 0);
+
+			cf_atomic_int_sub(&mc->rsv.p->n_bytes_memory, as_storage_record_get_n_bytes_memory(&rd));
+		}
+
+		as_index_delete(mc->rsv.tree, &r->key);
+		info->n_dropped++;
+	}
+
+	as_record_done(r_ref, mc->rsv.ns);
+}
+
+static void
+migrate_delta_send_start_ack(cf_node node, uint32_t mig_id, const migrate_delta_range *summary)
+{
+	// If we can't, the START retransmit gets acked instead.
+	msg *m = as_fabric_msg_get(M_TYPE_MIGRATE);
+	if (!m) {
+		return;
+	}
+
+	msg_set_uint32(m, MIG_FIELD_OP, OPERATION_START_ACK_OK);
+	msg_set_uint32(m, MIG_FIELD_MIG_ID, mig_id);
+	msg_set_uint32(m, MIG_FIELD_FEATURES, MIG_FEATURES_SUPPORTED);
+	if (summary) {
+		msg_set_buf(m, MIG_FIELD_SUMMARY, (const uint8_t *) summary, MIGRATE_DELTA_SUMMARY_SZ, MSG_SET_COPY);
+	}
+
+	if (0 != as_fabric_send(node, m, AS_FABRIC_PRIORITY_MEDIUM)) {
+		as_fabric_msg_put(m);
+	}
+	else {
+		cf_atomic_int_incr(&g_config.migrate_msgs_sent);
+	}
+}
+
+void *
+migrate_delta_fn(void *unused)
+{
+	while (true) {
+		migrate_delta_job job;
+		if (0 != cf_queue_pop(g_migrate_delta_q, &job, CF_QUEUE_FOREVER)) {
+			cf_crash(AS_MIGRATE, "unable to pop from delta migrate queue");
+		}
+
+		migrate_recv_control *mc = job.mc;
+		as_partition *p = mc->rsv.p;
+
+		// Only the first migration into a retained partition prunes it.
+		pthread_mutex_lock(&p->lock);
+		bool retained = p->delta_retained && p->state == AS_PARTITION_STATE_DESYNC;
+		p->delta_retained = false;
+		pthread_mutex_unlock(&p->lock);
+
+		migrate_delta_range *summary = migrate_delta_summarize(mc->rsv.tree);
+
+		if (retained) {
+			migrate_delta_drop_info info;
+			info.mc = mc;
+			info.n_dropped = 0;
+			memset(info.drop, 0, sizeof(info.drop));
+
+			uint32_t n_ranges_dropped = 0;
+
+			for (uint32_t i = 0; i < MIGRATE_DELTA_N_RANGES; i++) {
+				if (summary[i].n_records != 0 && ! (job.src_summary &&
+						migrate_delta_range_matches(&job.src_summary[i], &summary[i]))) {
+					info.drop[i >> 3] |= (uint8_t)(1 << (i & 7));
+					n_ranges_dropped++;
+				}
+			}
+
+			if (n_ranges_dropped != 0) {
+				as_index_reduce(mc->rsv.tree, migrate_delta_drop_reduce_fn, &info);
+			}
+
+			cf_debug(AS_MIGRATE, "{%s:%d} delta migrate: retained tree, dropped %"PRIu64" records in %u of %u ranges",
+					mc->rsv.ns->name, mc->rsv.pid, info.n_dropped, n_ranges_dropped, MIGRATE_DELTA_N_RANGES);
+		}
+
+		// Return the summary from before pruning - dropped ranges didn't
+		// match, so the sender won't skip them.
+		if (job.src_summary) {
+			mc->delta_summary = summary;
+			cf_free(job.src_summary);
+		}
+		else {
+			cf_free(summary);
+		}
+
+		__atomic_store_n(&mc->delta_pending, 0, __ATOMIC_RELEASE);
+
+		migrate_delta_send_start_ack(mc->source_node, job.mig_id, mc->delta_summary);
+
+		migrate_recv_control_release(mc);
+	}
+
+	return NULL;
+}
+
+//
+// Apply one incoming record to the partition - merge or flatten depending on
+// the migrate type and namespace. Returns non-zero if the record couldn't be
+// applied, in which case the caller doesn't ack and the sender retransmits.
+//
+
+int
+migrate_insert_component(migrate_recv_control *mc, cf_digest *key, as_record_merge_component *c)
+{
+	int winner_idx  = -1;
+	if (mc->mig_type == AS_MIGRATE_TYPE_OVERWRITE) {
+		// cf_info(AS_MIGRATE, "migrate rx: merge replace %"PRIx64" gen %d",*(uint64_t*)key,generation);
+		// NB: Blind replace is disabled, it is always flatten
+		// if (0 != as_record_replace(&mc->rsv, key, 1, c, &winner_idx)) {
+		if (0 != as_record_flatten(&mc->rsv, key, 1, c, &winner_idx)) {
+			cf_warning(AS_MIGRATE, "migrate: record replace failed %"PRIx64, *(uint64_t *)key);
+			return -1;
+		}
+	}
+	else {
+		if (mc->rsv.ns->allow_versions) {
+			// cf_info(AS_MIGRATE, "migrate rx: merge insert %"PRIx64" gen %d",*(uint64_t*)key,generation);
+			if (0 != as_record_merge(&mc->rsv, key, 1, c)) {
+				cf_warning(AS_MIGRATE, "migrate: record migrate failed %"PRIx64, *(uint64_t *)key);
+				return -1;
+			}
+		}
+		else {
+			// cf_info(AS_MIGRATE, "migrate rx: flatten insert %"PRIx64" gen %d",*(uint64_t*)key,generation);
+			if (0 != as_record_flatten(&mc->rsv, key, 1, c, &winner_idx)) {
+				cf_warning(AS_MIGRATE, "migrate: record flatten failed %"PRIx64, *(uint64_t *)key);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+//
+// Unpack a MIG_FIELD_RECORDS buffer and apply every record in it. Batches
+// never carry LDT records, so each component gets the plain-record defaults.
+// Keeps going past a failed record so the retransmit only has to fix that one
+// up - the rest merge as no-ops the second time around.
+//
+
+int
+migrate_insert_batch(migrate_recv_control *mc, uint8_t *buf, size_t buf_sz)
+{
+	uint8_t *end = buf + buf_sz;
+	int rv = 0;
+
+	while (buf < end) {
+		if ((size_t)(end - buf) < sizeof(migrate_batch_entry)) {
+			cf_warning(AS_MIGRATE, "migrate: truncated batch entry, %zu bytes left", (size_t)(end - buf));
+			return -1;
+		}
+
+		migrate_batch_entry *e = (migrate_batch_entry *) buf;
+		size_t entry_sz = sizeof(migrate_batch_entry) + (size_t)e->vinfo_len + e->rec_props_len + e->record_len;
+
+		if (entry_sz > (size_t)(end - buf)) {
+			cf_warning(AS_MIGRATE, "migrate: batch entry overruns buffer, need %zu have %zu", entry_sz, (size_t)(end - buf));
+			return -1;
+		}
+
+		cf_digest key = e->key;
+		uint8_t *data = e->data;
+
+		as_record_merge_component c;
+		if (e->vinfo_len == 0 ||
+				0 != as_partition_vinfoset_unpickle(&c.vinfoset, data, e->vinfo_len, "MIG")) {
+			memset(&c.vinfoset, 0, sizeof(c.vinfoset));
+		}
+		data += e->vinfo_len;
+
+		as_rec_props_clear(&c.rec_props);
+		if (e->rec_props_len != 0) {
+			c.rec_props.p_data = data;
+			c.rec_props.size = e->rec_props_len;
+		}
+		data += e->rec_props_len;
+
+		c.record_buf    = data;
+		c.record_buf_sz = e->record_len;
+		c.generation    = e->generation;
+		c.void_time     = e->void_time;
+		c.flag          = AS_COMPONENT_FLAG_MIG;
+		c.pdigest       = cf_digest_zero;
+		c.edigest       = cf_digest_zero;
+		c.version       = 0;
+		c.pgeneration   = 0;
+		c.pvoid_time    = 0;
+
+		if (0 != migrate_insert_component(mc, &key, &c)) {
+			rv = -1;
+		}
+
+		buf += entry_sz;
+	}
+
+	return rv;
+}
+
+
 int
 migrate_msg_fn(cf_node id, msg *m, void *udata)
 {
@@ -1330,34 +1722,10 @@ migrate_msg_fn(cf_node id, msg *m, void *udata)
 				c.void_time     = void_time;
 				c.rec_props     = rec_props;
 				as_ldt_get_migrate_info(mc, &c, m, key);
-				int winner_idx  = -1;
-				if (mc->mig_type == AS_MIGRATE_TYPE_OVERWRITE) {
-					// cf_info(AS_MIGRATE, "migrate rx: merge replace %"PRIx64" gen %d",*(uint64_t*)key,generation);
-					// NB: Blind replace is disabled, it is always flatten
-					// if (0 != as_record_replace(&mc->rsv, key, 1, &c, &winner_idx)) {
-					if (0 != as_record_flatten(&mc->rsv, key, 1, &c, &winner_idx)) {
-						cf_warning(AS_MIGRATE, "migrate: record replace failed %"PRIx64, *(uint64_t *)key);
-						migrate_recv_control_release(mc);
-						goto Done;
-					}
-				}
-				else {
-					if (mc->rsv.ns->allow_versions) {
-						// cf_info(AS_MIGRATE, "migrate rx: merge insert %"PRIx64" gen %d",*(uint64_t*)key,generation);
-						if (0 != as_record_merge(&mc->rsv, key, 1, &c)) {
-							cf_warning(AS_MIGRATE, "migrate: record migrate failed %"PRIx64, *(uint64_t *)key);
-							migrate_recv_control_release(mc);
-							goto Done;
-						}
-					}
-					else {
-						// cf_info(AS_MIGRATE, "migrate rx: flatten insert %"PRIx64" gen %d",*(uint64_t*)key,generation);
-						if (0 != as_record_flatten(&mc->rsv, key, 1, &c, &winner_idx)) {
-							cf_warning(AS_MIGRATE, "migrate: record flatten failed %"PRIx64, *(uint64_t *)key);
-							migrate_recv_control_release(mc);
-							goto Done;
-						}
-					}
+
+				if (0 != migrate_insert_component(mc, key, &c)) {
+					migrate_recv_control_release(mc);
+					goto Done;
 				}
 
 				migrate_recv_control_release(mc);
@@ -1389,6 +1757,62 @@ migrate_msg_fn(cf_node id, msg *m, void *udata)
 		}
 		break;
 
+		case OPERATION_INSERT_BATCH:
+		{
+
+			cf_atomic_int_incr(&g_config.migrate_inserts_rcvd);
+
+			uint32_t mig_id;
+			msg_get_uint32(m, MIG_FIELD_MIG_ID, &mig_id);
+
+			migrate_recv_control_index mc_i;
+			mc_i.source_node = id;
+			mc_i.mig_id = mig_id;
+
+			migrate_recv_control *mc;
+			if (RCHASH_OK == rchash_get(g_migrate_recv_control_hash, &mc_i, sizeof(mc_i), (void **) &mc))
+			{
+
+				if (mc->cluster_key != as_paxos_get_cluster_key()) {
+					cf_info(AS_MIGRATE, "migration insert batch: cluster key mismatch can't insert mig %d", mig_id);
+					as_migrate_print2_cluster_key("INSERTION FAIL", mc->cluster_key);
+					migrate_recv_control_release(mc);
+					goto Done;
+				}
+
+				uint8_t *records = NULL;
+				size_t records_sz = 0;
+				if (0 != msg_get_buf(m, MIG_FIELD_RECORDS, &records, &records_sz, MSG_GET_DIRECT)) {
+					cf_warning(AS_MIGRATE, "migrate: insert batch with no records, mig %d", mig_id);
+					migrate_recv_control_release(mc);
+					goto Done;
+				}
+
+				if (0 != migrate_insert_batch(mc, records, records_sz)) {
+					migrate_recv_control_release(mc);
+					goto Done;
+				}
+
+				migrate_recv_control_release(mc);
+
+			}
+
+			// ack it - one ack covers the whole batch
+			msg_set_unset(m, MIG_FIELD_RECORDS);
+			msg_set_unset(m, MIG_FIELD_NAMESPACE);
+			msg_set_uint32(m, MIG_FIELD_OP, OPERATION_ACK);
+			if (0 != as_fabric_send(id, m, AS_FABRIC_PRIORITY_HIGH)) {
+				cf_info(AS_MIGRATE, "insert-batch-ack-send-failed!!!!");
+			}
+			else {
+				m = 0;
+				cf_atomic_int_incr(&g_config.migrate_acks_sent);
+				cf_atomic_int_incr(&g_config.migrate_msgs_sent);
+			}
+
+		}
+		break;
+
 		case OPERATION_ACK:
 
 			cf_atomic_int_incr(&g_config.migrate_acks_rcvd);
@@ -1416,6 +1840,8 @@ migrate_msg_fn(cf_node id, msg *m, void *udata)
 			// Record the time fo the first START received.
 			mc->start_recv_ms = cf_getms();
 			mc->source_node = id;
+			mc->delta_pending = 0;
+			mc->delta_summary = NULL;
 			AS_PARTITION_RESERVATION_INIT(mc->rsv);
 
 			/*
@@ -1529,6 +1955,18 @@ migrate_msg_fn(cf_node id, msg *m, void *udata)
 				goto Done;
 			}
 
+			// Delta migration - if the sender sent its summary or we kept our
+			// tree, compare and prune on the delta thread, which does the ack.
+			uint8_t *src_summary = NULL;
+			size_t src_summary_sz = 0;
+			if (0 != msg_get_buf(m, MIG_FIELD_SUMMARY, &src_summary, &src_summary_sz, MSG_GET_DIRECT) ||
+					src_summary_sz != MIGRATE_DELTA_SUMMARY_SZ) {
+				src_summary = NULL;
+			}
+
+			bool use_delta = src_summary || mc->rsv.p->delta_retained;
+			mc->delta_pending = use_delta ? 1 : 0;
+
 			migrate_recv_control_index mc_i;
 			mc_i.source_node = id;
 			mc_i.mig_id = mig_id;
@@ -1551,6 +1989,23 @@ migrate_msg_fn(cf_node id, msg *m, void *udata)
 				migrate_start_network_policy(id);
 #endif
 
+				if (use_delta) {
+					migrate_delta_job job;
+					job.mc = mc;
+					job.mig_id = mig_id;
+					job.src_summary = NULL;
+
+					if (src_summary) {
+						job.src_summary = cf_malloc(MIGRATE_DELTA_SUMMARY_SZ);
+						cf_assert(job.src_summary, AS_MIGRATE, CF_CRITICAL, "malloc");
+						memcpy(job.src_summary, src_summary, MIGRATE_DELTA_SUMMARY_SZ);
+					}
+
+					cf_rc_reserve(mc);
+					cf_queue_push(g_migrate_delta_q, &job);
+					goto Done;
+				}
+
 			}
 			else {
 				// can't insert, means we're already started, so free what we were trying to put in
@@ -1559,10 +2014,27 @@ migrate_msg_fn(cf_node id, msg *m, void *udata)
 				cf_debug(AS_MIGRATE, "recv migrate start msg: duplicate, ignoring: {%s:%d} from node %"PRIx64, ns->name, part_id, id);
 
 				migrate_recv_control_release(mc);
+
+				msg_set_unset(m, MIG_FIELD_SUMMARY);
+
+				// the delta thread acks once it's done - until then, nothing
+				if (RCHASH_OK == rchash_get(g_migrate_recv_control_hash, &mc_i, sizeof(mc_i), (void **) &mc)) {
+					if (__atomic_load_n(&mc->delta_pending, __ATOMIC_ACQUIRE) != 0) {
+						migrate_recv_control_release(mc);
+						goto Done;
+					}
+
+					if (mc->delta_summary) {
+						msg_set_buf(m, MIG_FIELD_SUMMARY, (const uint8_t *) mc->delta_summary, MIGRATE_DELTA_SUMMARY_SZ, MSG_SET_COPY);
+					}
+
+					migrate_recv_control_release(mc);
+				}
 			}
 
 			// perhaps already seen, but another ack doesn't hurt, and hey, I've got this message just sitting here
 			msg_set_uint32(m, MIG_FIELD_OP, OPERATION_START_ACK_OK);
+			msg_set_uint32(m, MIG_FIELD_FEATURES, MIG_FEATURES_SUPPORTED);
 			if (0 == as_fabric_send(id, m, AS_FABRIC_PRIORITY_MEDIUM))  m = 0;
 
 		}
@@ -1589,6 +2061,27 @@ migrate_msg_fn(cf_node id, msg *m, void *udata)
 				migrate_xmit_control mig_c;
 				mig_c.mig_id = mig_id;
 				mig_c.op = op;
+				mig_c.features = 0;
+
+				// older nodes don't advertise features - treat as none
+				msg_get_uint32(m, MIG_FIELD_FEATURES, &mig_c.features);
+
+				// the destination's delta summary - first one wins
+				uint8_t *summary = NULL;
+				size_t summary_sz = 0;
+				if (op == OPERATION_START_ACK_OK &&
+						0 == msg_get_buf(m, MIG_FIELD_SUMMARY, &summary, &summary_sz, MSG_GET_DIRECT) &&
+						summary_sz == MIGRATE_DELTA_SUMMARY_SZ &&
+						! mig->dst_summary) {
+					migrate_delta_range *copy = cf_malloc(MIGRATE_DELTA_SUMMARY_SZ);
+					cf_assert(copy, AS_MIGRATE, CF_CRITICAL, "malloc");
+
+					memcpy(copy, summary, MIGRATE_DELTA_SUMMARY_SZ);
+
+					if (! __sync_bool_compare_and_swap(&mig->dst_summary, NULL, copy)) {
+						cf_free(copy);
+					}
+				}
 
 				// lookup the id in the mig table to see which node acked me
 				// and for that node, send the control message
@@ -1775,47 +2268,123 @@ migrate_rx_reaper_fn(void *gcc_is_ass)
 }
 
 //
-// This uses the asynchronous index reduce
-// which means the tree size is a guide
-// and you're guarenteed that the value exists, but not that it's particularly good
-// it may have been tombstone-ized or something
+// Global pacing for migrate-max-mb-per-sec. Every xmit thread reserves its
+// send's slice of time under the lock, then sleeps off whatever debt the
+// earlier sends left - so the cap is on the node's total, not per migration.
 //
 
+static pthread_mutex_t g_migrate_pace_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t g_migrate_pace_us = 0;
+
 void
-migrate_tree_reduce(as_index_ref *r_ref, void *udata)
+migrate_pace(uint32_t size)
 {
-	if ((r_ref == 0) || (r_ref->r == 0)) {
+	uint32_t mb_per_sec = g_config.migrate_max_mb_per_sec;
+
+	if (mb_per_sec == 0) {
 		return;
 	}
 
-	migration *mig = (migration *) udata;
+	uint64_t cost_us = ((uint64_t)size * 1000000) / ((uint64_t)mb_per_sec * 1024 * 1024);
 
-	if (mig->pickled_array == 0) {
-		// find the size, and malloc the pickled_array
-		// size is not guarenteed to be correct now, because this
-		if (mig->rsv.p->txstate & AS_PARTITION_MIG_TX_STATE_SUBRECORD) {
-			mig->pickled_alloc = mig->rsv.sub_tree->elements + 20;
-		} else {
-			mig->pickled_alloc = mig->rsv.tree->elements + 20;
+	pthread_mutex_lock(&g_migrate_pace_lock);
+
+	uint64_t now = cf_getus();
+
+	// Don't bank credit while idle - a burst after a quiet spell still paces.
+	if (g_migrate_pace_us < now) {
+		g_migrate_pace_us = now;
+	}
+
+	uint64_t wait_us = g_migrate_pace_us - now;
+
+	g_migrate_pace_us += cost_us;
+
+	pthread_mutex_unlock(&g_migrate_pace_lock);
+
+	if (wait_us != 0) {
+		usleep(wait_us);
+	}
+}
+
+//
+// Credit-based flow control - block until the migration's window has room for
+// another size bytes. Acks return credit (see migrate_process_ack). While we
+// wait, retransmit anything the destination hasn't acked, otherwise a lost
+// message would hold the window shut for good. An insert bigger than the
+// whole window still goes, once everything before it is acked.
+//
+
+int
+migrate_window_wait(migration *mig, uint32_t size)
+{
+	uint64_t last_retransmit_ms = cf_getms();
+
+	while (true) {
+		uint64_t unacked = (uint64_t)cf_atomic64_get(mig->unacked_bytes);
+
+		if (unacked == 0 || unacked + size <= g_config.migrate_window_size) {
+			return 0;
+		}
+
+		if (mig->cluster_key != as_paxos_get_cluster_key()) {
+			mig->xmit_fail_reason = "MIGRATE_INSERT_SEND: cluster key mismatch";
+			as_migrate_print2_cluster_key("MIGRATE_INSERT_SEND", mig->cluster_key);
+			return -1;
 		}
-		mig->pickled_array = cf_malloc(mig->pickled_alloc * sizeof(pickled_record));
-		cf_assert(mig->pickled_array, AS_MIGRATE, CF_CRITICAL, "malloc");
-		mig->pickled_size = 0;
+
+		uint64_t now = cf_getms();
+
+		if (now - last_retransmit_ms >= MIGRATE_WINDOW_RETRANSMIT_CHECK_MS) {
+			int rv = shash_reduce(mig->retransmit_hash, migrate_retransmit_reduce_fn, &now);
+
+			if (rv != 0 && rv != AS_FABRIC_ERR_QUEUE_FULL) {
+				cf_detail(AS_MIGRATE, "failure migrating - bad fabric send in window retransmission - error %d", rv);
+				mig->xmit_fail_reason = "retransmit send fail";
+				return -1;
+			}
+
+			last_retransmit_ms = now;
+		}
+
+		usleep(1000);
 	}
-	if (mig->pickled_size >= mig->pickled_alloc) {
-		cf_info(AS_MIGRATE, "tuning parameter: rcrb-reduce hit pickled array limit: alloc %d size %d growing",
-				mig->pickled_alloc, mig->pickled_size);
-		mig->pickled_alloc += 100;
-		mig->pickled_array = cf_realloc(mig->pickled_array, mig->pickled_alloc * sizeof(pickled_record) );
-		cf_assert(mig->pickled_array, AS_MIGRATE, CF_CRITICAL, "malloc");
+}
+
+int
+migrate_send_insert(migration *mig, msg *m, uint32_t size)
+{
+	if (0 != migrate_window_wait(mig, size)) {
+		as_fabric_msg_put(m);
+		return -1;
 	}
 
-	pickled_record *pr = &mig->pickled_array[mig->pickled_size];
-	mig->pickled_size++;
-	pr->record_buf = NULL;
+	migrate_pace(size);
 
+	// This might block a bit if the queues are blocked up
+	// but a failure is a hard-fail - can't notify other side
+	if (0 != migrate_send_reliable(mig, m, size)) {
+		mig->xmit_fail_reason = "data send reliable fail";
+		return -1;
+	}
+
+	return 0;
+}
+
+//
+// Pickle one record, then release it. The record lock is only held while
+// reading - by the time anything is sent the reduce has moved past it.
+// Returns 0 if pr is good to send, in which case the caller owns its buffers.
+//
+
+int
+migrate_pickle_record(migration *mig, as_index_ref *r_ref, pickled_record *pr)
+{
 	as_index *r = r_ref->r;
 
+	pr->record_buf = NULL;
+	as_rec_props_clear(&pr->rec_props);
+
 	pr->vinfo_buf_len = sizeof(pr->vinfo_buf);
 	if (0 != as_partition_vinfoset_mask_pickle(&mig->rsv.p->vinfoset, as_index_vinfo_mask_get(r, mig->rsv.ns->allow_versions), pr->vinfo_buf, &pr->vinfo_buf_len)) {
 		// this only happens if the record we have is too small. Do the best we can: send a null pickled value
@@ -1830,9 +2399,8 @@ migrate_tree_reduce(as_index_ref *r_ref, void *udata)
 	as_storage_rd rd;
 	if (0 != as_storage_record_open(mig->rsv.ns, r, &rd, &r->key)) {
 		cf_debug(AS_RECORD, "pickle: couldn't open record");
-		mig->pickled_size--;
 		as_record_done(r_ref, mig->rsv.ns);
-		return;
+		return -1;
 	}
 
 	rd.n_bins = as_bin_get_n_bins(r, &rd);
@@ -1842,10 +2410,9 @@ migrate_tree_reduce(as_index_ref *r_ref, void *udata)
 
 	if (0 != as_record_pickle(r, &rd, &pr->record_buf, &pr->record_len)) {
 		cf_info(AS_MIGRATE, "migrate could not pickle");
-		mig->pickled_size--;
 		as_storage_record_close(r, &rd);
 		as_record_done(r_ref, mig->rsv.ns);
-		return;
+		return -1;
 	}
 
 	pr->key = r->key;
@@ -1854,7 +2421,6 @@ migrate_tree_reduce(as_index_ref *r_ref, void *udata)
 
 	as_storage_record_get_key(&rd);
 
-	as_rec_props_clear(&pr->rec_props);
 	as_rec_props rec_props;
 	if (0 != as_storage_record_copy_rec_props(&rd, &rec_props)) {
 		pr->rec_props = rec_props;
@@ -1868,9 +2434,205 @@ migrate_tree_reduce(as_index_ref *r_ref, void *udata)
 
 	cf_atomic_int_incr(&g_config.migrate_reads);
 
-	mig->yield_count++;
-	if (g_config.migrate_read_priority && (mig->yield_count % g_config.migrate_read_priority == 0)) {
-		usleep(g_config.migrate_read_sleep);
+	return 0;
+}
+
+//
+// Send one record as its own INSERT - used for LDT namespaces, whose records
+// need the per-record LDT fields, and for destinations that can't take batches.
+//
+
+int
+migrate_send_record(migration *mig, pickled_record *pr)
+{
+	// TODO: what happens now then ... should it not retry
+	msg *m = as_fabric_msg_get(M_TYPE_MIGRATE);
+	if (!m) {
+		// [Note:  This can happen when the limit on number of migrate "msg" objects is reached.]
+		cf_detail(AS_MIGRATE, "failed to allocate a msg of type %d ~~ bailing out of migration", M_TYPE_MIGRATE);
+		mig->xmit_fail_reason = "no available msgs";
+		return -1;
+	}
+
+	if (as_ldt_fill_mig_msg(mig, m, pr, mig->is_subrecord)) {
+		cf_detail(AS_MIGRATE, "Skipping Stale version Subrecord Shipping");
+		as_fabric_msg_put(m);
+		return 0;
+	}
+
+	uint32_t size = (uint32_t)(sizeof(cf_digest) + pr->vinfo_buf_len + pr->rec_props.size + pr->record_len);
+
+	msg_set_uint32(m, MIG_FIELD_OP,         OPERATION_INSERT);
+	msg_set_buf   (m, MIG_FIELD_DIGEST,     (void *) &pr->key, sizeof(cf_digest), MSG_SET_COPY);
+	msg_set_uint32(m, MIG_FIELD_GENERATION, pr->generation);
+	msg_set_uint32(m, MIG_FIELD_VOID_TIME,  pr->void_time);
+	msg_set_buf   (m, MIG_FIELD_NAMESPACE,  (byte *) mig->rsv.ns->name, strlen(mig->rsv.ns->name), MSG_SET_COPY);
+	msg_set_buf   (m, MIG_FIELD_VINFOSET,   pr->vinfo_buf, pr->vinfo_buf_len, MSG_SET_COPY);
+
+	if (pr->rec_props.p_data) {
+		msg_set_buf(m, MIG_FIELD_REC_PROPS, (void *)pr->rec_props.p_data, pr->rec_props.size, MSG_SET_HANDOFF_MALLOC);
+		as_rec_props_clear(&pr->rec_props);
+	}
+
+	msg_set_buf(m, MIG_FIELD_RECORD, pr->record_buf, pr->record_len, MSG_SET_HANDOFF_MALLOC);
+	pr->record_len = 0;
+	pr->record_buf = NULL;
+
+	return migrate_send_insert(mig, m, size);
+}
+
+//
+// Ship whatever is in the batch buffer as one INSERT_BATCH. The buffer is
+// handed off to the msg - the next record starts a fresh one.
+//
+
+int
+migrate_batch_flush(migration *mig)
+{
+	if (mig->batch_n_records == 0) {
+		return 0;
+	}
+
+	msg *m = as_fabric_msg_get(M_TYPE_MIGRATE);
+	if (!m) {
+		cf_detail(AS_MIGRATE, "failed to allocate a msg of type %d ~~ bailing out of migration", M_TYPE_MIGRATE);
+		mig->xmit_fail_reason = "no available msgs";
+		return -1;
+	}
+
+	uint32_t size = (uint32_t)mig->batch_len;
+
+	msg_set_uint32(m, MIG_FIELD_OP,         OPERATION_INSERT_BATCH);
+	msg_set_buf   (m, MIG_FIELD_NAMESPACE,  (byte *) mig->rsv.ns->name, strlen(mig->rsv.ns->name), MSG_SET_COPY);
+	msg_set_buf   (m, MIG_FIELD_RECORDS,    mig->batch_buf, mig->batch_len, MSG_SET_HANDOFF_MALLOC);
+
+	mig->batch_buf = NULL;
+	mig->batch_alloc = 0;
+	mig->batch_len = 0;
+	mig->batch_n_records = 0;
+
+	return migrate_send_insert(mig, m, size);
+}
+
+int
+migrate_batch_add(migration *mig, pickled_record *pr)
+{
+	size_t entry_sz = sizeof(migrate_batch_entry) + pr->vinfo_buf_len + pr->rec_props.size + pr->record_len;
+
+	// Don't let a big record push an already-started batch past the limit.
+	if (mig->batch_len != 0 && mig->batch_len + entry_sz > MIGRATE_BATCH_MAX_BYTES) {
+		if (0 != migrate_batch_flush(mig)) {
+			return -1;
+		}
+	}
+
+	if (mig->batch_len + entry_sz > mig->batch_alloc) {
+		size_t alloc = MIGRATE_BATCH_MAX_BYTES;
+
+		if (mig->batch_len + entry_sz > alloc) {
+			alloc = mig->batch_len + entry_sz;
+		}
+
+		mig->batch_buf = cf_realloc(mig->batch_buf, alloc);
+		cf_assert(mig->batch_buf, AS_MIGRATE, CF_CRITICAL, "malloc");
+		mig->batch_alloc = alloc;
+	}
+
+	migrate_batch_entry *e = (migrate_batch_entry *)(mig->batch_buf + mig->batch_len);
+
+	e->key = pr->key;
+	e->generation = pr->generation;
+	e->void_time = pr->void_time;
+	e->record_len = (uint32_t)pr->record_len;
+	e->rec_props_len = pr->rec_props.size;
+	e->vinfo_len = (uint32_t)pr->vinfo_buf_len;
+
+	uint8_t *data = e->data;
+
+	memcpy(data, pr->vinfo_buf, pr->vinfo_buf_len);
+	data += pr->vinfo_buf_len;
+
+	if (pr->rec_props.size != 0) {
+		memcpy(data, pr->rec_props.p_data, pr->rec_props.size);
+		data += pr->rec_props.size;
+	}
+
+	memcpy(data, pr->record_buf, pr->record_len);
+
+	mig->batch_len += entry_sz;
+	mig->batch_n_records++;
+
+	if (mig->batch_n_records >= MIGRATE_BATCH_MAX_RECORDS ||
+			mig->batch_len >= MIGRATE_BATCH_MAX_BYTES) {
+		return migrate_batch_flush(mig);
+	}
+
+	return 0;
+}
+
+//
+// This uses the asynchronous index reduce
+// which means the tree size is a guide
+// and you're guarenteed that the value exists, but not that it's particularly good
+// it may have been tombstone-ized or something
+//
+// Records stream straight out of the reduce - at most one pickled record plus
+// one batch buffer exist at a time, and migrate_window_wait() caps what's in
+// flight, so memory per migration no longer scales with the partition.
+//
+
+void
+migrate_tree_reduce(as_index_ref *r_ref, void *udata)
+{
+	if ((r_ref == 0) || (r_ref->r == 0)) {
+		return;
+	}
+
+	migration *mig = (migration *) udata;
+
+	// Once the stream has failed, just release what's left of the reduce.
+	if (mig->xmit_fail_reason) {
+		as_record_done(r_ref, mig->rsv.ns);
+		return;
+	}
+
+	// Cluster key does not match it is obselete
+	if (mig->cluster_key != as_paxos_get_cluster_key()) {
+		mig->xmit_fail_reason = "MIGRATE_INSERT_SEND: cluster key mismatch";
+		as_migrate_print2_cluster_key("MIGRATE_INSERT_SEND", mig->cluster_key);
+		as_record_done(r_ref, mig->rsv.ns);
+		return;
+	}
+
+	// The destination already has this record's whole range - don't send it.
+	if (mig->use_delta && ! mig->is_subrecord) {
+		uint32_t range_id = migrate_delta_range_id(&r_ref->r->key);
+
+		if (mig->delta_skip[range_id >> 3] & (1 << (range_id & 7))) {
+			as_record_done(r_ref, mig->rsv.ns);
+			cf_atomic_int_incr(&g_config.migrate_delta_skipped);
+			return;
+		}
+	}
+
+	pickled_record pr;
+
+	if (0 != migrate_pickle_record(mig, r_ref, &pr)) {
+		return;
+	}
+
+	if (mig->use_batch) {
+		migrate_batch_add(mig, &pr);
+	}
+	else {
+		migrate_send_record(mig, &pr);
+	}
+
+	if (pr.record_buf) {
+		cf_free(pr.record_buf);
+	}
+	if (pr.rec_props.p_data) {
+		cf_free(pr.rec_props.p_data);
 	}
 }
 
@@ -1899,6 +2661,9 @@ migrate_start_send(migration *mig)
 		msg_set_buf(start_m, MIG_FIELD_NAMESPACE, (byte *) mig->rsv.ns->name, strlen(mig->rsv.ns->name), MSG_SET_COPY);
 		msg_set_uint32(start_m, MIG_FIELD_PARTITION, mig->rsv.pid);
 		msg_set_uint32(start_m, MIG_FIELD_TYPE, mig->mig_type);
+		if (mig->src_summary) {
+			msg_set_buf(start_m, MIG_FIELD_SUMMARY, (const uint8_t *) mig->src_summary, MIGRATE_DELTA_SUMMARY_SZ, MSG_SET_COPY);
+		}
 
 		mig->start_m = start_m;
 		for (uint i = 0; i < mig->dst_nodes_sz; i++)
@@ -1978,6 +2743,62 @@ get_most_urgent_migration_reduce_pop_fn(void *buf, void *udata)
 
 
 
+//
+// Delta migration - summarize our copy of the partition to send with the
+// START. Only for a single non-LDT destination - with several destinations
+// there's no one summary to compare against, and LDT sub-records would need
+// summaries of the sub-record tree as well. With no summary a destination that
+// kept its tree just drops it all.
+//
+
+void
+migrate_delta_start(migration *mig)
+{
+	if (mig->dst_nodes_sz != 1 || mig->rsv.ns->ldt_enabled ||
+			as_index_tree_size(mig->rsv.tree) == 0) {
+		return;
+	}
+
+	mig->src_summary = migrate_delta_summarize(mig->rsv.tree);
+}
+
+//
+// Delta migration - compare our summary with the one the destination sent
+// back with its START_ACK_OK, and mark the ranges that match so the tree
+// reduce skips them. No summary just means a full migration.
+//
+
+void
+migrate_delta_prepare(migration *mig)
+{
+	mig->use_delta = false;
+
+	migrate_delta_range *local = mig->src_summary;
+	migrate_delta_range *remote = __atomic_load_n(&mig->dst_summary, __ATOMIC_ACQUIRE);
+
+	if (! local || ! remote || (mig->dst_features & MIG_FEATURE_DELTA) == 0) {
+		return;
+	}
+
+	uint32_t n_ranges_matched = 0;
+	uint64_t n_records_matched = 0;
+
+	memset(mig->delta_skip, 0, sizeof(mig->delta_skip));
+
+	for (uint32_t i = 0; i < MIGRATE_DELTA_N_RANGES; i++) {
+		if (migrate_delta_range_matches(&local[i], &remote[i])) {
+			mig->delta_skip[i >> 3] |= (uint8_t)(1 << (i & 7));
+			n_ranges_matched++;
+			n_records_matched += local[i].n_records;
+		}
+	}
+
+	mig->use_delta = true;
+
+	cf_debug(AS_MIGRATE, "{%s:%d} delta migrate: %u of %u ranges match, skipping %"PRIu64" records",
+			mig->rsv.ns->name, mig->rsv.pid, n_ranges_matched, MIGRATE_DELTA_N_RANGES, n_records_matched);
+}
+
 /*
  * Workhorse function which reduce passed in tree and migrates based on data in
  * migration job
@@ -1992,83 +2813,30 @@ get_most_urgent_migration_reduce_pop_fn(void *buf, void *udata)
 int
 as_migrate_tree(migration *mig, as_index_tree *tree, bool is_subrecord)
 {
-	uint32_t yield_count = 0;
 	cf_detail(AS_MIGRATE, "DEBUG: TREE SIZE IF %d", as_index_tree_size(tree));
 	// Got sub record data
 	if (as_index_tree_size(tree) != 0) {
 
-		// reduce the hash table into an array/list
+		// LDT records carry per-record fields the batch format doesn't have.
+		mig->is_subrecord = is_subrecord;
+		mig->use_batch = ! mig->rsv.ns->ldt_enabled &&
+				(mig->dst_features & MIG_FEATURE_INSERT_BATCH) != 0;
+		mig->xmit_fail_reason = NULL;
+
+		// reduce the tree, streaming records out as we go
 		cf_debug(AS_MIGRATE, "migration reduce read started");
 		as_index_reduce(tree, migrate_tree_reduce, mig);
 		cf_debug(AS_MIGRATE, "migration reduce reads finished");
 
-		// transmit all with inserts into the retransmit hash
-		for (uint p_idx = 0; p_idx < mig->pickled_size ; p_idx++) {
-
-			// Cluster key does not match it is obselete
-			if (mig->cluster_key != as_paxos_get_cluster_key()) {
-				migrate_send_finish(mig, AS_MIGRATE_STATE_ERROR, "MIGRATE_INSERT_SEND: cluster key mismatch");
-				as_migrate_print2_cluster_key("MIGRATE_INSERT_SEND", mig->cluster_key);
-				return -1;
-			}
-
-			pickled_record *pr = &mig->pickled_array[p_idx];
-
-			// TODO: what happens now then ... should it not retry
-			msg *m = as_fabric_msg_get(M_TYPE_MIGRATE);
-			if (!m) {
-				// [Note:  This can happen when the limit on number of migrate "msg" objects is reached.]
-				cf_detail(AS_MIGRATE, "failed to allocate a msg of type %d ~~ bailing out of migration", M_TYPE_MIGRATE);
-				migrate_send_finish(mig, AS_MIGRATE_STATE_ERROR, "no available msgs");
-				return 1;
-			}
-
-			if (as_ldt_fill_mig_msg(mig, m, pr, is_subrecord)) {
-				cf_detail(AS_MIGRATE, "Skipping Stale version Subrecord Shipping");
-				as_fabric_msg_put(m);
-				continue;
-			}
-			msg_set_uint32(m, MIG_FIELD_OP,         OPERATION_INSERT);
-			msg_set_buf   (m, MIG_FIELD_DIGEST,     (void *) &pr->key, sizeof(cf_digest), MSG_SET_COPY);
-			msg_set_uint32(m, MIG_FIELD_GENERATION, pr->generation);
-			msg_set_uint32(m, MIG_FIELD_VOID_TIME,  pr->void_time);
-			msg_set_buf   (m, MIG_FIELD_NAMESPACE,  (byte *) mig->rsv.ns->name, strlen(mig->rsv.ns->name), MSG_SET_COPY);
-			msg_set_buf   (m, MIG_FIELD_VINFOSET,   pr->vinfo_buf, pr->vinfo_buf_len, MSG_SET_COPY);
-
-			if (pr->rec_props.p_data) {
-				msg_set_buf(m, MIG_FIELD_REC_PROPS, (void *)pr->rec_props.p_data, pr->rec_props.size, MSG_SET_HANDOFF_MALLOC);
-				as_rec_props_clear(&pr->rec_props);
-			}
-
-			msg_set_buf(m, MIG_FIELD_RECORD, pr->record_buf, pr->record_len, MSG_SET_HANDOFF_MALLOC);
-			pr->record_len = 0;
-			pr->record_buf = NULL;
-
-			// This might block a bit if the queues are blocked up
-			// but a failure is a hard-fail - can't notify other side
-			if (0 != migrate_send_reliable(mig, m)) {
-				migrate_send_finish(mig, AS_MIGRATE_STATE_ERROR, "data send reliable fail");
-				return 2;
-			}
-
-			// Don't want too many outstanding. Monitor the hash size and pause a bit if
-			// it gets too full.
-			if (shash_get_size(mig->retransmit_hash) > g_config.migrate_xmit_hwm) {
-				int escape = 0;
-				while ( shash_get_size(mig->retransmit_hash) > g_config.migrate_xmit_lwm ) {
-					if (escape++ >= 300) {
-						cf_debug(AS_MIGRATE, "tx transmit backoff: escaping: tid %d size %d", mig->id, shash_get_size(mig->retransmit_hash) );
-						break;
-					}
-					usleep(1000);
-				}
-			}
+		if (! mig->xmit_fail_reason && mig->use_batch) {
+			migrate_batch_flush(mig);
+		}
 
-			yield_count++;
-			if (g_config.migrate_xmit_priority && (yield_count % g_config.migrate_xmit_priority == 0)) {
-				usleep(g_config.migrate_xmit_sleep);
-			}
+		if (mig->xmit_fail_reason) {
+			migrate_send_finish(mig, AS_MIGRATE_STATE_ERROR, mig->xmit_fail_reason);
+			return 1;
 		}
+
 		cf_debug(AS_MIGRATE, "sent all, retransmitting: mig_id %d", mig->id);
 
 		// reduce over the retransmit hash until finished
@@ -2110,19 +2878,6 @@ as_migrate_tree(migration *mig, as_index_tree *tree, bool is_subrecord)
 		} while(1);
 
 		cf_detail(AS_MIGRATE, "retranmsits done %d", mig->id);
-
-		if (mig->pickled_array)	{
-			for (uint i = 0; i < mig->pickled_size; i++) {
-				if (mig->pickled_array[i].record_buf) {
-					cf_free(mig->pickled_array[i].record_buf);
-				}
-				if  (mig->pickled_array[i].rec_props.p_data) {
-					cf_free(mig->pickled_array[i].rec_props.p_data);
-				}
-			}
-			cf_free(mig->pickled_array);
-			mig->pickled_array = NULL;
-		}
 	}
 	return 0;
 }
@@ -2279,7 +3034,12 @@ migrate_xmit_fn(void *arg)
 			as_migrate_print2_cluster_key("MIGRATE_START_SEND", mig->cluster_key);
 			goto FinishedMigrate;
 		}
+		if (g_config.migrate_delta) {
+			migrate_delta_start(mig);
+		}
+
 		// send start messages until all nodes ack
+		mig->dst_features = MIG_FEATURES_SUPPORTED;
 		bool done = false;
 		do {
 
@@ -2297,6 +3057,9 @@ migrate_xmit_fn(void *arg)
 				switch (mxc.op) {
 					case OPERATION_START_ACK_OK:
 
+						// only use what every destination understands
+						mig->dst_features &= mxc.features;
+
 						// set the start_done flag properly
 						mig->start_done[mxc.node_offset] = true;
 						// check for completion
@@ -2361,7 +3124,6 @@ migrate_xmit_fn(void *arg)
 
 		} while( done == false);
 
-		mig->yield_count = 0;
 
 		// There are two algorithm to do this
 		//
@@ -2430,6 +3192,10 @@ migrate_xmit_fn(void *arg)
 			cf_detail(AS_MIGRATE, "LDT_MIGRATION: Started Sending Record Migration !! %s:%d:%d:%d",
 					  mig->rsv.ns->name, mig->rsv.p->partition_id, mig->rsv.p->vp->elements, mig->rsv.p->sub_vp->elements);
 		}
+		if (g_config.migrate_delta) {
+			migrate_delta_prepare(mig);
+		}
+
 		rv = as_migrate_tree(mig, mig->rsv.tree, false);
 		if (rv < 0) {
 			cancel = true;
@@ -2560,9 +3326,6 @@ as_migrate(cf_node *dst_node, uint dst_sz, as_namespace *ns, as_partition_id par
 	mig->dst_nodes_sz = dst_sz;
 
 	AS_PARTITION_RESERVATION_INIT(mig->rsv);
-	mig->pickled_alloc = 0;
-	mig->pickled_size = 0;
-	mig->pickled_array = 0;
 	mig->id = cf_atomic32_incr(&g_migrate_id);
 	mig->mig_type = mig_type;
 
@@ -2580,6 +3343,19 @@ as_migrate(cf_node *dst_node, uint dst_sz, as_namespace *ns, as_partition_id par
 	mig->retransmit_hash = 0;
 	mig->xmit_control_q = 0;
 
+	mig->dst_features = 0;
+	mig->unacked_bytes = 0;
+	mig->use_batch = false;
+	mig->is_subrecord = false;
+	mig->xmit_fail_reason = NULL;
+	mig->batch_buf = NULL;
+	mig->batch_alloc = 0;
+	mig->batch_len = 0;
+	mig->batch_n_records = 0;
+	mig->use_delta = false;
+	mig->src_summary = NULL;
+	mig->dst_summary = NULL;
+
 	// It is important to reserve the tree now, because we must migrate the tree
 	// that is in existance NOW
 	as_partition_reserve_migrate(ns, part_id, &mig->rsv, 0);
@@ -2670,6 +3446,9 @@ as_migrate_init()
 
 	pthread_create(&g_migrate_rx_reaper_th, 0, migrate_rx_reaper_fn, 0);
 
+	g_migrate_delta_q = cf_queue_create(sizeof(migrate_delta_job), true);
+	pthread_create(&g_migrate_delta_th, 0, migrate_delta_fn, 0);
+
 	as_fabric_register_msg_fn(M_TYPE_MIGRATE, migrate_mt, sizeof(migrate_mt), migrate_msg_fn, 0 /* udata */);
 
 	g_event_cb = as_partition_migrate_rx;
@@ -2740,8 +3519,8 @@ static int as_migrate_dump_migrate_hash_fn(void *key, uint32_t keylen, void *obj
 	migration *mig = (migration *) object;
 	int *item_num = (int *) udata;
 
-	cf_info(AS_MIGRATE, "[%d]: mig_id %d : id %d ; type %d ; start xmit ms %ld ; done xmit ms %ld ; yc %ld ; ck %016lX", *item_num, mig_id,
-			mig->id, mig->mig_type, mig->start_xmit_ms, mig->done_xmit_ms, mig->yield_count, mig->cluster_key);
+	cf_info(AS_MIGRATE, "[%d]: mig_id %d : id %d ; type %d ; start xmit ms %ld ; done xmit ms %ld ; unacked %ld ; ck %016lX", *item_num, mig_id,
+			mig->id, mig->mig_type, mig->start_xmit_ms, mig->done_xmit_ms, cf_atomic64_get(mig->unacked_bytes), mig->cluster_key);
 
 	*item_num += 1;
 
@@ -162,6 +162,7 @@
 
 #include "fault.h"
 #include "queue.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 #include "base/cfg.h"
@@ -435,6 +436,7 @@ as_partition_reinit(as_partition *p, as_namespace *ns, int pid)
 	memset(p->dupl_pvinfo, 0, sizeof(p->dupl_pvinfo));
 	p->reject_writes = false;
 	p->waiting_for_master = false;
+	p->delta_retained = false;
 	memset(&p->primary_version_info, 0, sizeof(p->primary_version_info));
 	memset(&p->version_info, 0, sizeof(p->version_info));
 	memset(&p->vinfoset, 0, sizeof(p->vinfoset));
@@ -507,19 +509,31 @@ void set_partition_desync_lockfree(as_partition *p, as_partition_vinfo *vinfo, a
 	if ((NULL == p) || (NULL == vinfo) || (NULL == ns)) /* params */
 		return;
 	p->state = AS_PARTITION_STATE_DESYNC;
-	as_index_tree *t = p->vp;
-	p->vp = as_index_tree_create(ns->arena, (as_index_value_destructor)&as_record_destroy, ns, ns->tree_roots ? &ns->tree_roots[pid] : NULL);
-	cf_debug(AS_PARTITION, "{%s:%d}set_partition_desync_lockfree: TREE %p ", ns->name, pid, p->vp);
-	cf_debug(AS_PARTITION, "{%s:%d}set_partition_desync_lockfree: OLD TREE %p  ref count %d", ns->name, pid, t, cf_rc_count(t));
-	as_index_tree_release(t, ns);
+
+	// With migrate-delta, keep the records we have - the first migration in
+	// drops the digest ranges that don't match the sender's before acking the
+	// START, so only the differences get shipped. LDT sub-records aren't
+	// summarized, so LDT namespaces always start over empty.
+	if (g_config.migrate_delta && ! ns->ldt_enabled) {
+		p->delta_retained = true;
+		cf_debug(AS_PARTITION, "{%s:%d}set_partition_desync_lockfree: RETAINED TREE %p ", ns->name, pid, p->vp);
+	}
+	else {
+		p->delta_retained = false;
+		as_index_tree *t = p->vp;
+		p->vp = as_index_tree_create(ns->arena, (as_index_value_destructor)&as_record_destroy, ns, ns->tree_roots ? &ns->tree_roots[pid] : NULL);
+		cf_debug(AS_PARTITION, "{%s:%d}set_partition_desync_lockfree: TREE %p ", ns->name, pid, p->vp);
+		cf_debug(AS_PARTITION, "{%s:%d}set_partition_desync_lockfree: OLD TREE %p  ref count %d", ns->name, pid, t, cf_rc_count(t));
+		as_index_tree_release(t, ns);
+		cf_atomic_int_set(&p->n_bytes_memory, 0);
+	}
 
 	as_index_tree *sub_t = p->sub_vp;
 	p->sub_vp = as_index_tree_create(ns->arena, (as_index_value_destructor)&as_record_destroy, ns, ns->sub_tree_roots ? &ns->sub_tree_roots[pid] : NULL);
 	cf_debug(AS_PARTITION, "{%s:%d}set_partition_desync_lockfree: SUBRECORD TREE %p ", ns->name, pid, p->sub_vp);
-	cf_debug(AS_PARTITION, "{%s:%d}set_partition_desync_lockfree: OLD SUBRECORD TREE %p  ref count %d", ns->name, pid, t, cf_rc_count(sub_t));
+	cf_debug(AS_PARTITION, "{%s:%d}set_partition_desync_lockfree: OLD SUBRECORD TREE %p  ref count %d", ns->name, pid, sub_t, cf_rc_count(sub_t));
 	as_index_tree_release(sub_t, ns);
 
-	cf_atomic_int_set(&p->n_bytes_memory, 0);
 	clear_partition_version_in_storage(ns, pid, flush);
 	memset(vinfo, 0, sizeof(as_partition_vinfo));
 	// Currently both tree have same property
@@ -573,6 +587,7 @@ void set_partition_absent_lockfree(as_partition *p, as_partition_vinfo *vinfo, a
 	// A Change:  Set the State BEFORE the tree release, just in case that
 	// is opening too large of a time window.
 	p->state = AS_PARTITION_STATE_ABSENT; // Move the state setting ABOVE the tree release.
+	p->delta_retained = false;
 	if (NULL != t) {
 		cf_debug(AS_PARTITION, "{%s:%d}as_partition_reinit: OLD TREE %p  ref count %d", ns->name, pid, t, cf_rc_count(t));
 		as_index_tree_release(t, ns);
@@ -701,6 +716,15 @@ as_partition_init(as_partition *p, as_namespace *ns, int pid)
 		cf_crash(AS_PARTITION, "couldn't initialize partition state lock: %s", cf_strerror(errno));
 	if (0 != pthread_mutex_init(&p->vinfoset_lock, 0))
 		cf_crash(AS_PARTITION, "couldn't initialize partition vinfo set lock: %s", cf_strerror(errno));
+	if (0 != pthread_mutex_init(&p->expire_lock, 0))
+		cf_crash(AS_PARTITION, "couldn't initialize partition expire index lock: %s", cf_strerror(errno));
+
+	// The void-time index ticks in seconds, the unit of void-times.
+	p->expire_wheel = NULL;
+	if (ns->nsup_expire_index) {
+		if (NULL == (p->expire_wheel = cf_timer_wheel_create(sizeof(cf_digest), 1, as_record_void_time_get())))
+			cf_crash(AS_PARTITION, "couldn't create partition expire index");
+	}
 
 	p->vp = (as_index_tree *) NULL;
 	p->sub_vp = (as_index_tree *) NULL;
@@ -709,6 +733,31 @@ as_partition_init(as_partition *p, as_namespace *ns, int pid)
 	return;
 }
 
+/* as_partition_expire_index_update
+ * Note a record's new void-time in the partition's void-time index, if enabled.
+ * Every place that sets a record's void-time calls this. Entries are never
+ * removed - when one comes due, nsup checks the record's current void-time and
+ * reschedules the entry if it was pushed out. So only a record that's new to
+ * the index, or whose void-time moved earlier, needs a new entry. This keeps
+ * the index at about one entry per expirable record, however often records
+ * are rewritten */
+void
+as_partition_expire_index_update(as_partition *p, cf_digest *keyd, uint32_t old_void_time, uint32_t void_time)
+{
+	if (! p->expire_wheel || void_time == 0)
+		return;
+
+	if (old_void_time != 0 && old_void_time <= void_time)
+		return;
+
+	pthread_mutex_lock(&p->expire_lock);
+
+	if (0 != cf_timer_wheel_add(p->expire_wheel, void_time, keyd))
+		cf_warning(AS_PARTITION, "couldn't add to partition expire index");
+
+	pthread_mutex_unlock(&p->expire_lock);
+}
+
 /* as_partition_getstates
  * Summarize the partition states, populating the supplied structure
  */
@@ -39,6 +39,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -77,6 +78,8 @@
 // Defined in thr_nsup.c, for historical reasons.
 extern bool as_cold_start_evict_if_needed(as_namespace* ns);
 
+void ssd_flush_swb(drv_ssd *ssd, ssd_write_buf *swb);
+
 
 //==========================================================
 // Constants.
@@ -212,8 +215,13 @@ static inline void
 push_wblock_to_defrag_q(drv_ssd *ssd, uint32_t wblock_id)
 {
 	if (ssd->defrag_wblock_q) { // null until devices are loaded at startup
+		ssd_defrag_entry entry = {
+				.wblock_id = wblock_id,
+				.enq_sec = (uint32_t)cf_get_seconds()
+		};
+
 		ssd->alloc_table->wblock_state[wblock_id].state = WBLOCK_STATE_DEFRAG;
-		cf_queue_push(ssd->defrag_wblock_q, &wblock_id);
+		cf_queue_push(ssd->defrag_wblock_q, &entry);
 		cf_atomic_int_incr(&ssd->defrag_wblock_counter);
 	}
 }
@@ -236,21 +244,28 @@ available_size(drv_ssd *ssd)
 // ssd_write_buf "swb" methods.
 //
 
+// Note - swb structs are never freed, only their bufs. A writer may still be
+// looking at the state of an swb that has since left its write lane.
+
 static inline ssd_write_buf*
 swb_create(drv_ssd *ssd)
 {
-	ssd_write_buf *swb = (ssd_write_buf*)cf_malloc(sizeof(ssd_write_buf));
+	ssd_write_buf *swb;
 
-	if (! swb) {
-		cf_warning(AS_DRV_SSD, "device %s - swb malloc failed", ssd->name);
-		return NULL;
+	if (CF_QUEUE_OK != cf_queue_pop(ssd->swb_husk_q, &swb, CF_QUEUE_NOWAIT)) {
+		swb = (ssd_write_buf*)cf_malloc(sizeof(ssd_write_buf));
+
+		if (! swb) {
+			cf_warning(AS_DRV_SSD, "device %s - swb malloc failed", ssd->name);
+			return NULL;
+		}
 	}
 
 	swb->buf = cf_valloc(ssd->write_block_size);
 
 	if (! swb->buf) {
 		cf_warning(AS_DRV_SSD, "device %s - swb buf valloc failed", ssd->name);
-		cf_free(swb);
+		cf_queue_push(ssd->swb_husk_q, &swb);
 		return NULL;
 	}
 
@@ -258,21 +273,36 @@ swb_create(drv_ssd *ssd)
 }
 
 static inline void
-swb_destroy(ssd_write_buf *swb)
+swb_destroy(drv_ssd *ssd, ssd_write_buf *swb)
 {
 	cf_free(swb->buf);
-	cf_free(swb);
+	swb->buf = NULL;
+	cf_queue_push(ssd->swb_husk_q, &swb);
 }
 
 static inline void
 swb_reset(ssd_write_buf *swb)
 {
 	swb->wblock_id = STORAGE_INVALID_WBLOCK;
-	swb->pos = 0;
+	__atomic_store_n(&swb->state, 0, __ATOMIC_RELEASE);
 }
 
 #define swb_reserve(_swb) cf_atomic32_incr(&(_swb)->rc)
 
+// Zero any unused space at the end of a filled swb, and enqueue it to be
+// flushed to device.
+static inline void
+swb_enqueue(drv_ssd *ssd, ssd_write_buf *swb, uint32_t pos)
+{
+	// Clean the end of the buffer before pushing to write queue.
+	if (ssd->write_block_size != pos) {
+		memset(&swb->buf[pos], 0, ssd->write_block_size - pos);
+	}
+
+	cf_queue_push(ssd->swb_write_q, &swb);
+	cf_atomic_int_incr(&ssd->ssd_write_buf_counter); // for write smoothing
+}
+
 static inline void
 swb_check_and_reserve(ssd_wblock_state *wblock_state, ssd_write_buf **p_swb)
 {
@@ -342,7 +372,7 @@ swb_get(drv_ssd *ssd)
 
 		swb->ssd = ssd;
 		swb->wblock_id = STORAGE_INVALID_WBLOCK;
-		swb->pos = 0;
+		swb->state = 0;
 		swb->rc = 0;
 	}
 
@@ -378,6 +408,10 @@ swb_get(drv_ssd *ssd)
 
 	pthread_mutex_unlock(&p_wblock_state->LOCK);
 
+	// Journal after attaching the swb - a snapshot starting now either finds
+	// the swb, or is in the epoch this journal entry belongs to.
+	swb->journal_seq = ssd_snapshot_journal_add(ssd, swb->wblock_id);
+
 	return swb;
 }
 
@@ -386,6 +420,120 @@ swb_get(drv_ssd *ssd)
 //------------------------------------------------
 
 
+//------------------------------------------------
+// Write lane methods.
+//
+
+static inline ssd_write_lane*
+lane_get(drv_ssd *ssd)
+{
+	int cpu = sched_getcpu();
+
+	return &ssd->lanes[cpu < 0 ? 0 : (uint32_t)cpu % ssd->n_lanes];
+}
+
+// Called when a writer (or the lane itself) is finished with the swb. If the
+// swb is closed and this was the last writer, enqueue it to be flushed.
+static inline void
+lane_writer_done(drv_ssd *ssd, ssd_write_buf *swb)
+{
+	uint64_t state = __atomic_sub_fetch(&swb->state, SWB_WRITER,
+			__ATOMIC_ACQ_REL);
+
+	if ((state & (SWB_OPEN | SWB_WRITERS_MASK)) == 0) {
+		swb_enqueue(ssd, swb, (uint32_t)(state & SWB_POS_MASK));
+	}
+}
+
+// Replace the lane's swb if it's still the (closed) one the caller saw. The
+// lane's hold on the old swb is released only by the thread that replaces it.
+static bool
+lane_rotate(drv_ssd *ssd, ssd_write_lane *lane, ssd_write_buf *old_swb)
+{
+	pthread_mutex_lock(&lane->lock);
+
+	if (lane->swb != old_swb || (old_swb &&
+			(__atomic_load_n(&old_swb->state, __ATOMIC_ACQUIRE) &
+					SWB_OPEN) != 0)) {
+		// Someone else got here first, or the swb was reopened after a timed
+		// flush - caller should retry.
+		pthread_mutex_unlock(&lane->lock);
+		return true;
+	}
+
+	ssd_write_buf *swb = swb_get(ssd);
+
+	if (swb) {
+		// Open the swb, counting the lane as a writer, only after swb_get() is
+		// done setting it up.
+		__atomic_store_n(&swb->state, SWB_OPEN | SWB_WRITER, __ATOMIC_RELEASE);
+	}
+
+	__atomic_store_n(&lane->swb, swb, __ATOMIC_RELEASE);
+	lane->flush_pos = 0;
+
+	pthread_mutex_unlock(&lane->lock);
+
+	if (old_swb) {
+		lane_writer_done(ssd, old_swb);
+	}
+
+	return swb != NULL;
+}
+
+// Reserve write_size bytes in the lane's swb. On success, the caller is counted
+// as a writer of *p_swb and must call lane_writer_done() when finished.
+static bool
+lane_reserve(drv_ssd *ssd, uint32_t write_size, ssd_write_buf **p_swb,
+		uint32_t *p_pos)
+{
+	ssd_write_lane *lane = lane_get(ssd);
+
+	while (true) {
+		ssd_write_buf *swb = __atomic_load_n(&lane->swb, __ATOMIC_ACQUIRE);
+
+		if (! swb) {
+			if (! lane_rotate(ssd, lane, NULL)) {
+				return false;
+			}
+
+			continue;
+		}
+
+		uint64_t state = __atomic_load_n(&swb->state, __ATOMIC_ACQUIRE);
+
+		while ((state & SWB_OPEN) != 0) {
+			uint32_t pos = (uint32_t)(state & SWB_POS_MASK);
+			uint64_t new_state;
+
+			// If there's not enough space, close the swb - we'll replace it.
+			new_state = write_size > ssd->write_block_size - pos ?
+					state & ~SWB_OPEN : state + SWB_WRITER + write_size;
+
+			if (__atomic_compare_exchange_n(&swb->state, &state, new_state,
+					false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				if ((new_state & SWB_OPEN) != 0) {
+					*p_swb = swb;
+					*p_pos = pos;
+					return true;
+				}
+
+				break;
+			}
+			// else - state was reloaded, try again.
+		}
+
+		if (! lane_rotate(ssd, lane, swb)) {
+			return false;
+		}
+	}
+}
+
+//
+// END - Write lane methods.
+//------------------------------------------------
+
+
 // Reduce wblock's used size, if result is 0 put it in the "free" pool, if it's
 // below the defrag threshold put it in the defrag queue.
 void
@@ -519,6 +667,53 @@ is_valid_record(const drv_ssd_block* block, const char* ns_name)
 }
 
 
+// Copy a record's device image as-is into the defrag swb - only its location
+// changes. Caller must hold the record lock.
+static bool
+ssd_defrag_move(drv_ssd *ssd, as_index *r, const drv_ssd_block *block,
+		uint32_t n_rblocks)
+{
+	uint32_t write_size = (uint32_t)RBLOCKS_TO_BYTES(n_rblocks);
+	ssd_write_buf *swb = ssd->defrag_swb;
+	uint32_t pos = swb ? swb_pos(swb) : 0;
+
+	if (! swb || write_size > ssd->write_block_size - pos) {
+		if (swb) {
+			swb_enqueue(ssd, swb, pos);
+		}
+
+		swb = swb_get(ssd);
+		ssd->defrag_swb = swb;
+		ssd->defrag_flush_pos = 0;
+
+		if (! swb) {
+			cf_warning(AS_DRV_SSD, "device %s: defrag couldn't get swb",
+					ssd->name);
+			return false;
+		}
+
+		pos = 0;
+	}
+
+	memcpy(&swb->buf[pos], block, write_size);
+	__atomic_store_n(&swb->state, (uint64_t)(pos + write_size),
+			__ATOMIC_RELEASE);
+
+	uint64_t old_rblock_id = r->storage_key.ssd.rblock_id;
+	uint32_t old_n_rblocks = r->storage_key.ssd.n_rblocks;
+
+	r->storage_key.ssd.rblock_id = BYTES_TO_RBLOCKS(WBLOCK_ID_TO_BYTES(ssd, swb->wblock_id) + pos);
+	r->storage_key.ssd.n_rblocks = n_rblocks;
+
+	cf_atomic64_add(&ssd->inuse_size, (int64_t)write_size);
+	cf_atomic32_add(&ssd->alloc_table->wblock_state[swb->wblock_id].inuse_sz, (int32_t)write_size);
+
+	ssd_block_free(ssd, old_rblock_id, old_n_rblocks, "defrag");
+
+	return true;
+}
+
+
 int
 ssd_record_defrag(drv_ssd *ssd, drv_ssd_block *block, uint64_t rblock_id,
 		uint32_t n_rblocks, uint64_t filepos)
@@ -555,43 +750,62 @@ ssd_record_defrag(drv_ssd *ssd, drv_ssd_block *block, uint64_t rblock_id,
 						ssd->name, rblock_id, r->storage_key.ssd.n_rblocks, n_rblocks);
 			}
 
-			as_storage_rd rd;
-			as_storage_record_open(ns, r, &rd, &block->keyd);
-
 			as_index_vinfo_mask_set(r,
 					as_partition_vinfoset_mask_unpickle(rsv.p,
 							block->data + block->vinfo_offset,
 							block->vinfo_length),
 					ns->allow_versions);
 
-			rd.u.ssd.block = block;
-			rd.have_device_block = true;
+			drv_ssds *ssds = (drv_ssds*)ns->storage_private;
+			uint64_t start_ns = g_config.microbenchmarks ? cf_getns() : 0;
 
-			rd.n_bins = as_bin_get_n_bins(r, &rd);
-			as_bin stack_bins[rd.ns->storage_data_in_memory ? 0 : rd.n_bins];
+			if (ssd_get_file_id(ssds, &block->keyd) == ssd->file_id) {
+				if (ssds->cache) {
+					ssd_cache_remove(ssds->cache, &block->keyd);
+				}
 
-			rd.bins = as_bin_get_all(r, &rd, stack_bins);
+				// The common case - no need to unpack and re-flatten.
+				rv = ssd_defrag_move(ssd, r, block, n_rblocks) ? 0 : -4;
+			}
+			else {
+				// Record belongs on another device (e.g. one was added) -
+				// rewrite it through the normal write path.
+				as_storage_rd rd;
+				as_storage_record_open(ns, r, &rd, &block->keyd);
 
-			as_storage_record_get_key(&rd);
+				rd.u.ssd.block = block;
+				rd.have_device_block = true;
 
-			size_t rec_props_data_size = as_storage_record_rec_props_size(&rd);
-			uint8_t rec_props_data[rec_props_data_size];
+				rd.n_bins = as_bin_get_n_bins(r, &rd);
+				as_bin stack_bins[rd.ns->storage_data_in_memory ? 0 : rd.n_bins];
 
-			if (rec_props_data_size > 0) {
-				as_storage_record_set_rec_props(&rd, rec_props_data);
-			}
+				rd.bins = as_bin_get_all(r, &rd, stack_bins);
 
-			rd.write_to_device = true;
+				as_storage_record_get_key(&rd);
 
-			uint64_t start_ns = g_config.microbenchmarks ? cf_getns() : 0;
+				size_t rec_props_data_size = as_storage_record_rec_props_size(&rd);
+				uint8_t rec_props_data[rec_props_data_size];
 
-			as_storage_record_close(r, &rd);
+				if (rec_props_data_size > 0) {
+					as_storage_record_set_rec_props(&rd, rec_props_data);
+				}
+
+				rd.write_to_device = true;
+
+				as_storage_record_close(r, &rd);
+
+				rv = 0;
+			}
 
 			if (start_ns != 0) {
 				histogram_insert_data_point(g_config.defrag_storage_close_hist, start_ns);
 			}
 
-			rv = 0; // record was in index tree and current - moved it
+			if (rv == 0) {
+				// Record was in index tree and current - moved it.
+				cf_atomic64_add(&ns->defrag_write_bytes,
+						(int64_t)RBLOCKS_TO_BYTES(n_rblocks));
+			}
 		}
 		else {
 			rv = -1; // record was in index tree - presumably was overwritten
@@ -610,59 +824,320 @@ ssd_record_defrag(drv_ssd *ssd, drv_ssd_block *block, uint64_t rblock_id,
 }
 
 
-int
-ssd_defrag_wblock(drv_ssd *ssd, uint32_t wblock_id, uint8_t *read_buf)
+//------------------------------------------------
+// Defrag pipeline - a read thread per device reads
+// batches of wblocks ahead of the defrag thread,
+// emptiest wblocks first.
+//
+
+#define DEFRAG_N_BUCKETS		100	// wblocks are bucketed by percent in use
+#define DEFRAG_READ_DEPTH		4	// max wblocks read ahead of defrag
+#define DEFRAG_IDLE_FLUSH_MS	100	// flush defrag swb after being idle this long
+
+// A wblock read ahead of defrag.
+typedef struct defrag_read_s {
+	drv_ssd					*ssd;
+	ssd_defrag_entry		entry;
+	uint8_t					*buf;
+	int32_t					res;	// bytes read, 0 if not read, or -errno
+	struct defrag_batch_s	*batch;
+#ifdef USE_URING
+	cf_uring_op				op;
+#endif
+} defrag_read;
+
+// Reads submitted together, waited for together.
+typedef struct defrag_batch_s {
+	pthread_mutex_t			lock;
+	pthread_cond_t			cond;
+	uint32_t				n_pending;
+} defrag_batch;
+
+// Queued wblocks of similar emptiness, oldest first.
+typedef struct defrag_bucket_s {
+	uint32_t				head;
+	uint32_t				tail;
+	uint32_t				capacity;
+	ssd_defrag_entry		*entries;
+} defrag_bucket;
+
+static void
+defrag_bucket_push(defrag_bucket *bucket, const ssd_defrag_entry *entry)
 {
-	if (! as_storage_has_space_ssd(ssd->ns)) {
-		cf_warning(AS_DRV_SSD, "{%s}: defrag: drives full", ssd->ns->name);
-		return 0;
+	if (bucket->tail == bucket->capacity) {
+		if (bucket->head != 0) {
+			bucket->tail -= bucket->head;
+			memmove(bucket->entries, &bucket->entries[bucket->head],
+					bucket->tail * sizeof(ssd_defrag_entry));
+			bucket->head = 0;
+		}
+		else {
+			bucket->capacity = bucket->capacity == 0 ?
+					1024 : bucket->capacity << 1;
+			bucket->entries = cf_realloc(bucket->entries,
+					bucket->capacity * sizeof(ssd_defrag_entry));
+
+			if (! bucket->entries) {
+				cf_crash(AS_DRV_SSD, "defrag bucket realloc failed");
+			}
+		}
+	}
+
+	bucket->entries[bucket->tail++] = *entry;
+}
+
+static bool
+defrag_bucket_pop(defrag_bucket *bucket, ssd_defrag_entry *entry)
+{
+	if (bucket->head == bucket->tail) {
+		return false;
+	}
+
+	*entry = bucket->entries[bucket->head++];
+
+	if (bucket->head == bucket->tail) {
+		bucket->head = 0;
+		bucket->tail = 0;
+	}
+
+	return true;
+}
+
+// Move everything on the defrag queue into buckets. If wait is set and there's
+// nothing to move, wait for something.
+static uint32_t
+defrag_buckets_fill(drv_ssd *ssd, defrag_bucket buckets[], bool wait)
+{
+	uint32_t n_added = 0;
+	ssd_defrag_entry entry;
+
+	while (CF_QUEUE_OK == cf_queue_pop(ssd->defrag_wblock_q, &entry,
+			wait && n_added == 0 ? CF_QUEUE_FOREVER : CF_QUEUE_NOWAIT)) {
+		uint32_t inuse_sz = cf_atomic32_get(
+				ssd->alloc_table->wblock_state[entry.wblock_id].inuse_sz);
+		uint64_t ix = ((uint64_t)inuse_sz * DEFRAG_N_BUCKETS) /
+				ssd->write_block_size;
+
+		defrag_bucket_push(&buckets[ix < DEFRAG_N_BUCKETS ?
+				ix : DEFRAG_N_BUCKETS - 1], &entry);
+		n_added++;
+	}
+
+	return n_added;
+}
+
+// Note - a wblock's in-use size only goes down while it's queued for defrag, so
+// it can't belong in a fuller bucket than the one it was put in.
+static void
+defrag_buckets_pop(defrag_bucket buckets[], ssd_defrag_entry *entry)
+{
+	for (uint32_t i = 0; i < DEFRAG_N_BUCKETS; i++) {
+		if (defrag_bucket_pop(&buckets[i], entry)) {
+			return;
+		}
+	}
+
+	cf_crash(AS_DRV_SSD, "defrag buckets unexpectedly empty");
+}
+
+static uint32_t
+defrag_buckets_oldest(defrag_bucket buckets[], uint32_t now)
+{
+	uint32_t oldest = now;
+
+	for (uint32_t i = 0; i < DEFRAG_N_BUCKETS; i++) {
+		defrag_bucket *bucket = &buckets[i];
+
+		if (bucket->head != bucket->tail &&
+				bucket->entries[bucket->head].enq_sec < oldest) {
+			oldest = bucket->entries[bucket->head].enq_sec;
+		}
 	}
 
+	return oldest;
+}
+
+static void
+defrag_read_done(defrag_read *read, int32_t res)
+{
+	defrag_batch *batch = read->batch;
+
+	read->res = res;
+
+	pthread_mutex_lock(&batch->lock);
+
+	if (--batch->n_pending == 0) {
+		pthread_cond_signal(&batch->cond);
+	}
+
+	pthread_mutex_unlock(&batch->lock);
+}
+
+#ifdef USE_URING
+
+// io_uring completion callback for defrag reads - runs on the reaper thread.
+static void
+defrag_read_uring_done(cf_uring_op *op, int32_t res)
+{
+	defrag_read *read = (defrag_read*)op->udata;
+
+	if (op->start_ns != 0) {
+		histogram_insert_data_point(read->ssd->hist_large_block_read,
+				op->start_ns);
+	}
+
+	defrag_read_done(read, res);
+}
+
+#endif // USE_URING
+
+// Read a batch of wblocks - concurrently if the device uses io_uring.
+static void
+defrag_read_batch(drv_ssd *ssd, defrag_read *reads[], uint32_t n_reads,
+		defrag_batch *batch)
+{
+	int fd = ssd_fd_get(ssd);
+
+	for (uint32_t i = 0; i < n_reads; i++) {
+		defrag_read *read = reads[i];
+		uint32_t wblock_id = read->entry.wblock_id;
+
+		read->res = 0;
+		read->batch = batch;
+
+		// Empty wblocks just need to be freed.
+		if (cf_atomic32_get(ssd->alloc_table->wblock_state[wblock_id].inuse_sz)
+				== 0) {
+			continue;
+		}
+
+		uint64_t file_offset = WBLOCK_ID_TO_BYTES(ssd, wblock_id);
+
+		pthread_mutex_lock(&batch->lock);
+		batch->n_pending++;
+		pthread_mutex_unlock(&batch->lock);
+
+#ifdef USE_URING
+		if (ssd->uring) {
+			read->op.done_fn = defrag_read_uring_done;
+			read->op.udata = read;
+			read->op.start_ns = g_config.storage_benchmarks ? cf_getns() : 0;
+
+			cf_uring_submit_read(ssd->uring, ssd->uring_fd, read->buf,
+					ssd->write_block_size, file_offset, &read->op);
+			continue;
+		}
+#endif
+
+		uint64_t start_ns = g_config.storage_benchmarks ? cf_getns() : 0;
+		ssize_t rlen = pread(fd, read->buf, ssd->write_block_size,
+				(off_t)file_offset);
+
+		if (start_ns != 0) {
+			histogram_insert_data_point(ssd->hist_large_block_read, start_ns);
+		}
+
+		defrag_read_done(read, rlen < 0 ? -errno : (int32_t)rlen);
+	}
+
+	ssd_fd_put(ssd, fd);
+
+	pthread_mutex_lock(&batch->lock);
+
+	while (batch->n_pending != 0) {
+		pthread_cond_wait(&batch->cond, &batch->lock);
+	}
+
+	pthread_mutex_unlock(&batch->lock);
+}
+
+// Thread "run" function to read wblocks ahead of a device's defrag thread.
+void*
+run_defrag_read(void *pv_data)
+{
+	drv_ssd *ssd = (drv_ssd*)pv_data;
+	defrag_bucket buckets[DEFRAG_N_BUCKETS];
+	uint32_t n_bucketed = 0;
+	defrag_batch batch;
+
+	memset(buckets, 0, sizeof(buckets));
+
+	pthread_mutex_init(&batch.lock, NULL);
+	pthread_cond_init(&batch.cond, NULL);
+	batch.n_pending = 0;
+
+	while (true) {
+		defrag_read *reads[DEFRAG_READ_DEPTH];
+		uint32_t n_reads = 0;
+
+		// Don't get too far ahead of defrag.
+		cf_queue_pop(ssd->defrag_slot_q, &reads[n_reads++], CF_QUEUE_FOREVER);
+
+		n_bucketed += defrag_buckets_fill(ssd, buckets, n_bucketed == 0);
+
+		while (n_reads < DEFRAG_READ_DEPTH && n_reads < n_bucketed &&
+				CF_QUEUE_OK == cf_queue_pop(ssd->defrag_slot_q,
+						&reads[n_reads], CF_QUEUE_NOWAIT)) {
+			n_reads++;
+		}
+
+		for (uint32_t i = 0; i < n_reads; i++) {
+			defrag_buckets_pop(buckets, &reads[i]->entry);
+		}
+
+		n_bucketed -= n_reads;
+
+		uint32_t now = (uint32_t)cf_get_seconds();
+
+		cf_atomic32_set(&ssd->defrag_backlog_age,
+				now - defrag_buckets_oldest(buckets, now));
+
+		defrag_read_batch(ssd, reads, n_reads, &batch);
+
+		for (uint32_t i = 0; i < n_reads; i++) {
+			cf_queue_push(ssd->defrag_read_q, &reads[i]);
+		}
+	}
+
+	// Although we ever expect to get here...
+	return NULL;
+}
+
+
+int
+ssd_defrag_wblock(drv_ssd *ssd, defrag_read *read)
+{
+	uint32_t wblock_id = read->entry.wblock_id;
+	uint8_t *read_buf = read->buf;
+
 	int record_count = 0;
 	int num_old_records = 0;
 	int num_deleted_records = 0;
 	int record_err_count = 0;
-	int fd = -1;
 
 	ssd_wblock_state* p_wblock_state = &ssd->alloc_table->wblock_state[wblock_id];
 
-	if (cf_atomic32_get(p_wblock_state->inuse_sz) == 0) {
+	// Nowhere to move records - skip the wblock but still release it below, so
+	// it's counted done, freed if empty, and re-queued as its records go away.
+	if (! as_storage_has_space_ssd(ssd->ns)) {
+		cf_warning(AS_DRV_SSD, "{%s}: defrag: drives full", ssd->ns->name);
 		goto Finished;
 	}
 
-	fd = ssd_fd_get(ssd);
-
-	if (-1 == fd) {
-		cf_warning(AS_DRV_SSD, "defrag: unable to get file descriptor for device %s errno %d",
-				ssd->name, errno);
+	if (read->res == 0 || cf_atomic32_get(p_wblock_state->inuse_sz) == 0) {
 		goto Finished;
 	}
 
 	uint64_t file_offset = WBLOCK_ID_TO_BYTES(ssd, wblock_id);
 
-	uint64_t start_ns = g_config.storage_benchmarks ? cf_getns() : 0;
-
-	if (lseek(fd, (off_t)file_offset, SEEK_SET) != (off_t)file_offset) {
-		cf_warning(AS_DRV_SSD, "DEVICE FAILED: device %s can't seek errno %d",
-				ssd->name, errno);
-		close(fd);
-		fd = -1;
-		goto Finished;
-	}
-
-	ssize_t rlen = read(fd, read_buf, ssd->write_block_size);
-
-	if (rlen != ssd->write_block_size) {
-		cf_info(AS_DRV_SSD, "defrag read failed: offset %"PRIu64" errno %d rv %zd",
-				file_offset, errno, rlen);
-		close(fd);
-		fd = -1;
+	if (read->res != (int32_t)ssd->write_block_size) {
+		cf_info(AS_DRV_SSD, "defrag read failed: offset %"PRIu64" rv %d",
+				file_offset, read->res);
 		goto Finished;
 	}
 
-	if (start_ns != 0) {
-		histogram_insert_data_point(ssd->hist_large_block_read, start_ns);
-	}
+	cf_atomic64_add(&ssd->ns->defrag_read_bytes,
+			(int64_t)ssd->write_block_size);
 
 	size_t wblock_offset = 0; // current offset within the wblock, in bytes
 
@@ -726,16 +1201,15 @@ ssd_defrag_wblock(drv_ssd *ssd, uint32_t wblock_id, uint8_t *read_buf)
 			cf_atomic_int_incr(&g_config.err_storage_defrag_corrupt_record);
 			record_err_count++;
 		}
+		else if (rv == -4) {
+			record_err_count++;
+		}
 
 		wblock_offset = next_wblock_offset;
 	}
 
 Finished:
 
-	if (fd != -1) {
-		ssd_fd_put(ssd, fd);
-	}
-
 	// Note - usually wblock's inuse_sz is 0 here, but may legitimately be non-0
 	// e.g. if a dropped partition's tree is not done purging. In this case, we
 	// may have found deleted records in the wblock whose used-size contribution
@@ -775,32 +1249,69 @@ Finished:
 
 	pthread_mutex_unlock(&p_wblock_state->LOCK);
 
+	cf_atomic_int_incr(&ssd->defrag_done_counter);
+
 	return record_count;
 }
 
 
+// Flush the defrag swb if defrag has moved records into it since it was last
+// flushed - it stays open for more. Caller must hold defrag_lock.
+static void
+ssd_defrag_swb_flush(drv_ssd *ssd)
+{
+	ssd_write_buf *swb = ssd->defrag_swb;
+
+	if (! swb) {
+		return;
+	}
+
+	uint32_t pos = swb_pos(swb);
+
+	if (pos == ssd->defrag_flush_pos) {
+		return;
+	}
+
+	ssd->defrag_flush_pos = pos;
+
+	// Clean the end of the buffer before flushing.
+	if (ssd->write_block_size != pos) {
+		memset(&swb->buf[pos], 0, ssd->write_block_size - pos);
+	}
+
+	ssd_flush_swb(ssd, swb);
+}
+
+
 // Thread "run" function to service a device's defrag queue.
 void*
 run_defrag(void *pv_data)
 {
 	drv_ssd *ssd = (drv_ssd*)pv_data;
-	uint32_t wblock_id;
-	uint8_t *read_buf = cf_valloc(ssd->write_block_size);
+	defrag_read *read;
 
-	if (! read_buf) {
-		cf_crash(AS_DRV_SSD, "device %s: defrag valloc failed", ssd->name);
-	}
+	while (true) {
+		if (CF_QUEUE_OK != cf_queue_pop(ssd->defrag_read_q, &read,
+				DEFRAG_IDLE_FLUSH_MS)) {
+			// Don't leave moved records only in memory while idle.
+			pthread_mutex_lock(&ssd->defrag_lock);
+			ssd_defrag_swb_flush(ssd);
+			pthread_mutex_unlock(&ssd->defrag_lock);
+			continue;
+		}
+
+		pthread_mutex_lock(&ssd->defrag_lock);
+		ssd_defrag_wblock(ssd, read);
+		pthread_mutex_unlock(&ssd->defrag_lock);
 
-	while (CF_QUEUE_OK ==
-			cf_queue_pop(ssd->defrag_wblock_q, &wblock_id, CF_QUEUE_FOREVER)) {
+		// Every read handed to us goes back to the read-ahead thread once,
+		// whatever ssd_defrag_wblock() made of it.
+		cf_queue_push(ssd->defrag_slot_q, &read);
 
-		ssd_defrag_wblock(ssd, wblock_id, read_buf);
 		usleep(ssd->ns->storage_defrag_sleep);
 	}
 
 	// Although we ever expect to get here...
-	cf_free(read_buf);
-
 	return NULL;
 }
 
@@ -813,6 +1324,29 @@ ssd_start_defrag_threads(drv_ssds *ssds)
 	for (int i = 0; i < ssds->n_ssds; i++) {
 		drv_ssd *ssd = &ssds->ssds[i];
 
+		if (! (ssd->defrag_read_q = cf_queue_create(sizeof(void*), true)) ||
+				! (ssd->defrag_slot_q = cf_queue_create(sizeof(void*), true))) {
+			cf_crash(AS_DRV_SSD, "%s defrag read queue create failed",
+					ssd->name);
+		}
+
+		for (uint32_t n = 0; n < DEFRAG_READ_DEPTH; n++) {
+			defrag_read *read = cf_malloc(sizeof(defrag_read));
+
+			if (! read || ! (read->buf = cf_valloc(ssd->write_block_size))) {
+				cf_crash(AS_DRV_SSD, "device %s: defrag valloc failed",
+						ssd->name);
+			}
+
+			read->ssd = ssd;
+			cf_queue_push(ssd->defrag_slot_q, &read);
+		}
+
+		if (pthread_create(&ssd->defrag_read_thread, NULL, run_defrag_read,
+				(void*)ssd) != 0) {
+			cf_crash(AS_DRV_SSD, "%s defrag read thread failed", ssd->name);
+		}
+
 		if (pthread_create(&ssd->defrag_thread, NULL, run_defrag,
 				(void*)ssd) != 0) {
 			cf_crash(AS_DRV_SSD, "%s defrag thread failed", ssd->name);
@@ -820,6 +1354,10 @@ ssd_start_defrag_threads(drv_ssds *ssds)
 	}
 }
 
+//
+// END - Defrag pipeline.
+//------------------------------------------------
+
 
 //------------------------------------------------
 // defrag_pen class.
@@ -871,12 +1409,16 @@ defrag_pen_add(defrag_pen *pen, uint32_t wblock_id)
 static void
 defrag_pen_transfer(defrag_pen *pen, drv_ssd *ssd)
 {
+	ssd_defrag_entry entry = { .enq_sec = (uint32_t)cf_get_seconds() };
+
 	// For speed, "customize" instead of using push_wblock_to_defrag_q()...
 	for (uint32_t i = 0; i < pen->n_ids; i++) {
 		uint32_t wblock_id = pen->ids[i];
 
+		entry.wblock_id = wblock_id;
+
 		ssd->alloc_table->wblock_state[wblock_id].state = WBLOCK_STATE_DEFRAG;
-		cf_queue_push(ssd->defrag_wblock_q, &wblock_id);
+		cf_queue_push(ssd->defrag_wblock_q, &entry);
 	}
 }
 
@@ -912,7 +1454,7 @@ run_load_queues(void *pv_data)
 		cf_crash(AS_DRV_SSD, "%s free wblock queue create failed", ssd->name);
 	}
 
-	if (! (ssd->defrag_wblock_q = cf_queue_create(sizeof(uint32_t), true))) {
+	if (! (ssd->defrag_wblock_q = cf_queue_create(sizeof(ssd_defrag_entry), true))) {
 		cf_crash(AS_DRV_SSD, "%s defrag queue create failed", ssd->name);
 	}
 
@@ -1070,6 +1612,201 @@ as_storage_record_get_n_bins_ssd(as_storage_rd *rd)
 }
 
 
+// Read from device into an aligned buffer, with a blocking read on a pooled
+// fd. With io-engine uring, client reads normally arrive with their data
+// already prefetched, and only fall back to this if the record moved since.
+static int
+ssd_read_device(drv_ssd *ssd, uint8_t *read_buf, size_t read_size,
+		uint64_t read_offset)
+{
+	int fd = ssd_fd_get(ssd);
+
+	uint64_t start_ns = g_config.storage_benchmarks ? cf_getns() : 0;
+
+	lseek(fd, (off_t)read_offset, SEEK_SET);
+
+	ssize_t rv = read(fd, read_buf, read_size);
+
+	if (start_ns != 0) {
+		histogram_insert_data_point(ssd->hist_read, start_ns);
+	}
+
+	if (rv != read_size) {
+		cf_warning(AS_DRV_SSD,"read failed: expected %d got %d: fd %d data %p errno %d",
+				read_size, rv, fd, read_buf, errno);
+		close(fd);
+		return -1;
+	}
+
+	ssd_fd_put(ssd, fd);
+
+	return 0;
+}
+
+
+//------------------------------------------------
+// Record prefetch - with io-engine uring, a transaction thread submits the
+// record's device read and parks the transaction. The completion callback
+// re-queues it with the data, so transaction threads never wait on the device.
+//
+
+struct as_storage_prefetch_s {
+#ifdef USE_URING
+	cf_uring_op				op;
+#endif
+	drv_ssd					*ssd;
+	cf_digest				keyd;
+	uint32_t				generation;
+	uint64_t				rblock_id;
+	uint64_t				read_offset;
+	uint32_t				read_size;
+	int32_t					res;		// bytes read, or negative errno
+	uint8_t					*buf;		// NULL once claimed
+	as_storage_prefetch_fn	cb;
+	void					*udata;
+};
+
+// The prefetch brought by the transaction this thread is running, if any.
+static __thread as_storage_prefetch *g_prefetch = NULL;
+
+#ifdef USE_URING
+
+// io_uring completion callback for prefetches - runs on the reaper thread.
+static void
+ssd_prefetch_done(cf_uring_op *op, int32_t res)
+{
+	as_storage_prefetch *pf = (as_storage_prefetch*)op->udata;
+
+	if (op->start_ns != 0) {
+		histogram_insert_data_point(pf->ssd->hist_read, op->start_ns);
+	}
+
+	pf->res = res;
+	pf->cb(pf, pf->udata);
+}
+
+#endif // USE_URING
+
+
+bool
+as_storage_record_prefetch_ssd(as_namespace *ns, as_record *r,
+		as_storage_prefetch_fn cb, void *udata)
+{
+#ifdef USE_URING
+	drv_ssds *ssds = (drv_ssds*)ns->storage_private;
+
+	// The record may not be locked - its location is only a hint here, it's
+	// checked again when the prefetch is claimed.
+	uint64_t rblock_id = r->storage_key.ssd.rblock_id;
+	uint32_t n_rblocks = r->storage_key.ssd.n_rblocks;
+	uint32_t file_id = r->storage_key.ssd.file_id;
+
+	if (STORAGE_RBLOCK_IS_INVALID(rblock_id) || file_id >= (uint32_t)ssds->n_ssds) {
+		return false;
+	}
+
+	drv_ssd *ssd = &ssds->ssds[file_id];
+
+	if (! ssd->uring) {
+		return false;
+	}
+
+	uint32_t wblock = RBLOCK_ID_TO_WBLOCK_ID(ssd, rblock_id);
+
+	// Records in a write buffer are read from memory - no I/O to get ahead of.
+	if (wblock >= ssd->alloc_table->n_wblocks ||
+			ssd->alloc_table->wblock_state[wblock].swb) {
+		return false;
+	}
+
+	uint64_t record_offset = RBLOCKS_TO_BYTES(rblock_id);
+	uint64_t record_end_offset = record_offset + RBLOCKS_TO_BYTES(n_rblocks);
+	uint64_t read_offset = BYTES_DOWN_TO_SYS_RBLOCK_BYTES(record_offset);
+	uint64_t read_end_offset = BYTES_UP_TO_SYS_RBLOCK_BYTES(record_end_offset);
+
+	as_storage_prefetch *pf = cf_malloc(sizeof(as_storage_prefetch));
+
+	if (! pf) {
+		return false;
+	}
+
+	pf->read_size = (uint32_t)(read_end_offset - read_offset);
+
+	if (! (pf->buf = cf_valloc(pf->read_size))) {
+		cf_free(pf);
+		return false;
+	}
+
+	pf->ssd = ssd;
+	pf->keyd = r->key;
+	pf->generation = r->generation;
+	pf->rblock_id = rblock_id;
+	pf->read_offset = read_offset;
+	pf->res = 0;
+	pf->cb = cb;
+	pf->udata = udata;
+
+	pf->op.done_fn = ssd_prefetch_done;
+	pf->op.udata = pf;
+	pf->op.start_ns = g_config.storage_benchmarks ? cf_getns() : 0;
+
+	cf_uring_submit_read(ssd->uring, ssd->uring_fd, pf->buf, pf->read_size,
+			read_offset, &pf->op);
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+
+void
+as_storage_prefetch_attach_ssd(as_storage_prefetch *pf)
+{
+	g_prefetch = pf;
+}
+
+
+void
+as_storage_prefetch_destroy_ssd(as_storage_prefetch *pf)
+{
+	if (g_prefetch == pf) {
+		g_prefetch = NULL;
+	}
+
+	if (pf->buf) {
+		cf_free(pf->buf);
+	}
+
+	cf_free(pf);
+}
+
+
+// Take the attached prefetch's buffer if it holds this read - the record must
+// not have moved or changed since the prefetch was submitted.
+static uint8_t *
+ssd_prefetch_claim(drv_ssd *ssd, as_record *r, cf_digest *keyd,
+		uint64_t read_offset, size_t read_size)
+{
+	as_storage_prefetch *pf = g_prefetch;
+
+	if (! pf || ! pf->buf || pf->ssd != ssd ||
+			pf->rblock_id != r->storage_key.ssd.rblock_id ||
+			pf->generation != r->generation ||
+			pf->read_offset != read_offset ||
+			pf->res != (int32_t)read_size ||
+			0 != cf_digest_compare(&pf->keyd, keyd)) {
+		return NULL;
+	}
+
+	uint8_t *buf = pf->buf;
+
+	pf->buf = NULL;
+
+	return buf;
+}
+
+
 int
 as_storage_record_read_ssd(as_storage_rd *rd)
 {
@@ -1087,6 +1824,7 @@ as_storage_record_read_ssd(as_storage_rd *rd)
 	uint8_t *read_buf = NULL;
 	drv_ssd_block *block = NULL;
 
+	drv_ssds *ssds = (drv_ssds*)rd->ns->storage_private;
 	drv_ssd *ssd = rd->u.ssd.ssd;
 	ssd_write_buf *swb = 0;
 	uint32_t wblock = RBLOCK_ID_TO_WBLOCK_ID(ssd, r->storage_key.ssd.rblock_id);
@@ -1109,6 +1847,14 @@ as_storage_record_read_ssd(as_storage_rd *rd)
 		memcpy(read_buf, swb->buf + swb_offset, record_size);
 		swb_release(swb);
 	}
+	else if (ssds->cache && (read_buf = ssd_cache_get(ssds->cache, &rd->keyd,
+			r->generation, r->storage_key.ssd.file_id,
+			r->storage_key.ssd.rblock_id, (uint32_t)record_size)) != NULL) {
+		// Data is in record cache.
+		cf_atomic32_incr(&rd->ns->n_reads_from_cache);
+
+		block = (drv_ssd_block*)read_buf;
+	}
 	else {
 		// Normal case - data is read from device.
 		cf_atomic32_incr(&rd->ns->n_reads_from_device);
@@ -1119,34 +1865,22 @@ as_storage_record_read_ssd(as_storage_rd *rd)
 		size_t read_size = read_end_offset - read_offset;
 		uint64_t record_buf_indent = record_offset - read_offset;
 
-		read_buf = cf_valloc(read_size);
+		read_buf = ssd_prefetch_claim(ssd, r, &rd->keyd, read_offset,
+				read_size);
 
 		if (! read_buf) {
-			return -1;
-		}
-
-		int fd = ssd_fd_get(ssd);
-
-		uint64_t start_ns = g_config.storage_benchmarks ? cf_getns() : 0;
-
-		lseek(fd, (off_t)read_offset, SEEK_SET);
+			read_buf = cf_valloc(read_size);
 
-		ssize_t rv = read(fd, read_buf, read_size);
-
-		if (start_ns != 0) {
-			histogram_insert_data_point(ssd->hist_read, start_ns);
-		}
+			if (! read_buf) {
+				return -1;
+			}
 
-		if (rv != read_size) {
-			cf_warning(AS_DRV_SSD,"read failed: expected %d got %d: fd %d data %p errno %d",
-					read_size, rv, fd, read_buf, errno);
-			cf_free(read_buf);
-			close(fd);
-			return -1;
+			if (0 != ssd_read_device(ssd, read_buf, read_size, read_offset)) {
+				cf_free(read_buf);
+				return -1;
+			}
 		}
 
-		ssd_fd_put(ssd, fd);
-
 		block = (drv_ssd_block*)(read_buf + record_buf_indent);
 
 		// Sanity checks.
@@ -1162,6 +1896,12 @@ as_storage_record_read_ssd(as_storage_rd *rd)
 			cf_free(read_buf);
 			return -1;
 		}
+
+		if (ssds->cache) {
+			ssd_cache_put(ssds->cache, &rd->keyd, r->generation,
+					r->storage_key.ssd.file_id, r->storage_key.ssd.rblock_id,
+					(uint8_t*)block, (uint32_t)record_size);
+		}
 	}
 
 	rd->u.ssd.block = block;
@@ -1561,6 +2301,8 @@ as_write_smoothing_fn(as_write_smoothing_arg *awsa)
 void
 ssd_flush_swb(drv_ssd *ssd, ssd_write_buf *swb)
 {
+	ssd_snapshot_journal_sync(ssd, swb->journal_seq);
+
 	int fd = ssd_fd_get(ssd);
 	off_t write_offset = (off_t)WBLOCK_ID_TO_BYTES(ssd, swb->wblock_id);
 
@@ -1586,6 +2328,111 @@ ssd_flush_swb(drv_ssd *ssd, ssd_write_buf *swb)
 }
 
 
+// Release a flushed swb, or hold it in the post-write queue as a read cache.
+static void
+ssd_post_write(drv_ssd *ssd, ssd_write_buf *swb)
+{
+	if (cf_atomic32_get(ssd->ns->storage_post_write_queue) == 0) {
+		swb_dereference_and_release(ssd, swb->wblock_id, swb);
+	}
+	else {
+		// Transfer swb to post-write queue.
+		cf_queue_push(ssd->post_write_q, &swb);
+	}
+
+	if (ssd->post_write_q) {
+		// Release post-write queue swbs if we're over the limit.
+		while ((uint32_t)cf_queue_sz(ssd->post_write_q) >
+				cf_atomic32_get(ssd->ns->storage_post_write_queue)) {
+			ssd_write_buf* cached_swb;
+
+			if (CF_QUEUE_OK != cf_queue_pop(ssd->post_write_q, &cached_swb,
+					CF_QUEUE_NOWAIT)) {
+				// Should never happen.
+				cf_warning(AS_DRV_SSD, "device %s: post-write queue pop failed",
+						ssd->name);
+				break;
+			}
+
+			swb_dereference_and_release(ssd, cached_swb->wblock_id,
+					cached_swb);
+		}
+	}
+}
+
+
+#ifdef USE_URING
+
+// io_uring completion callback for swb flushes - runs on the reaper thread.
+static void
+ssd_flush_swb_done(cf_uring_op *op, int32_t res)
+{
+	ssd_write_buf *swb = (ssd_write_buf*)op->udata;
+	drv_ssd *ssd = swb->ssd;
+
+	if (op->start_ns != 0) {
+		histogram_insert_data_point(ssd->hist_write, op->start_ns);
+	}
+
+	if (res != (int32_t)ssd->write_block_size) {
+		cf_crash(AS_DRV_SSD, "%s: DEVICE FAILED: can't write res %d (%s)",
+				ssd->name, res, res < 0 ? cf_strerror(-res) : "short write");
+	}
+
+	ssd_post_write(ssd, swb);
+}
+
+
+// Submit an swb flush to the io_uring engine - doesn't wait for completion.
+static void
+ssd_flush_swb_async(drv_ssd *ssd, ssd_write_buf *swb)
+{
+	ssd_snapshot_journal_sync(ssd, swb->journal_seq);
+
+	swb->flush_op.done_fn = ssd_flush_swb_done;
+	swb->flush_op.udata = swb;
+	swb->flush_op.start_ns = g_config.storage_benchmarks ? cf_getns() : 0;
+
+	cf_uring_submit_write(ssd->uring, ssd->uring_fd, swb->buf,
+			ssd->write_block_size, WBLOCK_ID_TO_BYTES(ssd, swb->wblock_id),
+			&swb->flush_op);
+}
+
+
+// Thread "run" function that makes io_uring completion callbacks.
+void *
+run_uring_reaper(void *arg)
+{
+	drv_ssd *ssd = (drv_ssd*)arg;
+
+	while (true) {
+		cf_uring_reap(ssd->uring);
+	}
+
+	return NULL;
+}
+
+
+void
+ssd_start_uring(drv_ssd *ssd)
+{
+	if (! (ssd->uring = cf_uring_create(ssd->ns->storage_io_depth))) {
+		cf_crash(AS_DRV_SSD, "%s: can't create io_uring - kernel may not support io-engine uring",
+				ssd->name);
+	}
+
+	// A dedicated fd - never returned to the fd pool.
+	ssd->uring_fd = ssd_fd_get(ssd);
+
+	pthread_create(&ssd->uring_thread, 0, run_uring_reaper, (void*)ssd);
+
+	cf_info(AS_DRV_SSD, "%s: using io-engine uring, io-depth %u", ssd->name,
+			ssd->ns->storage_io_depth);
+}
+
+#endif // USE_URING
+
+
 // Thread "run" function that flushes write buffers to device.
 void *
 ssd_write_worker(void *arg)
@@ -1616,34 +2463,17 @@ ssd_write_worker(void *arg)
 		}
 
 		// Flush to the device.
-		ssd_flush_swb(ssd, swb);
-
-		if (cf_atomic32_get(ssd->ns->storage_post_write_queue) == 0) {
-			swb_dereference_and_release(ssd, swb->wblock_id, swb);
+#ifdef USE_URING
+		if (ssd->uring) {
+			// Post-write handling is done on completion, by the reaper thread.
+			ssd_flush_swb_async(ssd, swb);
+			as_write_smoothing_fn(&awsa);
+			continue;
 		}
-		else {
-			// Transfer swb to post-write queue.
-			cf_queue_push(ssd->post_write_q, &swb);
-		}
-
-		if (ssd->post_write_q) {
-			// Release post-write queue swbs if we're over the limit.
-			while ((uint32_t)cf_queue_sz(ssd->post_write_q) >
-					cf_atomic32_get(ssd->ns->storage_post_write_queue)) {
-				ssd_write_buf* cached_swb;
-
-				if (CF_QUEUE_OK != cf_queue_pop(ssd->post_write_q, &cached_swb,
-						CF_QUEUE_NOWAIT)) {
-					// Should never happen.
-					cf_warning(AS_DRV_SSD, "device %s: post-write queue pop failed",
-							ssd->name);
-					break;
-				}
+#endif
 
-				swb_dereference_and_release(ssd, cached_swb->wblock_id,
-						cached_swb);
-			}
-		}
+		ssd_flush_swb(ssd, swb);
+		ssd_post_write(ssd, swb);
 
 		as_write_smoothing_fn(&awsa);
 	} // infinite event loop waiting for block to write
@@ -1765,69 +2595,27 @@ ssd_write_calculate_size(as_record *r, as_storage_rd *rd)
 
 int
 ssd_write_bins(as_record *r, as_storage_rd *rd)
-{
-	uint32_t write_size = ssd_write_calculate_size(r, rd);
-	drv_ssd *ssd = rd->u.ssd.ssd;
-
-	if (write_size == 0 || write_size > ssd->write_block_size) {
-		cf_warning(AS_DRV_SSD, "write: rejecting %"PRIx64" write size: %u",
-				*(uint64_t*)&rd->keyd, write_size);
-		return -1;
-	}
-
-	// Reserve the portion of the current swb where this record will be written.
-	pthread_mutex_lock(&ssd->LOCK);
-
-	ssd_write_buf *swb = ssd->current_swb;
-
-	if (! swb) {
-		swb = swb_get(ssd);
-		ssd->current_swb = swb;
-
-		if (! swb) {
-			cf_warning(AS_DRV_SSD, "write bins: couldn't get swb");
-			pthread_mutex_unlock(&ssd->LOCK);
-			return -1;
-		}
-	}
-
-	// Check if there's enough space in current buffer - if not, free and zero
-	// any remaining unused space, enqueue it to be flushed to device, and grab
-	// a new buffer.
-	if (write_size > ssd->write_block_size - swb->pos) {
-		if (ssd->write_block_size != swb->pos) {
-			// Clean the end of the buffer before pushing to write queue.
-			memset(&swb->buf[swb->pos], 0, ssd->write_block_size - swb->pos);
-		}
-
-		// Wait for all writers to finish.
-		while (cf_atomic32_get(ssd->n_writers) != 0) {
-			;
-		}
-
-		// Enqueue the buffer, to be flushed to device.
-		cf_queue_push(ssd->swb_write_q, &swb);
-		cf_atomic_int_incr(&ssd->ssd_write_buf_counter); // for write smoothing
-
-		// Get the new buffer.
-		swb = swb_get(ssd);
-		ssd->current_swb = swb;
+{
+	uint32_t write_size = ssd_write_calculate_size(r, rd);
+	drv_ssd *ssd = rd->u.ssd.ssd;
 
-		if (! swb) {
-			cf_warning(AS_DRV_SSD, "write bins: couldn't get swb");
-			pthread_mutex_unlock(&ssd->LOCK);
-			return -1;
-		}
+	if (write_size == 0 || write_size > ssd->write_block_size) {
+		cf_warning(AS_DRV_SSD, "write: rejecting %"PRIx64" write size: %u",
+				*(uint64_t*)&rd->keyd, write_size);
+		return -1;
 	}
 
-	// There's enough space - save the position where this record will be
-	// written, and advance swb->pos for the next writer.
-	uint32_t swb_pos = swb->pos;
+	// Reserve the portion of this lane's swb where this record will be written.
+	// If the swb is full, it's enqueued to be flushed to device once its last
+	// writer finishes, and the lane gets a new swb.
+	ssd_write_buf *swb;
+	uint32_t swb_pos;
 
-	swb->pos += write_size;
-	cf_atomic32_incr(&ssd->n_writers);
+	if (! lane_reserve(ssd, write_size, &swb, &swb_pos)) {
+		cf_warning(AS_DRV_SSD, "write bins: couldn't get swb");
+		return -1;
+	}
 
-	pthread_mutex_unlock(&ssd->LOCK);
 	// May now write this record concurrently with others in this swb.
 
 	// Flatten data into the block.
@@ -1872,7 +2660,7 @@ ssd_write_bins(as_record *r, as_storage_rd *rd)
 
 	if (0 == rd->bins) {
 		cf_warning(AS_DRV_SSD, "write bins: no bins array");
-		cf_atomic32_decr(&ssd->n_writers);
+		lane_writer_done(ssd, swb);
 		return -1;
 	}
 
@@ -1948,7 +2736,7 @@ ssd_write_bins(as_record *r, as_storage_rd *rd)
 	cf_atomic32_add(&ssd->alloc_table->wblock_state[swb->wblock_id].inuse_sz, (int32_t)write_size);
 
 	// We are finished writing to the buffer.
-	cf_atomic32_decr(&ssd->n_writers);
+	lane_writer_done(ssd, swb);
 
 	return 0;
 }
@@ -1970,6 +2758,11 @@ ssd_write(as_record *r, as_storage_rd *rd)
 
 	drv_ssds *ssds = (drv_ssds*)rd->ns->storage_private;
 
+	// The cached image (if any) is about to be stale.
+	if (ssds->cache) {
+		ssd_cache_remove(ssds->cache, &rd->keyd);
+	}
+
 	// Figure out which device to write to. When replacing an old record, it's
 	// possible this is different from the old device (e.g. if we've added a
 	// fresh device), so derive it from the digest each time.
@@ -2349,14 +3142,33 @@ ssd_log_stats(drv_ssd *ssd, uint64_t *p_prev_n_writes,
 	float defrag_rate = (float)(n_defrags - *p_prev_n_defrags) /
 			(float)LOG_STATS_INTERVAL_sec;
 
-	cf_info(AS_DRV_SSD, "device %s: used %lu, contig-free %luM (%d wblocks), swb-free %d, n-w %u, w-q %d w-tot %lu (%.1f/s), defrag-q %d defrag-tot %lu (%.1f/s)",
+	uint32_t n_writers = 0;
+
+	for (uint32_t i = 0; i < ssd->n_lanes; i++) {
+		ssd_write_buf *swb = __atomic_load_n(&ssd->lanes[i].swb,
+				__ATOMIC_ACQUIRE);
+
+		if (swb) {
+			uint64_t state = __atomic_load_n(&swb->state, __ATOMIC_RELAXED);
+			uint32_t n_swb_writers = (uint32_t)((state & SWB_WRITERS_MASK) >> 32);
+
+			// Don't count the lane's own hold on the swb.
+			if (n_swb_writers > 1) {
+				n_writers += n_swb_writers - 1;
+			}
+		}
+	}
+
+	cf_info(AS_DRV_SSD, "device %s: used %lu, contig-free %luM (%d wblocks), swb-free %d, n-w %u, w-q %d w-tot %lu (%.1f/s), defrag-q %lu (%us) defrag-tot %lu (%.1f/s)",
 			ssd->name, ssd->inuse_size,
 			available_size(ssd) >> 20,
 			cf_queue_sz(ssd->free_wblock_q),
 			cf_queue_sz(ssd->swb_free_q),
-			cf_atomic32_get(ssd->n_writers),
+			n_writers,
 			cf_queue_sz(ssd->swb_write_q), n_writes, write_rate,
-			cf_queue_sz(ssd->defrag_wblock_q), n_defrags, defrag_rate);
+			n_defrags - cf_atomic_int_get(ssd->defrag_done_counter),
+			cf_atomic32_get(ssd->defrag_backlog_age),
+			n_defrags, defrag_rate);
 
 	*p_prev_n_writes = n_writes;
 	*p_prev_n_defrags = n_defrags;
@@ -2379,63 +3191,73 @@ ssd_free_swbs(drv_ssd *ssd)
 			break;
 		}
 
-		swb_destroy(swb);
+		swb_destroy(ssd, swb);
 	}
 }
 
 
 void
-ssd_flush_current_swb(drv_ssd *ssd, uint64_t *p_prev_n_writes,
-		uint32_t *p_prev_size)
+ssd_flush_current_swbs(drv_ssd *ssd, uint64_t *p_prev_n_writes)
 {
 	uint64_t n_writes = cf_atomic_int_get(ssd->ssd_write_buf_counter);
 
 	// If there's an active write load, we don't need to flush.
 	if (n_writes != *p_prev_n_writes) {
 		*p_prev_n_writes = n_writes;
-		*p_prev_size = 0;
+
+		for (uint32_t i = 0; i < ssd->n_lanes; i++) {
+			ssd->lanes[i].flush_pos = 0;
+		}
+
 		return;
 	}
 
-	pthread_mutex_lock(&ssd->LOCK);
+	for (uint32_t i = 0; i < ssd->n_lanes; i++) {
+		ssd_write_lane *lane = &ssd->lanes[i];
 
-	n_writes = cf_atomic_int_get(ssd->ssd_write_buf_counter);
+		// Holding the lane lock keeps writers from replacing the swb while
+		// it's closed for flushing.
+		pthread_mutex_lock(&lane->lock);
 
-	// Must check under the lock, could be racing a current swb just queued.
-	if (n_writes != *p_prev_n_writes) {
+		ssd_write_buf *swb = lane->swb;
 
-		pthread_mutex_unlock(&ssd->LOCK);
+		if (! swb) {
+			pthread_mutex_unlock(&lane->lock);
+			continue;
+		}
 
-		*p_prev_n_writes = n_writes;
-		*p_prev_size = 0;
-		return;
-	}
+		uint64_t state = __atomic_load_n(&swb->state, __ATOMIC_ACQUIRE);
+		uint32_t pos = (uint32_t)(state & SWB_POS_MASK);
 
-	// Flush the current swb if it isn't empty, and has been written to since
-	// last flushed.
+		// Flush the swb if it isn't empty, has been written to since last
+		// flushed, and has no writers other than the lane. (If it has writers,
+		// it's in use and we'll likely flush it soon anyway.)
+		if (pos == 0 || pos == lane->flush_pos ||
+				(state & SWB_WRITERS_MASK) != SWB_WRITER ||
+				! __atomic_compare_exchange_n(&swb->state, &state,
+						state & ~SWB_OPEN, false, __ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+			pthread_mutex_unlock(&lane->lock);
+			continue;
+		}
 
-	ssd_write_buf *swb = ssd->current_swb;
+		// Closed, and no writers - safe to use the buffer.
 
-	if (swb && swb->pos != *p_prev_size) {
-		*p_prev_size = swb->pos;
+		lane->flush_pos = pos;
 
 		// Clean the end of the buffer before flushing.
-		if (ssd->write_block_size != swb->pos) {
-			memset(&swb->buf[swb->pos], 0, ssd->write_block_size - swb->pos);
-		}
-
-		// Wait for all writers to finish. (Arguably we should bail out instead,
-		// since current writers indicate we might soon flush this buffer, but
-		// let's opt for certainty.)
-		while (cf_atomic32_get(ssd->n_writers) != 0) {
-			;
+		if (ssd->write_block_size != pos) {
+			memset(&swb->buf[pos], 0, ssd->write_block_size - pos);
 		}
 
 		// Flush it.
 		ssd_flush_swb(ssd, swb);
-	}
 
-	pthread_mutex_unlock(&ssd->LOCK);
+		// Reopen it for writers.
+		__atomic_store_n(&swb->state, state, __ATOMIC_RELEASE);
+
+		pthread_mutex_unlock(&lane->lock);
+	}
 }
 
 
@@ -2481,7 +3303,6 @@ run_ssd_maintenance(void *udata)
 	uint64_t prev_n_defrags = 0;
 
 	uint64_t prev_n_writes_flush = 0;
-	uint32_t prev_size_flush = 0;
 
 	uint64_t now = cf_getus();
 	uint64_t next = now + MAX_INTERVAL;
@@ -2518,7 +3339,7 @@ run_ssd_maintenance(void *udata)
 		uint64_t flush_max_us = ns->storage_flush_max_us;
 
 		if (flush_max_us != 0 && now >= prev_flush + flush_max_us) {
-			ssd_flush_current_swb(ssd, &prev_n_writes_flush, &prev_size_flush);
+			ssd_flush_current_swbs(ssd, &prev_n_writes_flush);
 			prev_flush = now;
 			next = next_time(now, flush_max_us, next);
 		}
@@ -2809,7 +3630,7 @@ ssd_record_get_ldt_property(as_rec_props *props, bool *is_ldt_parent,
 //  0 - success, record added or updated
 // -1 - skipped or deleted this record for a "normal" reason
 // -2 - serious limit encountered, caller won't continue
-// -3 - couldn't parse this record, but caller will continue
+// Caller has checked the record with is_valid_record().
 int
 ssd_record_add(drv_ssds* ssds, drv_ssd* ssd, drv_ssd_block* block,
 		uint64_t rblock_id, uint32_t n_rblocks)
@@ -2831,11 +3652,6 @@ ssd_record_add(drv_ssds* ssds, drv_ssd* ssd, drv_ssd_block* block,
 		return -2;
 	}
 
-	// Sanity-check the record.
-	if (! is_valid_record(block, ns->name)) {
-		return -3;
-	}
-
 	// Don't bother with reservations - partition trees aren't going anywhere.
 	as_partition* p_partition = &ns->partitions[pid];
 
@@ -2905,13 +3721,15 @@ ssd_record_add(drv_ssds* ssds, drv_ssd* ssd, drv_ssd_block* block,
 					block->generation, r->generation);
 
 			as_record_done(&r_ref, ns);
-			ssd->record_add_generation_counter++;
+			cf_atomic64_incr(&ssd->record_add_generation_counter);
 			return -1;
 		}
 	}
 	// The record we're now reading is the latest version (so far) ...
 
 	// Set/reset the record's void-time and generation.
+	uint32_t old_void_time = r->void_time;
+
 	r->void_time = block->void_time;
 	r->generation = block->generation;
 
@@ -2931,7 +3749,7 @@ ssd_record_add(drv_ssds* ssds, drv_ssd* ssd, drv_ssd_block* block,
 
 			as_index_delete(p_partition->vp, &block->keyd);
 			as_record_done(&r_ref, ns);
-			ssd->record_add_expired_counter++;
+			cf_atomic64_incr(&ssd->record_add_expired_counter);
 			return -1;
 		}
 
@@ -2946,7 +3764,7 @@ ssd_record_add(drv_ssds* ssds, drv_ssd* ssd, drv_ssd_block* block,
 
 				as_index_delete(p_partition->vp, &block->keyd);
 				as_record_done(&r_ref, ns);
-				ssd->record_add_max_ttl_counter++;
+				cf_atomic64_incr(&ssd->record_add_max_ttl_counter);
 				return -1;
 			}
 		}
@@ -2958,6 +3776,8 @@ ssd_record_add(drv_ssds* ssds, drv_ssd* ssd, drv_ssd_block* block,
 	cf_atomic_int_setmax(&p_partition->max_void_time, r->void_time);
 	cf_atomic_int_setmax(&ns->max_void_time, r->void_time);
 
+	as_partition_expire_index_update(p_partition, &block->keyd, old_void_time, r->void_time);
+
 	if (props.size != 0) {
 		// Do this early since set-id is needed for the secondary index update.
 		as_record_apply_properties(r, ns, &props);
@@ -3183,10 +4003,10 @@ ssd_record_add(drv_ssds* ssds, drv_ssd* ssd, drv_ssd_block* block,
 		ssd_block_free(&ssds->ssds[r->storage_key.ssd.file_id],
 				r->storage_key.ssd.rblock_id, r->storage_key.ssd.n_rblocks,
 				"record-add");
-		ssd->record_add_replace_counter++;
+		cf_atomic64_incr(&ssd->record_add_replace_counter);
 	}
 	else {
-		ssd->record_add_unique_counter++;
+		cf_atomic64_incr(&ssd->record_add_unique_counter);
 	}
 
 	// Update storage accounting to include this record.
@@ -3195,8 +4015,10 @@ ssd_record_add(drv_ssds* ssds, drv_ssd* ssd, drv_ssd_block* block,
 	// TODO - pass in size instead of n_rblocks.
 	uint32_t size = (uint32_t)RBLOCKS_TO_BYTES(n_rblocks);
 
-	ssd->inuse_size += size;
-	ssd->alloc_table->wblock_state[wblock_id].inuse_sz += size;
+	// Records from one device may be added by several cold start workers.
+	cf_atomic64_add(&ssd->inuse_size, (int64_t)size);
+	cf_atomic32_add(&ssd->alloc_table->wblock_state[wblock_id].inuse_sz,
+			(int32_t)size);
 
 	// Set/reset the record's storage information.
 	r->storage_key.ssd.file_id = ssd->file_id;
@@ -3214,14 +4036,423 @@ ssd_record_add(drv_ssds* ssds, drv_ssd* ssd, drv_ssd_block* block,
 }
 
 
+//------------------------------------------------
+// Cold start pipeline - each device has a reader thread which reads large
+// blocks and finds the records in them, and a pool of worker threads (shared
+// by all devices of the namespace) adds the records to the index. Records are
+// sharded to workers by partition, so index tree locks are uncontended, and
+// all versions of a record are judged by the same worker.
+//
+
+// Bounds the memory held by each device's reader.
+#define LOAD_MAX_BUFS_PER_DEVICE	16
+
+typedef struct ssd_load_device_s {
+	drv_ssds		*ssds;
+	drv_ssd			*ssd;
+
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;		// signaled when a buffer is done
+	uint32_t		n_bufs;		// buffers handed to workers, not yet done
+	bool			halt;		// a worker hit a limit - stop reading
+} ssd_load_device;
+
+typedef struct ssd_load_rec_s {
+	uint64_t		rblock_id;
+	uint32_t		offset;		// within buffer
+	uint32_t		n_rblocks;
+	uint32_t		worker_ix;
+} ssd_load_rec;
+
+typedef struct ssd_load_buf_s {
+	ssd_load_device	*ld;
+	uint8_t			*buf;
+	ssd_load_rec	*recs;		// sorted by worker
+	cf_atomic32		n_users;	// workers still using buffer
+} ssd_load_buf;
+
+typedef struct ssd_load_item_s {
+	ssd_load_buf	*lb;		// NULL tells worker to exit
+	ssd_load_rec	*recs;
+	uint32_t		n_recs;
+} ssd_load_item;
+
+typedef struct ssd_load_pool_s {
+	drv_ssds		*ssds;
+	uint32_t		n_workers;
+	cf_queue		**queues;
+	pthread_t		*threads;
+} ssd_load_pool;
+
+typedef struct ssd_load_worker_data_s {
+	drv_ssds		*ssds;
+	cf_queue		*q;
+} ssd_load_worker_data;
+
+
+static void
+ssd_load_buf_release(ssd_load_buf *lb)
+{
+	if (cf_atomic32_decr(&lb->n_users) != 0) {
+		return;
+	}
+
+	ssd_load_device *ld = lb->ld;
+
+	cf_free(lb->recs);
+	cf_free(lb->buf);
+	cf_free(lb);
+
+	pthread_mutex_lock(&ld->lock);
+	ld->n_bufs--;
+	pthread_cond_signal(&ld->cond);
+	pthread_mutex_unlock(&ld->lock);
+}
+
+
+// Thread "run" function to add records found by device readers to the index.
+void *
+ssd_load_worker_fn(void *udata)
+{
+	ssd_load_worker_data *wd = (ssd_load_worker_data*)udata;
+	drv_ssds *ssds = wd->ssds;
+	cf_queue *q = wd->q;
+
+	cf_free(wd);
+
+#ifdef USE_JEM
+	// Allocate long-term storage in this namespace's JEMalloc arena.
+	jem_set_arena(ssds->ns->jem_arena);
+#endif
+
+	while (true) {
+		ssd_load_item item;
+
+		if (CF_QUEUE_OK != cf_queue_pop(q, &item, CF_QUEUE_FOREVER)) {
+			cf_crash(AS_DRV_SSD, "unable to pop from load queue");
+		}
+
+		if (! item.lb) {
+			break;
+		}
+
+		ssd_load_device *ld = item.lb->ld;
+
+		for (uint32_t i = 0; i < item.n_recs && ! ld->halt; i++) {
+			ssd_load_rec *rec = &item.recs[i];
+
+			int add_rv = ssd_record_add(ssds, ld->ssd,
+					(drv_ssd_block*)(item.lb->buf + rec->offset),
+					rec->rblock_id, rec->n_rblocks);
+
+			if (add_rv == -2) {
+				cf_warning(AS_DRV_SSD, "disk restore: hit high water limit before disk entirely loaded.");
+				ld->halt = true;
+			}
+		}
+
+		ssd_load_buf_release(item.lb);
+	}
+
+	return NULL;
+}
+
+
+static ssd_load_pool *
+ssd_load_pool_create(drv_ssds *ssds)
+{
+	ssd_load_pool *pool = cf_malloc(sizeof(ssd_load_pool));
+
+	if (! pool) {
+		cf_crash(AS_DRV_SSD, "memory allocation in device load");
+	}
+
+	uint32_t n_workers = ssds->ns->storage_cold_start_threads;
+
+	if (n_workers == 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		n_workers = n_cpus > 0 ? (uint32_t)n_cpus : 1;
+	}
+
+	pool->ssds = ssds;
+	pool->n_workers = n_workers;
+	pool->queues = cf_malloc(n_workers * sizeof(cf_queue*));
+	pool->threads = cf_malloc(n_workers * sizeof(pthread_t));
+
+	if (! pool->queues || ! pool->threads) {
+		cf_crash(AS_DRV_SSD, "memory allocation in device load");
+	}
+
+	for (uint32_t i = 0; i < n_workers; i++) {
+		ssd_load_worker_data *wd = cf_malloc(sizeof(ssd_load_worker_data));
+
+		if (! wd || ! (pool->queues[i] = cf_queue_create(sizeof(ssd_load_item), true))) {
+			cf_crash(AS_DRV_SSD, "memory allocation in device load");
+		}
+
+		wd->ssds = ssds;
+		wd->q = pool->queues[i];
+
+		if (0 != pthread_create(&pool->threads[i], 0, ssd_load_worker_fn, wd)) {
+			cf_crash(AS_DRV_SSD, "failed to create load worker thread");
+		}
+	}
+
+	cf_info(AS_DRV_SSD, "{%s} loading index with %u worker threads",
+			ssds->ns->name, n_workers);
+
+	return pool;
+}
+
+
+static void
+ssd_load_pool_destroy(ssd_load_pool *pool)
+{
+	ssd_load_item stop = { NULL, NULL, 0 };
+
+	for (uint32_t i = 0; i < pool->n_workers; i++) {
+		cf_queue_push(pool->queues[i], &stop);
+	}
+
+	for (uint32_t i = 0; i < pool->n_workers; i++) {
+		pthread_join(pool->threads[i], NULL);
+		cf_queue_destroy(pool->queues[i]);
+	}
+
+	cf_free(pool->threads);
+	cf_free(pool->queues);
+	cf_free(pool);
+}
+
+
+// Hand a buffer's records to the workers, one item per worker involved.
+static void
+ssd_load_buf_dispatch(ssd_load_pool *pool, ssd_load_buf *lb,
+		ssd_load_rec *found, uint32_t n_found)
+{
+	uint32_t n_workers = pool->n_workers;
+	uint32_t counts[n_workers];
+	uint32_t starts[n_workers];
+	uint32_t n_users = 0;
+
+	memset(counts, 0, sizeof(counts));
+
+	for (uint32_t i = 0; i < n_found; i++) {
+		if (counts[found[i].worker_ix]++ == 0) {
+			n_users++;
+		}
+	}
+
+	// Counting sort by worker.
+	uint32_t start = 0;
+
+	for (uint32_t w = 0; w < n_workers; w++) {
+		starts[w] = start;
+		start += counts[w];
+	}
+
+	for (uint32_t i = 0; i < n_found; i++) {
+		lb->recs[starts[found[i].worker_ix]++] = found[i];
+	}
+
+	lb->n_users = n_users;
+
+	for (uint32_t w = 0; w < n_workers; w++) {
+		if (counts[w] != 0) {
+			ssd_load_item item = {
+					.lb = lb,
+					.recs = lb->recs + starts[w] - counts[w],
+					.n_recs = counts[w]
+			};
+
+			cf_queue_push(pool->queues[w], &item);
+		}
+	}
+}
+
+
 // Sweep through storage devices and rebuild the index.
 //
 // If there are LDT records the sweep is done twice, once for LDT parent records
 // and then again for LDT subrecords.
+static void
+ssd_load_device_init(ssd_load_device *ld, drv_ssds *ssds, drv_ssd *ssd)
+{
+	ld->ssds = ssds;
+	ld->ssd = ssd;
+	pthread_mutex_init(&ld->lock, NULL);
+	pthread_cond_init(&ld->cond, NULL);
+	ld->n_bufs = 0;
+	ld->halt = false;
+}
+
+
+// Wait until the workers have room for another buffer. Returns false if they
+// hit a limit and reading should stop.
+static bool
+ssd_load_device_throttle(ssd_load_device *ld)
+{
+	pthread_mutex_lock(&ld->lock);
+
+	while (ld->n_bufs >= LOAD_MAX_BUFS_PER_DEVICE && ! ld->halt) {
+		pthread_cond_wait(&ld->cond, &ld->lock);
+	}
+
+	bool halt = ld->halt;
+
+	pthread_mutex_unlock(&ld->lock);
+
+	return ! halt;
+}
+
+
+// Wait for the workers to finish with our buffers.
+static void
+ssd_load_device_finish(ssd_load_device *ld)
+{
+	pthread_mutex_lock(&ld->lock);
+
+	while (ld->n_bufs != 0) {
+		pthread_cond_wait(&ld->cond, &ld->lock);
+	}
+
+	pthread_mutex_unlock(&ld->lock);
+
+	pthread_cond_destroy(&ld->cond);
+	pthread_mutex_destroy(&ld->lock);
+}
+
+
+// Find the records in a buffer read from device, unless we aren't interested
+// in their partitions. Counts (in *p_error_count) buffers with nothing at the
+// start, or with a corrupt record - the rest of such a buffer is skipped.
+// Returns the number of records found.
+static uint32_t
+ssd_load_buf_scan(drv_ssds *ssds, drv_ssd *ssd, ssd_load_pool *pool,
+		uint8_t *buf, size_t buf_size, off_t file_offset, ssd_load_rec *found,
+		int *p_error_count)
+{
+	size_t block_offset = 0; // current offset within the buffer, in bytes
+	uint32_t n_found = 0;
+
+	while (block_offset < buf_size) {
+		drv_ssd_block *block = (drv_ssd_block*)&buf[block_offset];
+
+		// Look for record magic.
+		if (block->magic != SSD_BLOCK_MAGIC) {
+			// No record found here.
+			// (Includes normal case of nothing ever written here).
+
+			block_offset += RBLOCK_SIZE;
+
+			// We always write some at the start of a 1M block.
+			if (block_offset == RBLOCK_SIZE) {
+				(*p_error_count)++;
+				return n_found;
+			}
+
+			// Otherwise check the next rblock, looking for magic.
+			continue;
+		}
+
+		// Note - if block->length is sane, we don't need to round up to a
+		// multiple of RBLOCK_SIZE, but let's do it anyway just to be safe.
+		size_t next_block_offset = block_offset +
+				BYTES_TO_RBLOCK_BYTES(block->length + SIGNATURE_OFFSET);
+
+		// Sanity-check for 1M block overruns.
+		// TODO - check write_block_size boundaries!
+		if (next_block_offset > buf_size) {
+			cf_warning(AS_DRV_SSD, "error: block extends over read size: foff %"PRIu64" boff %"PRIu64" blen %"PRIu64,
+				file_offset, block_offset, (uint64_t)block->length);
+
+			(*p_error_count)++;
+			return n_found;
+		}
+
+		// Check signature.
+		if (ssd->use_signature && block->sig) {
+			cf_signature sig;
+
+			cf_signature_compute(((uint8_t*)block) + SIGNATURE_OFFSET,
+					block->length, &sig);
+
+			if (sig != block->sig) {
+				block_offset += RBLOCK_SIZE;
+				ssd->record_add_sigfail_counter++;
+
+				// Check the next rblock, looking for magic.
+				continue;
+			}
+		}
+
+		// Found a record - queue it for its partition's worker, unless we
+		// aren't interested in the partition.
+		as_partition_id pid = as_partition_getid(block->keyd);
+
+		if (ssds->get_state_from_storage[pid]) {
+			if (! is_valid_record(block, ssds->ns->name)) {
+				(*p_error_count)++;
+				return n_found;
+			}
+
+			ssd_load_rec *rec = &found[n_found++];
+
+			rec->rblock_id = BYTES_TO_RBLOCKS(file_offset + block_offset);
+			rec->offset = (uint32_t)block_offset;
+			rec->n_rblocks = (uint32_t)BYTES_TO_RBLOCKS(next_block_offset - block_offset);
+			rec->worker_ix = pid % pool->n_workers;
+		}
+
+		*p_error_count = 0;
+		block_offset = next_block_offset;
+	}
+
+	return n_found;
+}
+
+
+// Hand a buffer's records to the workers - they free the buffer when done.
+static void
+ssd_load_buf_submit(ssd_load_device *ld, ssd_load_pool *pool, uint8_t *buf,
+		ssd_load_rec *found, uint32_t n_found)
+{
+	if (n_found == 0) {
+		cf_free(buf);
+		return;
+	}
+
+	ssd_load_buf *lb = cf_malloc(sizeof(ssd_load_buf));
+
+	if (! lb || ! (lb->recs = cf_malloc(n_found * sizeof(ssd_load_rec)))) {
+		cf_crash(AS_DRV_SSD, "memory allocation in device load");
+	}
+
+	lb->ld = ld;
+	lb->buf = buf;
+
+	pthread_mutex_lock(&ld->lock);
+	ld->n_bufs++;
+	pthread_mutex_unlock(&ld->lock);
+
+	ssd_load_buf_dispatch(pool, lb, found, n_found);
+}
+
+
 int
-ssd_load_device_sweep(drv_ssds *ssds, drv_ssd *ssd)
+ssd_load_device_sweep(drv_ssds *ssds, drv_ssd *ssd, ssd_load_pool *pool)
 {
-	uint8_t *buf = cf_valloc(LOAD_BUF_SIZE);
+	ssd_load_device ld;
+
+	ssd_load_device_init(&ld, ssds, ssd);
+
+	uint32_t max_recs = LOAD_BUF_SIZE / RBLOCK_SIZE;
+	ssd_load_rec *found = cf_malloc(max_recs * sizeof(ssd_load_rec));
+
+	if (! found) {
+		cf_crash(AS_DRV_SSD, "memory allocation in device load");
+	}
 
 	int fd = open(ssd->name, ssd->open_flag, S_IRUSR | S_IWUSR);
 
@@ -3241,109 +4472,114 @@ ssd_load_device_sweep(drv_ssds *ssds, drv_ssd *ssd)
 
 	// Loop over all blocks in device.
 	while (true) {
+		// Don't get too far ahead of the workers.
+		if (! ssd_load_device_throttle(&ld)) {
+			break;
+		}
+
+		uint8_t *buf = cf_valloc(LOAD_BUF_SIZE);
+
+		if (! buf) {
+			cf_crash(AS_DRV_SSD, "memory allocation in device load");
+		}
+
 		ssize_t rlen = read(fd, buf, LOAD_BUF_SIZE);
 
 		if (rlen != LOAD_BUF_SIZE) {
 			cf_warning(AS_DRV_SSD, "startup read failed: offset %"PRIu64" errno %d rv %zd",
 					file_offset, errno, rlen);
-			goto Finished;
+			cf_free(buf);
+			break;
+		}
+
+		uint32_t n_found = ssd_load_buf_scan(ssds, ssd, pool, buf,
+				LOAD_BUF_SIZE, file_offset, found, &error_count);
+
+		ssd_load_buf_submit(&ld, pool, buf, found, n_found);
+
+		// If we encounter enough 1M blocks that have no records, assume we've
+		// read all our data and we're done.
+		if (error_count > 10) {
+			break;
 		}
 
-		size_t block_offset = 0; // current offset within the 1M block, in bytes
+		file_offset += LOAD_BUF_SIZE;
+		ssd->cold_start_block_counter++;
+	}
 
-		while (block_offset < LOAD_BUF_SIZE) {
-			drv_ssd_block *block = (drv_ssd_block*)&buf[block_offset];
+	ssd_load_device_finish(&ld);
 
-			// Look for record magic.
-			if (block->magic != SSD_BLOCK_MAGIC) {
-				// No record found here.
-				// (Includes normal case of nothing ever written here).
+	ssd->cold_start_block_counter = ssd->file_size / LOAD_BUF_SIZE;
 
-				block_offset += RBLOCK_SIZE;
+	close(fd);
+	cf_free(found);
 
-				// We always write some at the start of a 1M block.
-				if (block_offset == RBLOCK_SIZE) {
-					error_count++;
-					goto NextBlock;
-				}
-				else {
-					// Otherwise check the next rblock, looking for magic.
-					continue;
-				}
-			}
+	return 0;
+}
 
-			// Note - if block->length is sane, we don't need to round up to a
-			// multiple of RBLOCK_SIZE, but let's do it anyway just to be safe.
-			size_t next_block_offset = block_offset +
-					BYTES_TO_RBLOCK_BYTES(block->length + SIGNATURE_OFFSET);
 
-			// Sanity-check for 1M block overruns.
-			// TODO - check write_block_size boundaries!
-			if (next_block_offset > LOAD_BUF_SIZE) {
-				cf_warning(AS_DRV_SSD, "error: block extends over read size: foff %"PRIu64" boff %"PRIu64" blen %"PRIu64,
-					file_offset, block_offset, (uint64_t)block->length);
+// Index was loaded from snapshot - read only the wblocks written since.
+int
+ssd_load_device_replay(drv_ssds *ssds, drv_ssd *ssd, ssd_load_pool *pool)
+{
+	ssd_load_device ld;
 
-				error_count++;
-				goto NextBlock;
-			}
+	ssd_load_device_init(&ld, ssds, ssd);
 
-			// Check signature.
-			if (ssd->use_signature && block->sig) {
-				cf_signature sig;
+	uint32_t max_recs = ssd->write_block_size / RBLOCK_SIZE;
+	ssd_load_rec *found = cf_malloc(max_recs * sizeof(ssd_load_rec));
 
-				cf_signature_compute(((uint8_t*)block) + SIGNATURE_OFFSET,
-						block->length, &sig);
+	if (! found) {
+		cf_crash(AS_DRV_SSD, "memory allocation in device load");
+	}
 
-				if (sig != block->sig) {
-					block_offset += RBLOCK_SIZE;
-					ssd->record_add_sigfail_counter++;
+	int fd = open(ssd->name, ssd->open_flag, S_IRUSR | S_IWUSR);
 
-					// Check the next rblock, looking for magic.
-					continue;
-				}
-			}
+	if (-1 == fd) {
+		cf_crash(AS_DRV_SSD, "unable to open device %s: %s",
+				ssd->name, cf_strerror(errno));
+	}
 
-			// Found a record - try to add it to the index.
-			int add_rv = ssd_record_add(ssds, ssd, block,
-					BYTES_TO_RBLOCKS(file_offset + block_offset),
-					(uint32_t)BYTES_TO_RBLOCKS(next_block_offset - block_offset));
+	uint32_t n_blocks = ssd->file_size / LOAD_BUF_SIZE;
+	uint32_t n_wblocks = ssd->n_replay_wblocks;
 
-			if (add_rv == -2) {
-				cf_warning(AS_DRV_SSD, "disk restore: hit high water limit before disk entirely loaded.");
-				goto Finished;
-			}
+	for (uint32_t i = 0; i < n_wblocks; i++) {
+		if (! ssd_load_device_throttle(&ld)) {
+			break;
+		}
 
-			if (add_rv == -3) {
-				error_count++;
-				goto NextBlock;
-			}
+		uint32_t wblock_id = ssd->replay_wblock_ids[i];
+		off_t file_offset = (off_t)WBLOCK_ID_TO_BYTES(ssd, wblock_id);
+		uint8_t *buf = cf_valloc(ssd->write_block_size);
 
-			error_count = 0;
-			block_offset = next_block_offset;
+		if (! buf) {
+			cf_crash(AS_DRV_SSD, "memory allocation in device load");
 		}
 
-NextBlock:
+		ssize_t rlen = pread(fd, buf, ssd->write_block_size, file_offset);
 
-		// If we encounter enough 1M blocks that have no records, assume we've
-		// read all our data and we're done.
-		if (error_count > 10) {
-			goto Finished;
+		if (rlen != (ssize_t)ssd->write_block_size) {
+			cf_crash(AS_DRV_SSD, "%s: replay read failed: offset %"PRIu64" errno %d rv %zd",
+					ssd->name, (uint64_t)file_offset, errno, rlen);
 		}
 
-		file_offset += LOAD_BUF_SIZE;
-		ssd->cold_start_block_counter++;
-	}
-
-Finished:
+		int error_count = 0;
+		uint32_t n_found = ssd_load_buf_scan(ssds, ssd, pool, buf,
+				ssd->write_block_size, file_offset, found, &error_count);
 
-	ssd->cold_start_block_counter = ssd->file_size / LOAD_BUF_SIZE;
+		ssd_load_buf_submit(&ld, pool, buf, found, n_found);
 
-	if (fd != -1) {
-		close(fd);
-		fd = -1;
+		// Progress, in terms of the full sweep the ticker expects.
+		ssd->cold_start_block_counter =
+				(uint32_t)(((uint64_t)(i + 1) * n_blocks) / n_wblocks);
 	}
 
-	cf_free(buf);
+	ssd_load_device_finish(&ld);
+
+	ssd->cold_start_block_counter = n_blocks;
+
+	close(fd);
+	cf_free(found);
 
 	return 0;
 }
@@ -3357,6 +4593,7 @@ Finished:
 typedef struct {
 	drv_ssds *ssds;
 	drv_ssd *ssd;
+	ssd_load_pool *pool;
 	cf_queue *complete_q;
 	void *complete_udata;
 	void *complete_rc;
@@ -3369,6 +4606,7 @@ ssd_load_devices_fn(void *udata)
 	ssd_load_devices_data *ldd = (ssd_load_devices_data*)udata;
 	drv_ssd *ssd = ldd->ssd;
 	drv_ssds *ssds = ldd->ssds;
+	ssd_load_pool *pool = ldd->pool;
 	cf_queue *complete_q = ldd->complete_q;
 	void *complete_udata = ldd->complete_udata;
 	void *complete_rc = ldd->complete_rc;
@@ -3376,7 +4614,13 @@ ssd_load_devices_fn(void *udata)
 	cf_free(ldd);
 	ldd = 0;
 
-	cf_info(AS_DRV_SSD, "device %s: reading device to load index", ssd->name);
+	if (ssd->replay_wblock_ids) {
+		cf_info(AS_DRV_SSD, "device %s: reading %u wblocks written since index snapshot",
+				ssd->name, ssd->n_replay_wblocks);
+	}
+	else {
+		cf_info(AS_DRV_SSD, "device %s: reading device to load index", ssd->name);
+	}
 
 #ifdef USE_JEM
 	int tid = syscall(SYS_gettid);
@@ -3390,13 +4634,23 @@ ssd_load_devices_fn(void *udata)
 	ssd->sub_sweep	= false;
 	ssd->has_ldt	= false;
 
-	ssd_load_device_sweep(ssds, ssd);
+	if (ssd->replay_wblock_ids) {
+		// No LDT - snapshots aren't taken for LDT-enabled namespaces.
+		ssd_load_device_replay(ssds, ssd, pool);
+
+		cf_free(ssd->replay_wblock_ids);
+		ssd->replay_wblock_ids = NULL;
+		ssd->n_replay_wblocks = 0;
+	}
+	else {
+		ssd_load_device_sweep(ssds, ssd, pool);
+	}
 
 	if (ssds->ns->ldt_enabled && ssd->has_ldt) {
 		cf_info(AS_DRV_SSD, "device %s: reading device again to load subrecords",
 				ssd->name);
 		ssd->sub_sweep = true;
-		ssd_load_device_sweep(ssds, ssd);
+		ssd_load_device_sweep(ssds, ssd, pool);
 	}
 
 	cf_info(AS_DRV_SSD, "device %s: read complete: UNIQUE %"PRIu64" (REPLACED %"PRIu64") (GEN %"PRIu64") (EXPIRED %"PRIu64") (MAX-TTL %"PRIu64") records",
@@ -3412,6 +4666,8 @@ ssd_load_devices_fn(void *udata)
 	if (0 == cf_rc_release(complete_rc)) {
 		// All drives are done reading.
 
+		ssd_load_pool_destroy(pool);
+
 		ssds->ns->cold_start_loading = false;
 		ssd_load_wblock_queues(ssds);
 
@@ -3423,6 +4679,7 @@ ssd_load_devices_fn(void *udata)
 		ssd_start_maintenance_threads(ssds);
 		ssd_start_write_worker_threads(ssds);
 		ssd_start_defrag_threads(ssds);
+		ssd_snapshot_start(ssds);
 	}
 
 	return 0;
@@ -3440,6 +4697,8 @@ ssd_load_devices_load(drv_ssds *ssds, cf_queue *complete_q, void *udata)
 		cf_rc_reserve(p);
 	}
 
+	ssd_load_pool *pool = ssd_load_pool_create(ssds);
+
 	for (int i = 0; i < ssds->n_ssds; i++) {
 		drv_ssd *ssd = &ssds->ssds[i];
 		ssd_load_devices_data *ldd = cf_malloc(sizeof(ssd_load_devices_data));
@@ -3450,6 +4709,7 @@ ssd_load_devices_load(drv_ssds *ssds, cf_queue *complete_q, void *udata)
 
 		ldd->ssds = ssds;
 		ldd->ssd = ssd;
+		ldd->pool = pool;
 		ldd->complete_q = complete_q;
 		ldd->complete_udata = udata;
 		ldd->complete_rc = p;
@@ -3541,6 +4801,10 @@ ssd_load_devices(drv_ssds *ssds, cf_queue *complete_q, void *udata)
 
 	// At least one device is not fresh. Check that all non-fresh devices match.
 
+	// An index snapshot is only good for the device set's state it was taken
+	// in, identified by the header random from the last run.
+	uint64_t prev_random = headers[first_used]->random;
+
 	for (int i = 0; i < n_ssds; i++) {
 		drv_ssd *ssd = &ssds->ssds[i];
 
@@ -3625,6 +4889,12 @@ ssd_load_devices(drv_ssds *ssds, cf_queue *complete_q, void *udata)
 
 	ns->cold_start_max_void_time = now + (uint32_t)ns->max_ttl;
 
+	// If there's a good index snapshot, load it - then only the wblocks
+	// written since need to be read.
+	if (ssds->snapshot) {
+		ssd_snapshot_load(ssds, prev_random);
+	}
+
 	// Fire off threads to load in data - will signal completion when threads
 	// are all done.
 	ssd_load_devices_load(ssds, complete_q, udata);
@@ -3942,6 +5212,21 @@ as_storage_namespace_init_ssd(as_namespace *ns, cf_queue *complete_q,
 
 	ns->storage_private = (void*)ssds;
 
+	if (ns->storage_record_cache_size != 0) {
+		if (ns->storage_data_in_memory) {
+			cf_warning(AS_DRV_SSD, "{%s} record-cache-size ignored - data is in memory",
+					ns->name);
+		}
+		else if (! (ssds->cache = ssd_cache_create(ns,
+				ns->storage_record_cache_size))) {
+			cf_crash(AS_DRV_SSD, "{%s} can't create record cache", ns->name);
+		}
+	}
+
+	if (ns->storage_index_snapshot_file) {
+		ssds->snapshot = ssd_snapshot_create(ssds);
+	}
+
 	// Finish initializing drv_ssd structures (non-zero-value members).
 	for (int i = 0; i < ssds->n_ssds; i++) {
 		drv_ssd *ssd = &ssds->ssds[i];
@@ -3949,10 +5234,19 @@ as_storage_namespace_init_ssd(as_namespace *ns, cf_queue *complete_q,
 		ssd->ns = ns;
 		ssd->file_id = i;
 
-		pthread_mutex_init(&ssd->LOCK, 0);
+		pthread_mutex_init(&ssd->defrag_lock, 0);
 
 		ssd->running = true;
 
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		ssd->n_lanes = n_cpus > MAX_SSD_WRITE_LANES ?
+				MAX_SSD_WRITE_LANES : (n_cpus > 0 ? (uint32_t)n_cpus : 1);
+
+		for (uint32_t l = 0; l < ssd->n_lanes; l++) {
+			pthread_mutex_init(&ssd->lanes[l].lock, 0);
+		}
+
 		ssd->use_signature = ns->storage_signature;
 		ssd->data_in_memory = ns->storage_data_in_memory;
 		ssd->write_block_size = ns->storage_write_block_size;
@@ -3973,6 +5267,10 @@ as_storage_namespace_init_ssd(as_namespace *ns, cf_queue *complete_q,
 			cf_crash(AS_DRV_SSD, "can't create swb-free queue");
 		}
 
+		if (! (ssd->swb_husk_q = cf_queue_create(sizeof(void*), true))) {
+			cf_crash(AS_DRV_SSD, "can't create swb-husk queue");
+		}
+
 		if (! ns->storage_data_in_memory) {
 			if (! (ssd->post_write_q = cf_queue_create(sizeof(void*), false))) {
 				cf_crash(AS_DRV_SSD, "can't create post-write queue");
@@ -4004,6 +5302,12 @@ as_storage_namespace_init_ssd(as_namespace *ns, cf_queue *complete_q,
 		if (! (ssd->hist_fsync = histogram_create(histname, HIST_MILLISECONDS))) {
 			cf_crash(AS_DRV_SSD, "cannot create histogram %s", histname);
 		}
+
+#ifdef USE_URING
+		if (ns->storage_io_engine == AS_STORAGE_IO_ENGINE_URING) {
+			ssd_start_uring(ssd);
+		}
+#endif
 	}
 
 	// Attempt to load the data.
@@ -4020,6 +5324,7 @@ as_storage_namespace_init_ssd(as_namespace *ns, cf_queue *complete_q,
 		ssd_start_maintenance_threads(ssds);
 		ssd_start_write_worker_threads(ssds);
 		ssd_start_defrag_threads(ssds);
+		ssd_snapshot_start(ssds);
 	}
 
 	return 0;
@@ -4070,7 +5375,11 @@ as_storage_namespace_destroy_ssd(as_namespace *ns)
 			close(fd);
 		}
 
-		pthread_mutex_destroy(&ssd->LOCK);
+		for (uint32_t l = 0; l < ssd->n_lanes; l++) {
+			pthread_mutex_destroy(&ssd->lanes[l].lock);
+		}
+
+		pthread_mutex_destroy(&ssd->defrag_lock);
 	}
 
 	cf_free(ssds);
@@ -4101,6 +5410,10 @@ as_storage_record_destroy_ssd(as_namespace *ns, as_record *r)
 		drv_ssds *ssds = (drv_ssds*)ns->storage_private;
 		drv_ssd *ssd = &ssds->ssds[r->storage_key.ssd.file_id];
 
+		if (ssds->cache) {
+			ssd_cache_remove(ssds->cache, &r->key);
+		}
+
 		ssd_block_free(ssd, r->storage_key.ssd.rblock_id,
 				r->storage_key.ssd.n_rblocks, "destroy");
 
@@ -4189,6 +5502,287 @@ as_storage_record_size_and_check_ssd(as_storage_rd *rd)
 }
 
 
+//==========================================================
+// Storage API implementation: device-order scan.
+//
+
+// Partition reservations for a device-order scan - taken the first time a
+// wblock has a record in the partition, and dropped once the wblock is done,
+// rather than once per record.
+#define SSD_SCAN_RSV_NONE		0
+#define SSD_SCAN_RSV_RESERVED	1
+#define SSD_SCAN_RSV_SKIP		2 // not master - nothing to scan
+
+typedef struct ssd_scan_rsvs_s {
+	as_partition_reservation rsvs[AS_PARTITIONS];
+	uint8_t			state[AS_PARTITIONS];
+	uint32_t		n_touched;
+	as_partition_id	touched[AS_PARTITIONS];
+} ssd_scan_rsvs;
+
+
+static as_partition_reservation *
+ssd_scan_rsv_get(as_namespace *ns, ssd_scan_rsvs *srsvs, as_partition_id pid)
+{
+	if (srsvs->state[pid] == SSD_SCAN_RSV_NONE) {
+		// Only scan partitions we're master for, as the partition scan does.
+		srsvs->state[pid] = 0 == as_partition_reserve_write(ns, pid,
+				&srsvs->rsvs[pid], NULL, NULL) ?
+						SSD_SCAN_RSV_RESERVED : SSD_SCAN_RSV_SKIP;
+		srsvs->touched[srsvs->n_touched++] = pid;
+	}
+
+	return srsvs->state[pid] == SSD_SCAN_RSV_RESERVED ?
+			&srsvs->rsvs[pid] : NULL;
+}
+
+
+static void
+ssd_scan_rsvs_release(ssd_scan_rsvs *srsvs)
+{
+	for (uint32_t i = 0; i < srsvs->n_touched; i++) {
+		as_partition_id pid = srsvs->touched[i];
+
+		if (srsvs->state[pid] == SSD_SCAN_RSV_RESERVED) {
+			as_partition_release(&srsvs->rsvs[pid]);
+		}
+
+		srsvs->state[pid] = SSD_SCAN_RSV_NONE;
+	}
+
+	srsvs->n_touched = 0;
+}
+
+
+// Hand a record found in a wblock to the scan callback, if it's the current
+// copy. Returns false if the callback wants the sweep to stop.
+static bool
+ssd_record_scan(drv_ssd *ssd, drv_ssd_block *block, uint64_t rblock_id,
+		ssd_scan_rsvs *srsvs, as_storage_scan_fn cb, void *udata)
+{
+	as_namespace *ns = ssd->ns;
+	as_partition_reservation *rsv = ssd_scan_rsv_get(ns, srsvs,
+			as_partition_getid(block->keyd));
+
+	if (! rsv) {
+		return true;
+	}
+
+	bool keep_going = true;
+	as_index_ref r_ref;
+	r_ref.skip_lock = false;
+
+	if (0 == as_record_get(rsv->tree, &block->keyd, &r_ref, ns)) {
+		as_index *r = r_ref.r;
+
+		// Skip old copies - e.g. overwritten, or already moved by defrag.
+		if (r->storage_key.ssd.file_id == ssd->file_id &&
+				r->storage_key.ssd.rblock_id == rblock_id &&
+				r->generation == block->generation &&
+				is_valid_record(block, ns->name)) {
+			as_storage_rd rd;
+
+			as_storage_record_open(ns, r, &rd, &block->keyd);
+
+			// Attach the block so nothing is read from device again.
+			rd.u.ssd.block = block;
+			rd.have_device_block = true;
+
+			keep_going = cb(&r_ref, &rd, udata);
+
+			as_storage_record_close(r, &rd);
+		}
+
+		as_record_done(&r_ref, ns);
+	}
+
+	return keep_going;
+}
+
+
+// Walk the records in a wblock-sized buffer. Returns false if the callback
+// wants the sweep to stop.
+static bool
+ssd_wblock_scan(drv_ssd *ssd, uint32_t wblock_id, uint8_t *buf,
+		size_t buf_size, ssd_scan_rsvs *srsvs, as_storage_scan_fn cb,
+		void *udata)
+{
+	uint64_t file_offset = WBLOCK_ID_TO_BYTES(ssd, wblock_id);
+	size_t wblock_offset = 0; // current offset within the wblock, in bytes
+
+	while (wblock_offset < buf_size) {
+		drv_ssd_block *block = (drv_ssd_block*)&buf[wblock_offset];
+
+		if (block->magic != SSD_BLOCK_MAGIC) {
+			// First block must have magic.
+			if (wblock_offset == 0) {
+				cf_warning(AS_DRV_SSD, "BLOCK CORRUPTED: device %s has bad data on wblock %d",
+						ssd->name, wblock_id);
+				break;
+			}
+
+			// Later blocks may have no magic, just skip to next block.
+			wblock_offset += RBLOCK_SIZE;
+			continue;
+		}
+
+		size_t next_wblock_offset = wblock_offset +
+				BYTES_TO_RBLOCK_BYTES(block->length + SIGNATURE_OFFSET);
+
+		if (next_wblock_offset > buf_size) {
+			cf_warning(AS_DRV_SSD, "error: block extends over read size: foff %"PRIu64" boff %"PRIu64" blen %"PRIu64,
+				file_offset, wblock_offset, (uint64_t)block->length);
+			break;
+		}
+
+		if (ssd->use_signature && block->sig) {
+			cf_signature sig;
+
+			cf_signature_compute(((uint8_t*)block) + SIGNATURE_OFFSET,
+					block->length, &sig);
+
+			if (sig != block->sig) {
+				wblock_offset += RBLOCK_SIZE;
+				continue;
+			}
+		}
+
+		if (! ssd_record_scan(ssd, block,
+				BYTES_TO_RBLOCKS(file_offset + wblock_offset), srsvs, cb,
+				udata)) {
+			return false;
+		}
+
+		wblock_offset = next_wblock_offset;
+	}
+
+	return true;
+}
+
+
+// Sweep through a device a wblock at a time, calling back for every current
+// record in partitions we're master for. Reads are large and sequential, as in
+// defrag - much cheaper than a random read per record for big scans. After each
+// wblock, with all reservations dropped, flush_cb gets a chance to do slow work
+// like sending results.
+//
+// Note - unlike the partition scan, this doesn't snapshot the index. A record
+// overwritten or defragged during the sweep may be missed, or seen twice, if
+// it moves across the sweep position.
+int
+as_storage_scan_device_ssd(as_namespace *ns, uint32_t device_ix,
+		as_storage_scan_fn cb, as_storage_scan_flush_fn flush_cb, void *udata)
+{
+	drv_ssds *ssds = (drv_ssds*)ns->storage_private;
+
+	if (device_ix >= (uint32_t)ssds->n_ssds) {
+		cf_warning(AS_DRV_SSD, "{%s} scan: bad device index %u", ns->name,
+				device_ix);
+		return -1;
+	}
+
+	drv_ssd *ssd = &ssds->ssds[device_ix];
+	uint8_t *read_buf = cf_valloc(ssd->write_block_size);
+
+	if (! read_buf) {
+		cf_warning(AS_DRV_SSD, "device %s: scan valloc failed", ssd->name);
+		return -1;
+	}
+
+	ssd_scan_rsvs *srsvs = cf_malloc(sizeof(ssd_scan_rsvs));
+
+	if (! srsvs) {
+		cf_warning(AS_DRV_SSD, "device %s: scan malloc failed", ssd->name);
+		cf_free(read_buf);
+		return -1;
+	}
+
+	memset(srsvs->state, SSD_SCAN_RSV_NONE, sizeof(srsvs->state));
+	srsvs->n_touched = 0;
+
+	int fd = ssd_fd_get(ssd);
+
+	if (-1 == fd) {
+		cf_warning(AS_DRV_SSD, "scan: unable to get file descriptor for device %s errno %d",
+				ssd->name, errno);
+		cf_free(srsvs);
+		cf_free(read_buf);
+		return -1;
+	}
+
+	ssd_alloc_table *at = ssd->alloc_table;
+	uint32_t first_id = BYTES_TO_WBLOCK_ID(ssd, ssd->header_size);
+	int rv = 0;
+
+	for (uint32_t wblock_id = first_id; wblock_id < at->n_wblocks; wblock_id++) {
+		ssd_wblock_state *p_wblock_state = &at->wblock_state[wblock_id];
+
+		if (cf_atomic32_get(p_wblock_state->inuse_sz) == 0) {
+			continue;
+		}
+
+		size_t buf_size = ssd->write_block_size;
+		ssd_write_buf *swb = 0;
+
+		swb_check_and_reserve(p_wblock_state, &swb);
+
+		if (swb) {
+			// Wblock is (or was recently) a write buffer - the device may not
+			// have it yet, so use the buffer, but only as far as it's filled.
+			buf_size = swb_pos(swb);
+			memcpy(read_buf, swb->buf, buf_size);
+			swb_release(swb);
+		}
+		else {
+			uint64_t file_offset = WBLOCK_ID_TO_BYTES(ssd, wblock_id);
+			uint64_t start_ns = g_config.storage_benchmarks ? cf_getns() : 0;
+
+			if (lseek(fd, (off_t)file_offset, SEEK_SET) != (off_t)file_offset) {
+				cf_warning(AS_DRV_SSD, "DEVICE FAILED: device %s can't seek errno %d",
+						ssd->name, errno);
+				close(fd);
+				fd = -1;
+				rv = -1;
+				break;
+			}
+
+			ssize_t rlen = read(fd, read_buf, buf_size);
+
+			if (rlen != (ssize_t)buf_size) {
+				cf_warning(AS_DRV_SSD, "scan read failed: offset %"PRIu64" errno %d rv %zd",
+						file_offset, errno, rlen);
+				close(fd);
+				fd = -1;
+				rv = -1;
+				break;
+			}
+
+			if (start_ns != 0) {
+				histogram_insert_data_point(ssd->hist_large_block_read, start_ns);
+			}
+		}
+
+		bool keep_going = ssd_wblock_scan(ssd, wblock_id, read_buf, buf_size,
+				srsvs, cb, udata);
+
+		ssd_scan_rsvs_release(srsvs);
+
+		if (! keep_going || (flush_cb && ! flush_cb(udata))) {
+			break;
+		}
+	}
+
+	if (fd != -1) {
+		ssd_fd_put(ssd, fd);
+	}
+
+	cf_free(srsvs);
+	cf_free(read_buf);
+
+	return rv;
+}
+
+
 //==========================================================
 // Storage API implementation: storage capacity monitoring.
 //
@@ -4437,6 +6031,25 @@ as_storage_stats_ssd(as_namespace *ns, int *available_pct,
 		// Used for shortcut in as_storage_has_space_ssd(), which is done on a
 		// per-transaction basis:
 		ns->storage_last_avail_pct = *available_pct;
+
+		// Refresh the defrag backlog stats while we're at it.
+		uint32_t backlog = 0;
+		uint32_t backlog_age = 0;
+
+		for (int i = 0; i < ssds->n_ssds; i++) {
+			drv_ssd *ssd = &ssds->ssds[i];
+			uint32_t age = cf_atomic32_get(ssd->defrag_backlog_age);
+
+			backlog += (uint32_t)(cf_atomic_int_get(ssd->defrag_wblock_counter) -
+					cf_atomic_int_get(ssd->defrag_done_counter));
+
+			if (age > backlog_age) {
+				backlog_age = age;
+			}
+		}
+
+		ns->defrag_backlog = backlog;
+		ns->defrag_backlog_age = backlog_age;
 	}
 
 	if (used_disk_bytes) {
@@ -4503,19 +6116,33 @@ as_storage_shutdown_ssd(as_namespace *ns)
 	for (int i = 0; i < ssds->n_ssds; i++) {
 		drv_ssd *ssd = &ssds->ssds[i];
 
-		// Stop the maintenance thread from (also) flushing the current swb.
-		pthread_mutex_lock(&ssd->LOCK);
+		for (uint32_t l = 0; l < ssd->n_lanes; l++) {
+			ssd_write_lane *lane = &ssd->lanes[l];
+
+			// Stop the maintenance thread from (also) flushing the lane's swb,
+			// and writers from replacing it.
+			pthread_mutex_lock(&lane->lock);
+
+			ssd_write_buf *swb = lane->swb;
 
-		// Flush current swb by pushing it to write-q.
-		if (ssd->current_swb) {
-			// Clean the end of the buffer before pushing to write-q.
-			if (ssd->write_block_size > ssd->current_swb->pos) {
-				memset(&ssd->current_swb->buf[ssd->current_swb->pos], 0,
-						ssd->write_block_size - ssd->current_swb->pos);
+			if (! swb) {
+				continue;
 			}
 
-			cf_queue_push(ssd->swb_write_q, &ssd->current_swb);
-			ssd->current_swb = NULL;
+			lane->swb = NULL;
+
+			// Close the swb, and release the lane's hold on it - the last
+			// writer pushes it to write-q.
+			__atomic_and_fetch(&swb->state, ~SWB_OPEN, __ATOMIC_ACQ_REL);
+			lane_writer_done(ssd, swb);
+		}
+
+		// Stop defrag from moving more records, and flush those it moved.
+		pthread_mutex_lock(&ssd->defrag_lock);
+
+		if (ssd->defrag_swb) {
+			swb_enqueue(ssd, ssd->defrag_swb, swb_pos(ssd->defrag_swb));
+			ssd->defrag_swb = NULL;
 		}
 	}
 
@@ -4537,5 +6164,12 @@ as_storage_shutdown_ssd(as_namespace *ns)
 
 			pthread_join(ssd->write_worker_thread[j], &p_void);
 		}
+
+#ifdef USE_URING
+		// Wait for flushes still in flight on the ring.
+		if (ssd->uring) {
+			cf_uring_wait_idle(ssd->uring);
+		}
+#endif
 	}
 }
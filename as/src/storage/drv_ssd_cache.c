@@ -0,0 +1,515 @@
+/*
+ * drv_ssd_cache.c
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+/*
+ * Read-through record cache for data-not-in-memory namespaces.
+ *
+ * Holds copies of drv_ssd_block images, keyed by digest. An entry is only
+ * served if its generation and device location still match the record's index
+ * entry, so a stale entry can never be returned - explicit invalidation just
+ * frees its memory early.
+ *
+ * Eviction is S3-FIFO - new entries go on a small FIFO queue, and only those
+ * read again before reaching its head are promoted to the main FIFO queue,
+ * where entries are kept while they're being read. Entries evicted from the
+ * small queue leave a "ghost" fingerprint, and re-inserts that hit a ghost go
+ * straight to the main queue. One-time reads (e.g. scans) can't flush the hot
+ * set.
+ *
+ * The cache is split into shards by digest, each with its own lock, queues and
+ * share of the memory budget.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "citrusleaf/alloc.h"
+#include "citrusleaf/cf_atomic.h"
+#include "citrusleaf/cf_digest.h"
+
+#include "fault.h"
+
+#include "base/datamodel.h"
+#include "storage/drv_ssd.h"
+
+
+//==========================================================
+// Constants & typedefs.
+//
+
+#define N_SHARDS			64
+#define SMALL_Q_PCT			10	// share of shard's budget for the small queue
+#define MAX_FREQ			3
+#define AVG_ELE_SZ_GUESS	1024	// for sizing hash tables
+#define MAX_ELE_SZ_FRACTION	16	// don't cache records bigger than this part of a shard
+
+typedef enum {
+	QUEUE_SMALL,
+	QUEUE_MAIN
+} cache_queue_id;
+
+typedef struct cache_ele_s {
+	struct cache_ele_s	*hash_next;
+	struct cache_ele_s	*q_prev;
+	struct cache_ele_s	*q_next;	// toward the tail (newest)
+
+	cf_digest			keyd;
+	uint64_t			rblock_id;
+	uint32_t			generation;
+	uint32_t			size;
+	uint8_t				file_id;
+	uint8_t				queue_id;
+	uint8_t				freq;
+
+	uint8_t				data[];		// drv_ssd_block image
+} cache_ele;
+
+typedef struct cache_queue_s {
+	cache_ele			*head;		// oldest - next to evict
+	cache_ele			*tail;
+	uint64_t			sz;			// bytes
+} cache_queue;
+
+// Ghost entries - fingerprints of entries recently evicted from the small
+// queue. Direct-mapped, so collisions just forget older ghosts.
+typedef struct cache_ghost_s {
+	uint32_t			fingerprint;
+	uint32_t			stamp;		// value of ghost_clock when inserted
+} cache_ghost;
+
+typedef struct cache_shard_s {
+	pthread_mutex_t		lock;
+
+	cache_ele			**buckets;
+	uint32_t			n_buckets;	// power of 2
+
+	cache_queue			small_q;
+	cache_queue			main_q;
+	uint64_t			max_sz;
+
+	cache_ghost			*ghosts;
+	uint32_t			n_ghosts;	// power of 2
+	uint32_t			ghost_clock;
+} cache_shard;
+
+struct ssd_cache_s {
+	as_namespace		*ns;
+	uint32_t			max_ele_sz;
+	cache_shard			shards[N_SHARDS];
+};
+
+
+//==========================================================
+// Forward declarations.
+//
+
+static cache_ele *shard_find(cache_shard *shard, const cf_digest *keyd, cache_ele ***p_link);
+static void shard_delete(ssd_cache *cache, cache_shard *shard, cache_ele *ele);
+static void shard_evict(ssd_cache *cache, cache_shard *shard);
+static void queue_append(cache_queue *q, cache_ele *ele);
+static void queue_unlink(cache_queue *q, cache_ele *ele);
+static bool ghost_check(cache_shard *shard, const cf_digest *keyd);
+static void ghost_add(cache_shard *shard, const cf_digest *keyd);
+
+
+//==========================================================
+// Inlines & macros.
+//
+
+static inline uint32_t
+power_of_2_at_least(uint64_t n)
+{
+	uint32_t p = 1024;
+
+	while (p < n && p < (1 << 30)) {
+		p <<= 1;
+	}
+
+	return p;
+}
+
+// Use digest bytes not used for partition or device selection.
+static inline cache_shard *
+cache_shard_of(ssd_cache *cache, const cf_digest *keyd)
+{
+	return &cache->shards[keyd->digest[19] % N_SHARDS];
+}
+
+static inline uint32_t
+digest_hash(const cf_digest *keyd)
+{
+	uint32_t hash;
+
+	memcpy(&hash, &keyd->digest[12], sizeof(hash));
+
+	return hash;
+}
+
+static inline uint32_t
+digest_fingerprint(const cf_digest *keyd)
+{
+	uint32_t fingerprint;
+
+	memcpy(&fingerprint, &keyd->digest[4], sizeof(fingerprint));
+
+	return fingerprint;
+}
+
+static inline uint64_t
+ele_mem_sz(const cache_ele *ele)
+{
+	return sizeof(cache_ele) + ele->size;
+}
+
+
+//==========================================================
+// Public API - used by drv_ssd.c.
+//
+
+ssd_cache *
+ssd_cache_create(as_namespace *ns, uint64_t size)
+{
+	ssd_cache *cache = cf_malloc(sizeof(ssd_cache));
+
+	if (! cache) {
+		return NULL;
+	}
+
+	memset(cache, 0, sizeof(ssd_cache));
+
+	uint64_t shard_sz = size / N_SHARDS;
+
+	cache->ns = ns;
+	cache->max_ele_sz = (uint32_t)(shard_sz / MAX_ELE_SZ_FRACTION);
+
+	for (int i = 0; i < N_SHARDS; i++) {
+		cache_shard *shard = &cache->shards[i];
+
+		pthread_mutex_init(&shard->lock, NULL);
+
+		shard->max_sz = shard_sz;
+		shard->n_buckets = power_of_2_at_least(shard_sz / AVG_ELE_SZ_GUESS);
+		shard->buckets = cf_calloc(shard->n_buckets, sizeof(cache_ele *));
+		shard->n_ghosts = shard->n_buckets;
+		shard->ghosts = cf_calloc(shard->n_ghosts, sizeof(cache_ghost));
+
+		if (! shard->buckets || ! shard->ghosts) {
+			cf_crash(AS_DRV_SSD, "{%s} record cache allocation failed", ns->name);
+		}
+	}
+
+	cf_info(AS_DRV_SSD, "{%s} record cache: %lu bytes, max record size %u",
+			ns->name, size, cache->max_ele_sz);
+
+	return cache;
+}
+
+
+// Returns a copy of the cached block image (caller must cf_free() it), or NULL
+// on a miss.
+uint8_t *
+ssd_cache_get(ssd_cache *cache, const cf_digest *keyd, uint32_t generation,
+		uint32_t file_id, uint64_t rblock_id, uint32_t size)
+{
+	cache_shard *shard = cache_shard_of(cache, keyd);
+	uint8_t *buf = NULL;
+
+	pthread_mutex_lock(&shard->lock);
+
+	cache_ele **link;
+	cache_ele *ele = shard_find(shard, keyd, &link);
+
+	if (ele && ele->generation == generation && ele->file_id == file_id &&
+			ele->rblock_id == rblock_id && ele->size == size) {
+		if (ele->freq < MAX_FREQ) {
+			ele->freq++;
+		}
+
+		if ((buf = cf_malloc(size)) != NULL) {
+			memcpy(buf, ele->data, size);
+		}
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	if (buf) {
+		cf_atomic64_incr(&cache->ns->record_cache_hits);
+	}
+	else {
+		cf_atomic64_incr(&cache->ns->record_cache_misses);
+	}
+
+	return buf;
+}
+
+
+// Insert (or replace) the block image read from device.
+void
+ssd_cache_put(ssd_cache *cache, const cf_digest *keyd, uint32_t generation,
+		uint32_t file_id, uint64_t rblock_id, const uint8_t *block,
+		uint32_t size)
+{
+	if (size > cache->max_ele_sz) {
+		return;
+	}
+
+	cache_ele *new_ele = cf_malloc(sizeof(cache_ele) + size);
+
+	if (! new_ele) {
+		return;
+	}
+
+	memset(new_ele, 0, sizeof(cache_ele));
+
+	new_ele->keyd = *keyd;
+	new_ele->rblock_id = rblock_id;
+	new_ele->generation = generation;
+	new_ele->size = size;
+	new_ele->file_id = (uint8_t)file_id;
+	memcpy(new_ele->data, block, size);
+
+	cache_shard *shard = cache_shard_of(cache, keyd);
+
+	pthread_mutex_lock(&shard->lock);
+
+	cache_ele **link;
+	cache_ele *ele = shard_find(shard, keyd, &link);
+
+	if (ele) {
+		// Stale version (e.g. record was moved by defrag) - the replacement
+		// inherits its queue and frequency.
+		new_ele->freq = ele->freq;
+		new_ele->queue_id = ele->queue_id;
+		shard_delete(cache, shard, ele);
+		cf_free(ele);
+		queue_append(new_ele->queue_id == QUEUE_MAIN ?
+				&shard->main_q : &shard->small_q, new_ele);
+	}
+	else if (ghost_check(shard, keyd)) {
+		new_ele->queue_id = QUEUE_MAIN;
+		queue_append(&shard->main_q, new_ele);
+	}
+	else {
+		new_ele->queue_id = QUEUE_SMALL;
+		queue_append(&shard->small_q, new_ele);
+	}
+
+	uint32_t bucket = digest_hash(keyd) & (shard->n_buckets - 1);
+
+	new_ele->hash_next = shard->buckets[bucket];
+	shard->buckets[bucket] = new_ele;
+
+	cf_atomic64_add(&cache->ns->record_cache_bytes, (int64_t)ele_mem_sz(new_ele));
+
+	while (shard->small_q.sz + shard->main_q.sz > shard->max_sz) {
+		shard_evict(cache, shard);
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+
+// Drop the entry for a digest, if any - called when the record is rewritten or
+// deleted.
+void
+ssd_cache_remove(ssd_cache *cache, const cf_digest *keyd)
+{
+	cache_shard *shard = cache_shard_of(cache, keyd);
+
+	pthread_mutex_lock(&shard->lock);
+
+	cache_ele **link;
+	cache_ele *ele = shard_find(shard, keyd, &link);
+
+	if (ele) {
+		shard_delete(cache, shard, ele);
+		cf_free(ele);
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+}
+
+
+//==========================================================
+// Local helpers - shards.
+//
+
+static cache_ele *
+shard_find(cache_shard *shard, const cf_digest *keyd, cache_ele ***p_link)
+{
+	uint32_t bucket = digest_hash(keyd) & (shard->n_buckets - 1);
+	cache_ele **link = &shard->buckets[bucket];
+
+	while (*link) {
+		if (cf_digest_compare(&(*link)->keyd, (cf_digest *)keyd) == 0) {
+			*p_link = link;
+			return *link;
+		}
+
+		link = &(*link)->hash_next;
+	}
+
+	return NULL;
+}
+
+
+// Remove element from hash and queue - caller frees it.
+static void
+shard_delete(ssd_cache *cache, cache_shard *shard, cache_ele *ele)
+{
+	cache_ele **link;
+
+	if (shard_find(shard, &ele->keyd, &link) == ele) {
+		*link = ele->hash_next;
+	}
+
+	queue_unlink(ele->queue_id == QUEUE_MAIN ?
+			&shard->main_q : &shard->small_q, ele);
+
+	cf_atomic64_sub(&cache->ns->record_cache_bytes, (int64_t)ele_mem_sz(ele));
+}
+
+
+static void
+shard_evict(ssd_cache *cache, cache_shard *shard)
+{
+	uint64_t small_max_sz = shard->max_sz * SMALL_Q_PCT / 100;
+
+	// Evict from the small queue while it's over its share.
+	while (shard->small_q.head &&
+			(shard->small_q.sz > small_max_sz || ! shard->main_q.head)) {
+		cache_ele *ele = shard->small_q.head;
+
+		if (ele->freq > 1) {
+			// Read again while in the small queue - promote.
+			queue_unlink(&shard->small_q, ele);
+			ele->freq = 0;
+			ele->queue_id = QUEUE_MAIN;
+			queue_append(&shard->main_q, ele);
+			continue;
+		}
+
+		ghost_add(shard, &ele->keyd);
+		shard_delete(cache, shard, ele);
+		cf_free(ele);
+		cf_atomic64_incr(&cache->ns->record_cache_evictions);
+		return;
+	}
+
+	// Evict from the main queue, giving recently read entries another lap.
+	while (shard->main_q.head) {
+		cache_ele *ele = shard->main_q.head;
+
+		if (ele->freq > 0) {
+			ele->freq--;
+			queue_unlink(&shard->main_q, ele);
+			queue_append(&shard->main_q, ele);
+			continue;
+		}
+
+		shard_delete(cache, shard, ele);
+		cf_free(ele);
+		cf_atomic64_incr(&cache->ns->record_cache_evictions);
+		return;
+	}
+}
+
+
+//==========================================================
+// Local helpers - queues.
+//
+
+static void
+queue_append(cache_queue *q, cache_ele *ele)
+{
+	ele->q_next = NULL;
+	ele->q_prev = q->tail;
+
+	if (q->tail) {
+		q->tail->q_next = ele;
+	}
+	else {
+		q->head = ele;
+	}
+
+	q->tail = ele;
+	q->sz += ele_mem_sz(ele);
+}
+
+
+static void
+queue_unlink(cache_queue *q, cache_ele *ele)
+{
+	if (ele->q_prev) {
+		ele->q_prev->q_next = ele->q_next;
+	}
+	else {
+		q->head = ele->q_next;
+	}
+
+	if (ele->q_next) {
+		ele->q_next->q_prev = ele->q_prev;
+	}
+	else {
+		q->tail = ele->q_prev;
+	}
+
+	ele->q_prev = NULL;
+	ele->q_next = NULL;
+	q->sz -= ele_mem_sz(ele);
+}
+
+
+//==========================================================
+// Local helpers - ghosts.
+//
+
+// A ghost is remembered for as many small-queue evictions as there are ghost
+// slots - roughly the number of entries the main queue holds.
+static bool
+ghost_check(cache_shard *shard, const cf_digest *keyd)
+{
+	uint32_t fingerprint = digest_fingerprint(keyd);
+	cache_ghost *ghost = &shard->ghosts[fingerprint & (shard->n_ghosts - 1)];
+
+	return ghost->fingerprint == fingerprint && ghost->stamp != 0 &&
+			shard->ghost_clock - ghost->stamp < shard->n_ghosts;
+}
+
+
+static void
+ghost_add(cache_shard *shard, const cf_digest *keyd)
+{
+	uint32_t fingerprint = digest_fingerprint(keyd);
+	cache_ghost *ghost = &shard->ghosts[fingerprint & (shard->n_ghosts - 1)];
+
+	// Skip stamp 0, which marks an unused slot.
+	if (++shard->ghost_clock == 0) {
+		shard->ghost_clock = 1;
+	}
+
+	ghost->fingerprint = fingerprint;
+	ghost->stamp = shard->ghost_clock;
+}
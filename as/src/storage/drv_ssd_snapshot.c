@@ -0,0 +1,1152 @@
+/*
+ * drv_ssd_snapshot.c
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+/*
+ * Periodic index snapshots, so a cold start (e.g. after a host reboot, when
+ * the index can't be resumed from shared memory) needn't sweep whole devices.
+ *
+ * A snapshot holds each partition's index entries - digest, generation,
+ * void-time, device location, set-id and key-stored flag - and is checksummed.
+ *
+ * Records on device don't say when they were written, so each snapshot starts
+ * an "epoch", and a journal lists every wblock taken off the free queues during
+ * the epoch. A journal entry is made durable before its wblock is first
+ * flushed. Cold start loads the snapshot, drops its entries that point into
+ * journaled wblocks (their contents have changed), then reads only journaled
+ * wblocks plus those that were being filled when the snapshot began.
+ *
+ * Journals are kept in two files by epoch parity, so the journal of the last
+ * complete snapshot survives while the next snapshot is being taken.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "citrusleaf/alloc.h"
+#include "citrusleaf/cf_atomic.h"
+#include "citrusleaf/cf_clock.h"
+#include "citrusleaf/cf_digest.h"
+
+#include "fault.h"
+#include "vmapx.h"
+
+#include "base/datamodel.h"
+#include "base/index.h"
+#include "storage/drv_ssd.h"
+
+
+//==========================================================
+// Forward declarations.
+//
+
+// Defined in thr_nsup.c, for historical reasons.
+extern bool as_cold_start_evict_if_needed(as_namespace* ns);
+
+
+//==========================================================
+// Constants & typedefs.
+//
+
+#define SNAPSHOT_MAGIC		0x4153534e41505331UL // "ASSNAPS1"
+#define SNAPSHOT_VERSION	1
+#define JOURNAL_MAGIC		0x41534a524e4c5331UL // "ASJRNLS1"
+
+#define FNV_INIT			0xcbf29ce484222325UL
+#define FNV_PRIME			0x100000001b3UL
+
+// Snapshot file layout:
+// - snapshot_header
+// - n_sets set names, each AS_SET_NAME_MAX_SIZE bytes (set-id is index + 1)
+// - n_open snapshot_wblock
+// - AS_PARTITIONS of: snapshot_partition followed by its snapshot_entry array
+// - snapshot_trailer
+
+typedef struct snapshot_header_s {
+	uint64_t	magic;
+	uint32_t	version;
+	uint32_t	epoch;
+	uint64_t	random;				// device set the snapshot belongs to
+	uint32_t	n_devices;
+	uint32_t	write_block_size;
+	uint32_t	n_sets;
+	uint32_t	n_open;				// wblocks being filled when epoch began
+} __attribute__((__packed__)) snapshot_header;
+
+typedef struct snapshot_wblock_s {
+	uint32_t	file_id;
+	uint32_t	wblock_id;
+} __attribute__((__packed__)) snapshot_wblock;
+
+typedef struct snapshot_partition_s {
+	uint32_t	pid;
+	uint32_t	n_entries;
+} __attribute__((__packed__)) snapshot_partition;
+
+typedef struct snapshot_entry_s {
+	cf_digest	keyd;
+	uint32_t	void_time;
+	uint16_t	generation;
+	uint16_t	set_id;
+	uint64_t	rblock_id;
+	uint16_t	n_rblocks;
+	uint8_t		file_id;
+	uint8_t		key_stored;
+} __attribute__((__packed__)) snapshot_entry;
+
+typedef struct snapshot_trailer_s {
+	uint64_t	n_entries;
+	uint64_t	checksum;			// FNV-1a of everything before the trailer
+} __attribute__((__packed__)) snapshot_trailer;
+
+// Journal file layout - journal_header followed by snapshot_wblock entries.
+typedef struct journal_header_s {
+	uint64_t	magic;
+	uint64_t	random;
+	uint32_t	epoch;
+	uint32_t	unused;
+} __attribute__((__packed__)) journal_header;
+
+struct ssd_snapshot_s {
+	drv_ssds		*ssds;
+
+	char			*path;
+	char			*tmp_path;
+	char			*journal_paths[2];	// by epoch parity
+
+	// Taken before journal_lock when both are needed.
+	pthread_mutex_t	sync_lock;
+	uint64_t		n_synced;			// journal entries known to be durable
+
+	pthread_mutex_t	journal_lock;
+	int				journal_fd;			// -1 until first snapshot begins
+	uint32_t		epoch;
+	uint64_t		n_journaled;		// journal entries ever written
+	bool			journal_failed;
+
+	pthread_t		thread;
+};
+
+// For gathering a partition's entries.
+typedef struct snapshot_collect_s {
+	as_namespace	*ns;
+	snapshot_entry	*entries;
+	uint32_t		n_entries;
+	uint32_t		capacity;
+} snapshot_collect;
+
+// For a pass over a snapshot file.
+typedef struct snapshot_reader_s {
+	drv_ssds		*ssds;
+	FILE			*fp;
+	uint64_t		checksum;
+	snapshot_header	header;
+	uint16_t		*set_ids;			// snapshot set-id -> our set-id
+	uint8_t			**replay_maps;		// per device, bit per wblock
+	bool			halted;				// eviction limit - stop adding
+	uint64_t		n_added;
+	uint64_t		n_dropped;			// pointed into replayed wblocks
+} snapshot_reader;
+
+
+//==========================================================
+// Forward declarations.
+//
+
+static void *run_snapshot(void *udata);
+static bool snapshot_write(ssd_snapshot *snap);
+static bool snapshot_begin_epoch(ssd_snapshot *snap);
+static void snapshot_invalidate(ssd_snapshot *snap);
+static void journal_fail(ssd_snapshot *snap);
+static void snapshot_collect_reduce_fn(as_index_ref *r_ref, void *udata);
+static bool snapshot_fwrite(FILE *fp, const void *buf, size_t size, uint64_t *checksum);
+static bool snapshot_fread(snapshot_reader *rdr, void *buf, size_t size);
+static bool snapshot_parse(snapshot_reader *rdr, bool apply);
+static void snapshot_apply_entry(snapshot_reader *rdr, as_partition_id pid, const snapshot_entry *e);
+static bool journal_read(snapshot_reader *rdr, const char *path, bool required);
+static void replay_map_set(snapshot_reader *rdr, uint32_t file_id, uint32_t wblock_id);
+static bool replay_map_test(snapshot_reader *rdr, uint32_t file_id, uint32_t wblock_id);
+
+static inline uint64_t
+fnv_update(uint64_t hash, const void *buf, size_t size)
+{
+	const uint8_t *p = (const uint8_t*)buf;
+	const uint8_t *end = p + size;
+
+	while (p < end) {
+		hash ^= (uint64_t)*p++;
+		hash *= FNV_PRIME;
+	}
+
+	return hash;
+}
+
+
+//==========================================================
+// Public API.
+//
+
+ssd_snapshot *
+ssd_snapshot_create(drv_ssds *ssds)
+{
+	as_namespace *ns = ssds->ns;
+
+	if (ns->storage_data_in_memory) {
+		cf_warning(AS_DRV_SSD, "{%s} index-snapshot-file ignored - data is in memory",
+				ns->name);
+		return NULL;
+	}
+
+	if (ns->ldt_enabled) {
+		cf_warning(AS_DRV_SSD, "{%s} index-snapshot-file ignored - ldt is enabled",
+				ns->name);
+		return NULL;
+	}
+
+	ssd_snapshot *snap = cf_malloc(sizeof(ssd_snapshot));
+
+	if (! snap) {
+		return NULL;
+	}
+
+	memset(snap, 0, sizeof(ssd_snapshot));
+
+	const char *path = ns->storage_index_snapshot_file;
+	size_t path_len = strlen(path);
+
+	snap->ssds = ssds;
+	snap->path = cf_strdup(path);
+	snap->tmp_path = cf_malloc(path_len + sizeof(".tmp"));
+	snap->journal_paths[0] = cf_malloc(path_len + sizeof(".journal-0"));
+	snap->journal_paths[1] = cf_malloc(path_len + sizeof(".journal-1"));
+
+	if (! snap->path || ! snap->tmp_path || ! snap->journal_paths[0] ||
+			! snap->journal_paths[1]) {
+		cf_crash(AS_DRV_SSD, "{%s} index snapshot allocation failed", ns->name);
+	}
+
+	sprintf(snap->tmp_path, "%s.tmp", path);
+	sprintf(snap->journal_paths[0], "%s.journal-0", path);
+	sprintf(snap->journal_paths[1], "%s.journal-1", path);
+
+	pthread_mutex_init(&snap->sync_lock, NULL);
+	pthread_mutex_init(&snap->journal_lock, NULL);
+	snap->journal_fd = -1;
+
+	return snap;
+}
+
+
+// Called during cold start, before the devices are read. If a valid snapshot
+// is found, adds its entries to the index and sets each device's replay list.
+// Returns false if the devices must be swept as usual.
+bool
+ssd_snapshot_load(drv_ssds *ssds, uint64_t prev_random)
+{
+	ssd_snapshot *snap = ssds->snapshot;
+	as_namespace *ns = ssds->ns;
+
+	snapshot_reader rdr;
+
+	memset(&rdr, 0, sizeof(rdr));
+	rdr.ssds = ssds;
+
+	if (! (rdr.fp = fopen(snap->path, "r"))) {
+		if (errno == ENOENT) {
+			cf_info(AS_DRV_SSD, "{%s} no index snapshot %s", ns->name,
+					snap->path);
+		}
+		else {
+			cf_warning(AS_DRV_SSD, "{%s} can't open index snapshot %s: %s",
+					ns->name, snap->path, cf_strerror(errno));
+		}
+
+		return false;
+	}
+
+	bool ok = false;
+
+	// First pass - validate structure and checksum before touching the index.
+	if (! snapshot_parse(&rdr, false)) {
+		goto Done;
+	}
+
+	snapshot_header *h = &rdr.header;
+
+	if (h->random != prev_random) {
+		cf_warning(AS_DRV_SSD, "{%s} index snapshot %s is for another device state",
+				ns->name, snap->path);
+		goto Done;
+	}
+
+	for (int i = 0; i < ssds->n_ssds; i++) {
+		if (ssds->ssds[i].started_fresh) {
+			cf_warning(AS_DRV_SSD, "{%s} index snapshot unusable - device %s is fresh",
+					ns->name, ssds->ssds[i].name);
+			goto Done;
+		}
+	}
+
+	if (! (rdr.replay_maps = cf_malloc(ssds->n_ssds * sizeof(uint8_t*)))) {
+		cf_crash(AS_DRV_SSD, "{%s} index snapshot allocation failed", ns->name);
+	}
+
+	for (int i = 0; i < ssds->n_ssds; i++) {
+		size_t map_size = (ssds->ssds[i].alloc_table->n_wblocks + 7) / 8;
+
+		if (! (rdr.replay_maps[i] = cf_malloc(map_size))) {
+			cf_crash(AS_DRV_SSD, "{%s} index snapshot allocation failed",
+					ns->name);
+		}
+
+		memset(rdr.replay_maps[i], 0, map_size);
+	}
+
+	// The journal of the snapshot's epoch must be intact. A snapshot of the
+	// next epoch may have been in progress, in which case its journal also
+	// lists wblocks written since.
+	if (! journal_read(&rdr, snap->journal_paths[h->epoch & 1], true) ||
+			! journal_read(&rdr, snap->journal_paths[(h->epoch + 1) & 1],
+					false)) {
+		goto Done;
+	}
+
+	// Second pass - add the entries to the index.
+	rewind(rdr.fp);
+
+	if (! snapshot_parse(&rdr, true)) {
+		// Checksum passed, so this would mean the file changed under us.
+		cf_crash(AS_DRV_SSD, "{%s} index snapshot %s failed second pass",
+				ns->name, snap->path);
+	}
+
+	for (int i = 0; i < ssds->n_ssds; i++) {
+		drv_ssd *ssd = &ssds->ssds[i];
+		uint32_t first_id = BYTES_TO_WBLOCK_ID(ssd, ssd->header_size);
+		uint32_t n_wblocks = ssd->alloc_table->n_wblocks;
+		uint32_t n_replay = 0;
+
+		for (uint32_t w = first_id; w < n_wblocks; w++) {
+			if (replay_map_test(&rdr, i, w)) {
+				n_replay++;
+			}
+		}
+
+		// Allocate at least one element - non-NULL means "replay only".
+		if (! (ssd->replay_wblock_ids =
+				cf_malloc((n_replay + 1) * sizeof(uint32_t)))) {
+			cf_crash(AS_DRV_SSD, "{%s} index snapshot allocation failed",
+					ns->name);
+		}
+
+		for (uint32_t w = first_id; w < n_wblocks; w++) {
+			if (replay_map_test(&rdr, i, w)) {
+				ssd->replay_wblock_ids[ssd->n_replay_wblocks++] = w;
+			}
+		}
+
+		cf_info(AS_DRV_SSD, "device %s: %u of %u wblocks written since index snapshot",
+				ssd->name, n_replay, n_wblocks - first_id);
+	}
+
+	cf_info(AS_DRV_SSD, "{%s} loaded index snapshot epoch %u: added %"PRIu64", dropped %"PRIu64"%s",
+			ns->name, h->epoch, rdr.n_added, rdr.n_dropped,
+			rdr.halted ? " (halted by eviction limit)" : "");
+
+	ok = true;
+
+Done:
+
+	fclose(rdr.fp);
+
+	if (rdr.set_ids) {
+		cf_free(rdr.set_ids);
+	}
+
+	if (rdr.replay_maps) {
+		for (int i = 0; i < ssds->n_ssds; i++) {
+			cf_free(rdr.replay_maps[i]);
+		}
+
+		cf_free(rdr.replay_maps);
+	}
+
+	return ok;
+}
+
+
+void
+ssd_snapshot_start(drv_ssds *ssds)
+{
+	ssd_snapshot *snap = ssds->snapshot;
+
+	if (! snap) {
+		return;
+	}
+
+	cf_info(AS_DRV_SSD, "{%s} starting index snapshot thread - period %u sec",
+			ssds->ns->name, ssds->ns->storage_index_snapshot_period);
+
+	if (pthread_create(&snap->thread, NULL, run_snapshot, (void*)snap) != 0) {
+		cf_crash(AS_DRV_SSD, "{%s} can't create index snapshot thread",
+				ssds->ns->name);
+	}
+}
+
+
+// Called when a wblock is taken off the free queue, after it's been attached
+// to its swb. Returns the journal sequence number to sync before flushing.
+uint64_t
+ssd_snapshot_journal_add(drv_ssd *ssd, uint32_t wblock_id)
+{
+	ssd_snapshot *snap = ((drv_ssds*)ssd->ns->storage_private)->snapshot;
+
+	if (! snap) {
+		return 0;
+	}
+
+	snapshot_wblock entry = { (uint32_t)ssd->file_id, wblock_id };
+
+	pthread_mutex_lock(&snap->journal_lock);
+
+	if (snap->journal_fd == -1 || snap->journal_failed) {
+		pthread_mutex_unlock(&snap->journal_lock);
+		return 0;
+	}
+
+	if (write(snap->journal_fd, &entry, sizeof(entry)) != sizeof(entry)) {
+		cf_warning(AS_DRV_SSD, "{%s} index snapshot journal write failed: %s",
+				ssd->ns->name, cf_strerror(errno));
+		pthread_mutex_unlock(&snap->journal_lock);
+
+		journal_fail(snap);
+		return 0;
+	}
+
+	uint64_t journal_seq = ++snap->n_journaled;
+
+	pthread_mutex_unlock(&snap->journal_lock);
+
+	return journal_seq;
+}
+
+
+// Called before flushing an swb - makes sure its wblock's journal entry is
+// durable. One sync covers all entries written so far.
+void
+ssd_snapshot_journal_sync(drv_ssd *ssd, uint64_t journal_seq)
+{
+	if (journal_seq == 0) {
+		return;
+	}
+
+	ssd_snapshot *snap = ((drv_ssds*)ssd->ns->storage_private)->snapshot;
+
+	pthread_mutex_lock(&snap->sync_lock);
+
+	if (journal_seq > snap->n_synced) {
+		pthread_mutex_lock(&snap->journal_lock);
+
+		int fd = snap->journal_fd;
+		uint64_t n_journaled = snap->n_journaled;
+
+		pthread_mutex_unlock(&snap->journal_lock);
+
+		// The fd can't be closed under us - that needs the sync lock.
+		if (fd != -1 && fdatasync(fd) != 0) {
+			cf_warning(AS_DRV_SSD, "{%s} index snapshot journal sync failed: %s",
+					ssd->ns->name, cf_strerror(errno));
+			journal_fail(snap);
+		}
+
+		snap->n_synced = n_journaled;
+	}
+
+	pthread_mutex_unlock(&snap->sync_lock);
+}
+
+
+//==========================================================
+// Local helpers - taking snapshots.
+//
+
+static void *
+run_snapshot(void *udata)
+{
+	ssd_snapshot *snap = (ssd_snapshot*)udata;
+	as_namespace *ns = snap->ssds->ns;
+
+	// After a restart the previous snapshot no longer matches the devices, so
+	// take one right away.
+	while (true) {
+		uint64_t start_ms = cf_getms();
+
+		if (snapshot_write(snap)) {
+			cf_info(AS_DRV_SSD, "{%s} index snapshot epoch %u took %"PRIu64" ms",
+					ns->name, snap->epoch, cf_getms() - start_ms);
+		}
+
+		sleep(ns->storage_index_snapshot_period);
+	}
+
+	return NULL;
+}
+
+
+static bool
+snapshot_write(ssd_snapshot *snap)
+{
+	drv_ssds *ssds = snap->ssds;
+	as_namespace *ns = ssds->ns;
+
+	if (! snapshot_begin_epoch(snap)) {
+		snapshot_invalidate(snap);
+		return false;
+	}
+
+	FILE *fp = fopen(snap->tmp_path, "w");
+
+	if (! fp) {
+		cf_warning(AS_DRV_SSD, "{%s} can't create index snapshot %s: %s",
+				ns->name, snap->tmp_path, cf_strerror(errno));
+		snapshot_invalidate(snap);
+		return false;
+	}
+
+	uint64_t checksum = FNV_INIT;
+	uint64_t n_entries = 0;
+	bool ok = false;
+
+	// Wblocks being filled now may get more records this epoch, but won't be
+	// journaled - note them. Anything allocated from here on is journaled.
+	uint32_t n_open = 0;
+	uint32_t open_capacity = 64;
+	snapshot_wblock *open = cf_malloc(open_capacity * sizeof(snapshot_wblock));
+
+	snapshot_collect collect = { ns, NULL, 0, 0 };
+
+	if (! open) {
+		goto Done;
+	}
+
+	for (int i = 0; i < ssds->n_ssds; i++) {
+		ssd_alloc_table *at = ssds->ssds[i].alloc_table;
+
+		for (uint32_t w = 0; w < at->n_wblocks; w++) {
+			ssd_wblock_state *wblock_state = &at->wblock_state[w];
+
+			pthread_mutex_lock(&wblock_state->LOCK);
+
+			bool has_swb = wblock_state->swb != NULL;
+
+			pthread_mutex_unlock(&wblock_state->LOCK);
+
+			if (! has_swb) {
+				continue;
+			}
+
+			if (n_open == open_capacity) {
+				open_capacity *= 2;
+
+				snapshot_wblock *new_open = cf_realloc(open,
+						open_capacity * sizeof(snapshot_wblock));
+
+				if (! new_open) {
+					goto Done;
+				}
+
+				open = new_open;
+			}
+
+			open[n_open].file_id = (uint32_t)i;
+			open[n_open].wblock_id = w;
+			n_open++;
+		}
+	}
+
+	uint32_t n_sets = cf_vmapx_count(ns->p_sets_vmap);
+
+	snapshot_header header = {
+			.magic = SNAPSHOT_MAGIC,
+			.version = SNAPSHOT_VERSION,
+			.epoch = snap->epoch,
+			.random = ssds->header->random,
+			.n_devices = (uint32_t)ssds->n_ssds,
+			.write_block_size = ns->storage_write_block_size,
+			.n_sets = n_sets,
+			.n_open = n_open
+	};
+
+	if (! snapshot_fwrite(fp, &header, sizeof(header), &checksum)) {
+		goto Done;
+	}
+
+	for (uint32_t i = 0; i < n_sets; i++) {
+		char name[AS_SET_NAME_MAX_SIZE];
+		const char *set_name = as_namespace_get_set_name(ns, (uint16_t)(i + 1));
+
+		memset(name, 0, sizeof(name));
+
+		if (set_name) {
+			strncpy(name, set_name, sizeof(name) - 1);
+		}
+
+		if (! snapshot_fwrite(fp, name, sizeof(name), &checksum)) {
+			goto Done;
+		}
+	}
+
+	if (! snapshot_fwrite(fp, open, n_open * sizeof(snapshot_wblock),
+			&checksum)) {
+		goto Done;
+	}
+
+	for (uint32_t pid = 0; pid < AS_PARTITIONS; pid++) {
+		collect.n_entries = 0;
+
+		// Callback holds each record's lock while copying its entry.
+		as_index_reduce(ns->partitions[pid].vp, snapshot_collect_reduce_fn,
+				&collect);
+
+		snapshot_partition partition = { pid, collect.n_entries };
+
+		if (! snapshot_fwrite(fp, &partition, sizeof(partition), &checksum) ||
+				! snapshot_fwrite(fp, collect.entries,
+						collect.n_entries * sizeof(snapshot_entry),
+						&checksum)) {
+			goto Done;
+		}
+
+		n_entries += collect.n_entries;
+	}
+
+	snapshot_trailer trailer = { n_entries, checksum };
+
+	if (fwrite(&trailer, sizeof(trailer), 1, fp) != 1 || fflush(fp) != 0 ||
+			fsync(fileno(fp)) != 0) {
+		goto Done;
+	}
+
+	ok = true;
+
+Done:
+
+	if (fclose(fp) != 0) {
+		ok = false;
+	}
+
+	if (collect.entries) {
+		cf_free(collect.entries);
+	}
+
+	if (open) {
+		cf_free(open);
+	}
+
+	if (ok) {
+		// Don't commit if this epoch's journal is incomplete. Holding the lock
+		// means a journal failure after this check removes the new snapshot.
+		pthread_mutex_lock(&snap->journal_lock);
+
+		if (snap->journal_failed || rename(snap->tmp_path, snap->path) != 0) {
+			ok = false;
+		}
+
+		pthread_mutex_unlock(&snap->journal_lock);
+	}
+
+	if (! ok) {
+		cf_warning(AS_DRV_SSD, "{%s} failed writing index snapshot %s: %s",
+				ns->name, snap->path, cf_strerror(errno));
+		unlink(snap->tmp_path);
+
+		// The next epoch would truncate the previous snapshot's journal.
+		snapshot_invalidate(snap);
+		return false;
+	}
+
+	return true;
+}
+
+
+// Switch journal files - entries from now on belong to the new epoch.
+static bool
+snapshot_begin_epoch(ssd_snapshot *snap)
+{
+	drv_ssds *ssds = snap->ssds;
+	bool ok = true;
+
+	pthread_mutex_lock(&snap->sync_lock);
+	pthread_mutex_lock(&snap->journal_lock);
+
+	// Entries of the old epoch that haven't been synced still matter (until
+	// the new snapshot is complete) - sync them before switching.
+	if (snap->journal_fd != -1) {
+		if (fdatasync(snap->journal_fd) != 0) {
+			ok = false;
+		}
+
+		close(snap->journal_fd);
+		snap->journal_fd = -1;
+	}
+
+	snap->n_synced = snap->n_journaled;
+
+	uint32_t epoch = snap->epoch + 1;
+	const char *path = snap->journal_paths[epoch & 1];
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+			S_IRUSR | S_IWUSR);
+
+	if (fd == -1) {
+		cf_warning(AS_DRV_SSD, "{%s} can't create index snapshot journal %s: %s",
+				ssds->ns->name, path, cf_strerror(errno));
+		ok = false;
+	}
+	else {
+		journal_header header = {
+				.magic = JOURNAL_MAGIC,
+				.random = ssds->header->random,
+				.epoch = epoch,
+				.unused = 0
+		};
+
+		if (write(fd, &header, sizeof(header)) != sizeof(header) ||
+				fdatasync(fd) != 0) {
+			cf_warning(AS_DRV_SSD, "{%s} can't write index snapshot journal %s: %s",
+					ssds->ns->name, path, cf_strerror(errno));
+			close(fd);
+			ok = false;
+		}
+		else {
+			snap->journal_fd = fd;
+		}
+	}
+
+	snap->epoch = epoch;
+	snap->journal_failed = ! ok;
+
+	pthread_mutex_unlock(&snap->journal_lock);
+	pthread_mutex_unlock(&snap->sync_lock);
+
+	return ok;
+}
+
+
+// Remove the last complete snapshot - restart will be a full cold start.
+static void
+snapshot_invalidate(ssd_snapshot *snap)
+{
+	if (unlink(snap->path) != 0 && errno != ENOENT) {
+		cf_warning(AS_DRV_SSD, "{%s} can't remove index snapshot %s: %s",
+				snap->ssds->ns->name, snap->path, cf_strerror(errno));
+	}
+}
+
+
+// Journal entries may be lost - neither the last complete snapshot nor the one
+// being taken can be trusted.
+static void
+journal_fail(ssd_snapshot *snap)
+{
+	pthread_mutex_lock(&snap->journal_lock);
+	snap->journal_failed = true;
+	pthread_mutex_unlock(&snap->journal_lock);
+
+	snapshot_invalidate(snap);
+}
+
+
+static void
+snapshot_collect_reduce_fn(as_index_ref *r_ref, void *udata)
+{
+	snapshot_collect *collect = (snapshot_collect*)udata;
+	as_index *r = r_ref->r;
+
+	if (collect->n_entries == collect->capacity) {
+		uint32_t capacity = collect->capacity == 0 ?
+				1024 : collect->capacity * 2;
+		snapshot_entry *entries = cf_realloc(collect->entries,
+				capacity * sizeof(snapshot_entry));
+
+		if (! entries) {
+			cf_crash(AS_DRV_SSD, "{%s} index snapshot allocation failed",
+					collect->ns->name);
+		}
+
+		collect->entries = entries;
+		collect->capacity = capacity;
+	}
+
+	// Skip records in the midst of being created.
+	if (STORAGE_RBLOCK_IS_VALID(r->storage_key.ssd.rblock_id) &&
+			r->storage_key.ssd.rblock_id != 0) {
+		snapshot_entry *e = &collect->entries[collect->n_entries++];
+
+		e->keyd = r->key;
+		e->void_time = r->void_time;
+		e->generation = r->generation;
+		e->set_id = as_index_get_set_id(r);
+		e->rblock_id = r->storage_key.ssd.rblock_id;
+		e->n_rblocks = (uint16_t)r->storage_key.ssd.n_rblocks;
+		e->file_id = (uint8_t)r->storage_key.ssd.file_id;
+		e->key_stored = as_index_is_flag_set(r, AS_INDEX_FLAG_KEY_STORED) ?
+				1 : 0;
+	}
+
+	as_record_done(r_ref, collect->ns);
+}
+
+
+static bool
+snapshot_fwrite(FILE *fp, const void *buf, size_t size, uint64_t *checksum)
+{
+	if (size == 0) {
+		return true;
+	}
+
+	*checksum = fnv_update(*checksum, buf, size);
+
+	return fwrite(buf, size, 1, fp) == 1;
+}
+
+
+//==========================================================
+// Local helpers - loading snapshots.
+//
+
+static bool
+snapshot_fread(snapshot_reader *rdr, void *buf, size_t size)
+{
+	if (size == 0) {
+		return true;
+	}
+
+	if (fread(buf, size, 1, rdr->fp) != 1) {
+		return false;
+	}
+
+	rdr->checksum = fnv_update(rdr->checksum, buf, size);
+
+	return true;
+}
+
+
+// One pass over the snapshot file. Without apply, validates it and maps its
+// set-ids. With apply, adds its entries to the index.
+static bool
+snapshot_parse(snapshot_reader *rdr, bool apply)
+{
+	drv_ssds *ssds = rdr->ssds;
+	as_namespace *ns = ssds->ns;
+	snapshot_header *h = &rdr->header;
+
+	rdr->checksum = FNV_INIT;
+
+	if (! snapshot_fread(rdr, h, sizeof(snapshot_header))) {
+		goto Corrupt;
+	}
+
+	if (h->magic != SNAPSHOT_MAGIC || h->version != SNAPSHOT_VERSION) {
+		cf_warning(AS_DRV_SSD, "{%s} index snapshot %s has bad magic or version",
+				ns->name, ssds->snapshot->path);
+		return false;
+	}
+
+	if (h->n_devices != (uint32_t)ssds->n_ssds ||
+			h->write_block_size != ns->storage_write_block_size) {
+		cf_warning(AS_DRV_SSD, "{%s} index snapshot %s device config mismatch",
+				ns->name, ssds->snapshot->path);
+		return false;
+	}
+
+	if (! apply) {
+		if (! (rdr->set_ids = cf_malloc((h->n_sets + 1) * sizeof(uint16_t)))) {
+			cf_crash(AS_DRV_SSD, "{%s} index snapshot allocation failed",
+					ns->name);
+		}
+
+		rdr->set_ids[0] = INVALID_SET_ID;
+	}
+
+	for (uint32_t i = 0; i < h->n_sets; i++) {
+		char name[AS_SET_NAME_MAX_SIZE];
+
+		if (! snapshot_fread(rdr, name, sizeof(name))) {
+			goto Corrupt;
+		}
+
+		name[sizeof(name) - 1] = 0;
+
+		// Only map sets once the file is known to be good.
+		if (apply) {
+			if (name[0] == 0 || as_namespace_get_create_set(ns, name,
+					&rdr->set_ids[i + 1], false) != 0) {
+				rdr->set_ids[i + 1] = INVALID_SET_ID;
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < h->n_open; i++) {
+		snapshot_wblock open;
+
+		if (! snapshot_fread(rdr, &open, sizeof(open))) {
+			goto Corrupt;
+		}
+
+		if (open.file_id >= (uint32_t)ssds->n_ssds ||
+				open.wblock_id >=
+						ssds->ssds[open.file_id].alloc_table->n_wblocks) {
+			goto Corrupt;
+		}
+
+		if (apply) {
+			replay_map_set(rdr, open.file_id, open.wblock_id);
+		}
+	}
+
+	uint64_t n_entries = 0;
+
+	for (uint32_t pid = 0; pid < AS_PARTITIONS; pid++) {
+		snapshot_partition partition;
+
+		if (! snapshot_fread(rdr, &partition, sizeof(partition)) ||
+				partition.pid != pid) {
+			goto Corrupt;
+		}
+
+		for (uint32_t i = 0; i < partition.n_entries; i++) {
+			snapshot_entry e;
+
+			if (! snapshot_fread(rdr, &e, sizeof(e))) {
+				goto Corrupt;
+			}
+
+			if (e.file_id >= ssds->n_ssds || e.set_id > h->n_sets ||
+					as_partition_getid(e.keyd) != pid) {
+				goto Corrupt;
+			}
+
+			if (apply && ! rdr->halted) {
+				snapshot_apply_entry(rdr, pid, &e);
+			}
+		}
+
+		n_entries += partition.n_entries;
+	}
+
+	uint64_t checksum = rdr->checksum;
+	snapshot_trailer trailer;
+
+	if (fread(&trailer, sizeof(trailer), 1, rdr->fp) != 1 ||
+			trailer.n_entries != n_entries || trailer.checksum != checksum) {
+		goto Corrupt;
+	}
+
+	return true;
+
+Corrupt:
+
+	cf_warning(AS_DRV_SSD, "{%s} index snapshot %s is truncated or corrupt",
+			ns->name, ssds->snapshot->path);
+
+	return false;
+}
+
+
+// Like ssd_record_add(), but from a snapshot entry instead of a device block.
+static void
+snapshot_apply_entry(snapshot_reader *rdr, as_partition_id pid,
+		const snapshot_entry *e)
+{
+	drv_ssds *ssds = rdr->ssds;
+
+	if (! ssds->get_state_from_storage[pid]) {
+		return;
+	}
+
+	drv_ssd *ssd = &ssds->ssds[e->file_id];
+	uint32_t wblock_id = RBLOCK_ID_TO_WBLOCK_ID(ssd, e->rblock_id);
+
+	// The wblock was rewritten since the snapshot - its records get added when
+	// it's replayed.
+	if (wblock_id >= ssd->alloc_table->n_wblocks ||
+			replay_map_test(rdr, e->file_id, wblock_id)) {
+		rdr->n_dropped++;
+		return;
+	}
+
+	as_namespace *ns = ssds->ns;
+
+	if (! as_cold_start_evict_if_needed(ns)) {
+		cf_warning(AS_DRV_SSD, "{%s} index snapshot load halting", ns->name);
+		rdr->halted = true;
+		return;
+	}
+
+	if (e->void_time != 0) {
+		if (e->void_time < cf_atomic32_get(ns->cold_start_threshold_void_time)) {
+			cf_atomic64_incr(&ssd->record_add_expired_counter);
+			return;
+		}
+
+		if (ns->max_ttl != 0 && e->void_time > ns->cold_start_max_void_time) {
+			cf_atomic64_incr(&ssd->record_add_max_ttl_counter);
+			return;
+		}
+	}
+
+	as_partition *p_partition = &ns->partitions[pid];
+	cf_digest keyd = e->keyd;
+	as_index_ref r_ref;
+
+	r_ref.skip_lock = false;
+
+	int rv = as_record_get_create(p_partition->vp, &keyd, &r_ref, ns);
+
+	if (rv < 0) {
+		cf_warning_digest(AS_DRV_SSD, &keyd, "snapshot load as_record_get_create() failed ");
+		return;
+	}
+
+	if (rv == 0) {
+		// Snapshots have one entry per digest - shouldn't get here.
+		as_record_done(&r_ref, ns);
+		cf_atomic64_incr(&ssd->record_add_generation_counter);
+		return;
+	}
+
+	as_index *r = r_ref.r;
+
+	as_partition_expire_index_update(p_partition, &r->key, r->void_time, e->void_time);
+
+	r->void_time = e->void_time;
+	r->generation = e->generation;
+
+	cf_atomic_int_setmax(&p_partition->max_void_time, r->void_time);
+	cf_atomic_int_setmax(&ns->max_void_time, r->void_time);
+
+	if (e->set_id != INVALID_SET_ID) {
+		as_index_set_set_id(r, rdr->set_ids[e->set_id]);
+	}
+
+	if (e->key_stored) {
+		as_index_set_flags(r, AS_INDEX_FLAG_KEY_STORED);
+	}
+
+	uint32_t size = (uint32_t)RBLOCKS_TO_BYTES(e->n_rblocks);
+
+	cf_atomic64_add(&ssd->inuse_size, (int64_t)size);
+	cf_atomic32_add(&ssd->alloc_table->wblock_state[wblock_id].inuse_sz,
+			(int32_t)size);
+
+	r->storage_key.ssd.file_id = e->file_id;
+	r->storage_key.ssd.rblock_id = e->rblock_id;
+	r->storage_key.ssd.n_rblocks = e->n_rblocks;
+
+	as_record_done(&r_ref, ns);
+
+	cf_atomic64_incr(&ssd->record_add_unique_counter);
+	rdr->n_added++;
+}
+
+
+// Mark a journal's wblocks for replay. A torn last entry (crash while
+// appending) is ignored - its wblock was never flushed.
+static bool
+journal_read(snapshot_reader *rdr, const char *path, bool required)
+{
+	as_namespace *ns = rdr->ssds->ns;
+	snapshot_header *h = &rdr->header;
+	FILE *fp = fopen(path, "r");
+
+	if (! fp) {
+		if (required) {
+			cf_warning(AS_DRV_SSD, "{%s} can't open index snapshot journal %s: %s",
+					ns->name, path, cf_strerror(errno));
+		}
+
+		return ! required;
+	}
+
+	journal_header header;
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+			header.magic != JOURNAL_MAGIC || header.random != h->random ||
+			(header.epoch != h->epoch && header.epoch != h->epoch + 1)) {
+		fclose(fp);
+
+		if (required) {
+			cf_warning(AS_DRV_SSD, "{%s} index snapshot journal %s doesn't match snapshot",
+					ns->name, path);
+		}
+
+		return ! required;
+	}
+
+	snapshot_wblock entry;
+	uint32_t n_entries = 0;
+
+	while (fread(&entry, sizeof(entry), 1, fp) == 1) {
+		if (entry.file_id >= (uint32_t)rdr->ssds->n_ssds ||
+				entry.wblock_id >=
+						rdr->ssds->ssds[entry.file_id].alloc_table->n_wblocks) {
+			fclose(fp);
+			cf_warning(AS_DRV_SSD, "{%s} index snapshot journal %s is corrupt",
+					ns->name, path);
+			return false;
+		}
+
+		replay_map_set(rdr, entry.file_id, entry.wblock_id);
+		n_entries++;
+	}
+
+	fclose(fp);
+
+	cf_info(AS_DRV_SSD, "{%s} index snapshot journal epoch %u has %u wblocks",
+			ns->name, header.epoch, n_entries);
+
+	return true;
+}
+
+
+static void
+replay_map_set(snapshot_reader *rdr, uint32_t file_id, uint32_t wblock_id)
+{
+	rdr->replay_maps[file_id][wblock_id >> 3] |= (uint8_t)(1 << (wblock_id & 7));
+}
+
+
+static bool
+replay_map_test(snapshot_reader *rdr, uint32_t file_id, uint32_t wblock_id)
+{
+	return (rdr->replay_maps[file_id][wblock_id >> 3] &
+			(uint8_t)(1 << (wblock_id & 7))) != 0;
+}
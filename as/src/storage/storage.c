@@ -486,6 +486,50 @@ as_storage_has_space(as_namespace *ns)
 	return true;
 }
 
+//--------------------------------------
+// as_storage_record_prefetch
+//
+
+typedef bool (*as_storage_record_prefetch_fn)(as_namespace *ns, as_record *r, as_storage_prefetch_fn cb, void *udata);
+static const as_storage_record_prefetch_fn as_storage_record_prefetch_table[AS_STORAGE_ENGINE_TYPES] = {
+	NULL,
+	0, // memory has no record read
+	as_storage_record_prefetch_ssd,
+	0  // kv doesn't support prefetch
+};
+
+bool
+as_storage_record_prefetch(as_namespace *ns, as_record *r, as_storage_prefetch_fn cb, void *udata)
+{
+	if (as_storage_record_prefetch_table[ns->storage_type]) {
+		return as_storage_record_prefetch_table[ns->storage_type](ns, r, cb, udata);
+	}
+
+	return false;
+}
+
+//--------------------------------------
+// as_storage_scan_device
+//
+
+typedef int (*as_storage_scan_device_fn)(as_namespace *ns, uint32_t device_ix, as_storage_scan_fn cb, as_storage_scan_flush_fn flush_cb, void *udata);
+static const as_storage_scan_device_fn as_storage_scan_device_table[AS_STORAGE_ENGINE_TYPES] = {
+	NULL,
+	0, // memory has no devices to scan
+	as_storage_scan_device_ssd,
+	0  // kv doesn't support device scan
+};
+
+int
+as_storage_scan_device(as_namespace *ns, uint32_t device_ix, as_storage_scan_fn cb, as_storage_scan_flush_fn flush_cb, void *udata)
+{
+	if (as_storage_scan_device_table[ns->storage_type]) {
+		return as_storage_scan_device_table[ns->storage_type](ns, device_ix, cb, flush_cb, udata);
+	}
+
+	return -1;
+}
+
 //--------------------------------------
 // as_storage_info_set
 //
@@ -820,3 +864,16 @@ as_storage_shutdown(void)
 
   	cf_info(AS_STORAGE, "completed flushing to storage");
 };
+
+// Only the ssd engine prefetches.
+void
+as_storage_prefetch_attach(as_storage_prefetch *pf)
+{
+	as_storage_prefetch_attach_ssd(pf);
+}
+
+void
+as_storage_prefetch_destroy(as_storage_prefetch *pf)
+{
+	as_storage_prefetch_destroy_ssd(pf);
+}
@@ -33,10 +33,26 @@
 // Histogram with logarithmic buckets, used for all the
 // latency metrics.
 //
+// Each CPU inserts into shard cpu % HIST_N_SHARDS,
+// allocated on first use, so inserts rarely contend -
+// shards are merged on read. Shards are ~16KB, so their
+// number is capped to bound the memory of the many
+// histograms (7 per sindex). Alongside the power-of-2
+// buckets, each shard keeps HDR-style sub-buckets, which
+// split every power of 2 into 2^HIST_SUB_BITS linear
+// slices. These are in microseconds for time histograms,
+// whatever the scale, and give percentiles to within
+// 1 / 2^HIST_SUB_BITS (under 2%).
+//
 
 #define N_BUCKETS (1 + 64)
 #define HISTOGRAM_NAME_SIZE 128
 
+#define HIST_N_SHARDS 16
+#define HIST_SUB_BITS 6
+#define HIST_MAX_BITS 36 // sub-bucketed values are capped below 2^36
+#define HIST_N_SUB_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
 typedef enum {
 	HIST_MILLISECONDS,
 	HIST_MICROSECONDS,
@@ -48,22 +64,45 @@ typedef enum {
 #define HIST_TAG_MICROSECONDS	"usec"
 #define HIST_TAG_RAW			"count"
 
+typedef struct histogram_shard_s {
+	uint64_t counts[N_BUCKETS];
+	uint64_t sub_counts[HIST_N_SUB_BUCKETS];
+	uint64_t max;
+} histogram_shard;
+
 // DO NOT access this member data directly - use the API!
 // (Except for cf_hist_track, for which histogram is a base class.)
 typedef struct histogram_s {
 	char name[HISTOGRAM_NAME_SIZE];
 	const char* scale_tag;
 	uint32_t time_div;
-	cf_atomic64 counts[N_BUCKETS];
+	histogram_shard* shards[HIST_N_SHARDS];
 } histogram;
 
+typedef struct histogram_percentiles_s {
+	uint64_t count;
+	uint64_t p50;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+} histogram_percentiles;
+
 extern histogram *histogram_create(const char *name, histogram_scale scale);
+extern void histogram_destroy(histogram *h);
 extern void histogram_clear(histogram *h);
 extern void histogram_dump(histogram *h );
 
 extern void histogram_insert_data_point(histogram *h, uint64_t start_ns);
 extern void histogram_insert_raw(histogram *h, uint64_t value);
 
+extern uint64_t histogram_get_counts(histogram *h, uint64_t counts[]);
+extern void histogram_get_percentiles(histogram *h, histogram_percentiles *p);
+extern void histogram_get_percentiles_info(histogram *h, cf_dyn_buf *db);
+
+// For derived classes (cf_hist_track) - set up and tear down the base.
+extern bool histogram_init(histogram *h, const char *name, histogram_scale scale);
+extern void histogram_release(histogram *h);
+
 
 //==========================================================
 // Histogram with linear buckets, used by the eviction
@@ -79,6 +79,9 @@ void cf_hist_track_get_info(cf_hist_track* this, uint32_t back_sec,
 		uint32_t duration_sec, uint32_t slice_sec, bool throughput_only,
 		cf_hist_track_info_format info_fmt, cf_dyn_buf* db_p);
 
+// Pass-through to base histogram - current percentiles, not from cache:
+void cf_hist_track_get_percentiles_info(cf_hist_track* this, cf_dyn_buf* db_p);
+
 //------------------------------------------------
 // Get Current Settings
 //
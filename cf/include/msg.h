@@ -35,6 +35,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/uio.h>
 #include <citrusleaf/cf_atomic.h>
 #include <citrusleaf/cf_types.h>
 #include "dynbuf.h"
@@ -177,6 +178,14 @@ extern int msg_get_initial(uint32_t *size, msg_type *type, const uint8_t *buf, c
 // msg_tobuf - Parse a message out into a buffer.
 extern int msg_fillbuf(const msg *m, uint8_t *buf, size_t *buflen);
 
+// msg_fill_iov - Like msg_fillbuf, but fields of at least ref_min bytes are
+// referenced in place by the iovecs instead of being copied into buf - the msg
+// must therefore not be modified or freed until the iovecs have been written.
+// On return buflen is the number of bytes of buf used and n_iov the number of
+// iovecs filled. Returns -2 (buflen set to size needed) if buf is too small,
+// -3 (n_iov set to count needed) if there are not enough iovecs.
+extern int msg_fill_iov(const msg *m, uint8_t *buf, size_t *buflen, struct iovec *iov, int *n_iov, size_t ref_min);
+
 // msg_reset - After a message has been parsed, and the information consumed,
 // reset all the internal pointers for another parse.
 extern void msg_reset(msg *m);
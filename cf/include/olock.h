@@ -29,17 +29,21 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <citrusleaf/cf_atomic.h>
 #include <citrusleaf/cf_digest.h>
 
 
 typedef struct olock_s {
 	uint32_t n_locks;
 	uint32_t mask;
+	cf_atomic64 n_contended;	// vlocks that had to wait
+	cf_atomic64 wait_ns;		// total time vlocks waited
 	pthread_mutex_t locks[];
 } olock;
 
 void olock_lock(olock *ol, cf_digest *d);
-void olock_vlock(olock *ol, cf_digest *d, pthread_mutex_t **vlock);
+// Returns how long it waited for the lock in ns - 0 if uncontended.
+uint64_t olock_vlock(olock *ol, cf_digest *d, pthread_mutex_t **vlock);
 void olock_unlock(olock *ol, cf_digest *d);
 olock *olock_create(uint32_t n_locks, bool mutex);
 void olock_destroy(olock *o);
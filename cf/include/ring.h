@@ -0,0 +1,65 @@
+/*
+ * ring.h
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* SYNOPSIS
+ *  This is the declarations file for a bounded, lock-free ring of fixed-size
+ *  elements. Any number of threads may push and pop concurrently (multiple
+ *  producers, multiple consumers.) Elements are copied in and out by value.
+ *
+ *  The ring does not block - push fails when the ring is full, and pop fails
+ *  when it's empty. Callers decide how to wait or where to overflow.
+ */
+
+typedef struct cf_ring_s cf_ring;
+
+/*
+ *  Create a ring of at least capacity elements (rounded up to a power of 2),
+ *  each ele_sz bytes. Returns NULL if allocation fails.
+ */
+cf_ring *cf_ring_create(uint32_t ele_sz, uint32_t capacity);
+
+/*
+ *  Destroy a ring - caller must ensure no other thread is using it.
+ */
+void cf_ring_destroy(cf_ring *ring);
+
+/*
+ *  Copy an element into the ring. Returns false if the ring is full.
+ */
+bool cf_ring_push(cf_ring *ring, const void *ele);
+
+/*
+ *  Copy the oldest element out of the ring. Returns false if the ring is empty.
+ */
+bool cf_ring_pop(cf_ring *ring, void *ele);
+
+/*
+ *  Get the number of elements in the ring - only a snapshot when there are
+ *  concurrent pushes and pops.
+ */
+uint32_t cf_ring_sz(cf_ring *ring);
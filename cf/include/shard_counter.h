@@ -0,0 +1,83 @@
+/*
+ * shard_counter.h
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+#pragma once
+
+#include <sched.h>
+#include <stdint.h>
+
+/* SYNOPSIS
+ *  Per-CPU sharded counters, for statistics bumped on hot paths. Each CPU
+ *  adds into its own shard - a cache line aligned block holding a slot for
+ *  every counter - so threads on different CPUs never bounce a cache line
+ *  between them. The add is still atomic, since a thread can be migrated
+ *  between picking its shard and adding, but it's uncontended and local.
+ *
+ *  Reading a counter sums its slot over all shards, so reads are for the rare
+ *  reader, e.g. info stats requests. Counters read one after another are not
+ *  a consistent snapshot of each other.
+ *
+ *  A counter gets its slot on first use - a zeroed cf_shard_counter is ready
+ *  to go, so counters can live in zeroed structs like g_config. Counters are
+ *  never released, there's a fixed number of slots.
+ */
+
+#define CF_SHARD_COUNTER_N_SHARDS	64
+#define CF_SHARD_COUNTER_N_SLOTS	256 // slot 0 is never assigned
+
+typedef struct cf_shard_counter_s {
+	uint32_t	slot;
+} cf_shard_counter;
+
+extern uint64_t g_cf_shard_counters[CF_SHARD_COUNTER_N_SHARDS][CF_SHARD_COUNTER_N_SLOTS];
+
+/*
+ *  Assign a slot to a counter that doesn't have one yet, and return it.
+ */
+uint32_t cf_shard_counter_assign(cf_shard_counter *c);
+
+/*
+ *  Get a counter's total over all shards.
+ */
+uint64_t cf_shard_counter_get(const cf_shard_counter *c);
+
+static inline void
+cf_shard_counter_add(cf_shard_counter *c, uint64_t delta)
+{
+	uint32_t slot = __atomic_load_n(&c->slot, __ATOMIC_ACQUIRE);
+
+	if (slot == 0) {
+		slot = cf_shard_counter_assign(c);
+	}
+
+	int cpu = sched_getcpu();
+	uint32_t shard = cpu < 0 ? 0 : (uint32_t)cpu % CF_SHARD_COUNTER_N_SHARDS;
+
+	__atomic_fetch_add(&g_cf_shard_counters[shard][slot], delta, __ATOMIC_RELAXED);
+}
+
+static inline void
+cf_shard_counter_incr(cf_shard_counter *c)
+{
+	cf_shard_counter_add(c, 1);
+}
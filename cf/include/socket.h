@@ -48,6 +48,8 @@ typedef struct cf_socket_cfg_t {
 	int port;
 	bool reuse_addr; // set if you want 'reuseaddr' for server socket setup
 					 // not recommended for production use, rather nice for debugging
+	bool reuse_port; // set if several server sockets will share the port - kernel
+					 // spreads incoming connections across them
 	int proto;
 	int sock;
 	struct sockaddr_in saddr;
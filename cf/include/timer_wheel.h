@@ -0,0 +1,72 @@
+/*
+ * timer_wheel.h
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+/* SYNOPSIS
+ *  This is the declarations file for a hierarchical timer wheel. Elements are
+ *  fixed-size and copied in by value, each with an expiry time in ms. Adding
+ *  an element is O(1), and advancing the wheel costs in proportion to the
+ *  elements that come due (plus an occasional cascade), not the number held.
+ *
+ *  There is no removal - callers that need to cancel or reschedule an element
+ *  should make it identify its owner, and ignore it when it fires if the owner
+ *  has gone or moved on.
+ *
+ *  The wheel is not thread safe - callers must serialize access.
+ */
+
+typedef struct cf_timer_wheel_s cf_timer_wheel;
+
+typedef void (*cf_timer_wheel_fn)(void *ele, uint64_t expire_ms, void *udata);
+
+/*
+ *  Create a wheel of ele_sz byte elements, with a resolution of tick_ms, whose
+ *  time starts at now_ms. Returns NULL if allocation fails.
+ */
+cf_timer_wheel *cf_timer_wheel_create(uint32_t ele_sz, uint32_t tick_ms, uint64_t now_ms);
+
+/*
+ *  Destroy a wheel and any elements it still holds.
+ */
+void cf_timer_wheel_destroy(cf_timer_wheel *w);
+
+/*
+ *  Copy an element into the wheel, to fire once the wheel is advanced past
+ *  expire_ms. Expiry times already passed fire on the next advance. Returns -1
+ *  if allocation fails, 0 otherwise.
+ */
+int cf_timer_wheel_add(cf_timer_wheel *w, uint64_t expire_ms, const void *ele);
+
+/*
+ *  Advance the wheel to now_ms, calling cb for every element that comes due.
+ *  The callback may add elements to the wheel. Returns the number fired.
+ */
+uint32_t cf_timer_wheel_advance(cf_timer_wheel *w, uint64_t now_ms, cf_timer_wheel_fn cb, void *udata);
+
+/*
+ *  Get the number of elements in the wheel.
+ */
+uint32_t cf_timer_wheel_sz(cf_timer_wheel *w);
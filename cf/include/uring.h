@@ -0,0 +1,100 @@
+/*
+ * uring.h
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* SYNOPSIS
+ *  This is the declarations file for a minimal interface to the Linux
+ *  io_uring asynchronous I/O facility, using the raw system calls (i.e., no
+ *  dependency on liburing.)
+ *
+ *  A ring is shared by any number of submitting threads. Exactly one thread
+ *  per ring should call "cf_uring_reap()" in a loop - completion callbacks are
+ *  made on that thread. The interface is for work that doesn't wait on its own
+ *  completion, like flushes and read-ahead, so one reaper keeps up - callbacks
+ *  should just hand results off, e.g. re-queue the work that needed the data.
+ *
+ *  The number of operations in flight is bounded by the ring depth - when the
+ *  ring is full, submitters block until completions are reaped. The exception
+ *  is the reaping thread itself, e.g. a callback that submits - it never
+ *  blocks, its operations are deferred until the reap frees slots.
+ *
+ *  Short transfers are resubmitted for the remainder - the callback is made
+ *  once, for the whole operation.
+ */
+
+typedef struct cf_uring_s cf_uring;
+typedef struct cf_uring_op_s cf_uring_op;
+
+/*
+ *  Completion callback. Result is the number of bytes transferred, or a
+ *  negative errno value upon failure.
+ */
+typedef void (*cf_uring_done_fn)(cf_uring_op *op, int32_t res);
+
+/*
+ *  Caller-owned per-operation context - embed this in the caller's structure
+ *  and recover the structure in the callback. Must stay valid until the
+ *  callback is made.
+ */
+struct cf_uring_op_s {
+	cf_uring_done_fn	done_fn;
+	void				*udata;
+	uint64_t			start_ns;	// for caller's use, e.g. latency histograms
+
+	// Set on submit - internal use only.
+	cf_uring_op			*next;		// while deferred
+	uint8_t				opcode;
+	int					fd;
+	uint8_t				*buf;
+	uint32_t			size;
+	uint32_t			n_done;		// bytes transferred so far
+	uint64_t			offset;
+};
+
+/*
+ *  Create a ring allowing up to depth operations in flight.
+ *  Returns the ring if successful, NULL otherwise (e.g., kernel too old.)
+ */
+cf_uring *cf_uring_create(uint32_t depth);
+
+/*
+ *  Asynchronously read or write size bytes at offset in file descriptor fd.
+ *  Blocks only if the ring is full.
+ */
+void cf_uring_submit_read(cf_uring *ur, int fd, void *buf, uint32_t size, uint64_t offset, cf_uring_op *op);
+void cf_uring_submit_write(cf_uring *ur, int fd, const void *buf, uint32_t size, uint64_t offset, cf_uring_op *op);
+
+/*
+ *  Wait for at least one completion, then make the callbacks for all available
+ *  completions. Returns the number of completions processed.
+ */
+uint32_t cf_uring_reap(cf_uring *ur);
+
+/*
+ *  Wait until every operation submitted so far has completed and had its
+ *  callback made. Don't call on the reaping thread.
+ */
+void cf_uring_wait_idle(cf_uring *ur);
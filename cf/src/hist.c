@@ -23,6 +23,7 @@
 #include "hist.h"
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -41,28 +42,22 @@
 //
 
 //------------------------------------------------
-// Create a histogram. There's no destroy(), but
-// you can just cf_free() the histogram.
+// Set up a histogram in place - histogram_create()
+// and derived classes use this.
 //
-histogram*
-histogram_create(const char *name, histogram_scale scale)
+bool
+histogram_init(histogram *h, const char *name, histogram_scale scale)
 {
 	if (! (name && strlen(name) < HISTOGRAM_NAME_SIZE)) {
-		return NULL;
+		return false;
 	}
 
 	if (! (scale >= 0 && scale < HIST_SCALE_MAX_PLUS_1)) {
-		return NULL;
-	}
-
-	histogram *h = cf_malloc(sizeof(histogram));
-
-	if (! h) {
-		return NULL;
+		return false;
 	}
 
 	strcpy(h->name, name);
-	memset(&h->counts, 0, sizeof(h->counts));
+	memset(&h->shards, 0, sizeof(h->shards));
 
 	switch (scale) {
 	case HIST_MILLISECONDS:
@@ -81,20 +76,98 @@ histogram_create(const char *name, histogram_scale scale)
 		break;
 	}
 
+	return true;
+}
+
+//------------------------------------------------
+// Free a histogram's shards, but not the histogram.
+//
+void
+histogram_release(histogram *h)
+{
+	for (int i = 0; i < HIST_N_SHARDS; i++) {
+		if (h->shards[i]) {
+			cf_free(h->shards[i]);
+			h->shards[i] = NULL;
+		}
+	}
+}
+
+//------------------------------------------------
+// Create a histogram.
+//
+histogram*
+histogram_create(const char *name, histogram_scale scale)
+{
+	histogram *h = cf_malloc(sizeof(histogram));
+
+	if (! h) {
+		return NULL;
+	}
+
+	if (! histogram_init(h, name, scale)) {
+		cf_free(h);
+		return NULL;
+	}
+
 	return h;
 }
 
 //------------------------------------------------
-// Clear a histogram.
+// Destroy a histogram.
+//
+void
+histogram_destroy(histogram *h)
+{
+	histogram_release(h);
+	cf_free(h);
+}
+
+//------------------------------------------------
+// Clear a histogram. Inserts racing with this may
+// survive it.
 //
 void
 histogram_clear(histogram *h)
 {
-	for (int i = 0; i < N_BUCKETS; i++) {
-		cf_atomic64_set(&h->counts[i], 0);
+	for (int i = 0; i < HIST_N_SHARDS; i++) {
+		histogram_shard *shard = __atomic_load_n(&h->shards[i], __ATOMIC_ACQUIRE);
+
+		if (shard) {
+			memset(shard, 0, sizeof(histogram_shard));
+		}
 	}
 }
 
+//------------------------------------------------
+// Merge the shards' power-of-2 buckets into
+// counts[N_BUCKETS]. Returns the total.
+//
+uint64_t
+histogram_get_counts(histogram *h, uint64_t counts[])
+{
+	uint64_t total = 0;
+
+	memset(counts, 0, sizeof(uint64_t) * N_BUCKETS);
+
+	for (int i = 0; i < HIST_N_SHARDS; i++) {
+		histogram_shard *shard = __atomic_load_n(&h->shards[i], __ATOMIC_ACQUIRE);
+
+		if (! shard) {
+			continue;
+		}
+
+		for (int b = 0; b < N_BUCKETS; b++) {
+			uint64_t n = __atomic_load_n(&shard->counts[b], __ATOMIC_RELAXED);
+
+			counts[b] += n;
+			total += n;
+		}
+	}
+
+	return total;
+}
+
 //------------------------------------------------
 // Dump a histogram to log.
 //
@@ -108,9 +181,7 @@ histogram_dump(histogram *h)
 	int b;
 	uint64_t counts[N_BUCKETS];
 
-	for (b = 0; b < N_BUCKETS; b++) {
-		counts[b] = cf_atomic64_get(h->counts[b]);
-	}
+	histogram_get_counts(h, counts);
 
 	int i = N_BUCKETS;
 	int j = 0;
@@ -230,6 +301,91 @@ msb(uint64_t n)
 	return -1;
 }
 
+//------------------------------------------------
+// Sub-bucket index for value v. Values below
+// 2^(HIST_SUB_BITS + 1) get a sub-bucket each.
+// Above that, each power of 2 is split into
+// 2^HIST_SUB_BITS equal sub-buckets.
+//
+static inline uint32_t
+sub_bucket(uint64_t v)
+{
+	if (v >= (1UL << HIST_MAX_BITS)) {
+		v = (1UL << HIST_MAX_BITS) - 1;
+	}
+
+	if (v < (1UL << HIST_SUB_BITS)) {
+		return (uint32_t)v;
+	}
+
+	int e = msb(v) - HIST_SUB_BITS;
+
+	return ((uint32_t)(e - 1) << HIST_SUB_BITS) + (uint32_t)(v >> (e - 1));
+}
+
+//------------------------------------------------
+// Highest value that maps to sub-bucket i.
+//
+static uint64_t
+sub_bucket_high(uint32_t i)
+{
+	if (i < (1 << HIST_SUB_BITS)) {
+		return i;
+	}
+
+	uint32_t e = i >> HIST_SUB_BITS;
+	uint64_t m = i - ((e - 1) << HIST_SUB_BITS);
+
+	return ((m + 1) << (e - 1)) - 1;
+}
+
+//------------------------------------------------
+// Get this CPU's shard, allocating it if it's the
+// shard's first insert. The increments that follow
+// are atomic, since CPUs beyond HIST_N_SHARDS share
+// shards and a thread may migrate in between.
+//
+static histogram_shard*
+get_shard(histogram *h)
+{
+	int cpu = sched_getcpu();
+	uint32_t n = cpu < 0 ? 0 : (uint32_t)cpu % HIST_N_SHARDS;
+	histogram_shard *shard = __atomic_load_n(&h->shards[n], __ATOMIC_ACQUIRE);
+
+	if (shard) {
+		return shard;
+	}
+
+	histogram_shard *new_shard = cf_malloc(sizeof(histogram_shard));
+
+	cf_assert(new_shard, AS_INFO, CF_CRITICAL, "histogram %s shard allocation failed", h->name);
+	memset(new_shard, 0, sizeof(histogram_shard));
+
+	if (! __atomic_compare_exchange_n(&h->shards[n], &shard, new_shard, false,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		// Another thread got there first - use its shard.
+		cf_free(new_shard);
+		return shard;
+	}
+
+	return new_shard;
+}
+
+static inline void
+shard_insert(histogram_shard *shard, int bucket, uint64_t sub_value)
+{
+	__atomic_fetch_add(&shard->counts[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&shard->sub_counts[sub_bucket(sub_value)], 1, __ATOMIC_RELAXED);
+
+	uint64_t max = __atomic_load_n(&shard->max, __ATOMIC_RELAXED);
+
+	while (sub_value > max &&
+			! __atomic_compare_exchange_n(&shard->max, &max, sub_value, true,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		;
+	}
+}
+
 //------------------------------------------------
 // Insert a time interval data point. The interval
 // is time elapsed since start_ns, converted to
@@ -258,27 +414,26 @@ msb(uint64_t n)
 //		4		8 to 16 (more exactly, 15.999)
 //		etc.
 //
+// The sub-buckets always get the interval in
+// microseconds.
+//
 void
 histogram_insert_data_point(histogram *h, uint64_t start_ns)
 {
 	uint64_t end_ns = cf_getns();
-	uint64_t delta_t = (end_ns - start_ns) / h->time_div;
-
-	int bucket = 0;
-
-	if (delta_t != 0) {
-		bucket = msb(delta_t);
-
-		if (start_ns > end_ns) {
-			// Either the clock went backwards, or wrapped. (Assume the former,
-			// since it takes ~580 years from 0 to wrap.)
-			cf_warning(AS_INFO, "clock went backwards: start %lu end %lu",
-					start_ns, end_ns);
-			bucket = 0;
-		}
+	uint64_t delta_ns = end_ns - start_ns;
+
+	if (start_ns > end_ns) {
+		// Either the clock went backwards, or wrapped. (Assume the former,
+		// since it takes ~580 years from 0 to wrap.)
+		cf_warning(AS_INFO, "clock went backwards: start %lu end %lu",
+				start_ns, end_ns);
+		delta_ns = 0;
 	}
 
-	cf_atomic64_incr(&h->counts[bucket]);
+	uint64_t delta_t = delta_ns / h->time_div;
+
+	shard_insert(get_shard(h), delta_t == 0 ? 0 : msb(delta_t), delta_ns / 1000);
 }
 
 //------------------------------------------------
@@ -297,7 +452,92 @@ histogram_insert_data_point(histogram *h, uint64_t start_ns)
 void
 histogram_insert_raw(histogram *h, uint64_t value)
 {
-	cf_atomic64_incr(&h->counts[msb(value)]);
+	shard_insert(get_shard(h), msb(value), value);
+}
+
+//------------------------------------------------
+// Get count, p50, p99, p999 and max from the
+// merged sub-buckets - microseconds for time
+// histograms, raw values otherwise. Percentiles
+// are the top of the sub-bucket they fall in.
+//
+void
+histogram_get_percentiles(histogram *h, histogram_percentiles *p)
+{
+	static uint64_t sub_counts[HIST_N_SUB_BUCKETS];
+	static pthread_mutex_t sub_counts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+	// Too big for the stack of an info thread - share one merge buffer.
+	pthread_mutex_lock(&sub_counts_lock);
+
+	memset(sub_counts, 0, sizeof(sub_counts));
+	memset(p, 0, sizeof(histogram_percentiles));
+
+	for (int i = 0; i < HIST_N_SHARDS; i++) {
+		histogram_shard *shard = __atomic_load_n(&h->shards[i], __ATOMIC_ACQUIRE);
+
+		if (! shard) {
+			continue;
+		}
+
+		for (uint32_t j = 0; j < HIST_N_SUB_BUCKETS; j++) {
+			uint64_t n = __atomic_load_n(&shard->sub_counts[j], __ATOMIC_RELAXED);
+
+			sub_counts[j] += n;
+			p->count += n;
+		}
+
+		uint64_t max = __atomic_load_n(&shard->max, __ATOMIC_RELAXED);
+
+		if (max > p->max) {
+			p->max = max;
+		}
+	}
+
+	// Ranks out of 10000 - 5000 is p50, 9900 is p99, 9990 is p999.
+	const uint64_t ranks[] = { 5000, 9900, 9990 };
+	uint64_t* values[] = { &p->p50, &p->p99, &p->p999 };
+	uint32_t r = 0;
+	uint64_t subtotal = 0;
+
+	for (uint32_t j = 0; j < HIST_N_SUB_BUCKETS && r < 3 && p->count != 0; j++) {
+		subtotal += sub_counts[j];
+
+		while (r < 3 && subtotal * 10000 >= p->count * ranks[r]) {
+			uint64_t high = sub_bucket_high(j);
+
+			*values[r++] = high < p->max ? high : p->max;
+		}
+	}
+
+	pthread_mutex_unlock(&sub_counts_lock);
+}
+
+//------------------------------------------------
+// Append percentiles in info format, e.g.:
+// reads:unit=usec,count=1000,p50=120,p99=860,p999=2900,max=15344;
+//
+void
+histogram_get_percentiles_info(histogram *h, cf_dyn_buf *db)
+{
+	histogram_percentiles p;
+
+	histogram_get_percentiles(h, &p);
+
+	cf_dyn_buf_append_string(db, h->name);
+	cf_dyn_buf_append_string(db, ":unit=");
+	cf_dyn_buf_append_string(db, h->time_div == 0 ? HIST_TAG_RAW : HIST_TAG_MICROSECONDS);
+	cf_dyn_buf_append_string(db, ",count=");
+	cf_dyn_buf_append_uint64(db, p.count);
+	cf_dyn_buf_append_string(db, ",p50=");
+	cf_dyn_buf_append_uint64(db, p.p50);
+	cf_dyn_buf_append_string(db, ",p99=");
+	cf_dyn_buf_append_uint64(db, p.p99);
+	cf_dyn_buf_append_string(db, ",p999=");
+	cf_dyn_buf_append_uint64(db, p.p999);
+	cf_dyn_buf_append_string(db, ",max=");
+	cf_dyn_buf_append_uint64(db, p.max);
+	cf_dyn_buf_append_string(db, ";");
 }
 
 
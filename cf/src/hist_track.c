@@ -129,14 +129,6 @@ static int thresholds_to_buckets(const char* thresholds, uint32_t buckets[]);
 cf_hist_track*
 cf_hist_track_create(const char* name, histogram_scale scale)
 {
-	if (! (name && strlen(name) < HISTOGRAM_NAME_SIZE)) {
-		return NULL;
-	}
-
-	if (! (scale >= 0 && scale < HIST_SCALE_MAX_PLUS_1)) {
-		return NULL;
-	}
-
 	cf_hist_track* this = (cf_hist_track*)cf_malloc(sizeof(cf_hist_track));
 
 	if (! this) {
@@ -148,25 +140,11 @@ cf_hist_track_create(const char* name, histogram_scale scale)
 		return NULL;
 	}
 
-	// Base histogram setup, same as in histogram_create():
-	strcpy(this->hist.name, name);
-	memset((void*)this->hist.counts, 0, sizeof(this->hist.counts));
-
-	switch (scale) {
-	case HIST_MILLISECONDS:
-		this->hist.scale_tag = HIST_TAG_MILLISECONDS;
-		this->hist.time_div = 1000 * 1000;
-		break;
-	case HIST_MICROSECONDS:
-		this->hist.scale_tag = HIST_TAG_MICROSECONDS;
-		this->hist.time_div = 1000;
-		break;
-	default:
-		this->hist.scale_tag = HIST_TAG_RAW;
-		this->hist.time_div = 0;
-		// If cf_hist_track_insert_data_point() is called for a raw histogram,
-		// the divide by 0 will crash - consider that a high-performance assert.
-		break;
+	// Base histogram setup.
+	if (! histogram_init((histogram*)this, name, scale)) {
+		pthread_mutex_destroy(&this->rows_lock);
+		cf_free(this);
+		return NULL;
 	}
 
 	// Start with tracking off.
@@ -183,6 +161,7 @@ cf_hist_track_destroy(cf_hist_track* this)
 {
 	cf_hist_track_stop(this);
 	pthread_mutex_destroy(&this->rows_lock);
+	histogram_release((histogram*)this);
 	cf_free(this);
 }
 
@@ -315,12 +294,7 @@ cf_hist_track_dump(cf_hist_track* this)
 
 	// "Freeze" the histogram for consistency of total.
 	uint64_t counts[N_BUCKETS];
-	uint64_t total_count = 0;
-
-	for (int j = 0; j < N_BUCKETS; j++) {
-		counts[j] = cf_atomic64_get(this->hist.counts[j]);
-		total_count += counts[j];
-	}
+	uint64_t total_count = histogram_get_counts((histogram*)this, counts);
 
 	uint64_t subtotal = 0;
 
@@ -364,6 +338,15 @@ cf_hist_track_insert_raw(cf_hist_track* this, uint64_t value)
 	histogram_insert_raw((histogram*)this, value);
 }
 
+//------------------------------------------------
+// Pass-through to base histogram.
+//
+void
+cf_hist_track_get_percentiles_info(cf_hist_track* this, cf_dyn_buf* db_p)
+{
+	histogram_get_percentiles_info((histogram*)this, db_p);
+}
+
 //------------------------------------------------
 // Get time-sliced info from cache.
 //
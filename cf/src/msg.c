@@ -559,6 +559,126 @@ msg_fillbuf(const msg *m, uint8_t *buf, size_t *buflen)
 	return(0);
 }
 
+// Pointer to the payload of a variable length field, or NULL for the integer
+// types, which are always stamped into the buffer.
+
+static inline const void *
+msg_field_var_data(const msg_field *mf)
+{
+	switch (mf->type) {
+		case M_FT_STR:
+			return(mf->u.str);
+		case M_FT_BUF:
+			return(mf->u.buf);
+		case M_FT_ARRAY_UINT32:
+			return(mf->u.ui32_a);
+		case M_FT_ARRAY_UINT64:
+			return(mf->u.ui64_a);
+		case M_FT_ARRAY_STR:
+			return(mf->u.str_a);
+		case M_FT_ARRAY_BUF:
+			return(mf->u.buf_a);
+		default:
+			return(NULL);
+	}
+}
+
+// msg_fill_iov - parse a message out into a buffer plus a list of iovecs. Small
+// fields and all the headers go into buf, large payloads are pointed at where
+// they live in the msg, so the caller can hand the whole thing to one
+// writev()/sendmsg() without copying them.
+
+int
+msg_fill_iov(const msg *m, uint8_t *buf, size_t *buflen, struct iovec *iov, int *n_iov, size_t ref_min)
+{
+	// Figure out the sizes - on the wire, in buf, and number of iovecs
+	uint32_t	sz = 6;
+	size_t		buf_sz = 6;
+	int			iov_sz = 1;
+
+	for (int i=0;i<m->len;i++) {
+		const msg_field *mf = &m->f[i];
+		if ((mf->is_valid==true) && (mf->is_set==true)) {
+			size_t wire_sz = msg_get_wire_field_size(mf);
+			sz += wire_sz;
+			if (mf->field_len >= ref_min && msg_field_var_data(mf)) {
+				buf_sz += 7;
+				iov_sz += 2;
+			}
+			else {
+				buf_sz += wire_sz;
+			}
+		}
+	}
+
+	// validate the sizes
+	if (buf_sz > *buflen) {
+		cf_debug(CF_MSG,"msg_fill_iov: passed in size too small want %zu have %zu",buf_sz,*buflen);
+		*buflen = buf_sz;
+		return(-2);
+	}
+	if (iov_sz > *n_iov) {
+		cf_debug(CF_MSG,"msg_fill_iov: too few iovecs want %d have %d",iov_sz,*n_iov);
+		*n_iov = iov_sz;
+		return(-3);
+	}
+
+	uint8_t *p = buf;
+
+	// stamp the size in the buf
+	(* (uint32_t *) p) = htonl(sz - 6);
+	p += 4;
+	// stamp the type
+	(* (uint16_t *) p) = htons(m->type);
+	p += 2;
+
+	// start of the bytes in buf not yet covered by an iovec
+	uint8_t *seg = buf;
+	int n = 0;
+
+	for (int i=0;i<m->len;i++) {
+		const msg_field *mf = &m->f[i];
+		if ((mf->is_valid==true) && (mf->is_set==true)) {
+			const void *data = msg_field_var_data(mf);
+			if (mf->field_len >= ref_min && data) {
+				// stamp just the field header, and point at the payload
+				uint32_t flen = mf->field_len;
+				p[0] = (mf->id >> 8) & 0xff;
+				p[1] = mf->id & 0xff;
+				p[2] = (msg_field_type) mf->type;
+				p[3] = (flen >> 24) & 0xff;
+				p[4] = (flen >> 16) & 0xff;
+				p[5] = (flen >> 8) & 0xff;
+				p[6] = flen & 0xff;
+				p += 7;
+
+				iov[n].iov_base = seg;
+				iov[n].iov_len = p - seg;
+				n++;
+				iov[n].iov_base = (void *) data;
+				iov[n].iov_len = flen;
+				n++;
+
+				seg = p;
+			}
+			else {
+				p += msg_stamp_field(p, mf);
+			}
+		}
+	}
+
+	if (p != seg) {
+		iov[n].iov_base = seg;
+		iov[n].iov_len = p - seg;
+		n++;
+	}
+
+	*buflen = p - buf;
+	*n_iov = n;
+
+	return(0);
+}
+
 //
 // Purpose of msg_reset is to reset its internal state and make it ready for more reading or parsing
 
@@ -33,6 +33,8 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include <citrusleaf/cf_atomic.h>
+#include <citrusleaf/cf_clock.h>
 #include <citrusleaf/cf_digest.h>
 #include <citrusleaf/alloc.h>
 
@@ -54,16 +56,32 @@ olock_lock(olock *ol, cf_digest *d)
 	pthread_mutex_lock(&ol->locks[n]);
 }
 
-void
+uint64_t
 olock_vlock(olock *ol, cf_digest *d, pthread_mutex_t **vlock)
 {
 	uint32_t n = OLOCK_HASH(ol, d);
 
 	*vlock = &ol->locks[n];
 
+	// Only time the lock if we'd have to wait - keep the clock off the
+	// uncontended path.
+	if (0 == pthread_mutex_trylock(*vlock)) {
+		return 0;
+	}
+
+	uint64_t start_ns = cf_getns();
+
 	if (0 != pthread_mutex_lock(*vlock)) {
 		fprintf(stderr, "olock vlock failed\n");
 	}
+
+	uint64_t wait_ns = cf_getns() - start_ns;
+
+	cf_atomic64_incr(&ol->n_contended);
+	cf_atomic64_add(&ol->wait_ns, wait_ns);
+
+	// Never return 0 for a wait, so callers can tell it was contended.
+	return wait_ns == 0 ? 1 : wait_ns;
 }
 
 void
@@ -94,6 +112,8 @@ olock_create(uint32_t n_locks, bool mutex)
 
 	ol->n_locks = n_locks;
 	ol->mask = mask;
+	ol->n_contended = 0;
+	ol->wait_ns = 0;
 
 	for (int i = 0; i < n_locks; i++) {
 		if (mutex) {
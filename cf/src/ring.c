@@ -0,0 +1,205 @@
+/*
+ * ring.c
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+/*
+ * Bounded lock-free multi-producer, multi-consumer ring.
+ *
+ * Each cell carries a sequence number which says whose turn it is. A producer
+ * may fill the cell at position pos when its sequence is pos, and then sets it
+ * to pos + 1. A consumer may empty the cell at position pos when its sequence
+ * is pos + 1, and then sets it to pos + capacity, ready for the next lap.
+ */
+
+#include "ring.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "citrusleaf/alloc.h"
+
+
+//==========================================================
+// Constants & typedefs.
+//
+
+#define CACHE_LINE_SZ 64
+
+typedef struct ring_cell_s {
+	uint64_t	seq;
+	uint8_t		data[];
+} ring_cell;
+
+struct cf_ring_s {
+	uint64_t	push_pos;
+	uint8_t		pad0[CACHE_LINE_SZ - sizeof(uint64_t)];
+
+	uint64_t	pop_pos;
+	uint8_t		pad1[CACHE_LINE_SZ - sizeof(uint64_t)];
+
+	uint32_t	ele_sz;
+	uint32_t	cell_sz;
+	uint64_t	mask;
+	uint8_t		*cells;
+};
+
+
+//==========================================================
+// Inlines & macros.
+//
+
+static inline ring_cell *
+ring_cell_at(cf_ring *ring, uint64_t pos)
+{
+	return (ring_cell *)(ring->cells + ((pos & ring->mask) * ring->cell_sz));
+}
+
+
+//==========================================================
+// Public API.
+//
+
+cf_ring *
+cf_ring_create(uint32_t ele_sz, uint32_t capacity)
+{
+	uint64_t n_cells = 2;
+
+	while (n_cells < capacity) {
+		n_cells <<= 1;
+	}
+
+	cf_ring *ring = cf_malloc(sizeof(cf_ring));
+
+	if (! ring) {
+		return NULL;
+	}
+
+	memset(ring, 0, sizeof(cf_ring));
+
+	ring->ele_sz = ele_sz;
+	// Keep the sequence numbers 8-byte aligned.
+	ring->cell_sz = (sizeof(ring_cell) + ele_sz + 7) & ~7;
+	ring->mask = n_cells - 1;
+	ring->cells = cf_malloc(n_cells * ring->cell_sz);
+
+	if (! ring->cells) {
+		cf_free(ring);
+		return NULL;
+	}
+
+	for (uint64_t pos = 0; pos < n_cells; pos++) {
+		ring_cell_at(ring, pos)->seq = pos;
+	}
+
+	return ring;
+}
+
+
+void
+cf_ring_destroy(cf_ring *ring)
+{
+	cf_free(ring->cells);
+	cf_free(ring);
+}
+
+
+bool
+cf_ring_push(cf_ring *ring, const void *ele)
+{
+	uint64_t pos = __atomic_load_n(&ring->push_pos, __ATOMIC_RELAXED);
+	ring_cell *cell;
+
+	while (true) {
+		cell = ring_cell_at(ring, pos);
+
+		uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t)seq - (int64_t)pos;
+
+		if (diff == 0) {
+			// Cell is free - try to claim it (on failure, pos is reloaded).
+			if (__atomic_compare_exchange_n(&ring->push_pos, &pos, pos + 1,
+					true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			// Cell still holds an element from the previous lap - full.
+			return false;
+		}
+		else {
+			// Another producer got here first.
+			pos = __atomic_load_n(&ring->push_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(cell->data, ele, ring->ele_sz);
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+
+bool
+cf_ring_pop(cf_ring *ring, void *ele)
+{
+	uint64_t pos = __atomic_load_n(&ring->pop_pos, __ATOMIC_RELAXED);
+	ring_cell *cell;
+
+	while (true) {
+		cell = ring_cell_at(ring, pos);
+
+		uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t)seq - (int64_t)(pos + 1);
+
+		if (diff == 0) {
+			// Cell is filled - try to claim it (on failure, pos is reloaded).
+			if (__atomic_compare_exchange_n(&ring->pop_pos, &pos, pos + 1,
+					true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			// Cell not filled yet - empty.
+			return false;
+		}
+		else {
+			// Another consumer got here first.
+			pos = __atomic_load_n(&ring->pop_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(ele, cell->data, ring->ele_sz);
+	__atomic_store_n(&cell->seq, pos + ring->mask + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+
+uint32_t
+cf_ring_sz(cf_ring *ring)
+{
+	uint64_t pop_pos = __atomic_load_n(&ring->pop_pos, __ATOMIC_RELAXED);
+	uint64_t push_pos = __atomic_load_n(&ring->push_pos, __ATOMIC_RELAXED);
+
+	return push_pos > pop_pos ? (uint32_t)(push_pos - pop_pos) : 0;
+}
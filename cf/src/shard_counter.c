@@ -0,0 +1,77 @@
+/*
+ * shard_counter.c
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+#include "shard_counter.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "fault.h"
+
+
+// Shard-major, so each CPU's slots are contiguous and start on a cache line.
+uint64_t g_cf_shard_counters[CF_SHARD_COUNTER_N_SHARDS][CF_SHARD_COUNTER_N_SLOTS]
+		__attribute__ ((aligned(64)));
+
+static pthread_mutex_t g_assign_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t g_next_slot = 1;
+
+
+uint32_t
+cf_shard_counter_assign(cf_shard_counter *c)
+{
+	pthread_mutex_lock(&g_assign_lock);
+
+	// Another thread may have got here first.
+	uint32_t slot = c->slot;
+
+	if (slot == 0) {
+		if (g_next_slot == CF_SHARD_COUNTER_N_SLOTS) {
+			cf_crash(CF_MISC, "out of shard counter slots");
+		}
+
+		slot = g_next_slot++;
+		__atomic_store_n(&c->slot, slot, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&g_assign_lock);
+
+	return slot;
+}
+
+uint64_t
+cf_shard_counter_get(const cf_shard_counter *c)
+{
+	uint32_t slot = __atomic_load_n(&c->slot, __ATOMIC_ACQUIRE);
+
+	if (slot == 0) {
+		return 0;
+	}
+
+	uint64_t total = 0;
+
+	for (uint32_t i = 0; i < CF_SHARD_COUNTER_N_SHARDS; i++) {
+		total += __atomic_load_n(&g_cf_shard_counters[i][slot], __ATOMIC_RELAXED);
+	}
+
+	return total;
+}
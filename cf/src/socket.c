@@ -224,6 +224,17 @@ cf_socket_init_svc(cf_socket_cfg *s)
 		setsockopt(s->sock, SOL_SOCKET, SO_REUSEADDR, &v, sizeof(v) );
 	}
 
+	if (s->reuse_port) {
+		int v = 1;
+		if (0 != setsockopt(s->sock, SOL_SOCKET, SO_REUSEPORT, &v, sizeof(v))) {
+			int e = errno;
+			cf_warning(CF_SOCKET, "setsockopt SO_REUSEPORT: %s", cf_strerror(e));
+			close(s->sock);
+			s->sock = -1;
+			return(e);
+		}
+	}
+
 	/* Set close-on-exec */
 	fcntl(s->sock, F_SETFD, FD_CLOEXEC);
 
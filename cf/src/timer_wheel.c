@@ -0,0 +1,279 @@
+/*
+ * timer_wheel.c
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * Level 0 has a slot per tick. Each level above has a slot per revolution of
+ * the level below. An element goes into the lowest level whose range covers
+ * its expiry, and is cascaded down a level each time the level below finishes
+ * a revolution, until it reaches level 0 and fires. Expiries beyond the top
+ * level's range are parked in its furthest slot, and re-parked each time that
+ * slot cascades, until they come within range.
+ */
+
+#include "timer_wheel.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "citrusleaf/alloc.h"
+
+
+//==========================================================
+// Constants & typedefs.
+//
+
+#define SLOT_BITS 6
+#define N_SLOTS (1 << SLOT_BITS)
+#define SLOT_MASK (N_SLOTS - 1)
+#define N_LEVELS 4
+
+// Each slot is an unordered, growable array of records.
+typedef struct wheel_slot_s {
+	uint32_t	n_recs;
+	uint32_t	capacity;
+	uint8_t		*recs;
+} wheel_slot;
+
+typedef struct wheel_rec_s {
+	uint64_t	expire_ms;
+	uint8_t		data[];
+} wheel_rec;
+
+struct cf_timer_wheel_s {
+	uint32_t	ele_sz;
+	uint32_t	rec_sz;
+	uint32_t	tick_ms;
+	uint32_t	n_eles;
+	uint64_t	cur_tick;	// next tick to be served
+	wheel_slot	slots[N_LEVELS][N_SLOTS];
+};
+
+
+//==========================================================
+// Forward declarations.
+//
+
+static int wheel_insert(cf_timer_wheel *w, uint64_t expire_ms, const void *ele);
+static void wheel_cascade(cf_timer_wheel *w, uint32_t level);
+
+
+//==========================================================
+// Inlines & macros.
+//
+
+static inline wheel_rec *
+slot_rec_at(const cf_timer_wheel *w, const wheel_slot *slot, uint32_t i)
+{
+	return (wheel_rec *)(slot->recs + ((size_t)i * w->rec_sz));
+}
+
+
+//==========================================================
+// Public API.
+//
+
+cf_timer_wheel *
+cf_timer_wheel_create(uint32_t ele_sz, uint32_t tick_ms, uint64_t now_ms)
+{
+	cf_timer_wheel *w = cf_malloc(sizeof(cf_timer_wheel));
+
+	if (! w) {
+		return NULL;
+	}
+
+	memset(w, 0, sizeof(cf_timer_wheel));
+
+	w->ele_sz = ele_sz;
+	w->rec_sz = (sizeof(wheel_rec) + ele_sz + 7) & ~7;
+	w->tick_ms = tick_ms ? tick_ms : 1;
+	w->cur_tick = now_ms / w->tick_ms;
+
+	return w;
+}
+
+
+void
+cf_timer_wheel_destroy(cf_timer_wheel *w)
+{
+	for (uint32_t level = 0; level < N_LEVELS; level++) {
+		for (uint32_t i = 0; i < N_SLOTS; i++) {
+			if (w->slots[level][i].recs) {
+				cf_free(w->slots[level][i].recs);
+			}
+		}
+	}
+
+	cf_free(w);
+}
+
+
+int
+cf_timer_wheel_add(cf_timer_wheel *w, uint64_t expire_ms, const void *ele)
+{
+	if (wheel_insert(w, expire_ms, ele) != 0) {
+		return -1;
+	}
+
+	w->n_eles++;
+
+	return 0;
+}
+
+
+uint32_t
+cf_timer_wheel_advance(cf_timer_wheel *w, uint64_t now_ms, cf_timer_wheel_fn cb, void *udata)
+{
+	uint64_t now_tick = now_ms / w->tick_ms;
+	uint32_t n_fired = 0;
+
+	while (w->cur_tick <= now_tick) {
+		// Nothing held - jump straight to now.
+		if (w->n_eles == 0) {
+			w->cur_tick = now_tick + 1;
+			break;
+		}
+
+		uint32_t idx = (uint32_t)(w->cur_tick & SLOT_MASK);
+
+		// Level 0 is starting a revolution - bring down the next level's slot,
+		// and so on up while those levels are starting revolutions too.
+		if (idx == 0) {
+			for (uint32_t level = 1; level < N_LEVELS; level++) {
+				wheel_cascade(w, level);
+
+				if (((w->cur_tick >> (SLOT_BITS * level)) & SLOT_MASK) != 0) {
+					break;
+				}
+			}
+		}
+
+		// Detach the slot, so the callback can add to the wheel (even this
+		// slot) while we walk it.
+		wheel_slot due = w->slots[0][idx];
+
+		memset(&w->slots[0][idx], 0, sizeof(wheel_slot));
+		w->n_eles -= due.n_recs;
+		w->cur_tick++;
+
+		for (uint32_t i = 0; i < due.n_recs; i++) {
+			wheel_rec *rec = slot_rec_at(w, &due, i);
+
+			cb(rec->data, rec->expire_ms, udata);
+			n_fired++;
+		}
+
+		// Give the memory back to the slot if nothing was added meanwhile.
+		if (w->slots[0][idx].recs == NULL) {
+			due.n_recs = 0;
+			w->slots[0][idx] = due;
+		}
+		else if (due.recs) {
+			cf_free(due.recs);
+		}
+	}
+
+	return n_fired;
+}
+
+
+uint32_t
+cf_timer_wheel_sz(cf_timer_wheel *w)
+{
+	return w->n_eles;
+}
+
+
+//==========================================================
+// Local helpers.
+//
+
+static int
+wheel_insert(cf_timer_wheel *w, uint64_t expire_ms, const void *ele)
+{
+	uint64_t tick = expire_ms / w->tick_ms;
+
+	if (tick < w->cur_tick) {
+		tick = w->cur_tick;
+	}
+
+	uint64_t delta = tick - w->cur_tick;
+	uint32_t level = 0;
+
+	while (level < N_LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) {
+		level++;
+	}
+
+	// Beyond the top level's range - park in its furthest slot.
+	if (delta >= (1ULL << (SLOT_BITS * N_LEVELS))) {
+		tick = w->cur_tick + (1ULL << (SLOT_BITS * N_LEVELS)) - 1;
+	}
+
+	wheel_slot *slot = &w->slots[level][(tick >> (SLOT_BITS * level)) & SLOT_MASK];
+
+	if (slot->n_recs == slot->capacity) {
+		uint32_t capacity = slot->capacity ? slot->capacity * 2 : 8;
+		uint8_t *recs = cf_realloc(slot->recs, (size_t)capacity * w->rec_sz);
+
+		if (! recs) {
+			return -1;
+		}
+
+		slot->recs = recs;
+		slot->capacity = capacity;
+	}
+
+	wheel_rec *rec = slot_rec_at(w, slot, slot->n_recs++);
+
+	rec->expire_ms = expire_ms;
+	memcpy(rec->data, ele, w->ele_sz);
+
+	return 0;
+}
+
+
+// Re-insert everything in the current slot of a level - it all now falls
+// within the range of lower levels.
+static void
+wheel_cascade(cf_timer_wheel *w, uint32_t level)
+{
+	uint32_t idx = (uint32_t)((w->cur_tick >> (SLOT_BITS * level)) & SLOT_MASK);
+	wheel_slot moving = w->slots[level][idx];
+
+	if (moving.n_recs == 0) {
+		return;
+	}
+
+	memset(&w->slots[level][idx], 0, sizeof(wheel_slot));
+
+	for (uint32_t i = 0; i < moving.n_recs; i++) {
+		wheel_rec *rec = slot_rec_at(w, &moving, i);
+
+		if (wheel_insert(w, rec->expire_ms, rec->data) != 0) {
+			// Out of memory - the element is lost.
+			w->n_eles--;
+		}
+	}
+
+	cf_free(moving.recs);
+}
@@ -0,0 +1,369 @@
+/*
+ * uring.c
+ *
+ * Copyright (C) 2014 Aerospike, Inc.
+ *
+ * Portions may be licensed to Aerospike, Inc. under one or more contributor
+ * license agreements.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Affero General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see http://www.gnu.org/licenses/
+ */
+
+/*
+ * io_uring Interface.
+ */
+
+#include "uring.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "citrusleaf/alloc.h"
+
+#include "fault.h"
+
+
+//==========================================================
+// Constants & typedefs.
+//
+
+// Older C library headers may not know the system call numbers.
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup		425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter		426
+#endif
+
+struct cf_uring_s {
+	int					fd;
+	uint32_t			depth;
+
+	// Submission side - shared by all submitters.
+	pthread_mutex_t		sq_lock;
+	pthread_cond_t		sq_cond;	// signaled when slots are reaped, after callbacks
+	uint32_t			n_inflight;
+	cf_uring_op			*deferred_head;	// submitted by the reaper on a full ring
+	cf_uring_op			*deferred_tail;
+	uint32_t			n_deferred;
+	uint32_t			*sq_head;
+	uint32_t			*sq_tail;
+	uint32_t			*sq_mask;
+	uint32_t			*sq_array;
+	struct io_uring_sqe	*sqes;
+
+	// Completion side - used only by the reaping thread.
+	uint32_t			*cq_head;
+	uint32_t			*cq_tail;
+	uint32_t			*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void				*sq_ring;
+	size_t				sq_ring_sz;
+	void				*cq_ring;
+	size_t				cq_ring_sz;
+	size_t				sqes_sz;
+};
+
+
+//==========================================================
+// Globals.
+//
+
+// The ring this thread is reaping, if any - it must never wait for a slot.
+static __thread cf_uring *g_reaping = NULL;
+
+
+//==========================================================
+// Forward declarations.
+//
+
+static void uring_submit(cf_uring *ur, cf_uring_op *op);
+static void uring_push(cf_uring *ur, cf_uring_op *op);
+
+
+//==========================================================
+// Public API.
+//
+
+cf_uring *
+cf_uring_create(uint32_t depth)
+{
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+
+	int fd = (int)syscall(__NR_io_uring_setup, depth, &params);
+
+	if (fd < 0) {
+		cf_warning(CF_MISC, "io_uring setup failed: %s", cf_strerror(errno));
+		return NULL;
+	}
+
+	cf_uring *ur = cf_malloc(sizeof(cf_uring));
+
+	if (! ur) {
+		close(fd);
+		return NULL;
+	}
+
+	memset(ur, 0, sizeof(cf_uring));
+
+	ur->fd = fd;
+	ur->depth = params.sq_entries;
+
+	ur->sq_ring_sz = params.sq_off.array + (params.sq_entries * sizeof(uint32_t));
+	ur->cq_ring_sz = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+	ur->sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+	ur->cq_ring = mmap(NULL, ur->cq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+	ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+	if (ur->sq_ring == MAP_FAILED || ur->cq_ring == MAP_FAILED ||
+			ur->sqes == MAP_FAILED) {
+		cf_warning(CF_MISC, "io_uring mmap failed: %s", cf_strerror(errno));
+
+		if (ur->sq_ring != MAP_FAILED) {
+			munmap(ur->sq_ring, ur->sq_ring_sz);
+		}
+
+		if (ur->cq_ring != MAP_FAILED) {
+			munmap(ur->cq_ring, ur->cq_ring_sz);
+		}
+
+		if (ur->sqes != MAP_FAILED) {
+			munmap(ur->sqes, ur->sqes_sz);
+		}
+
+		close(fd);
+		cf_free(ur);
+		return NULL;
+	}
+
+	uint8_t *sq = (uint8_t*)ur->sq_ring;
+
+	ur->sq_head = (uint32_t*)(sq + params.sq_off.head);
+	ur->sq_tail = (uint32_t*)(sq + params.sq_off.tail);
+	ur->sq_mask = (uint32_t*)(sq + params.sq_off.ring_mask);
+	ur->sq_array = (uint32_t*)(sq + params.sq_off.array);
+
+	uint8_t *cq = (uint8_t*)ur->cq_ring;
+
+	ur->cq_head = (uint32_t*)(cq + params.cq_off.head);
+	ur->cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+	ur->cq_mask = (uint32_t*)(cq + params.cq_off.ring_mask);
+	ur->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+	pthread_mutex_init(&ur->sq_lock, NULL);
+	pthread_cond_init(&ur->sq_cond, NULL);
+
+	return ur;
+}
+
+
+void
+cf_uring_submit_read(cf_uring *ur, int fd, void *buf, uint32_t size,
+		uint64_t offset, cf_uring_op *op)
+{
+	op->opcode = IORING_OP_READ;
+	op->fd = fd;
+	op->buf = (uint8_t*)buf;
+	op->size = size;
+	op->n_done = 0;
+	op->offset = offset;
+
+	uring_submit(ur, op);
+}
+
+
+void
+cf_uring_submit_write(cf_uring *ur, int fd, const void *buf, uint32_t size,
+		uint64_t offset, cf_uring_op *op)
+{
+	op->opcode = IORING_OP_WRITE;
+	op->fd = fd;
+	op->buf = (uint8_t*)buf;
+	op->size = size;
+	op->n_done = 0;
+	op->offset = offset;
+
+	uring_submit(ur, op);
+}
+
+
+uint32_t
+cf_uring_reap(cf_uring *ur)
+{
+	g_reaping = ur;
+
+	uint32_t head = *ur->cq_head;
+	uint32_t tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+
+	while (head == tail) {
+		if (syscall(__NR_io_uring_enter, ur->fd, 0, 1, IORING_ENTER_GETEVENTS,
+				NULL, 0) < 0 && errno != EINTR) {
+			cf_warning(CF_MISC, "io_uring wait failed: %s", cf_strerror(errno));
+			return 0;
+		}
+
+		tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	uint32_t n_reaped = 0;
+
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &ur->cqes[head & *ur->cq_mask];
+		cf_uring_op *op = (cf_uring_op*)(uintptr_t)cqe->user_data;
+		int32_t res = cqe->res;
+
+		// Hand the slot back to the kernel before the (possibly slow) callback.
+		__atomic_store_n(ur->cq_head, ++head, __ATOMIC_RELEASE);
+
+		n_reaped++;
+
+		// Short transfer - go again for the rest.
+		if (res > 0 && op->n_done + (uint32_t)res < op->size) {
+			op->n_done += (uint32_t)res;
+			uring_submit(ur, op);
+			continue;
+		}
+
+		op->done_fn(op, res < 0 ? res : (int32_t)(op->n_done + (uint32_t)res));
+	}
+
+	pthread_mutex_lock(&ur->sq_lock);
+
+	ur->n_inflight -= n_reaped;
+
+	while (ur->deferred_head && ur->n_inflight < ur->depth) {
+		cf_uring_op *op = ur->deferred_head;
+
+		if (! (ur->deferred_head = op->next)) {
+			ur->deferred_tail = NULL;
+		}
+
+		ur->n_deferred--;
+		uring_push(ur, op);
+	}
+
+	pthread_cond_broadcast(&ur->sq_cond);
+	pthread_mutex_unlock(&ur->sq_lock);
+
+	return n_reaped;
+}
+
+
+void
+cf_uring_wait_idle(cf_uring *ur)
+{
+	pthread_mutex_lock(&ur->sq_lock);
+
+	while (ur->n_inflight + ur->n_deferred != 0) {
+		pthread_cond_wait(&ur->sq_cond, &ur->sq_lock);
+	}
+
+	pthread_mutex_unlock(&ur->sq_lock);
+}
+
+
+//==========================================================
+// Local helpers.
+//
+
+static void
+uring_submit(cf_uring *ur, cf_uring_op *op)
+{
+	pthread_mutex_lock(&ur->sq_lock);
+
+	// The reaping thread frees the slots, so it can't wait for one - defer
+	// until the end of the reap.
+	if (ur->n_inflight >= ur->depth && g_reaping == ur) {
+		op->next = NULL;
+
+		if (ur->deferred_tail) {
+			ur->deferred_tail->next = op;
+		}
+		else {
+			ur->deferred_head = op;
+		}
+
+		ur->deferred_tail = op;
+		ur->n_deferred++;
+
+		pthread_mutex_unlock(&ur->sq_lock);
+		return;
+	}
+
+	// Bounding in-flight operations by the ring depth guarantees neither the
+	// submission nor the completion ring can overflow.
+	while (ur->n_inflight >= ur->depth) {
+		pthread_cond_wait(&ur->sq_cond, &ur->sq_lock);
+	}
+
+	uring_push(ur, op);
+
+	pthread_mutex_unlock(&ur->sq_lock);
+}
+
+
+// Put an operation (or what's left of it) on the ring. Call under sq_lock,
+// with a slot free.
+static void
+uring_push(cf_uring *ur, cf_uring_op *op)
+{
+	uint32_t tail = *ur->sq_tail;
+	uint32_t index = tail & *ur->sq_mask;
+	struct io_uring_sqe *sqe = &ur->sqes[index];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	sqe->opcode = op->opcode;
+	sqe->fd = op->fd;
+	sqe->addr = (uint64_t)(uintptr_t)(op->buf + op->n_done);
+	sqe->len = op->size - op->n_done;
+	sqe->off = op->offset + op->n_done;
+	sqe->user_data = (uint64_t)(uintptr_t)op;
+
+	ur->sq_array[index] = index;
+
+	__atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	ur->n_inflight++;
+
+	int rv;
+
+	while ((rv = (int)syscall(__NR_io_uring_enter, ur->fd, 1, 0, 0, NULL, 0)) < 0 &&
+			errno == EINTR) {
+		;
+	}
+
+	if (rv != 1) {
+		cf_crash(CF_MISC, "io_uring submit failed: rv %d errno %d (%s)",
+				rv, errno, cf_strerror(errno));
+	}
+}